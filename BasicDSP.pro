@@ -17,86 +17,18 @@ TEMPLATE = app
 # Portaudio stuff
 ################################################################################
 
-INCLUDEPATH += contrib/portaudio/include \
-               contrib/portaudio/src/common
-
-SOURCES +=  contrib/portaudio/src/common/pa_allocation.c \
-            contrib/portaudio/src/common/pa_converters.c \
-            contrib/portaudio/src/common/pa_cpuload.c \
-            contrib/portaudio/src/common/pa_debugprint.c \
-            contrib/portaudio/src/common/pa_dither.c \
-            contrib/portaudio/src/common/pa_front.c \
-            contrib/portaudio/src/common/pa_process.c \
-            contrib/portaudio/src/common/pa_ringbuffer.c \
-            contrib/portaudio/src/common/pa_stream.c \
-            contrib/portaudio/src/common/pa_trace.c
-
-## Windows specific stuff
-win32 {
-    DEFINES += PA_USE_WMME
-    DEFINES += PA_USE_WASAPI
-    DEFINES += PA_USE_DS
-    DEFINES += PA_USE_WDMKS PA_WDMKS_NO_KSGUID_LIB
-    DEFINES += PAWIN_USE_DIRECTSOUNDFULLDUPLEXCREATE
-    DEFINES += _CRT_SECURE_NO_WARNINGS
-
-    INCLUDEPATH += contrib/portaudio/src/os/win
-
-    SOURCES += contrib/portaudio/src/os/win/pa_win_hostapis.c \
-               contrib/portaudio/src/os/win/pa_win_util.c \
-               contrib/portaudio/src/os/win/pa_win_waveformat.c \
-               contrib/portaudio/src/os/win/pa_x86_plain_converters.c \
-               contrib/portaudio/src/os/win/pa_win_coinitialize.c
-
-    SOURCES += contrib/portaudio/src/hostapi/dsound/pa_win_ds.c \
-               contrib/portaudio/src/hostapi/dsound/pa_win_ds_dynlink.c \
-               contrib/portaudio/src/hostapi/wdmks/pa_win_wdmks.c \
-               contrib/portaudio/src/hostapi/wasapi/pa_win_wasapi.c \
-               contrib/portaudio/src/hostapi/wmme/pa_win_wmme.c
-
-    LIBS += winmm.lib dsound.lib user32.lib Advapi32.lib
-}
-
-## linux make
-## needs: libasound2-dev
-unix:!macx {
-    DEFINES += PA_USE_ALSA
-
-    INCLUDEPATH += contrib/portaudio/src/os/unix
-
-    SOURCES += contrib/portaudio/src/os/unix/pa_unix_hostapis.c \
-               contrib/portaudio/src/os/unix/pa_unix_util.c
-
-    SOURCES += contrib/portaudio/src/hostapi/alsa/pa_linux_alsa.c
-
-    LIBS += -lasound
-}
-
-## OSX
-macx {
-    DEFINES -= __linux__
-    DEFINES += PA_USE_COREAUDIO
-
-    INCLUDEPATH += contrib/portaudio/src/hostapi/coreaudio
-    INCLUDEPATH += contrib/portaudio/src/os/unix
-
-    SOURCES += contrib/portaudio/src/hostapi/coreaudio/pa_mac_core.c \
-               contrib/portaudio/src/hostapi/coreaudio/pa_mac_core_blocking.c \
-               contrib/portaudio/src/hostapi/coreaudio/pa_mac_core_utilities.c \
-               contrib/portaudio/src/os/unix/pa_unix_util.c \
-               contrib/portaudio/src/os/unix/pa_unix_hostapis.c
-
-    LIBS += -framework CoreAudio -framework CoreServices
-    LIBS += -framework AudioUnit -framework AudioToolbox
-}
+include(portaudio.pri)
 
 ################################################################################
 # Kiss FFT stuff
 ################################################################################
 
-SOURCES += contrib/kiss_fft130/kiss_fft.c
-HEADERS += contrib/kiss_fft130/kiss_fft.h
-INCLUDEPATH += contrib/kiss_fft130
+SOURCES += contrib/kiss_fft130/kiss_fft.c\
+           contrib/kiss_fft130/tools/kiss_fftr.c
+HEADERS += contrib/kiss_fft130/kiss_fft.h\
+           contrib/kiss_fft130/tools/kiss_fftr.h
+INCLUDEPATH += contrib/kiss_fft130\
+               contrib/kiss_fft130/tools
 
 ################################################################################
 # Main Basic DSP sources
@@ -107,12 +39,33 @@ RC_FILE = resources/basicdsp.rc
 SOURCES += main.cpp\
         vumeter.cpp\
         virtualmachine.cpp\
+        bytecode.cpp\
         namedslider.cpp\
         parser.cpp\
         tokenizer.cpp\
         reader.cpp\
         logging.cpp\
         asttovm.cpp\
+        astoptimizer.cpp\
+        rateanalyzer.cpp\
+        fastmath.cpp\
+        vectormath.cpp\
+        vectormath_sse2.cpp\
+        vectormath_avx2.cpp\
+        vectormath_avx512.cpp\
+        noisegenerator.cpp\
+        firfilter.cpp\
+        biquadfilter.cpp\
+        convolver.cpp\
+        resampler.cpp\
+        oversampler.cpp\
+        statearena.cpp\
+        programinstance.cpp\
+        pipeline.cpp\
+        multiinstance.cpp\
+        jitcompiler.cpp\
+        peephole.cpp\
+        nativecompiler.cpp\
         fft.cpp\
         portaudio_helper.cpp\
         spectrumwidget.cpp\
@@ -135,6 +88,26 @@ HEADERS  += mainwindow.h\
             reader.h\
             logging.h\
             asttovm.h\
+            astoptimizer.h\
+            rateanalyzer.h\
+            fastmath.h\
+            fastmathdefs.h\
+            vectormath.h\
+            vectormath_simd.h\
+            noisegenerator.h\
+            firfilter.h\
+            biquadfilter.h\
+            convolver.h\
+            resampler.h\
+            oversampler.h\
+            statearena.h\
+            handoff.h\
+            programinstance.h\
+            pipeline.h\
+            multiinstance.h\
+            jitcompiler.h\
+            peephole.h\
+            nativecompiler.h\
             fft.h\
             portaudio_helper.h\
             spectrumwidget.h\
@@ -0,0 +1,639 @@
+/*
+
+  Description:  AST optimization pass: constant folding
+                and dead-statement elimination.
+
+  License: GPLv2
+
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include "functiondefs.h"
+#include "virtualmachine.h"
+#include "astoptimizer.h"
+
+ASTOptimizer::ASTOptimizer()
+{
+    m_samplerate = 44100.0f;
+    m_foldSamplerate = false;
+}
+
+void ASTOptimizer::addObservedVariable(const std::string &name)
+{
+    if (!name.empty())
+    {
+        m_observed.insert(name);
+    }
+}
+
+bool ASTOptimizer::isLiteral(const ASTNode *node, float &value)
+{
+    if (node == 0)
+        return false;
+
+    if (node->type == ASTNode::NodeFloat)
+    {
+        value = node->info.floatVal;
+        return true;
+    }
+    if (node->type == ASTNode::NodeInteger)
+    {
+        value = static_cast<float>(node->info.intVal);
+        return true;
+    }
+    return false;
+}
+
+bool ASTOptimizer::evaluate(const ASTNode *node, const std::vector<float> &ops, float &result)
+{
+    // the expressions below must match VirtualMachine::executeRange
+    switch(node->type)
+    {
+    case ASTNode::NodeAdd:
+        if (ops.size() != 2) return false;
+        result = ops[0] + ops[1];
+        return true;
+    case ASTNode::NodeSub:
+        if (ops.size() != 2) return false;
+        result = ops[0] - ops[1];
+        return true;
+    case ASTNode::NodeMul:
+        if (ops.size() != 2) return false;
+        result = ops[0] * ops[1];
+        return true;
+    case ASTNode::NodeDiv:
+        if (ops.size() != 2) return false;
+        result = ops[0] / ops[1];
+        return true;
+    case ASTNode::NodeUnaryMinus:
+        if (ops.size() != 1) return false;
+        result = -ops[0];
+        return true;
+    case ASTNode::NodeFunction:
+        break;
+    default:
+        return false;
+    }
+
+    int32_t nargs = functionDefs::getNumberOfArguments(node->functionID);
+    if ((nargs < 0) || (ops.size() != static_cast<size_t>(nargs)))
+        return false;
+
+    const float x = ops.empty() ? 0.0f : ops[0];
+    switch(node->functionID)
+    {
+    case P_sin:   result = sin(x); break;
+    case P_cos:   result = cos(x); break;
+    case P_tan:   result = tan(x); break;
+    case P_tanh:  result = tanh(x); break;
+    case P_sin1:  result = sin(2.0f*M_PI*x); break;
+    case P_cos1:  result = cos(2.0f*M_PI*x); break;
+    case P_mod1:  result = x-(int)x; break;
+    case P_abs:   result = fabs(x); break;
+    case P_sqrt:  result = sqrt(x); break;
+    case P_round: result = round(x); break;
+    case P_trunc: result = std::trunc(x); break;
+    case P_ceil:  result = std::ceil(x); break;
+    case P_floor: result = std::floor(x); break;
+    case P_pow:   result = pow(x, ops[1]); break;
+    case P_atan2: result = atan2(x, ops[1]); break;
+    case P_limit:
+        result = std::min(x, 1.0f);
+        result = std::max(result, -1.0f);
+        break;
+    case P_sign:
+        result = (x >= 0.0f) ? 1.0f : -1.0f;
+        break;
+    default:
+        // the noise functions and unknown functions are not folded
+        return false;
+    }
+    return true;
+}
+
+bool ASTOptimizer::foldNode(ASTNode *&node, uint32_t &folded)
+{
+    if (node == 0)
+        return false;
+
+    float value;
+    if (isLiteral(node, value))
+        return true;
+
+    if (node->type == ASTNode::NodeIdent)
+    {
+        if (!m_foldSamplerate || (node->info.txt != "samplerate"))
+            return false;
+
+        value = m_samplerate;
+    }
+    else
+    {
+        // fold all children, even when one of them is not constant
+        bool constant = true;
+        if (node->left != 0)
+            constant = foldNode(node->left, folded) && constant;
+        if (node->right != 0)
+            constant = foldNode(node->right, folded) && constant;
+        for(size_t i=0; i<node->function_args.size(); i++)
+            constant = foldNode(node->function_args[i], folded) && constant;
+
+        if (!constant)
+            return false;
+
+        // operands in the order ASTToVM pushes them
+        std::vector<float> ops;
+        if (isLiteral(node->left, value))
+            ops.push_back(value);
+        if (isLiteral(node->right, value))
+            ops.push_back(value);
+        for(size_t i=0; i<node->function_args.size(); i++)
+        {
+            if (isLiteral(node->function_args[i], value))
+                ops.push_back(value);
+        }
+
+        if (!evaluate(node, ops, value))
+            return false;
+    }
+
+    ASTNode *literal = new ASTNode(ASTNode::NodeFloat);
+    literal->info.floatVal = value;
+    delete node;
+    node = literal;
+    folded++;
+    return true;
+}
+
+void ASTOptimizer::reduceStrength(ASTNode *&node, uint32_t &reduced)
+{
+    if (node == 0)
+        return;
+
+    if (node->left != 0)
+        reduceStrength(node->left, reduced);
+    if (node->right != 0)
+        reduceStrength(node->right, reduced);
+    for(size_t i=0; i<node->function_args.size(); i++)
+        reduceStrength(node->function_args[i], reduced);
+
+    float value;
+    if ((node->type == ASTNode::NodeFunction) && (node->functionID == P_pow) &&
+        (node->function_args.size() == 2) && isLiteral(node->function_args[1], value))
+    {
+        ASTNode *x = node->function_args[0];
+        const int32_t n = static_cast<int32_t>(value);
+        if ((value != static_cast<float>(n)) || (n < -4) || (n > 4))
+            return;
+
+        // x is evaluated more than once for |n| > 1
+        // and not at all for n = 0.
+        if ((n != 1) && (n != -1) && hasSideEffects(x))
+            return;
+
+        ASTNode *result = 0;
+        if (n == 0)
+        {
+            result = new ASTNode(ASTNode::NodeFloat);
+            result->info.floatVal = 1.0f;
+            delete x;
+        }
+        else
+        {
+            const int32_t m = (n < 0) ? -n : n;
+            result = x;
+            if (m >= 2)
+            {
+                result = new ASTNode(ASTNode::NodeMul);
+                result->left = x;
+                result->right = cloneNode(x);
+            }
+            if (m == 3)
+            {
+                ASTNode *cube = new ASTNode(ASTNode::NodeMul);
+                cube->left = result;
+                cube->right = cloneNode(x);
+                result = cube;
+            }
+            if (m == 4)
+            {
+                ASTNode *square = new ASTNode(ASTNode::NodeMul);
+                square->left = result;
+                square->right = cloneNode(result);
+                result = square;
+            }
+            if (n < 0)
+            {
+                ASTNode *div = new ASTNode(ASTNode::NodeDiv);
+                div->left = new ASTNode(ASTNode::NodeFloat);
+                div->left->info.floatVal = 1.0f;
+                div->right = result;
+                result = div;
+            }
+        }
+
+        node->function_args.clear();
+        delete node;
+        node = result;
+        reduced++;
+        return;
+    }
+
+    if ((node->type == ASTNode::NodeDiv) && isLiteral(node->right, value))
+    {
+        const float reciprocal = 1.0f/value;
+        if (std::isfinite(value) && (value != 0.0f) && std::isfinite(reciprocal))
+        {
+            node->type = ASTNode::NodeMul;
+            delete node->right;
+            node->right = new ASTNode(ASTNode::NodeFloat);
+            node->right->info.floatVal = reciprocal;
+            reduced++;
+        }
+    }
+}
+
+std::string ASTOptimizer::makeKey(const ASTNode *node)
+{
+    if (node == 0)
+        return std::string("_");
+
+    std::stringstream ss;
+    float value;
+    if (isLiteral(node, value))
+    {
+        // compare literals by their bit pattern
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        ss << "#" << std::hex << bits;
+        return ss.str();
+    }
+
+    if (node->type == ASTNode::NodeIdent)
+        return node->info.txt;
+
+    if (node->type == ASTNode::NodeString)
+        return "\"" + node->info.txt + "\"";
+
+    ss << "(" << node->type << ":" << node->functionID;
+    ss << " " << makeKey(node->left) << " " << makeKey(node->right);
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        ss << " " << makeKey(node->function_args[i]);
+    }
+    ss << ")";
+    return ss.str();
+}
+
+uint32_t ASTOptimizer::countNodes(const ASTNode *node)
+{
+    if (node == 0)
+        return 0;
+
+    uint32_t count = 1 + countNodes(node->left) + countNodes(node->right);
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        count += countNodes(node->function_args[i]);
+    }
+    return count;
+}
+
+ASTNode* ASTOptimizer::cloneNode(const ASTNode *node)
+{
+    if (node == 0)
+        return 0;
+
+    ASTNode *copy = new ASTNode(node->type);
+    copy->info = node->info;
+    copy->functionID = node->functionID;
+    copy->left = cloneNode(node->left);
+    copy->right = cloneNode(node->right);
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        copy->function_args.push_back(cloneNode(node->function_args[i]));
+    }
+    return copy;
+}
+
+void ASTOptimizer::collectSubtrees(ASTNode *&node, std::vector<ASTNode**> &slots)
+{
+    if (node == 0)
+        return;
+
+    if (node->left != 0)
+        collectSubtrees(node->left, slots);
+    if (node->right != 0)
+        collectSubtrees(node->right, slots);
+    for(size_t i=0; i<node->function_args.size(); i++)
+        collectSubtrees(node->function_args[i], slots);
+
+    // a function call, or at least two operations,
+    // costs more than writing and reading a variable.
+    const bool worthIt = ((node->type == ASTNode::NodeFunction) && (node->function_args.size() > 0)) ||
+                         (countNodes(node) >= 4);
+
+    if (worthIt && !hasSideEffects(node))
+    {
+        slots.push_back(&node);
+    }
+}
+
+uint32_t ASTOptimizer::eliminateCommonSubexpressions(statements_t &statements)
+{
+    struct group_t
+    {
+        std::vector<ASTNode**>  slots;  // occurrences of the subtree
+        size_t                  first;  // statement of the first occurrence
+        uint32_t                size;   // number of nodes
+        std::set<std::string>   reads;  // variables read by the subtree
+    };
+
+    uint32_t temps = 0;
+    while(true)
+    {
+        // find the subtrees that are computed more than once
+        // without a write to one of their variables in between.
+        std::vector<group_t> groups;
+        std::map<std::string, size_t> available;
+        for(size_t i=0; i<statements.size(); i++)
+        {
+            ASTNode *s = statements[i];
+            if ((s == 0) || (s->type != ASTNode::NodeAssign))
+                continue;
+
+            std::vector<ASTNode**> slots;
+            collectSubtrees(s->right, slots);
+            for(size_t j=0; j<slots.size(); j++)
+            {
+                std::string key = makeKey(*slots[j]);
+                std::map<std::string, size_t>::iterator iter = available.find(key);
+                if (iter != available.end())
+                {
+                    groups[iter->second].slots.push_back(slots[j]);
+                    continue;
+                }
+
+                group_t group;
+                group.slots.push_back(slots[j]);
+                group.first = i;
+                group.size = countNodes(*slots[j]);
+                collectReads(*slots[j], group.reads);
+                available[key] = groups.size();
+                groups.push_back(group);
+            }
+
+            // the assignment invalidates the subtrees that read its target
+            std::map<std::string, size_t>::iterator iter = available.begin();
+            while(iter != available.end())
+            {
+                if (groups[iter->second].reads.count(s->info.txt) != 0)
+                    available.erase(iter++);
+                else
+                    ++iter;
+            }
+        }
+
+        // hoist the largest repeated subtree first,
+        // the smaller ones are found in the next pass.
+        size_t best = groups.size();
+        for(size_t i=0; i<groups.size(); i++)
+        {
+            if (groups[i].slots.size() < 2)
+                continue;
+            if ((best == groups.size()) || (groups[i].size > groups[best].size))
+                best = i;
+        }
+        if (best == groups.size())
+            break;
+
+        const group_t &group = groups[best];
+
+        temps++;
+        std::stringstream ss;
+        ss << "$cse" << temps;
+        const std::string name = ss.str();
+
+        ASTNode *assign = new ASTNode(ASTNode::NodeAssign);
+        assign->info.txt = name;
+        assign->right = *group.slots[0];
+        for(size_t i=0; i<group.slots.size(); i++)
+        {
+            if (i > 0)
+                delete *group.slots[i];
+            ASTNode *ident = new ASTNode(ASTNode::NodeIdent);
+            ident->info.txt = name;
+            *group.slots[i] = ident;
+        }
+
+        std::stringstream report;
+        report << name << ": subexpression computed once for " << group.slots.size()
+               << " uses, first used by " << statements[group.first]->info.txt;
+        m_report.push_back(report.str());
+
+        statements.insert(statements.begin()+group.first, assign);
+    }
+    return temps;
+}
+
+bool ASTOptimizer::hasSideEffects(const ASTNode *node)
+{
+    if (node == 0)
+        return false;
+
+    if ((node->type == ASTNode::NodeFunction) && functionDefs::isNoise(node->functionID))
+        return true;
+
+    if (hasSideEffects(node->left) || hasSideEffects(node->right))
+        return true;
+
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        if (hasSideEffects(node->function_args[i]))
+            return true;
+    }
+    return false;
+}
+
+void ASTOptimizer::collectReads(const ASTNode *node, std::set<std::string> &reads)
+{
+    if (node == 0)
+        return;
+
+    if (node->type == ASTNode::NodeIdent)
+        reads.insert(node->info.txt);
+
+    collectReads(node->left, reads);
+    collectReads(node->right, reads);
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        collectReads(node->function_args[i], reads);
+    }
+}
+
+void ASTOptimizer::collectVariables(const statements_t &statements, std::set<std::string> &vars)
+{
+    for(size_t i=0; i<statements.size(); i++)
+    {
+        const ASTNode *s = statements[i];
+        if (s == 0)
+            continue;
+        if (s->type == ASTNode::NodeAssign)
+            vars.insert(s->info.txt);
+        collectReads(s->right, vars);
+    }
+}
+
+bool ASTOptimizer::isSelfAssignment(const ASTNode *statement)
+{
+    return (statement->type == ASTNode::NodeAssign) &&
+           (statement->right != 0) &&
+           (statement->right->type == ASTNode::NodeIdent) &&
+           (statement->right->info.txt == statement->info.txt);
+}
+
+std::vector<bool> ASTOptimizer::findDeadStatements(const statements_t &statements) const
+{
+    std::vector<bool> dead(statements.size(), false);
+
+    // backward liveness analysis. the program runs once per
+    // sample, so the variables read at the start of the program
+    // are live at its end, together with the outputs and the
+    // observed variables. iterate until this set is stable.
+    std::set<std::string> liveAtStart;
+    while(true)
+    {
+        std::set<std::string> live = m_observed;
+        live.insert("out");
+        live.insert("outl");
+        live.insert("outr");
+        live.insert(liveAtStart.begin(), liveAtStart.end());
+
+        for(size_t i=statements.size(); i>0; i--)
+        {
+            const ASTNode *s = statements[i-1];
+            if ((s == 0) || (s->type != ASTNode::NodeAssign))
+            {
+                dead[i-1] = false;
+                continue;
+            }
+
+            if (isSelfAssignment(s) ||
+                ((live.count(s->info.txt) == 0) && !hasSideEffects(s->right)))
+            {
+                dead[i-1] = true;
+                continue;
+            }
+
+            dead[i-1] = false;
+            live.erase(s->info.txt);
+            collectReads(s->right, live);
+        }
+
+        if (live == liveAtStart)
+            break;
+
+        liveAtStart = live;
+    }
+    return dead;
+}
+
+uint32_t ASTOptimizer::process(statements_t &statements)
+{
+    m_report.clear();
+    m_removedVars.clear();
+
+    std::set<std::string> before;
+    collectVariables(statements, before);
+
+    // samplerate is only a constant if the program
+    // does not assign to it.
+    m_foldSamplerate = true;
+    for(size_t i=0; i<statements.size(); i++)
+    {
+        const ASTNode *s = statements[i];
+        if ((s != 0) && (s->type == ASTNode::NodeAssign) && (s->info.txt == "samplerate"))
+            m_foldSamplerate = false;
+    }
+
+    uint32_t changes = 0;
+    for(size_t i=0; i<statements.size(); i++)
+    {
+        ASTNode *s = statements[i];
+        if ((s == 0) || (s->right == 0))
+            continue;
+
+        uint32_t folded = 0;
+        foldNode(s->right, folded);
+        if (folded > 0)
+        {
+            std::stringstream ss;
+            ss << "statement " << i+1 << " (" << s->info.txt << "): folded "
+               << folded << " constant subexpression(s)";
+            m_report.push_back(ss.str());
+            changes += folded;
+        }
+
+        uint32_t reduced = 0;
+        reduceStrength(s->right, reduced);
+        if (reduced > 0)
+        {
+            std::stringstream ss;
+            ss << "statement " << i+1 << " (" << s->info.txt << "): "
+               << reduced << " strength reduction(s)";
+            m_report.push_back(ss.str());
+            changes += reduced;
+        }
+    }
+
+    std::vector<bool> dead = findDeadStatements(statements);
+    statements_t result;
+    for(size_t i=0; i<statements.size(); i++)
+    {
+        if (!dead[i])
+        {
+            result.push_back(statements[i]);
+            continue;
+        }
+
+        std::stringstream ss;
+        ss << "statement " << i+1 << " (" << statements[i]->info.txt << "): removed, ";
+        if (isSelfAssignment(statements[i]))
+            ss << "assigns the variable to itself";
+        else
+            ss << "value is never used";
+        m_report.push_back(ss.str());
+
+        delete statements[i];
+        changes++;
+    }
+    statements.swap(result);
+
+    changes += eliminateCommonSubexpressions(statements);
+
+    std::set<std::string> after;
+    collectVariables(statements, after);
+    std::set<std::string>::const_iterator iter;
+    for(iter = before.begin(); iter != before.end(); ++iter)
+    {
+        if (after.count(*iter) == 0)
+        {
+            m_removedVars.insert(*iter);
+            m_report.push_back("variable " + *iter + " removed");
+        }
+    }
+
+    return changes;
+}
+
+void ASTOptimizer::dump(std::ostream &stream) const
+{
+    for(size_t i=0; i<m_report.size(); i++)
+    {
+        stream << m_report[i] << std::endl;
+    }
+}
@@ -0,0 +1,138 @@
+/*
+
+  Description:  AST optimization pass: constant folding
+                and dead-statement elimination.
+
+  License: GPLv2
+
+*/
+
+#ifndef astoptimizer_h
+#define astoptimizer_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <ostream>
+#include "parser.h"
+
+/** The AST optimizer runs between Parser::process and
+    ASTToVM::process and performs these transformations:
+
+    * constant folding: subtrees that only depend on literals
+      are replaced by a single float literal. The samplerate
+      variable is a load-time constant and is folded too,
+      unless the program assigns to it. The noise functions
+      are never folded.
+
+    * dead-statement elimination: a statement is removed when
+      the value it assigns is overwritten or never read before
+      it reaches an output (out, outl, outr) or an observed
+      variable. Reads in the next sample count, so feedback
+      paths are kept. Statements that call a noise function
+      are kept, as removing them would renumber the noise
+      generators of the statements that follow.
+
+    * strength reduction: pow() with an integer exponent
+      between -4 and 4 becomes a chain of multiplications, and
+      a division by a literal becomes a multiplication by its
+      reciprocal. Unlike the other transformations these can
+      change a result in the last bit, unless the divisor is a
+      power of two.
+
+    * common subexpression elimination: identical subtrees
+      without side effects, in one statement or in several, are
+      computed once into a temporary variable ($cse1, $cse2, ..)
+      as long as none of the variables they read is written in
+      between.
+
+    Folded expressions are evaluated in single precision with
+    the same expressions as the interpreter, so folding does
+    not change the results.
+*/
+class ASTOptimizer
+{
+public:
+    ASTOptimizer();
+
+    /** set the sample rate the program will be loaded with */
+    void setSamplerate(float samplerate)
+    {
+        m_samplerate = samplerate;
+    }
+
+    /** mark a variable as observed from outside the program,
+        for instance by the scope or the spectrum analyser. */
+    void addObservedVariable(const std::string &name);
+
+    /** optimize the statements in place. removed statements
+        are deleted. returns the number of changes made. */
+    uint32_t process(statements_t &statements);
+
+    /** write a report of the changes to a stream */
+    void dump(std::ostream &stream) const;
+
+    /** returns the variables that were referenced by the
+        program but were removed by the optimizer. */
+    const std::set<std::string>& getRemovedVariables() const
+    {
+        return m_removedVars;
+    }
+
+protected:
+    /** fold the constant subtrees of a node. returns true
+        if the node itself is a constant. */
+    bool foldNode(ASTNode *&node, uint32_t &folded);
+
+    /** evaluate an operation with constant operands.
+        returns false if it cannot be folded. */
+    static bool evaluate(const ASTNode *node, const std::vector<float> &ops, float &result);
+
+    /** rewrite expensive operations into cheaper ones that
+        give the same result. */
+    static void reduceStrength(ASTNode *&node, uint32_t &reduced);
+
+    /** hoist repeated subtrees into temporary variables.
+        returns the number of temporaries created. */
+    uint32_t eliminateCommonSubexpressions(statements_t &statements);
+
+    /** collect the slots of all subtrees without side effects
+        that are worth hoisting, children before their parents. */
+    static void collectSubtrees(ASTNode *&node, std::vector<ASTNode**> &slots);
+
+    /** returns a string that is equal for identical subtrees */
+    static std::string makeKey(const ASTNode *node);
+
+    /** returns the number of nodes in a subtree */
+    static uint32_t countNodes(const ASTNode *node);
+
+    /** returns a deep copy of a subtree */
+    static ASTNode* cloneNode(const ASTNode *node);
+
+    /** returns true if the node is a literal, and its value in 'value' */
+    static bool isLiteral(const ASTNode *node, float &value);
+
+    /** returns true if the expression has side effects */
+    static bool hasSideEffects(const ASTNode *node);
+
+    /** collect the names of the variables read by an expression */
+    static void collectReads(const ASTNode *node, std::set<std::string> &reads);
+
+    /** collect the names of all variables used by the statements */
+    static void collectVariables(const statements_t &statements, std::set<std::string> &vars);
+
+    /** returns true if the statement assigns a variable to itself */
+    static bool isSelfAssignment(const ASTNode *statement);
+
+    /** returns, for each statement, true if it can be removed */
+    std::vector<bool> findDeadStatements(const statements_t &statements) const;
+
+    float                   m_samplerate;
+    bool                    m_foldSamplerate;
+    std::set<std::string>   m_observed;
+    std::set<std::string>   m_removedVars;
+    std::vector<std::string> m_report;
+};
+
+#endif
@@ -1,59 +1,360 @@
 /*
 
   Description:  Convert the AST from the parser
-                to stack-based instructions of
-                the VM
+                to stack-based or register-based
+                instructions of the VM
 
   Author: Niels A. Moseley (c) 2016
 
 */
 
 #include <QDebug>
+#include <algorithm>
+#include <string.h>
+#include "functiondefs.h"
+#include "wavstreamer.h"
 #include "asttovm.h"
 
+/** returns the type of generator of a noise function, or -1 */
+static int32_t getNoiseType(uint32_t functionID)
+{
+    switch(functionID)
+    {
+    case P_noise:
+        return NoiseGenerator::NOISE_UNIFORM;
+    case P_gaussnoise:
+        return NoiseGenerator::NOISE_GAUSSIAN;
+    case P_pinknoise:
+        return NoiseGenerator::NOISE_PINK;
+    default:
+        return -1;
+    }
+}
+
+/** returns the number of noise generators used by a program */
+static uint32_t countNoiseGenerators(const VM::program_t &program)
+{
+    uint32_t count = 0;
+    for(size_t pc=0; pc<program.size(); pc+=VM::getInstructionLength(program[pc].icode))
+    {
+        if ((program[pc].icode & 0xff000000) == P_noisegen)
+            count++;
+    }
+    return count;
+}
+
+/** evaluate an expression of literals, as the interpreter would */
+static bool evaluateConstant(const ASTNode *node, float &value)
+{
+    if (node == 0)
+        return false;
+
+    float a, b;
+    switch(node->type)
+    {
+    case ASTNode::NodeFloat:
+        value = node->info.floatVal;
+        return true;
+    case ASTNode::NodeInteger:
+        value = node->info.intVal;
+        return true;
+    case ASTNode::NodeUnaryMinus:
+        if (!evaluateConstant(node->right, a))
+            return false;
+        value = -a;
+        return true;
+    case ASTNode::NodeAdd:
+    case ASTNode::NodeSub:
+    case ASTNode::NodeMul:
+    case ASTNode::NodeDiv:
+        if (!evaluateConstant(node->left, a) || !evaluateConstant(node->right, b))
+            return false;
+        if (node->type == ASTNode::NodeAdd)
+            value = a + b;
+        else if (node->type == ASTNode::NodeSub)
+            value = a - b;
+        else if (node->type == ASTNode::NodeMul)
+            value = a * b;
+        else
+            value = a / b;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool ASTToVM::getCoefficients(const ASTNode *node, std::vector<float> &coefficients)
+{
+    // the first argument is the input
+    coefficients.clear();
+    for(size_t i=1; i<node->function_args.size(); i++)
+    {
+        float value;
+        if (!evaluateConstant(node->function_args[i], value))
+        {
+            qDebug() << "The coefficients of fir() must be constants";
+            return false;
+        }
+        coefficients.push_back(value);
+    }
+
+    if (coefficients.empty() || (coefficients.size() > FIR_MAXTAPS))
+    {
+        qDebug() << "fir() needs between 1 and" << FIR_MAXTAPS << "coefficients";
+        return false;
+    }
+    return true;
+}
+
+bool ASTToVM::getImpulseResponse(const ASTNode *node, std::vector<float> &response)
+{
+    if ((node->function_args.size() != 2) ||
+        (node->function_args[1]->type != ASTNode::NodeString))
+    {
+        qDebug() << "conv() needs the name of a WAV file";
+        return false;
+    }
+
+    // the parser has resolved the name of the file
+    const std::string &filename = node->function_args[1]->info.txt;
+    std::vector<float> samples;
+    uint32_t channels;
+    WavStreamer wav;
+    if (wav.loadFile(QString::fromStdString(filename), samples, channels) != 0)
+    {
+        qDebug() << "Cannot read the impulse response" << filename.c_str();
+        return false;
+    }
+
+    // stereo files use their left channel
+    const size_t length = samples.size() / channels;
+    if ((length == 0) || (length > CONV_MAXLENGTH))
+    {
+        qDebug() << "The impulse response of conv() needs between 1 and" << CONV_MAXLENGTH << "samples";
+        return false;
+    }
+    response.resize(length);
+    for(size_t i=0; i<length; i++)
+    {
+        response[i] = samples[i*channels];
+    }
+    return true;
+}
+
+bool ASTToVM::getBiquad(const ASTNode *node, VM::biquad_t &biquad)
+{
+    const size_t count = node->function_args.size() - 1;
+    if ((count % BIQUAD_COEFFICIENTS) != 0)
+    {
+        qDebug() << "biquad() needs" << BIQUAD_COEFFICIENTS << "coefficients per section";
+        return false;
+    }
+    const size_t sections = count / BIQUAD_COEFFICIENTS;
+    if ((sections == 0) || (sections > BIQUAD_MAXSECTIONS))
+    {
+        qDebug() << "biquad() needs between 1 and" << BIQUAD_MAXSECTIONS << "sections";
+        return false;
+    }
+
+    // the first argument is the input
+    biquad.coefficients.resize(count);
+    biquad.dynamic = false;
+    for(size_t i=0; i<count; i++)
+    {
+        if (!evaluateConstant(node->function_args[i+1], biquad.coefficients[i]))
+        {
+            biquad.dynamic = true;
+        }
+    }
+
+    if (biquad.dynamic)
+    {
+        for(size_t i=0; i<count; i++)
+        {
+            size_t k = i % BIQUAD_COEFFICIENTS;
+            biquad.coefficients[i] = ((k == 0) || (k == 3)) ? 1.0f : 0.0f;
+        }
+        return true;
+    }
+
+    for(size_t k=0; k<sections; k++)
+    {
+        if (biquad.coefficients[k*BIQUAD_COEFFICIENTS + 3] == 0.0f)
+        {
+            qDebug() << "The coefficient a0 of biquad() must not be zero";
+            return false;
+        }
+    }
+    return true;
+}
+
 bool ASTToVM::process(const statements_t &s,
                       VM::program_t &program,
                       VM::variables_t &variables)
 {
     program.clear();
     variables.clear();
+    return convertStatements(s, program, variables, NULL);
+}
 
+bool ASTToVM::convertStatements(const statements_t &s,
+                                VM::program_t &program,
+                                VM::variables_t &variables,
+                                VM::filters_t *filters)
+{
     size_t N = s.size();
     for(size_t i=0; i<N; i++)
     {
-        if (!convertNode(s[i], program, variables))
+        if (!convertNode(s[i], program, variables, filters))
             return false;
     }
+
+    if (countNoiseGenerators(program) > VM_MAXNOISE)
+    {
+        qDebug() << "Too many noise functions";
+        return false;
+    }
+
+    // the virtual machine refuses programs
+    // that need a deeper stack
+    uint32_t depth = 0;
+    if (!VM::getStackDepth(program, depth) || (depth > VM_MAXSTACKDEPTH))
+    {
+        qDebug() << "Expression too complex, stack depth" << depth;
+        return false;
+    }
     return true;
 }
 
 bool ASTToVM::convertNode(ASTNode *node,
                           VM::program_t &program,
-                          VM::variables_t &variables)
+                          VM::variables_t &variables,
+                          VM::filters_t *filters)
 {
     if (node == 0)
         return true;
 
+    VM::variable_t var;
+    VM::instruction_t instr;
+    int32_t idx;
+
+    if ((node->type == ASTNode::NodeFunction) && (node->functionID == P_firfilter))
+    {
+        // only the input goes on the stack, the
+        // coefficients are part of the filter
+        if (filters == NULL)
+        {
+            qDebug() << "fir() cannot be used at the control rate";
+            return false;
+        }
+
+        std::vector<float> coefficients;
+        if (!getCoefficients(node, coefficients))
+            return false;
+
+        if (!convertNode(node->function_args[0], program, variables, filters))
+            return false;
+
+        if (filters->fir.size() >= VM_MAXFILTERS)
+        {
+            qDebug() << "Too many filters";
+            return false;
+        }
+
+        // filters are numbered in program order,
+        // like in the register program
+        instr.icode = P_fir | filters->fir.size();
+        program.push_back(instr);
+        filters->fir.push_back(coefficients);
+        return true;
+    }
+
+    if ((node->type == ASTNode::NodeFunction) && (node->functionID == P_convolve))
+    {
+        // only the input goes on the stack
+        if (filters == NULL)
+        {
+            qDebug() << "conv() cannot be used at the control rate";
+            return false;
+        }
+
+        std::vector<float> response;
+        if (!getImpulseResponse(node, response))
+            return false;
+
+        if (!convertNode(node->function_args[0], program, variables, filters))
+            return false;
+
+        if (filters->conv.size() >= VM_MAXFILTERS)
+        {
+            qDebug() << "Too many filters";
+            return false;
+        }
+
+        instr.icode = P_conv | filters->conv.size();
+        program.push_back(instr);
+        filters->conv.push_back(response);
+        return true;
+    }
+
+    if ((node->type == ASTNode::NodeFunction) && (node->functionID == P_biquadfilter))
+    {
+        // fixed coefficients are part of the filter, the others
+        // are pushed after the input, one section after the other
+        if (filters == NULL)
+        {
+            qDebug() << "biquad() cannot be used at the control rate";
+            return false;
+        }
+
+        VM::biquad_t biquad;
+        if (!getBiquad(node, biquad))
+            return false;
+
+        const size_t count = biquad.dynamic ? node->function_args.size() : 1;
+        for(size_t i=0; i<count; i++)
+        {
+            if (!convertNode(node->function_args[i], program, variables, filters))
+                return false;
+        }
+
+        if (filters->biquad.size() >= VM_MAXFILTERS)
+        {
+            qDebug() << "Too many filters";
+            return false;
+        }
+
+        uint32_t sections = biquad.coefficients.size() / BIQUAD_COEFFICIENTS;
+        instr.icode = P_biquad | filters->biquad.size();
+        if (biquad.dynamic)
+        {
+            instr.icode |= sections << 16;
+        }
+        program.push_back(instr);
+        filters->biquad.push_back(biquad);
+        return true;
+    }
+
     if (node->left != 0)
     {
-        convertNode(node->left, program, variables);
+        if (!convertNode(node->left, program, variables, filters))
+            return false;
     }
 
     if (node->right != 0)
     {
-        convertNode(node->right, program, variables);
+        if (!convertNode(node->right, program, variables, filters))
+            return false;
     }
 
     // push arguments of functions here!
     uint32_t nargs = node->function_args.size();
     for(uint32_t i=0; i<nargs; i++)
     {
-        convertNode(node->function_args[i], program, variables);
+        if (!convertNode(node->function_args[i], program, variables, filters))
+            return false;
     }
 
-    VM::variable_t var;
-    VM::instruction_t instr;
-    int32_t idx;
     switch(node->type)
     {
     default:
@@ -141,10 +442,366 @@ bool ASTToVM::convertNode(ASTNode *node,
     }
     case ASTNode::NodeFunction:
     {
-        instr.icode = node->functionID;
+        int32_t noiseType = getNoiseType(node->functionID);
+        if (noiseType != -1)
+        {
+            // every call gets its own generator, numbered in
+            // program order like in the register program
+            uint32_t n = countNoiseGenerators(program);
+            instr.icode = P_noisegen | (noiseType << 16) | (n & 0xFFFF);
+        }
+        else
+        {
+            instr.icode = node->functionID;
+        }
         program.push_back(instr);
         return true;
     }
     } // end switch
     return true;
 }
+
+bool ASTToVM::process(const statements_t &s,
+                      VM::program_t &program,
+                      VM::regprogram_t &regprogram,
+                      VM::variables_t &variables,
+                      VM::filters_t &filters)
+{
+    program.clear();
+    variables.clear();
+    filters.fir.clear();
+    filters.biquad.clear();
+    filters.conv.clear();
+
+    // the stack program defines the variables,
+    // the register program uses the same ones.
+    if (!convertStatements(s, program, variables, &filters))
+        return false;
+
+    return convertRegisters(s, regprogram, variables);
+}
+
+bool ASTToVM::process(const statements_t &control,
+                      const statements_t &s,
+                      VM::program_t &controlProgram,
+                      VM::program_t &program,
+                      VM::regprogram_t &regprogram,
+                      VM::variables_t &variables,
+                      VM::filters_t &filters)
+{
+    controlProgram.clear();
+    program.clear();
+    variables.clear();
+    filters.fir.clear();
+    filters.biquad.clear();
+    filters.conv.clear();
+
+    // all variables must exist before the register
+    // program is generated, as its constants and
+    // temporaries follow the variables.
+    if (!convertStatements(control, controlProgram, variables, NULL))
+        return false;
+    if (!convertStatements(s, program, variables, &filters))
+        return false;
+
+    return convertRegisters(s, regprogram, variables);
+}
+
+bool ASTToVM::convertRegisters(const statements_t &s,
+                               VM::regprogram_t &regprogram,
+                               VM::variables_t &variables)
+{
+    regprogram.code.clear();
+    regprogram.constants.clear();
+    regprogram.operands.clear();
+    regprogram.temporaries = 0;
+
+    regstate_t state;
+    state.nextTemp = 0;
+    state.maxTemps = 0;
+    state.noiseGenerators = 0;
+    state.firFilters = 0;
+    state.biquadFilters = 0;
+    state.convolvers = 0;
+
+    size_t N = s.size();
+    for(size_t i=0; i<N; i++)
+    {
+        ASTNode *node = s[i];
+        if ((node == 0) || (node->type != ASTNode::NodeAssign))
+            return false;
+
+        regref_t dst;
+        dst.kind = regref_t::R_VAR;
+        dst.index = VM::findVariableByName(variables, node->info.txt);
+
+        regref_t result;
+        if (!convertRegisterNode(node->right, state, variables, &dst, result))
+            return false;
+
+        // plain copies, such as x = y or x = 1.0,
+        // need an explicit move
+        if ((result.kind != dst.kind) || (result.index != dst.index))
+        {
+            reginstr_t instr;
+            instr.opcode = P_mov;
+            instr.dst = dst;
+            instr.srcA = result;
+            instr.srcB = result;
+            state.code.push_back(instr);
+        }
+        state.nextTemp = 0;
+    }
+
+    // relocate constants and temporaries to
+    // the registers following the variables
+    const uint32_t constBase = variables.size();
+    const uint32_t tempBase = constBase + state.constants.size();
+    if ((tempBase + state.maxTemps) > 65536)
+    {
+        qDebug() << "Register program needs too many registers";
+        return false;
+    }
+
+    regref_t *refs[3];
+    for(size_t i=0; i<state.code.size(); i++)
+    {
+        VM::reginstr_t instr;
+        uint16_t *operands[3] = {&instr.dst, &instr.srcA, &instr.srcB};
+        refs[0] = &state.code[i].dst;
+        refs[1] = &state.code[i].srcA;
+        refs[2] = &state.code[i].srcB;
+        for(uint32_t j=0; j<3; j++)
+        {
+            *operands[j] = relocate(*refs[j], constBase, tempBase);
+        }
+        instr.opcode = state.code[i].opcode;
+        regprogram.code.push_back(instr);
+    }
+    for(size_t i=0; i<state.operands.size(); i++)
+    {
+        regprogram.operands.push_back(relocate(state.operands[i], constBase, tempBase));
+    }
+
+    regprogram.constants = state.constants;
+    regprogram.temporaries = state.maxTemps;
+    return true;
+}
+
+uint16_t ASTToVM::relocate(const regref_t &ref, uint32_t constBase, uint32_t tempBase)
+{
+    switch(ref.kind)
+    {
+    case regref_t::R_CONST:
+        return constBase + ref.index;
+    case regref_t::R_TEMP:
+        return tempBase + ref.index;
+    default:
+        return ref.index;
+    }
+}
+
+ASTToVM::regref_t ASTToVM::getConstant(regstate_t &state, float value)
+{
+    // identical values share a register
+    regref_t ref;
+    ref.kind = regref_t::R_CONST;
+    ref.index = 0;
+    while((ref.index < state.constants.size()) &&
+          (memcmp(&state.constants[ref.index], &value, sizeof(float)) != 0))
+    {
+        ref.index++;
+    }
+    if (ref.index == state.constants.size())
+    {
+        state.constants.push_back(value);
+    }
+    return ref;
+}
+
+void ASTToVM::releaseTemp(regstate_t &state, const regref_t &ref)
+{
+    // temporaries are allocated and released in
+    // stack order, so only the last one can be freed.
+    if ((ref.kind == regref_t::R_TEMP) && (ref.index+1 == state.nextTemp))
+    {
+        state.nextTemp--;
+    }
+}
+
+bool ASTToVM::convertRegisterNode(ASTNode *node,
+                                  regstate_t &state,
+                                  VM::variables_t &variables,
+                                  const regref_t *target,
+                                  regref_t &result)
+{
+    if (node == 0)
+        return false;
+
+    float value;
+    switch(node->type)
+    {
+    case ASTNode::NodeFloat:
+    case ASTNode::NodeInteger:
+    {
+        // literals become constant registers
+        if (node->type == ASTNode::NodeFloat)
+            value = node->info.floatVal;
+        else
+            value = node->info.intVal;
+
+        result = getConstant(state, value);
+        return true;
+    }
+    case ASTNode::NodeIdent:
+    {
+        int32_t idx = VM::findVariableByName(variables, node->info.txt);
+        if (idx == -1)
+        {
+            VM::variable_t var;
+            var.name = node->info.txt;
+            var.value = 0.0f;
+            variables.push_back(var);
+            idx = variables.size()-1;
+        }
+        result.kind = regref_t::R_VAR;
+        result.index = idx;
+        return true;
+    }
+    default:
+        break;
+    }
+
+    // collect the operands of the operation
+    std::vector<ASTNode*> args;
+    reginstr_t instr;
+    switch(node->type)
+    {
+    case ASTNode::NodeAdd:
+        instr.opcode = P_add;
+        args.push_back(node->left);
+        args.push_back(node->right);
+        break;
+    case ASTNode::NodeSub:
+        instr.opcode = P_sub;
+        args.push_back(node->left);
+        args.push_back(node->right);
+        break;
+    case ASTNode::NodeMul:
+        instr.opcode = P_mul;
+        args.push_back(node->left);
+        args.push_back(node->right);
+        break;
+    case ASTNode::NodeDiv:
+        instr.opcode = P_div;
+        args.push_back(node->left);
+        args.push_back(node->right);
+        break;
+    case ASTNode::NodeUnaryMinus:
+        instr.opcode = P_neg;
+        args.push_back(node->right);
+        break;
+    case ASTNode::NodeFunction:
+        instr.opcode = node->functionID;
+        args = node->function_args;
+        break;
+    default:
+        return false;
+    }
+
+    // filters only take their input from a register,
+    // srcB holds the number of the filter. the changing
+    // coefficients of a biquad filter are listed in
+    // state.operands instead.
+    const bool isFilter = (node->type == ASTNode::NodeFunction) &&
+                          functionDefs::isFilter(node->functionID);
+    const bool isBiquad = isFilter && (node->functionID == P_biquadfilter);
+    VM::biquad_t biquad;
+    std::vector<regref_t> coefficients;
+    if (isBiquad && !getBiquad(node, biquad))
+    {
+        return false;
+    }
+    if (isFilter)
+    {
+        args.resize(1);
+    }
+
+    // noise functions take the number of their
+    // generator from a constant register
+    regref_t noise;
+    bool isNoise = (node->type == ASTNode::NodeFunction) && (getNoiseType(node->functionID) != -1);
+    if (isNoise)
+    {
+        noise = getConstant(state, static_cast<float>(state.noiseGenerators++));
+    }
+
+    if (args.size() > 2)
+        return false;
+
+    regref_t operands[2];
+    for(size_t i=0; i<args.size(); i++)
+    {
+        if (!convertRegisterNode(args[i], state, variables, NULL, operands[i]))
+            return false;
+    }
+    if (isBiquad && biquad.dynamic)
+    {
+        coefficients.resize(node->function_args.size()-1);
+        for(size_t i=0; i<coefficients.size(); i++)
+        {
+            if (!convertRegisterNode(node->function_args[i+1], state, variables, NULL, coefficients[i]))
+                return false;
+        }
+        state.operands.insert(state.operands.end(), coefficients.begin(), coefficients.end());
+    }
+
+    // the filter is numbered after the ones in its input
+    regref_t filter;
+    if (isFilter)
+    {
+        uint32_t *filters = &state.firFilters;
+        if (isBiquad)
+            filters = &state.biquadFilters;
+        else if (node->functionID == P_convolve)
+            filters = &state.convolvers;
+        filter = getConstant(state, static_cast<float>((*filters)++));
+    }
+
+    for(size_t i=coefficients.size(); i>0; i--)
+    {
+        releaseTemp(state, coefficients[i-1]);
+    }
+    for(size_t i=args.size(); i>0; i--)
+    {
+        releaseTemp(state, operands[i-1]);
+    }
+
+    if (target != NULL)
+    {
+        result = *target;
+    }
+    else
+    {
+        result.kind = regref_t::R_TEMP;
+        result.index = state.nextTemp++;
+        state.maxTemps = std::max(state.maxTemps, state.nextTemp);
+    }
+
+    // unused operands repeat a valid register
+    // so the interpreter can always read them
+    instr.dst = result;
+    instr.srcA = (args.size() > 0) ? operands[0] : result;
+    instr.srcB = (args.size() > 1) ? operands[1] : instr.srcA;
+    if (isNoise)
+    {
+        instr.srcA = noise;
+        instr.srcB = noise;
+    }
+    if (isFilter)
+    {
+        instr.srcB = filter;
+    }
+    state.code.push_back(instr);
+    return true;
+}
@@ -1,8 +1,8 @@
 /*
 
   Description:  Convert the AST from the parser
-                to stack-based instructions of
-                the VM
+                to stack-based or register-based
+                instructions of the VM
 
   Author: Niels A. Moseley (c) 2016
 
@@ -17,10 +17,103 @@
 class ASTToVM
 {
 public:
+    /** convert the AST into a stack program. Programs that
+        use filters need one of the overloads below. */
     static bool process(const statements_t &s, VM::program_t &program, VM::variables_t &variables);
 
+    /** convert the AST into a stack program and into the equivalent
+        three-address register program. Both programs share the
+        same variables and the filters, which are numbered in the
+        order of the stack program. */
+    static bool process(const statements_t &s, VM::program_t &program,
+                        VM::regprogram_t &regprogram, VM::variables_t &variables,
+                        VM::filters_t &filters);
+
+    /** as above, and convert the control-rate statements in
+        'control' into a separate stack program. The control
+        program shares the variables with the other programs,
+        but cannot use filters. */
+    static bool process(const statements_t &control, const statements_t &s,
+                        VM::program_t &controlProgram, VM::program_t &program,
+                        VM::regprogram_t &regprogram, VM::variables_t &variables,
+                        VM::filters_t &filters);
+
+    /** get the coefficients of a call of biquad(). when one of
+        them is not a constant expression, the filter is dynamic
+        and gets sections that pass their input until the program
+        sets the coefficients. */
+    static bool getBiquad(const ASTNode *node, VM::biquad_t &biquad);
+
 protected:
-    static bool convertNode(ASTNode *node, VM::program_t &program, VM::variables_t &variables);
+    /** convert statements into stack code, adding their
+        variables to the existing ones and their filters to
+        'filters'. filters are refused when it is NULL. */
+    static bool convertStatements(const statements_t &s, VM::program_t &program,
+                                  VM::variables_t &variables, VM::filters_t *filters);
+
+    /** generate the register program for statements whose
+        variables have already been defined. */
+    static bool convertRegisters(const statements_t &s, VM::regprogram_t &regprogram,
+                                 VM::variables_t &variables);
+
+    static bool convertNode(ASTNode *node, VM::program_t &program,
+                            VM::variables_t &variables, VM::filters_t *filters);
+
+    /** get the coefficients of a call of fir() */
+    static bool getCoefficients(const ASTNode *node, std::vector<float> &coefficients);
+
+    /** load the impulse response of a call of conv() */
+    static bool getImpulseResponse(const ASTNode *node, std::vector<float> &response);
+
+    /** register operand during code generation.
+        constants and temporaries are numbered separately
+        and relocated to the register file once the number
+        of variables is known. */
+    struct regref_t
+    {
+        enum kind_t {R_VAR, R_CONST, R_TEMP};
+        kind_t   kind;
+        uint32_t index;
+    };
+
+    struct reginstr_t
+    {
+        uint32_t opcode;
+        regref_t dst;
+        regref_t srcA;
+        regref_t srcB;
+    };
+
+    /** state of the register code generator */
+    struct regstate_t
+    {
+        std::vector<reginstr_t> code;
+        std::vector<float>      constants;
+        uint32_t                nextTemp;   // first free temporary
+        uint32_t                maxTemps;   // number of temporaries used
+        uint32_t                noiseGenerators; // number of noise functions so far
+        uint32_t                firFilters;      // number of FIR filters so far
+        uint32_t                biquadFilters;   // number of biquad filters so far
+        uint32_t                convolvers;      // number of convolvers so far
+        std::vector<regref_t>   operands;        // coefficients of dynamic biquad filters
+    };
+
+    /** generate register code for an expression. The result is
+        written to 'target' when it is not NULL and the expression
+        is an operation, otherwise to a temporary. The register
+        that holds the result is returned in 'result'. */
+    static bool convertRegisterNode(ASTNode *node, regstate_t &state,
+                                    VM::variables_t &variables,
+                                    const regref_t *target, regref_t &result);
+
+    /** returns the constant register holding a value */
+    static regref_t getConstant(regstate_t &state, float value);
+
+    /** release a temporary once its value has been consumed */
+    static void releaseTemp(regstate_t &state, const regref_t &ref);
+
+    /** returns the register of an operand in the register file */
+    static uint16_t relocate(const regref_t &ref, uint32_t constBase, uint32_t tempBase);
 };
 
 #endif
@@ -0,0 +1,628 @@
+/*
+
+  Batch renderer for BasicDSP scripts
+
+  Runs a script on WAV files without a sound card, for
+  instance in regression tests on a build server. Every
+  input file is rendered as fast as the engine allows and
+  written as a stereo 32-bit float WAV file with the same
+  name in the output directory. Several files are rendered
+  at the same time by a pool of threads, and the speed of
+  each file is reported in samples per second.
+
+  When there are more threads than files, a program with finite
+  memory (see VM::getMemoryLength) renders a file in chunks on
+  several threads: every chunk starts early by the memory of
+  the program, and the output of the extra samples is dropped,
+  so the result is the same as that of one run.
+
+  Usage: dspbatch [options] script.dsp input.wav|directory ...
+
+  License: GPLv2
+
+*/
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+#include "reader.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "astoptimizer.h"
+#include "rateanalyzer.h"
+#include "asttovm.h"
+#include "peephole.h"
+#include "nativecompiler.h"
+#include "programinstance.h"
+#include "wavstreamer.h"
+#include "convolver.h"
+
+// a file is split into chunks of at least CHUNK_MINFRAMES
+// frames and CHUNK_MINRATIO times the memory of the program
+#define CHUNK_MINFRAMES 65536
+#define CHUNK_MINRATIO 8
+
+struct engineName_t
+{
+    const char                  *name;
+    VirtualMachine::engine_t    engine;
+    bool                        blockMode;
+};
+
+static const engineName_t g_engines[] =
+{
+    {"stack",    VirtualMachine::ENGINE_STACK,    false},
+    {"block",    VirtualMachine::ENGINE_STACK,    true},
+    {"register", VirtualMachine::ENGINE_REGISTER, false},
+    {"threaded", VirtualMachine::ENGINE_THREADED, false},
+    {"jit",      VirtualMachine::ENGINE_JIT,      false},
+    {"native",   VirtualMachine::ENGINE_NATIVE,   false}
+};
+
+#define g_enginesLen (sizeof(g_engines)/sizeof(g_engines[0]))
+
+struct options_t
+{
+    QString     script;         // source code of the script
+    QString     directory;      // directory of the script, for its filter files
+    QString     outputDir;
+    uint32_t    jobs;           // number of threads
+    const engineName_t *engine;
+    uint32_t    virtualRate;    // rate of the program, or 0 for that of the file
+    float       sliders[4];
+    uint32_t    noiseSeed;
+};
+
+struct result_t
+{
+    bool        ok;
+    QString     error;
+    uint32_t    frames;
+    uint32_t    sampleRate;     // rate of the file
+    double      seconds;        // time spent rendering
+    uint32_t    chunks;         // number of chunks rendered in parallel
+};
+
+/** a program compiled for one sample rate.
+    the statements are deleted with it. */
+struct compiled_t
+{
+    statements_t        statements;
+    statements_t        control;
+    VM::program_t       program;
+    VM::program_t       controlProgram;
+    VM::regprogram_t    regprogram;
+    VM::variables_t     variables;
+    VM::filters_t       filters;
+
+    ~compiled_t()
+    {
+        for(size_t i=0; i<statements.size(); i++)
+        {
+            delete statements[i];
+        }
+        for(size_t i=0; i<control.size(); i++)
+        {
+            delete control[i];
+        }
+    }
+};
+
+/** compile a script the way the GUI does, for a program
+    running at 'sampleRate'. returns false on error. */
+static bool compileScript(const options_t &options, float sampleRate,
+                          compiled_t &compiled, QString &error)
+{
+    QScopedPointer<Reader> reader(Reader::create(options.script));
+    if (reader.isNull())
+    {
+        error = "cannot read the script";
+        return false;
+    }
+
+    Tokenizer tokenizer;
+    std::vector<token_t> tokens;
+    if (!tokenizer.process(reader.data(), tokens))
+    {
+        error = "the script contains invalid characters";
+        return false;
+    }
+
+    Parser parser;
+    parser.setDirectory(options.directory.toLocal8Bit().constData());
+    if (!parser.process(tokens, compiled.statements))
+    {
+        Reader::position_info pos = parser.getLastErrorPos();
+        error = QString("error on line %1: %2").arg(pos.line+1).arg(parser.getLastError().c_str());
+        return false;
+    }
+
+    // only the output is observed
+    ASTOptimizer optimizer;
+    optimizer.setSamplerate(sampleRate);
+    optimizer.process(compiled.statements);
+    RateAnalyzer::split(compiled.statements, compiled.control);
+
+    if (!ASTToVM::process(compiled.control, compiled.statements, compiled.controlProgram,
+                          compiled.program, compiled.regprogram, compiled.variables,
+                          compiled.filters))
+    {
+        error = "the script cannot be converted to byte code";
+        return false;
+    }
+    Peephole::process(compiled.program);
+    return true;
+}
+
+/** write interleaved stereo samples to a 32-bit float WAV file */
+static bool writeWav(const QString &filename, const std::vector<float> &samples, uint32_t sampleRate)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        return false;
+    }
+
+    WavFormatChunk format;
+    format.wFormatTag = 3;
+    format.wChannels = 2;
+    format.dwSamplesPerSec = sampleRate;
+    format.wBitsPerSample = 32;
+    format.wBlockAlign = format.wChannels*format.wBitsPerSample/8;
+    format.dwAvgBytesPerSec = format.dwSamplesPerSec*format.wBlockAlign;
+
+    const uint32_t dataSize = samples.size()*sizeof(float);
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.writeRawData("RIFF", 4);
+    stream << static_cast<quint32>(4 + 8 + sizeof(format) + 8 + dataSize);
+    stream.writeRawData("WAVE", 4);
+    stream.writeRawData("fmt ", 4);
+    stream << static_cast<quint32>(sizeof(format));
+    stream << format.wFormatTag << format.wChannels << format.dwSamplesPerSec
+           << format.dwAvgBytesPerSec << format.wBlockAlign << format.wBitsPerSample;
+    stream.writeRawData("data", 4);
+    stream << static_cast<quint32>(dataSize);
+    for(size_t i=0; i<samples.size(); i++)
+    {
+        uint32_t bits;
+        memcpy(&bits, &samples[i], sizeof(bits));
+        stream << static_cast<quint32>(bits);
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+/** load a compiled program into 'instance', with the engine
+    and sliders of 'options'. returns false on error. */
+static bool loadInstance(const options_t &options, const compiled_t &compiled,
+                         uint32_t fileRate, float programRate,
+                         ProgramInstance &instance, QString &error)
+{
+    if (!instance.load(compiled.program, compiled.regprogram, compiled.variables,
+                       compiled.controlProgram, compiled.filters, FastMath::PRECISION_EXACT,
+                       options.noiseSeed, fileRate, programRate, options.engine->engine, 1))
+    {
+        error = "the program is rejected by the virtual machine";
+        return false;
+    }
+    if (options.engine->engine == VirtualMachine::ENGINE_NATIVE)
+    {
+        NativeCompiler *native = new NativeCompiler();
+        if (!native->compile(compiled.statements, compiled.variables) || !instance.setNative(native))
+        {
+            delete native;
+        }
+        else
+        {
+            instance.activateEngine(VirtualMachine::ENGINE_NATIVE);
+        }
+    }
+    if (instance.getEngine() != options.engine->engine)
+    {
+        error = QString("the %1 engine cannot run the script").arg(options.engine->name);
+        return false;
+    }
+    for(uint32_t i=0; i<4; i++)
+    {
+        instance.setSlider(i, options.sliders[i]);
+    }
+    return true;
+}
+
+/** execute an instance on the frames first..last-1 and write the
+    output of the frames from 'keep' on, which the instance has
+    seen all of the memory of the program for */
+static void renderRange(const options_t &options, ProgramInstance &instance,
+                        const std::vector<float> &left, const std::vector<float> &right,
+                        uint32_t first, uint32_t keep, uint32_t last, std::vector<float> &out)
+{
+    const uint32_t chunk = instance.getChunkSize();
+    std::vector<float> buffer(2*chunk);
+    for(uint32_t i=first; i<last; i+=chunk)
+    {
+        const uint32_t n = std::min(chunk, last-i);
+        if (i >= keep)
+        {
+            instance.process(&left[i], &right[i], n, &out[2*i], options.engine->blockMode, NULL);
+        }
+        else
+        {
+            // the pre-roll, or the part of it that
+            // ends in the middle of this block
+            instance.process(&left[i], &right[i], n, &buffer[0], options.engine->blockMode, NULL);
+            if (i+n > keep)
+            {
+                std::copy(buffer.begin() + 2*(keep-i), buffer.begin() + 2*n, out.begin() + 2*keep);
+            }
+        }
+    }
+}
+
+/** render one input file into 'output' on at most 'threads' threads */
+static result_t renderFile(const options_t &options, const QString &input, const QString &output,
+                           uint32_t threads)
+{
+    result_t result;
+    result.ok = false;
+    result.frames = 0;
+    result.sampleRate = 0;
+    result.seconds = 0.0;
+    result.chunks = 1;
+
+    WavStreamer wav;
+    std::vector<float> samples;
+    uint32_t channels = 0;
+    uint32_t fileRate = 0;
+    if (wav.loadFile(input, samples, channels, &fileRate) != 0)
+    {
+        result.error = "cannot read the file, only mono and stereo WAV files are supported";
+        return result;
+    }
+
+    result.sampleRate = fileRate;
+
+    // the program may run at a virtual rate,
+    // if the resamplers support the ratio
+    float programRate = fileRate;
+    if ((options.virtualRate != 0) && (options.virtualRate != fileRate))
+    {
+        if ((options.virtualRate > VM_MAXVIRTUALRATIO*fileRate) ||
+            !Resampler::isSupported(options.virtualRate, fileRate))
+        {
+            result.error = QString("cannot resample from %1 Hz to %2 Hz").arg(fileRate).arg(options.virtualRate);
+            return result;
+        }
+        programRate = options.virtualRate;
+    }
+
+    compiled_t compiled;
+    if (!compileScript(options, programRate, compiled, result.error))
+    {
+        return result;
+    }
+
+    // a program that forgets its past, and runs at the rate of
+    // the file, can render chunks of the file independently
+    const uint32_t frames = samples.size() / channels;
+    uint32_t memory = 0;
+    uint32_t chunks = 1;
+    if ((threads > 1) && (programRate == fileRate) &&
+        VM::getMemoryLength(compiled.program, compiled.filters, memory))
+    {
+        const uint64_t minimum = std::max<uint64_t>(CHUNK_MINFRAMES, CHUNK_MINRATIO*static_cast<uint64_t>(memory));
+        chunks = static_cast<uint32_t>(std::min<uint64_t>(threads, std::max<uint64_t>(frames / minimum, 1)));
+    }
+
+    std::vector<ProgramInstance*> instances;
+    for(uint32_t c=0; c<chunks; c++)
+    {
+        instances.push_back(new ProgramInstance());
+        if (!loadInstance(options, compiled, fileRate, programRate, *instances.back(), result.error))
+        {
+            for(uint32_t i=0; i<instances.size(); i++)
+            {
+                delete instances[i];
+            }
+            return result;
+        }
+    }
+
+    // the planar input of the program, a mono
+    // file is played on both channels
+    std::vector<float> left(frames);
+    std::vector<float> right(frames);
+    for(uint32_t i=0; i<frames; i++)
+    {
+        left[i] = samples[i*channels];
+        right[i] = samples[i*channels + channels-1];
+    }
+    samples.clear();
+
+    std::vector<float> out(2*frames);
+    QElapsedTimer timer;
+    timer.start();
+    if (chunks == 1)
+    {
+        renderRange(options, *instances[0], left, right, 0, 0, frames, out);
+    }
+    else
+    {
+        // a chunk starts 'memory' frames early, on a multiple
+        // of the largest block of a convolver, so that its
+        // blocks line up with those of a run from the start
+        std::vector<std::thread> workers;
+        for(uint32_t c=0; c<chunks; c++)
+        {
+            const uint32_t keep = static_cast<uint64_t>(frames)*c/chunks;
+            const uint32_t last = static_cast<uint64_t>(frames)*(c+1)/chunks;
+            const uint32_t first = (keep > memory) ? (keep - memory) / CONV_MAXBLOCK * CONV_MAXBLOCK : 0;
+            workers.push_back(std::thread(renderRange, std::cref(options), std::ref(*instances[c]),
+                                          std::cref(left), std::cref(right), first, keep, last,
+                                          std::ref(out)));
+        }
+        for(size_t c=0; c<workers.size(); c++)
+        {
+            workers[c].join();
+        }
+    }
+    result.seconds = timer.nsecsElapsed()*1e-9;
+    result.frames = frames;
+    result.chunks = chunks;
+    for(uint32_t c=0; c<instances.size(); c++)
+    {
+        delete instances[c];
+    }
+
+    if (!writeWav(output, out, fileRate))
+    {
+        result.error = "cannot write " + output;
+        return result;
+    }
+    result.ok = true;
+    return result;
+}
+
+static void usage()
+{
+    printf("usage: dspbatch [options] script.dsp input.wav|directory ...\n\n"
+           "  -o dir      output directory, default: the current directory\n"
+           "  -j n        number of files rendered at the same time,\n"
+           "              default: the number of cores\n"
+           "  -e engine   stack, block, register, threaded, jit or native,\n"
+           "              default: block\n"
+           "  -r rate     run the program at a virtual sample rate\n"
+           "  -s n=value  set slider n (1-4), default: 0.5\n"
+           "  -n seed     seed of the noise generators, default: 1\n\n"
+           "The WAV files in a directory are rendered, and the output is\n"
+           "written as stereo 32-bit float WAV files with the same names,\n"
+           "so no two input files may have the same name.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    options_t options;
+    options.outputDir = ".";
+    options.jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    options.engine = &g_engines[1];
+    options.virtualRate = 0;
+    options.noiseSeed = 1;
+    for(uint32_t i=0; i<4; i++)
+    {
+        options.sliders[i] = 0.5f;
+    }
+
+    QStringList args = app.arguments().mid(1);
+    QStringList paths;
+    for(int i=0; i<args.size(); i++)
+    {
+        const QString &arg = args[i];
+        if (!arg.startsWith("-") || (arg.size() != 2))
+        {
+            paths << arg;
+            continue;
+        }
+        if (i+1 >= args.size())
+        {
+            usage();
+            return 1;
+        }
+
+        const QString value = args[++i];
+        bool ok = true;
+        switch(arg[1].toLatin1())
+        {
+        case 'o':
+            options.outputDir = value;
+            break;
+        case 'j':
+            options.jobs = value.toUInt(&ok);
+            ok = ok && (options.jobs > 0);
+            break;
+        case 'e':
+            ok = false;
+            for(uint32_t e=0; e<g_enginesLen; e++)
+            {
+                if (value == g_engines[e].name)
+                {
+                    options.engine = &g_engines[e];
+                    ok = true;
+                }
+            }
+            break;
+        case 'r':
+            options.virtualRate = value.toUInt(&ok);
+            break;
+        case 's':
+            {
+                const uint32_t n = value.section('=', 0, 0).toUInt(&ok);
+                const float v = value.section('=', 1).toFloat(&ok);
+                ok = ok && (n >= 1) && (n <= 4);
+                if (ok)
+                {
+                    options.sliders[n-1] = v;
+                }
+            }
+            break;
+        case 'n':
+            options.noiseSeed = value.toUInt(&ok);
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "invalid option %s %s\n", arg.toLocal8Bit().constData(),
+                    value.toLocal8Bit().constData());
+            return 1;
+        }
+    }
+
+    if (paths.size() < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    QFile script(paths[0]);
+    if (!script.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        fprintf(stderr, "cannot open %s\n", paths[0].toLocal8Bit().constData());
+        return 1;
+    }
+    options.script = QString(script.readAll());
+    options.directory = QFileInfo(paths[0]).absolutePath();
+
+    // check the script once, before any file is rendered
+    {
+        compiled_t compiled;
+        QString error;
+        if (!compileScript(options, 44100.0f, compiled, error))
+        {
+            fprintf(stderr, "%s: %s\n", paths[0].toLocal8Bit().constData(), error.toLocal8Bit().constData());
+            return 1;
+        }
+    }
+
+    QStringList inputs;
+    for(int i=1; i<paths.size(); i++)
+    {
+        QFileInfo info(paths[i]);
+        if (info.isDir())
+        {
+            QDir dir(paths[i]);
+            QStringList names = dir.entryList(QStringList() << "*.wav" << "*.WAV", QDir::Files, QDir::Name);
+            for(int n=0; n<names.size(); n++)
+            {
+                inputs << dir.filePath(names[n]);
+            }
+        }
+        else
+        {
+            inputs << paths[i];
+        }
+    }
+
+    // the output of a file has its name, so two files with the
+    // same name in different directories would be written to the
+    // same output by two threads at once
+    QStringList outputs;
+    std::map<QString, int> owners;
+    for(int i=0; i<inputs.size(); i++)
+    {
+        const QString name = QFileInfo(inputs[i]).fileName();
+        std::map<QString, int>::const_iterator owner = owners.find(name);
+        if (owner != owners.end())
+        {
+            fprintf(stderr, "%s and %s would both be written to %s\n",
+                    inputs[owner->second].toLocal8Bit().constData(),
+                    inputs[i].toLocal8Bit().constData(),
+                    QDir(options.outputDir).filePath(name).toLocal8Bit().constData());
+            return 1;
+        }
+        owners[name] = i;
+        outputs << QDir(options.outputDir).filePath(name);
+    }
+
+    if (!QDir().mkpath(options.outputDir))
+    {
+        fprintf(stderr, "cannot create %s\n", options.outputDir.toLocal8Bit().constData());
+        return 1;
+    }
+
+    // the threads take the files in turn, and the threads
+    // that are left over render chunks of the files
+    std::vector<result_t> results(inputs.size());
+    const uint32_t threadsPerFile = std::max<uint32_t>(options.jobs / std::max<int>(inputs.size(), 1), 1);
+    std::atomic<int> next(0);
+    std::atomic<bool> failed(false);
+    auto worker = [&]()
+    {
+        int i;
+        while((i = next.fetch_add(1)) < inputs.size())
+        {
+            const QString &output = outputs[i];
+            if (QFileInfo(output).absoluteFilePath() == QFileInfo(inputs[i]).absoluteFilePath())
+            {
+                results[i].ok = false;
+                results[i].error = "the output would overwrite the input";
+            }
+            else
+            {
+                results[i] = renderFile(options, inputs[i], output, threadsPerFile);
+            }
+
+            const QByteArray name = inputs[i].toLocal8Bit();
+            if (results[i].ok)
+            {
+                const double rate = results[i].frames / std::max(results[i].seconds, 1e-9);
+                printf("%-40s %10u frames %8.3f s %12.0f samples/s %8.1fx realtime %3u chunks\n",
+                       name.constData(), results[i].frames, results[i].seconds,
+                       rate, rate / results[i].sampleRate, results[i].chunks);
+            }
+            else
+            {
+                printf("%-40s %s\n", name.constData(), results[i].error.toLocal8Bit().constData());
+                failed = true;
+            }
+            fflush(stdout);
+        }
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<std::thread> threads;
+    const uint32_t count = std::min<uint32_t>(options.jobs, inputs.size());
+    for(uint32_t t=0; t<count; t++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+    for(size_t t=0; t<threads.size(); t++)
+    {
+        threads[t].join();
+    }
+
+    uint64_t frames = 0;
+    for(size_t i=0; i<results.size(); i++)
+    {
+        frames += results[i].ok ? results[i].frames : 0;
+    }
+    const double seconds = timer.nsecsElapsed()*1e-9;
+    printf("%d files, %llu frames in %.3f s with %u threads, %.0f samples/s\n",
+           static_cast<int>(inputs.size()), static_cast<unsigned long long>(frames), seconds, count*threadsPerFile,
+           frames / std::max(seconds, 1e-9));
+    return failed ? 1 : 0;
+}
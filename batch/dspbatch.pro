@@ -0,0 +1,82 @@
+#-------------------------------------------------
+#
+# Batch renderer for BasicDSP scripts. Renders
+# WAV files with a script on all cores, without
+# a sound card or PortAudio, and reports the
+# speed of each file.
+#
+#-------------------------------------------------
+
+CONFIG   += c++11 console
+CONFIG   -= app_bundle
+QT       += core
+QT       -= gui
+
+TARGET = dspbatch
+TEMPLATE = app
+
+# only the ring buffer of PortAudio is used,
+# for the monitor interface of the engines
+INCLUDEPATH += ..\
+               ../contrib/portaudio/include\
+               ../contrib/portaudio/src/common\
+               ../contrib/kiss_fft130\
+               ../contrib/kiss_fft130/tools
+
+SOURCES += dspbatch.cpp\
+        ../bytecode.cpp\
+        ../parser.cpp\
+        ../tokenizer.cpp\
+        ../reader.cpp\
+        ../asttovm.cpp\
+        ../astoptimizer.cpp\
+        ../fastmath.cpp\
+        ../vectormath.cpp\
+        ../vectormath_sse2.cpp\
+        ../vectormath_avx2.cpp\
+        ../vectormath_avx512.cpp\
+        ../noisegenerator.cpp\
+        ../firfilter.cpp\
+        ../biquadfilter.cpp\
+        ../convolver.cpp\
+        ../resampler.cpp\
+        ../oversampler.cpp\
+        ../statearena.cpp\
+        ../programinstance.cpp\
+        ../pipeline.cpp\
+        ../rateanalyzer.cpp\
+        ../jitcompiler.cpp\
+        ../peephole.cpp\
+        ../nativecompiler.cpp\
+        ../functiondefs.cpp\
+        ../wavstreamer.cpp\
+        ../contrib/portaudio/src/common/pa_ringbuffer.c\
+        ../contrib/kiss_fft130/kiss_fft.c\
+        ../contrib/kiss_fft130/tools/kiss_fftr.c
+
+HEADERS += ../virtualmachine.h\
+        ../parser.h\
+        ../tokenizer.h\
+        ../reader.h\
+        ../asttovm.h\
+        ../astoptimizer.h\
+        ../fastmath.h\
+        ../fastmathdefs.h\
+        ../vectormath.h\
+        ../vectormath_simd.h\
+        ../noisegenerator.h\
+        ../firfilter.h\
+        ../biquadfilter.h\
+        ../convolver.h\
+        ../resampler.h\
+        ../oversampler.h\
+        ../statearena.h\
+        ../handoff.h\
+        ../programinstance.h\
+        ../pipeline.h\
+        ../rateanalyzer.h\
+        ../jitcompiler.h\
+        ../peephole.h\
+        ../nativecompiler.h\
+        ../functiondefs.h\
+        ../wavstreamer.h
@@ -0,0 +1,509 @@
+/*
+
+  Benchmark for the precision tiers of the
+  transcendental functions of the virtual machine.
+
+  Every function of each tier is evaluated on a
+  fixed set of pseudo-random arguments. The maximum
+  error against the double-precision C library and
+  the time per call are reported. The absolute error
+  is used, except for pow which reports the relative
+  error.
+
+  The second table reports the time per element of
+  the kernels of the vector math library for each
+  instruction set supported by the CPU, and checks
+  that they are bit-identical to the scalar code,
+  including infinities, NaNs and large arguments.
+
+  Usage: mathbench
+
+  License: GPLv2
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "fastmath.h"
+#include "vectormath.h"
+
+#define BENCH_ARGS      4096    // arguments per function
+#define BENCH_REPEAT    2000    // passes over the arguments for the timing
+#define BENCH_BLOCK     256     // elements per call of a vector kernel
+
+struct function_t
+{
+    const char  *name;
+    const char  *range;
+    float       xmin, xmax;     // range of the first argument
+    float       ymin, ymax;     // range of the second argument
+    bool        relative;       // report the relative error
+};
+
+static const function_t g_functions[] =
+{
+    {"sin",   "[-100, 100]",       -100.0f, 100.0f,  0.0f,  0.0f, false},
+    {"cos",   "[-100, 100]",       -100.0f, 100.0f,  0.0f,  0.0f, false},
+    {"sin1",  "[-100, 100]",       -100.0f, 100.0f,  0.0f,  0.0f, false},
+    {"cos1",  "[-100, 100]",       -100.0f, 100.0f,  0.0f,  0.0f, false},
+    {"tanh",  "[-10, 10]",          -10.0f,  10.0f,  0.0f,  0.0f, false},
+    {"pow",   "x [0.01,10] y [-8,8]", 0.01f, 10.0f, -8.0f,  8.0f, true},
+    {"atan2", "[-10, 10]^2",        -10.0f,  10.0f, -10.0f, 10.0f, false}
+};
+
+#define g_functionsLen (sizeof(g_functions)/sizeof(g_functions[0]))
+
+static const FastMath::precision_t g_tiers[] =
+{
+    FastMath::PRECISION_EXACT,
+    FastMath::PRECISION_FAST,
+    FastMath::PRECISION_ULTRAFAST
+};
+
+#define g_tiersLen (sizeof(g_tiers)/sizeof(g_tiers[0]))
+
+/** uniformly distributed pseudo-random number in [lo, hi) */
+static float uniform(uint32_t &state, float lo, float hi)
+{
+    state = state*1664525u + 1013904223u;
+    return lo + (hi-lo)*static_cast<float>(state >> 8)/16777216.0f;
+}
+
+/** double-precision reference of a function */
+static double reference(uint32_t f, float x, float y)
+{
+    switch(f)
+    {
+    case 0: return sin(static_cast<double>(x));
+    case 1: return cos(static_cast<double>(x));
+    case 2: return sin(2.0*M_PI*x);
+    case 3: return cos(2.0*M_PI*x);
+    case 4: return tanh(static_cast<double>(x));
+    case 5: return pow(static_cast<double>(x), static_cast<double>(y));
+    default: return atan2(static_cast<double>(x), static_cast<double>(y));
+    }
+}
+
+/** evaluate a function of a tier */
+static float evaluate(const FastMath::kernels_t &k, uint32_t f, float x, float y)
+{
+    switch(f)
+    {
+    case 0: return k.sin(x);
+    case 1: return k.cos(x);
+    case 2: return k.sin1(x);
+    case 3: return k.cos1(x);
+    case 4: return k.tanh(x);
+    case 5: return k.pow(x,y);
+    default: return k.atan2(x,y);
+    }
+}
+
+/** time per call in nanoseconds, through a function
+    pointer as in the interpreters. */
+static double timeFunction(const FastMath::kernels_t &k, uint32_t f,
+                           const std::vector<float> &x, const std::vector<float> &y)
+{
+    FastMath::unary_t  unary  = NULL;
+    FastMath::binary_t binary = NULL;
+    switch(f)
+    {
+    case 0: unary = k.sin;  break;
+    case 1: unary = k.cos;  break;
+    case 2: unary = k.sin1; break;
+    case 3: unary = k.cos1; break;
+    case 4: unary = k.tanh; break;
+    case 5: binary = k.pow; break;
+    default: binary = k.atan2; break;
+    }
+
+    volatile float sink = 0.0f;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(uint32_t r=0; r<BENCH_REPEAT; r++)
+    {
+        float sum = 0.0f;
+        if (unary != NULL)
+        {
+            for(uint32_t i=0; i<x.size(); i++) sum += unary(x[i]);
+        }
+        else
+        {
+            for(uint32_t i=0; i<x.size(); i++) sum += binary(x[i], y[i]);
+        }
+        sink = sink + sum;
+    }
+    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (x.size()*BENCH_REPEAT);
+}
+
+// **************************************************
+//   vector math library
+// **************************************************
+
+struct vector_function_t
+{
+    const char  *name;
+    float       xmin, xmax;     // range of the first argument
+    float       ymin, ymax;     // range of the second argument
+    uint32_t    args;           // 1 or 2, 3 for mac, 0 for addk and mulk
+};
+
+static const vector_function_t g_vectorFunctions[] =
+{
+    {"add",   -100.0f, 100.0f, -100.0f, 100.0f, 2},
+    {"mul",   -100.0f, 100.0f, -100.0f, 100.0f, 2},
+    {"div",   -100.0f, 100.0f, -100.0f, 100.0f, 2},
+    {"mulk",  -100.0f, 100.0f,    0.0f,   0.0f, 0},
+    {"mac",   -100.0f, 100.0f, -100.0f, 100.0f, 3},
+    {"abs",   -100.0f, 100.0f,    0.0f,   0.0f, 1},
+    {"sqrt",     0.0f, 100.0f,    0.0f,   0.0f, 1},
+    {"limit",   -2.0f,   2.0f,    0.0f,   0.0f, 1},
+    {"mod1",  -100.0f, 100.0f,    0.0f,   0.0f, 1},
+    {"floor", -100.0f, 100.0f,    0.0f,   0.0f, 1},
+    {"round", -100.0f, 100.0f,    0.0f,   0.0f, 1},
+    {"sin",   -100.0f, 100.0f,    0.0f,   0.0f, 1},
+    {"cos",   -100.0f, 100.0f,    0.0f,   0.0f, 1},
+    {"sin1",  -100.0f, 100.0f,    0.0f,   0.0f, 1},
+    {"cos1",  -100.0f, 100.0f,    0.0f,   0.0f, 1},
+    {"tanh",   -10.0f,  10.0f,    0.0f,   0.0f, 1},
+    {"atan2",  -10.0f,  10.0f,  -10.0f,  10.0f, 2},
+    {"dot",     -1.0f,   1.0f,   -1.0f,   1.0f, 2},
+    {"dotsym",  -1.0f,   1.0f,   -1.0f,   1.0f, 2},
+    {"sos",     -1.0f,   1.0f,    0.0f,   0.0f, 1},
+    {"cmac",  -100.0f, 100.0f, -100.0f, 100.0f, 3}
+};
+
+// number of sections of the cascade that is timed
+#define BENCH_SECTIONS 10
+
+#define g_vectorFunctionsLen (sizeof(g_vectorFunctions)/sizeof(g_vectorFunctions[0]))
+
+/** all kernels that are checked for bit-exactness */
+static const char* const g_checkedKernels[] =
+{
+    "add", "sub", "mul", "div", "addk", "mulk", "mac", "neg", "abs", "sqrt",
+    "limit", "sign", "mod1", "trunc", "floor", "ceil", "round",
+    "sin", "cos", "sin1", "cos1", "tan", "tanh", "pow", "atan2"
+};
+
+#define g_checkedKernelsLen (sizeof(g_checkedKernels)/sizeof(g_checkedKernels[0]))
+
+/** fill the rows of a stable cascade of second-order sections */
+static void makeCascade(std::vector<float> &sos, uint32_t sections)
+{
+    const uint32_t stride = VM_SOS_STRIDE(sections);
+    sos.assign(VM_SOS_ROWS*stride, 0.0f);
+    uint32_t state = 5;
+    for(uint32_t k=0; k<sections; k++)
+    {
+        // poles at radius r and angle w
+        const float r = uniform(state, 0.5f, 0.99f);
+        const float w = uniform(state, 0.1f, 3.0f);
+        sos[VM_SOS_B0*stride + k] = uniform(state, -1.0f, 1.0f);
+        sos[VM_SOS_B1*stride + k] = uniform(state, -1.0f, 1.0f);
+        sos[VM_SOS_B2*stride + k] = uniform(state, -1.0f, 1.0f);
+        sos[VM_SOS_A1*stride + k] = -2.0f*r*cosf(w);
+        sos[VM_SOS_A2*stride + k] = r*r;
+    }
+}
+
+/** apply a kernel of the vector math library by name */
+static void applyVector(const VectorMath::kernels_t &k, const char *name, float *dst,
+                        const float *a, const float *b, uint32_t n)
+{
+    std::string s(name);
+    if (s == "add")         k.add(dst, a, b, n);
+    else if (s == "sub")    k.sub(dst, a, b, n);
+    else if (s == "mul")    k.mul(dst, a, b, n);
+    else if (s == "div")    k.div(dst, a, b, n);
+    else if (s == "addk")   k.addk(dst, a, 0.3f, n);
+    else if (s == "mulk")   k.mulk(dst, a, 0.3f, n);
+    else if (s == "mac")    k.mac(dst, b, a, b, n);
+    else if (s == "neg")    k.neg(dst, a, n);
+    else if (s == "abs")    k.abs(dst, a, n);
+    else if (s == "sqrt")   k.sqrt(dst, a, n);
+    else if (s == "limit")  k.limit(dst, a, n);
+    else if (s == "sign")   k.sign(dst, a, n);
+    else if (s == "mod1")   k.mod1(dst, a, n);
+    else if (s == "trunc")  k.trunc(dst, a, n);
+    else if (s == "floor")  k.floor(dst, a, n);
+    else if (s == "ceil")   k.ceil(dst, a, n);
+    else if (s == "round")  k.round(dst, a, n);
+    else if (s == "sin")    k.sin(dst, a, n);
+    else if (s == "cos")    k.cos(dst, a, n);
+    else if (s == "sin1")   k.sin1(dst, a, n);
+    else if (s == "cos1")   k.cos1(dst, a, n);
+    else if (s == "tan")    k.tan(dst, a, n);
+    else if (s == "tanh")   k.tanh(dst, a, n);
+    else if (s == "pow")    k.pow(dst, a, b, n);
+    else if (s == "dot")    dst[0] = k.dot(a, b, n);
+    else if (s == "dotsym") dst[0] = k.dotsym(a, b, n);
+    else if (s == "sos")
+    {
+        static std::vector<float> cascade;
+        if (cascade.empty())
+            makeCascade(cascade, BENCH_SECTIONS);
+        k.sos(dst, a, n, &cascade[0], BENCH_SECTIONS);
+    }
+    else if (s == "cmac")   k.cmac(dst, dst + n/2, a, a + n/2, b, b + n/2, n/2);
+    else                    k.atan2(dst, a, b, n);
+}
+
+/** arguments for the exactness check: special values
+    followed by random values of several magnitudes */
+static void checkArguments(std::vector<float> &x)
+{
+    static const float special[] =
+    {
+        0.0f, -0.0f, 0.5f, -0.5f, 1.5f, -2.5f, 0.25f, 0.75f, 1.0f, -1.0f,
+        1e-40f, -1e-40f, 8388607.5f, 8388608.0f, -8388609.0f, 4194303.5f, 4194304.0f,
+        0.625f, -0.625f, 4.97f, 9.0f, -9.0f, 255.9f, 256.0f, 1e9f, -1e9f, 3e9f, 1e30f,
+        INFINITY, -INFINITY, NAN, -NAN, 3.40282347e+38f, -3.40282347e+38f
+    };
+
+    uint32_t nspecial = sizeof(special)/sizeof(special[0]);
+    uint32_t state = 3;
+    for(uint32_t i=0; i<x.size(); i++)
+    {
+        if (i < nspecial)
+        {
+            x[i] = special[i];
+        }
+        else
+        {
+            float scale = powf(10.0f, static_cast<float>(i % 12) - 3.0f);
+            x[i] = uniform(state, -scale, scale);
+        }
+    }
+}
+
+/** returns true if the kernels of an instruction set give
+    the same bits as the generic kernels */
+static bool checkVector(const VectorMath::kernels_t &k, const VectorMath::kernels_t &ref,
+                        const char **failed)
+{
+    // the length is not a multiple of the vector width,
+    // so the scalar tail is checked too.
+    const uint32_t n = 4099;
+    std::vector<float> x(n), y(n), r1(n), r2(n);
+    checkArguments(x);
+    checkArguments(y);
+    std::rotate(y.begin(), y.begin()+7, y.end());
+    for(uint32_t i=0; i<n; i++)
+    {
+        y[i] = (i & 1) ? fabsf(y[i]) : y[i];
+    }
+
+    for(uint32_t f=0; f<g_checkedKernelsLen; f++)
+    {
+        applyVector(ref, g_checkedKernels[f], &r1[0], &x[0], &y[0], n);
+        applyVector(k, g_checkedKernels[f], &r2[0], &x[0], &y[0], n);
+        if (memcmp(&r1[0], &r2[0], n*sizeof(float)) != 0)
+        {
+            *failed = g_checkedKernels[f];
+            return false;
+        }
+
+        // in place
+        std::vector<float> r3(x);
+        applyVector(k, g_checkedKernels[f], &r3[0], &r3[0], &y[0], n);
+        if (memcmp(&r1[0], &r3[0], n*sizeof(float)) != 0)
+        {
+            *failed = g_checkedKernels[f];
+            return false;
+        }
+    }
+
+    // the dot products, for lengths around the multiples
+    // of the number of partial sums, after the special values
+    const uint32_t offset = 40;
+    for(uint32_t len=0; len<n-offset; len+=(len < 8*VM_DOT_LANES) ? 1 : 97)
+    {
+        float d1 = ref.dot(&x[offset], &y[offset], len);
+        float d2 = k.dot(&x[offset], &y[offset], len);
+        if (memcmp(&d1, &d2, sizeof(float)) != 0)
+        {
+            *failed = "dot";
+            return false;
+        }
+        d1 = ref.dotsym(&x[offset], &y[offset], len);
+        d2 = k.dotsym(&x[offset], &y[offset], len);
+        if (memcmp(&d1, &d2, sizeof(float)) != 0)
+        {
+            *failed = "dotsym";
+            return false;
+        }
+    }
+
+    // complex multiply-accumulate, with the accumulator
+    // taken from the arguments
+    for(uint32_t len=0; len<n/2; len+=(len < 64) ? 1 : 331)
+    {
+        std::vector<float> acc1(y), acc2(y);
+        ref.cmac(&acc1[0], &acc1[n/2], &x[0], &x[n/2], &y[1], &y[n/2+1], len);
+        k.cmac(&acc2[0], &acc2[n/2], &x[0], &x[n/2], &y[1], &y[n/2+1], len);
+        if (memcmp(&acc1[0], &acc2[0], n*sizeof(float)) != 0)
+        {
+            *failed = "cmac";
+            return false;
+        }
+    }
+
+    // cascades of second-order sections, in two calls so the
+    // state is checked too, and in place for the second one
+    static const uint32_t lengths[] = {0, 1, 2, 3, 5, 17, 256, 1000};
+    for(uint32_t sections=1; sections<=40; sections++)
+    {
+        for(uint32_t l=0; l<sizeof(lengths)/sizeof(lengths[0]); l++)
+        {
+            const uint32_t len = lengths[l];
+            std::vector<float> sos1, sos2;
+            makeCascade(sos1, sections);
+            makeCascade(sos2, sections);
+            ref.sos(&r1[0], &x[offset], len, &sos1[0], sections);
+            k.sos(&r2[0], &x[offset], len, &sos2[0], sections);
+            std::vector<float> r3(x.begin()+offset+len, x.begin()+offset+2*len);
+            std::vector<float> r4(r3);
+            ref.sos(&r3[0], &r3[0], len, &sos1[0], sections);
+            k.sos(&r4[0], &r4[0], len, &sos2[0], sections);
+            if ((memcmp(&r1[0], &r2[0], len*sizeof(float)) != 0) ||
+                (memcmp(&r3[0], &r4[0], len*sizeof(float)) != 0) ||
+                (memcmp(&sos1[0], &sos2[0], sos1.size()*sizeof(float)) != 0))
+            {
+                *failed = "sos";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/** time per element in nanoseconds, for blocks of
+    BENCH_BLOCK elements as in the block executor */
+static double timeVector(const VectorMath::kernels_t &k, const vector_function_t &func,
+                         const std::vector<float> &x, const std::vector<float> &y)
+{
+    std::vector<float> out(x.size());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(uint32_t r=0; r<BENCH_REPEAT; r++)
+    {
+        for(uint32_t i=0; i<x.size(); i+=BENCH_BLOCK)
+        {
+            applyVector(k, func.name, &out[i], &x[i], &y[i], BENCH_BLOCK);
+        }
+    }
+    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (x.size()*BENCH_REPEAT);
+}
+
+static void benchmarkVector(FastMath::precision_t precision)
+{
+    printf("\nvector kernels, %s precision, ns/element\n%-7s", FastMath::getPrecisionName(precision), "");
+    for(uint32_t isa=VectorMath::ISA_GENERIC; isa<=VectorMath::ISA_AVX512; isa++)
+    {
+        printf(" %8s", VectorMath::getISAName(static_cast<VectorMath::isa_t>(isa)));
+    }
+    printf("\n");
+
+    for(uint32_t f=0; f<g_vectorFunctionsLen; f++)
+    {
+        const vector_function_t &func = g_vectorFunctions[f];
+        uint32_t state = 1;
+        std::vector<float> x(BENCH_ARGS), y(BENCH_ARGS);
+        for(uint32_t i=0; i<BENCH_ARGS; i++)
+        {
+            x[i] = uniform(state, func.xmin, func.xmax);
+            y[i] = uniform(state, func.ymin, func.ymax);
+        }
+
+        printf("%-7s", func.name);
+        for(uint32_t isa=VectorMath::ISA_GENERIC; isa<=VectorMath::ISA_AVX512; isa++)
+        {
+            const VectorMath::kernels_t *k = VectorMath::getKernels(precision, static_cast<VectorMath::isa_t>(isa));
+            if (k == NULL)
+                printf(" %8s", "-");
+            else
+                printf(" %8.2f", timeVector(*k, func, x, y));
+        }
+        printf("\n");
+    }
+
+    const VectorMath::kernels_t *ref = VectorMath::getKernels(precision, VectorMath::ISA_GENERIC);
+    for(uint32_t isa=VectorMath::ISA_SSE2; isa<=VectorMath::ISA_AVX512; isa++)
+    {
+        const VectorMath::kernels_t *k = VectorMath::getKernels(precision, static_cast<VectorMath::isa_t>(isa));
+        if (k == NULL)
+            continue;
+        const char *failed = NULL;
+        if (checkVector(*k, *ref, &failed))
+            printf("%s: bit-identical to the scalar code\n", VectorMath::getISAName(static_cast<VectorMath::isa_t>(isa)));
+        else
+            printf("%s: %s differs from the scalar code\n", VectorMath::getISAName(static_cast<VectorMath::isa_t>(isa)), failed);
+    }
+}
+
+int main()
+{
+    printf("%-7s %-20s", "", "");
+    for(uint32_t t=0; t<g_tiersLen; t++)
+    {
+        printf("  %-21s", FastMath::getPrecisionName(g_tiers[t]));
+    }
+    printf("\n%-7s %-20s", "", "range");
+    for(uint32_t t=0; t<g_tiersLen; t++)
+    {
+        printf("  %-10s %10s", "max error", "ns/call");
+    }
+    printf("\n");
+
+    for(uint32_t f=0; f<g_functionsLen; f++)
+    {
+        const function_t &func = g_functions[f];
+
+        // the errors are measured on many more arguments
+        // than the timing, which uses a cache-sized set
+        uint32_t state = 1;
+        std::vector<float> x(BENCH_ARGS), y(BENCH_ARGS);
+        for(uint32_t i=0; i<BENCH_ARGS; i++)
+        {
+            x[i] = uniform(state, func.xmin, func.xmax);
+            y[i] = uniform(state, func.ymin, func.ymax);
+        }
+
+        printf("%-7s %-20s", func.name, func.range);
+        for(uint32_t t=0; t<g_tiersLen; t++)
+        {
+            const FastMath::kernels_t &kernels = FastMath::getKernels(g_tiers[t]);
+
+            uint32_t errState = 2;
+            double maxError = 0.0;
+            for(uint32_t i=0; i<BENCH_ARGS*1000; i++)
+            {
+                float a = uniform(errState, func.xmin, func.xmax);
+                float b = uniform(errState, func.ymin, func.ymax);
+                double ref = reference(f, a, b);
+                double err = fabs(evaluate(kernels, f, a, b) - ref);
+                if (func.relative)
+                    err /= fabs(ref);
+                if (err > maxError)
+                    maxError = err;
+            }
+
+            double ns = timeFunction(kernels, f, x, y);
+            printf("  %-10.1e %10.1f", maxError, ns);
+        }
+        printf("\n");
+    }
+
+    for(uint32_t t=0; t<g_tiersLen; t++)
+    {
+        benchmarkVector(g_tiers[t]);
+    }
+    return 0;
+}
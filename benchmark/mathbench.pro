@@ -0,0 +1,29 @@
+#-------------------------------------------------
+#
+# Benchmark for the precision tiers of the
+# transcendental functions of the virtual
+# machine. Reports the maximum error and the
+# time per call of each function, and the speed
+# and exactness of the vector kernels.
+#
+#-------------------------------------------------
+
+CONFIG   += c++11 console
+CONFIG   -= app_bundle qt
+
+TARGET = mathbench
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += mathbench.cpp\
+        ../fastmath.cpp\
+        ../vectormath.cpp\
+        ../vectormath_sse2.cpp\
+        ../vectormath_avx2.cpp\
+        ../vectormath_avx512.cpp
+
+HEADERS += ../fastmath.h\
+        ../fastmathdefs.h\
+        ../vectormath.h\
+        ../vectormath_simd.h
@@ -0,0 +1,317 @@
+/*
+
+  Benchmark for the BasicDSP virtual machine engines
+
+  Every script is compiled once and executed by each
+  interpreter on the same input signal. The time per
+  sample is reported, together with a check that the
+  output matches the switch-based stack interpreter.
+  The last column runs the script on BENCH_CHANNELS
+  channels of a MultiInstance and reports the time per
+  sample of one channel.
+
+  Usage: vmbench [script.dsp ...]
+  Without arguments, all scripts in examples/ are used.
+
+  License: GPLv2
+
+*/
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "reader.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "astoptimizer.h"
+#include "asttovm.h"
+#include "peephole.h"
+#include "virtualmachine.h"
+#include "multiinstance.h"
+
+#define BENCH_FRAMES 256        // frames per processSamples call
+#define BENCH_BLOCKS 2000       // number of calls per measurement
+#define BENCH_CHANNELS 32       // channels of the multi-instance
+
+struct benchConfig_t
+{
+    const char                  *name;
+    VirtualMachine::engine_t    engine;
+    bool                        blockMode;
+    bool                        peephole;   // fuse superinstructions
+};
+
+static const benchConfig_t g_configs[] =
+{
+    {"stack",    VirtualMachine::ENGINE_STACK,    false, false},
+    {"stack-pp", VirtualMachine::ENGINE_STACK,    false, true},
+    {"block",    VirtualMachine::ENGINE_STACK,    true,  false},
+    {"register", VirtualMachine::ENGINE_REGISTER, false, false},
+    {"threaded", VirtualMachine::ENGINE_THREADED, false, false},
+    {"thread-pp",VirtualMachine::ENGINE_THREADED, false, true},
+    {"jit",      VirtualMachine::ENGINE_JIT,      false, false},
+    {"native",   VirtualMachine::ENGINE_NATIVE,   false, false}
+};
+
+#define g_configsLen (sizeof(g_configs)/sizeof(g_configs[0]))
+
+/** compile a script file, returns false on error.
+    the caller must delete the statements. */
+static bool compileScript(const QString &filename,
+                          statements_t &statements,
+                          VM::program_t &program,
+                          VM::regprogram_t &regprogram,
+                          VM::variables_t &variables,
+                          VM::filters_t &filters)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        return false;
+    }
+
+    QScopedPointer<Reader> reader(Reader::create(QString(file.readAll())));
+    if (reader.isNull())
+    {
+        return false;
+    }
+
+    Tokenizer tokenizer;
+    std::vector<token_t> tokens;
+    if (!tokenizer.process(reader.data(), tokens))
+    {
+        return false;
+    }
+
+    Parser parser;
+    parser.setDirectory(QFileInfo(filename).absolutePath().toLocal8Bit().constData());
+    if (!parser.process(tokens, statements))
+    {
+        return false;
+    }
+
+    // fold constants as the editor does, so that every
+    // engine runs on folded literals such as 1/0
+    ASTOptimizer optimizer;
+    optimizer.setSamplerate(VirtualMachine(NULL).getProgramSamplerate());
+    optimizer.process(statements);
+    return ASTToVM::process(statements, program, regprogram, variables, filters);
+}
+
+/** run a script with the given configuration.
+    returns the time per sample in nanoseconds
+    and the output of the first block. */
+static double runScript(const benchConfig_t &config,
+                        const statements_t &statements,
+                        const VM::program_t &program,
+                        const VM::regprogram_t &regprogram,
+                        const VM::variables_t &variables,
+                        const VM::filters_t &filters,
+                        const std::vector<float> &input,
+                        std::vector<float> &output)
+{
+    VM::program_t fused = program;
+    if (config.peephole)
+    {
+        Peephole::process(fused);
+    }
+
+    VirtualMachine machine(NULL);
+    machine.loadProgram(fused, regprogram, variables, VM::program_t(), filters);
+    machine.setBlockMode(config.blockMode);
+    if (config.engine == VirtualMachine::ENGINE_NATIVE)
+    {
+        machine.compileNative(statements, variables);
+    }
+    if (!machine.setEngine(config.engine))
+    {
+        return -1.0;
+    }
+
+    // sliders at mid position, like the GUI default
+    for(uint32_t i=0; i<4; i++)
+    {
+        machine.setSlider(i, 0.5f);
+    }
+
+    srand(1);
+    machine.startOffline();
+
+    std::vector<float> buffer(BENCH_FRAMES*2);
+    machine.processSamples(const_cast<float*>(&input[0]), &output[0], BENCH_FRAMES);
+
+    QElapsedTimer timer;
+    timer.start();
+    for(uint32_t i=0; i<BENCH_BLOCKS; i++)
+    {
+        machine.processSamples(const_cast<float*>(&input[0]), &buffer[0], BENCH_FRAMES);
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+
+    machine.stop();
+    return static_cast<double>(elapsed) / (BENCH_FRAMES*BENCH_BLOCKS);
+}
+
+/** run a script on BENCH_CHANNELS channels of a multi-instance
+    with the same input. returns the time per sample of one
+    channel in nanoseconds and the output of the first block
+    of channel 0, interleaved. */
+static double runMulti(const VM::program_t &program,
+                       const VM::variables_t &variables,
+                       const VM::filters_t &filters,
+                       float sampleRate,
+                       const std::vector<float> &input,
+                       std::vector<float> &output)
+{
+    VM::program_t fused = program;
+    Peephole::process(fused);
+
+    MultiInstance multi;
+    if (!multi.load(fused, variables, VM::program_t(), filters, FastMath::PRECISION_EXACT,
+                    1, sampleRate, BENCH_CHANNELS))
+    {
+        return -1.0;
+    }
+    for(uint32_t i=0; i<4; i++)
+    {
+        multi.setSlider(i, 0.5f);
+    }
+
+    // planar input and output of every channel
+    std::vector<float> left(BENCH_FRAMES);
+    std::vector<float> right(BENCH_FRAMES);
+    for(uint32_t i=0; i<BENCH_FRAMES; i++)
+    {
+        left[i] = input[i*2];
+        right[i] = input[i*2+1];
+    }
+    std::vector<float> buffer(2*BENCH_CHANNELS*BENCH_FRAMES);
+    std::vector<const float*> inLeft(BENCH_CHANNELS, &left[0]);
+    std::vector<const float*> inRight(BENCH_CHANNELS, &right[0]);
+    std::vector<float*> outLeft(BENCH_CHANNELS);
+    std::vector<float*> outRight(BENCH_CHANNELS);
+    for(uint32_t c=0; c<BENCH_CHANNELS; c++)
+    {
+        outLeft[c] = &buffer[2*c*BENCH_FRAMES];
+        outRight[c] = &buffer[(2*c+1)*BENCH_FRAMES];
+    }
+
+    multi.process(&inLeft[0], &inRight[0], &outLeft[0], &outRight[0], BENCH_FRAMES);
+    for(uint32_t i=0; i<BENCH_FRAMES; i++)
+    {
+        output[i*2] = outLeft[0][i];
+        output[i*2+1] = outRight[0][i];
+    }
+
+    // as many samples in all as the other configurations
+    const uint32_t blocks = std::max(BENCH_BLOCKS/BENCH_CHANNELS, 1);
+    QElapsedTimer timer;
+    timer.start();
+    for(uint32_t i=0; i<blocks; i++)
+    {
+        multi.process(&inLeft[0], &inRight[0], &outLeft[0], &outRight[0], BENCH_FRAMES);
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+    return static_cast<double>(elapsed) / (BENCH_FRAMES*blocks*BENCH_CHANNELS);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList files = app.arguments().mid(1);
+    if (files.isEmpty())
+    {
+        QDir dir(EXAMPLES_DIR);
+        QStringList names = dir.entryList(QStringList() << "*.dsp", QDir::Files, QDir::Name);
+        for(int i=0; i<names.size(); i++)
+        {
+            files << dir.filePath(names[i]);
+        }
+    }
+
+    // stereo test signal: a 500 Hz sine on the left
+    // and a slow cosine on the right channel
+    std::vector<float> input(BENCH_FRAMES*2);
+    for(uint32_t i=0; i<BENCH_FRAMES; i++)
+    {
+        input[i*2]   = sin(2.0*M_PI*500.0*i/44100.0);
+        input[i*2+1] = 0.5*cos(0.01*i);
+    }
+
+    printf("%-36s", "ns/sample");
+    for(uint32_t c=0; c<g_configsLen; c++)
+    {
+        printf("%10s", g_configs[c].name);
+    }
+    printf("%8s%02d\n", "multi", BENCH_CHANNELS);
+
+    bool allMatch = true;
+    for(int f=0; f<files.size(); f++)
+    {
+        statements_t statements;
+        VM::program_t program;
+        VM::regprogram_t regprogram;
+        VM::variables_t variables;
+        VM::filters_t filters;
+        bool ok = compileScript(files[f], statements, program, regprogram, variables, filters);
+
+        printf("%-36s", QFileInfo(files[f]).fileName().toLocal8Bit().constData());
+
+        std::vector<float> reference(BENCH_FRAMES*2);
+        std::vector<float> output(BENCH_FRAMES*2);
+        for(uint32_t c=0; (c<g_configsLen) && ok; c++)
+        {
+            double ns = runScript(g_configs[c], statements, program, regprogram, variables,
+                                  filters, input, (c == 0) ? reference : output);
+            if (ns < 0.0)
+            {
+                printf("%10s", "n/a");
+                continue;
+            }
+
+            // mark results that are not bit-identical
+            // to the stack interpreter
+            bool match = (c == 0) ||
+                (memcmp(&reference[0], &output[0], reference.size()*sizeof(float)) == 0);
+            allMatch = allMatch && match;
+            printf("%9.1f%c", ns, match ? ' ' : '*');
+        }
+        if (ok)
+        {
+            const float sampleRate = VirtualMachine(NULL).getProgramSamplerate();
+            double ns = runMulti(program, variables, filters, sampleRate, input, output);
+            if (ns < 0.0)
+            {
+                printf("%10s", "n/a");
+            }
+            else
+            {
+                bool match = (memcmp(&reference[0], &output[0], reference.size()*sizeof(float)) == 0);
+                allMatch = allMatch && match;
+                printf("%9.1f%c", ns, match ? ' ' : '*');
+            }
+        }
+        printf(ok ? "\n" : " compile error\n");
+
+        for(size_t i=0; i<statements.size(); i++)
+        {
+            delete statements[i];
+        }
+    }
+
+    if (!allMatch)
+    {
+        printf("\n* output differs from the stack interpreter\n");
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+#-------------------------------------------------
+#
+# Benchmark for the BasicDSP virtual machine
+# interpreters. Runs every script in examples/
+# with each interpreter and reports the time
+# spent per sample.
+#
+#-------------------------------------------------
+
+CONFIG   += c++11 console
+CONFIG   -= app_bundle
+QT       += core gui
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = vmbench
+TEMPLATE = app
+
+DEFINES += EXAMPLES_DIR=\\\"$$PWD/../examples\\\"
+
+include(../portaudio.pri)
+
+INCLUDEPATH += ..\
+               ../contrib/kiss_fft130\
+               ../contrib/kiss_fft130/tools
+
+SOURCES += vmbench.cpp\
+        ../virtualmachine.cpp\
+        ../bytecode.cpp\
+        ../parser.cpp\
+        ../tokenizer.cpp\
+        ../reader.cpp\
+        ../astoptimizer.cpp\
+        ../asttovm.cpp\
+        ../fastmath.cpp\
+        ../vectormath.cpp\
+        ../vectormath_sse2.cpp\
+        ../vectormath_avx2.cpp\
+        ../vectormath_avx512.cpp\
+        ../noisegenerator.cpp\
+        ../firfilter.cpp\
+        ../biquadfilter.cpp\
+        ../convolver.cpp\
+        ../resampler.cpp\
+        ../oversampler.cpp\
+        ../statearena.cpp\
+        ../programinstance.cpp\
+        ../pipeline.cpp\
+        ../multiinstance.cpp\
+        ../rateanalyzer.cpp\
+        ../jitcompiler.cpp\
+        ../peephole.cpp\
+        ../nativecompiler.cpp\
+        ../functiondefs.cpp\
+        ../wavstreamer.cpp\
+        ../contrib/kiss_fft130/kiss_fft.c\
+        ../contrib/kiss_fft130/tools/kiss_fftr.c
+
+HEADERS += ../virtualmachine.h\
+        ../parser.h\
+        ../tokenizer.h\
+        ../reader.h\
+        ../astoptimizer.h\
+        ../asttovm.h\
+        ../fastmath.h\
+        ../fastmathdefs.h\
+        ../vectormath.h\
+        ../vectormath_simd.h\
+        ../noisegenerator.h\
+        ../firfilter.h\
+        ../biquadfilter.h\
+        ../convolver.h\
+        ../resampler.h\
+        ../oversampler.h\
+        ../statearena.h\
+        ../handoff.h\
+        ../programinstance.h\
+        ../pipeline.h\
+        ../multiinstance.h\
+        ../rateanalyzer.h\
+        ../jitcompiler.h\
+        ../peephole.h\
+        ../nativecompiler.h\
+        ../functiondefs.h\
+        ../wavstreamer.h
@@ -0,0 +1,70 @@
+/*
+
+  Description:  Cascade of biquad sections in transposed
+                direct form II.
+
+  License: GPLv2
+
+*/
+
+#include <algorithm>
+#include "biquadfilter.h"
+
+BiquadFilter::BiquadFilter()
+    : m_coefficients(NULL),
+      m_sos(NULL),
+      m_sections(0),
+      m_stride(0),
+      m_sosKernel(NULL)
+{
+}
+
+size_t BiquadFilter::getStateSize(uint32_t sections)
+{
+    return StateArena::getSize<float>(sections*BIQUAD_COEFFICIENTS) +
+           StateArena::getSize<float>(VM_SOS_ROWS*VM_SOS_STRIDE(sections));
+}
+
+void BiquadFilter::init(const std::vector<float> &coefficients, StateArena &arena)
+{
+    m_sections = coefficients.size() / BIQUAD_COEFFICIENTS;
+    m_stride = VM_SOS_STRIDE(m_sections);
+    m_coefficients = arena.take<float>(m_sections*BIQUAD_COEFFICIENTS);
+    std::copy(coefficients.begin(), coefficients.begin() + m_sections*BIQUAD_COEFFICIENTS, m_coefficients);
+
+    // the padding of the rows stays zero, so the
+    // vector kernels compute silence in unused lanes
+    m_sos = arena.take<float>(VM_SOS_ROWS*m_stride);
+    std::fill(m_sos, m_sos + VM_SOS_ROWS*m_stride, 0.0f);
+    if (m_sections > 0)
+    {
+        normalize(m_coefficients);
+    }
+
+    // the cascade is the same in every precision tier
+    m_sosKernel = VectorMath::getKernels(FastMath::PRECISION_EXACT).sos;
+}
+
+void BiquadFilter::reset()
+{
+    std::fill(m_sos + VM_SOS_S1*m_stride, m_sos + VM_SOS_ROWS*m_stride, 0.0f);
+}
+
+void BiquadFilter::normalize(const float *coefficients)
+{
+    for(uint32_t k=0; k<m_sections; k++)
+    {
+        const float *c = coefficients + k*BIQUAD_COEFFICIENTS;
+        const float a0 = c[3];
+        m_sos[VM_SOS_B0*m_stride + k] = c[0] / a0;
+        m_sos[VM_SOS_B1*m_stride + k] = c[1] / a0;
+        m_sos[VM_SOS_B2*m_stride + k] = c[2] / a0;
+        m_sos[VM_SOS_A1*m_stride + k] = c[4] / a0;
+        m_sos[VM_SOS_A2*m_stride + k] = c[5] / a0;
+    }
+
+    if (coefficients != m_coefficients)
+    {
+        std::copy(coefficients, coefficients + m_sections*BIQUAD_COEFFICIENTS, m_coefficients);
+    }
+}
@@ -0,0 +1,110 @@
+/*
+
+  Description:  Cascade of biquad sections in transposed
+                direct form II.
+
+  License: GPLv2
+
+*/
+
+#ifndef biquadfilter_h
+#define biquadfilter_h
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "vectormath.h"
+#include "statearena.h"
+
+// coefficients of a biquad section: b0 b1 b2 a0 a1 a2
+#define BIQUAD_COEFFICIENTS 6
+
+// maximum number of sections of a cascade
+#define BIQUAD_MAXSECTIONS 255
+
+/** A biquad filter is a cascade of second-order sections
+
+      H(z) = (b0 + b1*z^-1 + b2*z^-2) / (a0 + a1*z^-1 + a2*z^-2)
+
+    Every section is computed in transposed direct form II,
+    which needs two state variables and five multiplications,
+    with the coefficients divided by a0 beforehand.
+
+    The coefficients can be changed while the filter runs,
+    see setCoefficients. They are only divided by a0 again
+    when they are different from the previous ones.
+
+    Blocks of samples are filtered by the sos kernel of
+    VectorMath, which runs several sections at once on the
+    vector units. The result does not depend on whether
+    samples are processed one by one or in blocks.
+
+    The coefficients and the state are taken from a StateArena
+    by init(), so the filter never allocates memory.
+*/
+class BiquadFilter
+{
+public:
+    BiquadFilter();
+
+    /** returns the number of bytes of the arena
+        that a cascade of 'sections' takes */
+    static size_t getStateSize(uint32_t sections);
+
+    /** set the number of sections and their coefficients,
+        BIQUAD_COEFFICIENTS per section, and clear the state,
+        which is taken from 'arena' */
+    void init(const std::vector<float> &coefficients, StateArena &arena);
+
+    /** clear the state of all sections */
+    void reset();
+
+    /** returns the number of sections */
+    uint32_t getSections() const
+    {
+        return m_sections;
+    }
+
+    /** change the coefficients, BIQUAD_COEFFICIENTS per section.
+        the state is kept. */
+    inline void setCoefficients(const float *coefficients)
+    {
+        if (memcmp(coefficients, m_coefficients, m_sections*BIQUAD_COEFFICIENTS*sizeof(float)) != 0)
+        {
+            normalize(coefficients);
+        }
+    }
+
+    /** filter one sample */
+    inline float process(float x)
+    {
+        float *sos = m_sos;
+        for(uint32_t k=0; k<m_sections; k++)
+        {
+            const float y = sos[VM_SOS_B0*m_stride + k]*x + sos[VM_SOS_S1*m_stride + k];
+            sos[VM_SOS_S1*m_stride + k] = sos[VM_SOS_B1*m_stride + k]*x - sos[VM_SOS_A1*m_stride + k]*y
+                                        + sos[VM_SOS_S2*m_stride + k];
+            sos[VM_SOS_S2*m_stride + k] = sos[VM_SOS_B2*m_stride + k]*x - sos[VM_SOS_A2*m_stride + k]*y;
+            x = y;
+        }
+        return x;
+    }
+
+    /** filter n samples. 'in' and 'out' may be the same array. */
+    void process(const float *in, float *out, uint32_t n)
+    {
+        m_sosKernel(out, in, n, m_sos, m_sections);
+    }
+
+protected:
+    /** divide the coefficients by a0 */
+    void normalize(const float *coefficients);
+
+    float               *m_coefficients;    // as given, before normalization
+    float               *m_sos;             // rows of VectorMath, see VM_SOS_ROWS
+    uint32_t            m_sections;
+    uint32_t            m_stride;           // length of a row of m_sos
+    VectorMath::sos_t   m_sosKernel;
+};
+
+#endif
@@ -0,0 +1,405 @@
+/*
+
+  Description:  Helpers for the byte code of the virtual machine,
+                declared in virtualmachine.h. They are kept apart
+                from VirtualMachine so that the tools can load and
+                execute programs without PortAudio.
+
+  License: GPLv2
+
+*/
+
+#include <algorithm>
+#include "functiondefs.h"
+#include "biquadfilter.h"
+#include "convolver.h"
+#include "virtualmachine.h"
+
+int32_t VM::findVariableByName(const variables_t &vars, const std::string &name)
+{
+    size_t N = vars.size();
+    size_t i=0;
+    while(i<N)
+    {
+        if (vars[i].name == name)
+            return (int32_t)i;
+        i++;
+    }
+    return -1;
+}
+
+int32_t VM::getStackEffect(uint32_t icode)
+{
+    if (icode & 0x80000000)
+    {
+        switch(icode & 0xff000000)
+        {
+        case P_readvar:
+            return 1;
+        case P_writevar:
+            return -1;
+        case P_addvv:
+        case P_mulvv:
+        case P_noisegen:
+            return 1;
+        case P_fir:
+        case P_conv:
+            return 0;
+        case P_biquad:
+            // pops the coefficients of its sections
+            return -BIQUAD_COEFFICIENTS*static_cast<int32_t>((icode >> 16) & 0xFF);
+        default:
+            return 0;
+        }
+    }
+
+    switch(icode)
+    {
+    case P_add:
+    case P_sub:
+    case P_mul:
+    case P_div:
+        return -1;
+    case P_neg:
+    case P_mov:
+    case P_mullit:
+    case P_addlit:
+        return 0;
+    case P_literal:
+        return 1;
+    default:
+        break;
+    }
+
+    // built-in functions pop their arguments
+    // and push a single result
+    int32_t nargs = functionDefs::getNumberOfArguments(icode);
+    if (nargs < 0)
+    {
+        return 0;
+    }
+    return 1-nargs;
+}
+
+bool VM::isStackInstruction(uint32_t icode)
+{
+    if (icode & 0x80000000)
+    {
+        switch(icode & 0xff000000)
+        {
+        case P_writevar:
+        case P_readvar:
+        case P_fir:
+        case P_biquad:
+        case P_addvv:
+        case P_mulvv:
+        case P_mac:
+        case P_rmwadd:
+        case P_noisegen:
+        case P_conv:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    switch(icode)
+    {
+    case P_add:
+    case P_sub:
+    case P_mul:
+    case P_div:
+    case P_neg:
+    case P_literal:
+    case P_mullit:
+    case P_addlit:
+    case P_sin:
+    case P_cos:
+    case P_sin1:
+    case P_cos1:
+    case P_mod1:
+    case P_abs:
+    case P_round:
+    case P_sqrt:
+    case P_tan:
+    case P_tanh:
+    case P_pow:
+    case P_limit:
+    case P_atan2:
+    case P_sign:
+    case P_trunc:
+    case P_ceil:
+    case P_floor:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool VM::isRegisterInstruction(uint16_t opcode)
+{
+    switch(opcode)
+    {
+    case P_add:
+    case P_sub:
+    case P_mul:
+    case P_div:
+    case P_neg:
+    case P_mov:
+    case P_sin:
+    case P_cos:
+    case P_sin1:
+    case P_cos1:
+    case P_mod1:
+    case P_abs:
+    case P_round:
+    case P_sqrt:
+    case P_tan:
+    case P_tanh:
+    case P_pow:
+    case P_limit:
+    case P_atan2:
+    case P_sign:
+    case P_noise:
+    case P_trunc:
+    case P_ceil:
+    case P_floor:
+    case P_gaussnoise:
+    case P_pinknoise:
+    case P_firfilter:
+    case P_biquadfilter:
+    case P_convolve:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool VM::getStackDepth(const program_t &program, uint32_t &maxDepth)
+{
+    const size_t N = program.size();
+    size_t pc = 0;
+    int32_t depth = 0;
+    maxDepth = 0;
+    while(pc < N)
+    {
+        uint32_t icode = program[pc].icode;
+        if (!isStackInstruction(icode))
+            return false;
+        int32_t effect = getStackEffect(icode);
+
+        // number of values the instruction takes from the stack
+        int32_t inputs = (effect > 0) ? 0 : 1-effect;
+        switch(icode & 0xff000000)
+        {
+        case P_writevar:
+            inputs = 1;
+            break;
+        case P_rmwadd:
+            inputs = 0;
+            break;
+        default:
+            break;
+        }
+
+        if (depth < inputs)
+            return false;
+
+        pc += getInstructionLength(icode);
+        if (pc > N)
+            return false;
+
+        depth += effect;
+        maxDepth = std::max(maxDepth, static_cast<uint32_t>(depth));
+    }
+    return (depth == 0);
+}
+
+uint32_t VM::getInstructionLength(uint32_t icode)
+{
+    switch(icode)
+    {
+    case P_literal:
+    case P_mullit:
+    case P_addlit:
+        return 2;
+    default:
+        break;
+    }
+
+    switch(icode & 0xff000000)
+    {
+    case P_addvv:
+    case P_mulvv:
+    case P_mac:
+    case P_rmwadd:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+bool VM::getMemoryLength(const program_t &program, const filters_t &filters, uint32_t &samples)
+{
+    // the memory of a value is the number of past samples
+    // of the input it depends on. -1 marks a variable that is
+    // not assigned (yet): one that the program never assigns
+    // only holds an input, a slider or a value of the control
+    // program, which have no memory.
+    uint32_t nvars = 0;
+    uint32_t writes = 0;
+    for(size_t pc=0; pc<program.size(); pc+=getInstructionLength(program[pc].icode))
+    {
+        const uint32_t icode = program[pc].icode;
+        if ((icode & 0x80000000) != 0)
+        {
+            nvars = std::max(nvars, (icode & 0xFFFF) + 1);
+        }
+        switch(icode & 0xff000000)
+        {
+        case P_addvv:
+        case P_mulvv:
+        case P_mac:
+            if (pc+1 < program.size())
+                nvars = std::max(nvars, program[pc+1].icode + 1);
+            break;
+        case P_writevar:
+        case P_rmwadd:
+            writes++;
+            break;
+        case P_biquad:
+        case P_noisegen:
+            return false;
+        default:
+            break;
+        }
+    }
+
+    // a value read before its assignment is one sample older
+    // than the value assigned in the previous sample. the
+    // memory of the previous sample grows with every pass
+    // until it settles, unless a variable feeds back on
+    // itself, and each pass settles at least one assignment.
+    std::vector<int64_t> previous(nvars, -1);
+    std::vector<int64_t> current(nvars);
+    std::vector<int64_t> stack;
+    for(uint32_t pass=0; pass<=writes+1; pass++)
+    {
+        int64_t longest = 0;
+        std::fill(current.begin(), current.end(), -1);
+        stack.clear();
+        size_t pc = 0;
+        while(pc < program.size())
+        {
+            const uint32_t icode = program[pc].icode;
+            const uint32_t operand = (pc+1 < program.size()) ? program[pc+1].icode : 0;
+            pc += getInstructionLength(icode);
+
+            const uint32_t n = icode & 0xFFFF;
+            const uint32_t opcode = ((icode & 0x80000000) != 0) ? (icode & 0xff000000) : 0;
+
+            // the variables the instruction reads
+            uint32_t vars[2] = {0xFFFFFFFF, 0xFFFFFFFF};
+            switch(opcode)
+            {
+            case P_addvv:
+            case P_mulvv:
+            case P_mac:
+                vars[1] = operand;
+                // fall through
+            case P_readvar:
+            case P_rmwadd:
+                vars[0] = n;
+                break;
+            default:
+                break;
+            }
+            int64_t reads[2] = {0, 0};
+            for(uint32_t k=0; k<2; k++)
+            {
+                const uint32_t v = vars[k];
+                if (v < nvars)
+                    reads[k] = (current[v] >= 0) ? current[v] : ((previous[v] >= 0) ? previous[v]+1 : 0);
+            }
+
+            int64_t memory = 0;
+            switch(opcode)
+            {
+            case P_readvar:
+                stack.push_back(reads[0]);
+                break;
+            case P_writevar:
+                if (stack.empty())
+                    return false;
+                current[n] = stack.back();
+                stack.pop_back();
+                break;
+            case P_rmwadd:
+                current[n] = reads[0];
+                break;
+            case P_addvv:
+            case P_mulvv:
+                stack.push_back(std::max(reads[0], reads[1]));
+                break;
+            case P_mac:
+                if (stack.empty())
+                    return false;
+                stack.back() = std::max(stack.back(), std::max(reads[0], reads[1]));
+                break;
+            case P_fir:
+                if (stack.empty() || (n >= filters.fir.size()))
+                    return false;
+                stack.back() += std::max<int64_t>(static_cast<int64_t>(filters.fir[n].size()) - 1, 0);
+                break;
+            case P_conv:
+                // the blocks of the convolver reach back
+                // two blocks beyond the impulse response
+                if (stack.empty() || (n >= filters.conv.size()))
+                    return false;
+                stack.back() += filters.conv[n].size() + 2*CONV_MAXBLOCK;
+                break;
+            default:
+                {
+                    // the other instructions combine the values they pop
+                    const int32_t effect = getStackEffect(icode);
+                    const int32_t pops = (icode == P_literal) ? 0 : 1-effect;
+                    if ((pops < 0) || (static_cast<size_t>(pops) > stack.size()))
+                        return false;
+                    for(int32_t k=0; k<pops; k++)
+                    {
+                        memory = std::max(memory, stack.back());
+                        stack.pop_back();
+                    }
+                    stack.push_back(memory);
+                }
+                break;
+            }
+            if (!stack.empty())
+            {
+                longest = std::max(longest, stack.back());
+            }
+            for(uint32_t k=0; k<2; k++)
+            {
+                longest = std::max(longest, reads[k]);
+            }
+        }
+
+        bool settled = true;
+        for(uint32_t v=0; v<nvars; v++)
+        {
+            if ((current[v] >= 0) && (current[v] != previous[v]))
+            {
+                previous[v] = current[v];
+                settled = false;
+            }
+        }
+        if (settled)
+        {
+            if (longest > 0x7FFFFFFF)
+                return false;
+            samples = static_cast<uint32_t>(longest);
+            return true;
+        }
+    }
+    return false;
+}
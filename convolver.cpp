@@ -0,0 +1,230 @@
+/*
+
+  Description:  Uniformly partitioned overlap-save
+                convolution for long impulse responses.
+
+  License: GPLv2
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "convolver.h"
+
+Convolver::Convolver()
+    : m_length(0),
+      m_blockSize(0),
+      m_bins(0),
+      m_partitions(0),
+      m_spectraRe(NULL),
+      m_spectraIm(NULL),
+      m_delayRe(NULL),
+      m_delayIm(NULL),
+      m_delayPos(0),
+      m_window(NULL),
+      m_tail(NULL),
+      m_fill(0),
+      m_accRe(NULL),
+      m_accIm(NULL),
+      m_nextPartition(1),
+      m_spectrum(NULL),
+      m_time(NULL),
+      m_forward(NULL),
+      m_inverse(NULL),
+      m_vmath(NULL)
+{
+}
+
+uint32_t Convolver::chooseBlockSize(uint32_t length)
+{
+    // the partitions in the frequency domain cost about
+    // length/B operations per sample, the first one B.
+    uint32_t B = CONV_MINBLOCK;
+    while((B < CONV_MAXBLOCK) && (B*B < length))
+    {
+        B *= 2;
+    }
+    return B;
+}
+
+size_t Convolver::getFFTSize(uint32_t size)
+{
+    // kiss_fftr_alloc only reports the size
+    // when the memory it is given is too small
+    size_t bytes = 0;
+    kiss_fftr_alloc(size, 0, NULL, &bytes);
+    return bytes;
+}
+
+size_t Convolver::getStateSize(uint32_t length)
+{
+    const uint32_t B = chooseBlockSize(length);
+    size_t bytes = FIRFilter::getStateSize(std::min(length, B));
+    const uint32_t partitions = (length > B) ? (length - B + B - 1) / B : 0;
+    if (partitions > 0)
+    {
+        bytes += 4*StateArena::getSize<float>(partitions*(B+1));
+        bytes += StateArena::getSize<float>(2*B) + StateArena::getSize<float>(B);
+        bytes += 2*StateArena::getSize<float>(B+1);
+        bytes += StateArena::getSize<kiss_fft_cpx>(B+1) + StateArena::getSize<float>(2*B);
+        bytes += 2*StateArena::align(getFFTSize(2*B));
+    }
+    return bytes;
+}
+
+void Convolver::init(const std::vector<float> &response, StateArena &arena)
+{
+    const uint32_t length = response.size();
+    m_length = length;
+    m_blockSize = chooseBlockSize(length);
+    const uint32_t B = m_blockSize;
+
+    const uint32_t headLength = std::min(length, B);
+    m_head.init(std::vector<float>(response.begin(), response.begin() + headLength), arena);
+
+    m_partitions = (length > B) ? (length - B + B - 1) / B : 0;
+    m_bins = B + 1;
+    m_vmath = &VectorMath::getKernels(FastMath::PRECISION_EXACT);
+    if (m_partitions == 0)
+    {
+        reset();
+        return;
+    }
+
+    const uint32_t entries = m_partitions*m_bins;
+    m_spectraRe = arena.take<float>(entries);
+    m_spectraIm = arena.take<float>(entries);
+    m_delayRe   = arena.take<float>(entries);
+    m_delayIm   = arena.take<float>(entries);
+    m_window    = arena.take<float>(2*B);
+    m_tail      = arena.take<float>(B);
+    m_accRe     = arena.take<float>(m_bins);
+    m_accIm     = arena.take<float>(m_bins);
+    m_spectrum  = arena.take<kiss_fft_cpx>(m_bins);
+    m_time      = arena.take<float>(2*B);
+
+    size_t bytes = getFFTSize(2*B);
+    m_forward = kiss_fftr_alloc(2*B, 0, arena.take<uint8_t>(bytes), &bytes);
+    m_inverse = kiss_fftr_alloc(2*B, 1, arena.take<uint8_t>(bytes), &bytes);
+
+    // kiss_fftri does not divide by the size of the FFT
+    const float scale = 1.0f / static_cast<float>(2*B);
+    for(uint32_t p=0; p<m_partitions; p++)
+    {
+        // partition p holds the samples from (p+1)*B onwards,
+        // followed by B zeros
+        std::fill(m_time, m_time + 2*B, 0.0f);
+        const uint32_t first = (p+1)*B;
+        const uint32_t count = std::min(B, length - first);
+        std::copy(response.begin() + first, response.begin() + first + count, m_time);
+
+        kiss_fftr(m_forward, m_time, m_spectrum);
+        for(uint32_t k=0; k<m_bins; k++)
+        {
+            m_spectraRe[p*m_bins + k] = m_spectrum[k].r * scale;
+            m_spectraIm[p*m_bins + k] = m_spectrum[k].i * scale;
+        }
+    }
+    reset();
+}
+
+void Convolver::reset()
+{
+    m_head.reset();
+    m_delayPos = 0;
+    m_fill = 0;
+    m_nextPartition = 1;
+    if (m_partitions == 0)
+    {
+        return;
+    }
+
+    const uint32_t B = m_blockSize;
+    std::fill(m_delayRe, m_delayRe + m_partitions*m_bins, 0.0f);
+    std::fill(m_delayIm, m_delayIm + m_partitions*m_bins, 0.0f);
+    std::fill(m_window, m_window + 2*B, 0.0f);
+    std::fill(m_tail, m_tail + B, 0.0f);
+    std::fill(m_accRe, m_accRe + m_bins, 0.0f);
+    std::fill(m_accIm, m_accIm + m_bins, 0.0f);
+}
+
+void Convolver::accumulatePartitions(uint32_t last)
+{
+    // the next block gets partition p of the block that was
+    // completed p blocks before the current one, which is
+    // p-1 entries before the most recent
+    for(uint32_t p=m_nextPartition; p<last; p++)
+    {
+        uint32_t entry = (m_delayPos + m_partitions + 1 - p) % m_partitions;
+        m_vmath->cmac(m_accRe, m_accIm,
+                      &m_delayRe[entry*m_bins], &m_delayIm[entry*m_bins],
+                      &m_spectraRe[p*m_bins], &m_spectraIm[p*m_bins], m_bins);
+    }
+    m_nextPartition = last;
+}
+
+void Convolver::processBlock()
+{
+    const uint32_t B = m_blockSize;
+
+    // spectrum of the last 2B samples, stored as
+    // the most recent entry of the delay line
+    kiss_fftr(m_forward, m_window, m_spectrum);
+    m_delayPos = (m_delayPos + 1) % m_partitions;
+    float *re = &m_delayRe[m_delayPos*m_bins];
+    float *im = &m_delayIm[m_delayPos*m_bins];
+    for(uint32_t k=0; k<m_bins; k++)
+    {
+        re[k] = m_spectrum[k].r;
+        im[k] = m_spectrum[k].i;
+    }
+    memcpy(&m_window[0], &m_window[B], B*sizeof(float));
+
+    // the older partitions have been added while the block
+    // came in, see accumulate(). the first one takes the
+    // block that has just been completed.
+    m_vmath->cmac(m_accRe, m_accIm, re, im, m_spectraRe, m_spectraIm, m_bins);
+
+    // the second half of the circular convolution
+    // is the linear one
+    for(uint32_t k=0; k<m_bins; k++)
+    {
+        m_spectrum[k].r = m_accRe[k];
+        m_spectrum[k].i = m_accIm[k];
+    }
+    kiss_fftri(m_inverse, m_spectrum, m_time);
+    memcpy(&m_tail[0], &m_time[B], B*sizeof(float));
+    m_fill = 0;
+
+    std::fill(m_accRe, m_accRe + m_bins, 0.0f);
+    std::fill(m_accIm, m_accIm + m_bins, 0.0f);
+    m_nextPartition = 1;
+}
+
+void Convolver::process(const float *in, float *out, uint32_t n)
+{
+    if (m_partitions == 0)
+    {
+        m_head.process(in, out, n);
+        return;
+    }
+
+    // up to the end of the current block at a time
+    while(n > 0)
+    {
+        const uint32_t count = std::min(n, m_blockSize - m_fill);
+        memcpy(&m_window[m_blockSize + m_fill], in, count*sizeof(float));
+        m_head.process(in, out, count);
+        m_vmath->add(out, out, &m_tail[m_fill], count);
+        m_fill += count;
+        accumulate(m_fill);
+        in += count;
+        out += count;
+        n -= count;
+        if (m_fill == m_blockSize)
+        {
+            processBlock();
+        }
+    }
+}
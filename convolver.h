@@ -0,0 +1,169 @@
+/*
+
+  Description:  Uniformly partitioned overlap-save
+                convolution for long impulse responses.
+
+  License: GPLv2
+
+*/
+
+#ifndef convolver_h
+#define convolver_h
+
+#include <stdint.h>
+#include <vector>
+#include "kiss_fftr.h"
+#include "firfilter.h"
+#include "vectormath.h"
+#include "statearena.h"
+
+// maximum length of an impulse response
+#define CONV_MAXLENGTH 4194304
+
+// smallest and largest partition of the impulse response
+#define CONV_MINBLOCK 64
+#define CONV_MAXBLOCK 1024
+
+/** A convolver filters a signal with an impulse response
+    that is too long for a FIR filter.
+
+    The impulse response is split into partitions of B samples.
+    The first partition is a FIRFilter, so there is no latency.
+    The other partitions are applied in the frequency domain:
+    every B samples the last 2B input samples are transformed
+    with an FFT of size 2B, and the spectra of the last blocks
+    are multiplied with those of the partitions. The inverse
+    FFT of the sum gives the contribution of all partitions
+    but the first to the next B output samples (overlap-save).
+
+    Only the first of the partitions in the frequency domain
+    needs the block that has just been completed. The products
+    of the others use older blocks, so they are added up while
+    the samples of the current block come in, a few partitions
+    every sample, and the cost is spread evenly over the block.
+    What remains at the end of a block is the FFT, one product
+    and the inverse FFT of size 2B, which the callback that
+    completes a block carries in addition to its share of the
+    rest: some 30 microseconds for B = 1024 on a desktop CPU.
+    There, a callback of 256 frames takes about 0.2 ms for a
+    response of 1000000 samples and 2 ms for one of 4194304,
+    no matter whether it completes a block or not.
+
+    B grows with the square root of the length, which balances
+    the cost of the FIR filter against that of the spectra.
+    The work per block is constant, and all memory, the FFT
+    configurations included, is taken from a StateArena by
+    init(), so process() can be called from the audio thread.
+    The result does not depend on whether samples are processed
+    one by one or in blocks.
+*/
+class Convolver
+{
+public:
+    Convolver();
+
+    /** returns the number of bytes of the arena that
+        an impulse response of 'length' samples takes */
+    static size_t getStateSize(uint32_t length);
+
+    /** set the impulse response and clear the state,
+        which is taken from 'arena' */
+    void init(const std::vector<float> &response, StateArena &arena);
+
+    /** clear the state */
+    void reset();
+
+    /** returns the length of the impulse response */
+    uint32_t getLength() const
+    {
+        return m_length;
+    }
+
+    /** returns the size of the partitions */
+    uint32_t getBlockSize() const
+    {
+        return m_blockSize;
+    }
+
+    /** returns the number of partitions, the first one included */
+    uint32_t getPartitions() const
+    {
+        return m_partitions + 1;
+    }
+
+    /** filter one sample */
+    inline float process(float x)
+    {
+        if (m_partitions == 0)
+        {
+            return m_head.process(x);
+        }
+
+        const float y = m_head.process(x) + m_tail[m_fill];
+        m_window[m_blockSize + m_fill] = x;
+        accumulate(++m_fill);
+        if (m_fill == m_blockSize)
+        {
+            processBlock();
+        }
+        return y;
+    }
+
+    /** filter n samples. 'in' and 'out' may be the same array. */
+    void process(const float *in, float *out, uint32_t n);
+
+protected:
+    /** returns B for an impulse response of 'length' samples */
+    static uint32_t chooseBlockSize(uint32_t length);
+
+    /** returns the number of bytes of a real FFT configuration */
+    static size_t getFFTSize(uint32_t size);
+
+    /** add the products of the partitions that are due after
+        'fill' samples of the current block to m_accRe and m_accIm.
+        partitions 1..m_partitions-1 are spread evenly over the
+        block, and are all done when the block is complete. */
+    inline void accumulate(uint32_t fill)
+    {
+        const uint32_t due = 1 + ((m_partitions-1)*fill) / m_blockSize;
+        if (m_nextPartition < due)
+        {
+            accumulatePartitions(due);
+        }
+    }
+
+    /** add the products of the partitions m_nextPartition..last-1 */
+    void accumulatePartitions(uint32_t last);
+
+    /** transform the last block of input, add the product of
+        the first partition and compute the contribution of all
+        partitions to the next block */
+    void processBlock();
+
+    uint32_t            m_length;       // of the impulse response
+    FIRFilter           m_head;         // first partition
+    uint32_t            m_blockSize;    // B
+    uint32_t            m_bins;         // B+1 bins of a spectrum
+    uint32_t            m_partitions;   // partitions in the frequency domain
+
+    float               *m_spectraRe;   // spectra of the partitions, scaled
+    float               *m_spectraIm;   // for the inverse FFT
+    float               *m_delayRe;     // spectra of the last input blocks,
+    float               *m_delayIm;     // a ring of m_partitions entries
+    uint32_t            m_delayPos;     // entry of the most recent block
+
+    float               *m_window;      // the last 2B input samples
+    float               *m_tail;        // contribution to the current block
+    uint32_t            m_fill;         // samples of the current block
+    float               *m_accRe;       // sum of the products of the spectra
+    float               *m_accIm;       // for the next block
+    uint32_t            m_nextPartition;// next partition to add to the sum
+    kiss_fft_cpx        *m_spectrum;    // input and output of the FFTs
+    float               *m_time;        // output of the inverse FFT
+
+    kiss_fftr_cfg       m_forward;
+    kiss_fftr_cfg       m_inverse;
+    const VectorMath::kernels_t *m_vmath;
+};
+
+#endif
@@ -0,0 +1,22 @@
+%
+% A fixed and a tunable biquad filter.
+% The left input is filtered by a fixed
+% lowpass filter, the right input by a
+% lowpass filter whose cutoff frequency
+% is set using slider 1.
+%
+% The coefficients of the tunable filter
+% are computed from the slider, so they
+% are passed to biquad() on every sample.
+
+% fixed lowpass filter
+outl = biquad(inl, 0.2, 0.4, 0.2, 1, -0.5, 0.3);
+
+% tunable second-order Butterworth lowpass,
+% k = tan(pi*cutoff/samplerate)
+k = tan(0.05 + 0.3*slider1);
+n = 1/(1 + 1.414*k + k*k);
+b0 = k*k*n;
+a1 = 2*(k*k-1)*n;
+a2 = (1 - 1.414*k + k*k)*n;
+outr = biquad(inr, b0, 2*b0, b0, 1, a1, a2);
@@ -0,0 +1,13 @@
+%
+% A hard clipper with infinite gain.
+% The gain 1/0 is folded into an infinite
+% constant when the script is compiled,
+% and limit() clips the amplified input
+% to -1 or 1. The small offset keeps
+% silence from becoming 0*inf, which is
+% not a number.
+%
+
+gain = 1/0;
+outl = limit((inl + 0.000001)*gain);
+outr = limit((inr + 0.000001)*(1/0));
@@ -0,0 +1,257 @@
+/*
+
+  Description:  Implementations of the transcendental
+                functions of the virtual machine in
+                three precision tiers.
+
+  License: GPLv2
+
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "fastmath.h"
+#include "fastmathdefs.h"
+
+/** evaluate a polynomial of N coefficients with Horner's
+    rule. the recursion unrolls the loop at compile time. */
+template<uint32_t N, class T> struct Polynomial
+{
+    static inline T eval(const T *c, T x)
+    {
+        return c[0] + x*Polynomial<N-1, T>::eval(c+1, x);
+    }
+};
+
+template<class T> struct Polynomial<1, T>
+{
+    static inline T eval(const T *c, T)
+    {
+        return c[0];
+    }
+};
+
+/** returns 2^n as a double, for -1022 <= n <= 1023 */
+static inline double exp2int(int32_t n)
+{
+    uint64_t bits = static_cast<uint64_t>(n + 1023) << 52;
+    double result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// **************************************************
+//   exact tier: the expressions of earlier versions
+// **************************************************
+
+static float exactSin(float x)              { return sin(x); }
+static float exactCos(float x)              { return cos(x); }
+static float exactSin1(float x)             { return sin(2.0f*M_PI*x); }
+static float exactCos1(float x)             { return cos(2.0f*M_PI*x); }
+static float exactTanh(float x)             { return tanh(x); }
+static float exactPow(float x, float y)     { return pow(x,y); }
+static float exactAtan2(float y, float x)   { return atan2(y,x); }
+
+// **************************************************
+//   fast and ultra-fast tiers
+// **************************************************
+
+/** sin(2*pi*r) for r in [-1/2, 1/2] */
+template<uint32_t N> static inline float sinTurns(const float *c, float r)
+{
+    // fold into [-1/4, 1/4] with sin(pi-a) = sin(a). the
+    // selects compile to min/max instead of branches, which
+    // would be mispredicted for half of the arguments.
+    float a = fabsf(r);
+    float b = 0.5f - a;
+    r = copysignf((a < b) ? a : b, r);
+    return r*Polynomial<N, float>::eval(c, r*r);
+}
+
+static float fastSin1(float x)
+{
+    if (!(fabsf(x) < FM_SIN1_MAXARG))
+        return exactSin1(x);
+    float r = x - ((x + FM_ROUND_FLOAT) - FM_ROUND_FLOAT);
+    return sinTurns<FM_LENGTH(c_sin1Fast)>(c_sin1Fast, r);
+}
+
+static float fastCos1(float x)
+{
+    if (!(fabsf(x) < FM_SIN1_MAXARG))
+        return exactCos1(x);
+    float r = x - ((x + FM_ROUND_FLOAT) - FM_ROUND_FLOAT) + 0.25f;
+    r -= (r > 0.5f) ? 1.0f : 0.0f;
+    return sinTurns<FM_LENGTH(c_sin1Fast)>(c_sin1Fast, r);
+}
+
+static float fastSin(float x)
+{
+    // the reduction is done in double precision
+    // so large arguments keep their accuracy.
+    if (!(fabsf(x) < FM_SIN_MAXARG))
+        return exactSin(x);
+    double t = x*FM_INV_2PI;
+    float r = static_cast<float>(t - ((t + FM_ROUND_DOUBLE) - FM_ROUND_DOUBLE));
+    return sinTurns<FM_LENGTH(c_sin1Fast)>(c_sin1Fast, r);
+}
+
+static float fastCos(float x)
+{
+    if (!(fabsf(x) < FM_SIN_MAXARG))
+        return exactCos(x);
+    double t = x*FM_INV_2PI + 0.25;
+    float r = static_cast<float>(t - ((t + FM_ROUND_DOUBLE) - FM_ROUND_DOUBLE));
+    return sinTurns<FM_LENGTH(c_sin1Fast)>(c_sin1Fast, r);
+}
+
+static float fastTanh(float x)
+{
+    float a = fabsf(x);
+    if (a < FM_TANH_POLYARG)
+    {
+        return x*Polynomial<FM_LENGTH(c_tanhFast), float>::eval(c_tanhFast, x*x);
+    }
+    if (!(a < FM_TANH_MAXARG))
+    {
+        // tanh rounds to 1, NaN stays NaN
+        return (a == a) ? copysignf(1.0f, x) : x;
+    }
+
+    // tanh(a) = 1 - 2/(exp(2a) + 1)
+    float z = 2.0f*static_cast<float>(FM_LOG2E)*a;
+    float n = (z + FM_ROUND_FLOAT) - FM_ROUND_FLOAT;
+    float e = Polynomial<FM_LENGTH(c_exp2Tanh), float>::eval(c_exp2Tanh, z - n);
+    e *= static_cast<float>(exp2int(static_cast<int32_t>(n)));
+    return copysignf(1.0f - 2.0f/(e + 1.0f), x);
+}
+
+/** returns (cond ? offset - v : v) without a branch, which
+    would be mispredicted for arbitrary arguments. */
+static inline float reflect(bool cond, float v, float offset)
+{
+    uint32_t mask = 0u - static_cast<uint32_t>(cond);
+    uint32_t vbits, obits;
+    memcpy(&vbits, &v, sizeof(vbits));
+    memcpy(&obits, &offset, sizeof(obits));
+    vbits ^= mask & 0x80000000u;
+    obits &= mask;
+    memcpy(&v, &vbits, sizeof(v));
+    memcpy(&offset, &obits, sizeof(offset));
+    return offset + v;
+}
+
+/** atan2(y, x) for finite arguments that are not both zero */
+template<uint32_t N> static inline float atan2Poly(const float *c, float y, float x)
+{
+    float ax = fabsf(x);
+    float ay = fabsf(y);
+    float a = std::min(ax, ay)/std::max(ax, ay);
+    float r = a*Polynomial<N, float>::eval(c, a*a);
+    r = reflect(ay > ax, r, static_cast<float>(FM_PI/2.0));
+    r = reflect(x < 0.0f, r, static_cast<float>(FM_PI));
+    return copysignf(r, y);
+}
+
+static float fastAtan2(float y, float x)
+{
+    if (!((fabsf(x) <= FM_FLT_MAX) && (fabsf(y) <= FM_FLT_MAX)) ||
+        ((x == 0.0f) && (y == 0.0f)))
+        return exactAtan2(y,x);
+    return atan2Poly<FM_LENGTH(c_atanFast)>(c_atanFast, y, x);
+}
+
+static float ultraSin1(float x)
+{
+    if (!(fabsf(x) < FM_SIN1_MAXARG))
+        return exactSin1(x);
+    float r = x - ((x + FM_ROUND_FLOAT) - FM_ROUND_FLOAT);
+    return sinTurns<FM_LENGTH(c_sin1Ultra)>(c_sin1Ultra, r);
+}
+
+static float ultraCos1(float x)
+{
+    if (!(fabsf(x) < FM_SIN1_MAXARG))
+        return exactCos1(x);
+    float r = x - ((x + FM_ROUND_FLOAT) - FM_ROUND_FLOAT) + 0.25f;
+    r -= (r > 0.5f) ? 1.0f : 0.0f;
+    return sinTurns<FM_LENGTH(c_sin1Ultra)>(c_sin1Ultra, r);
+}
+
+static float ultraSin(float x)
+{
+    if (!(fabsf(x) < FM_ULTRA_MAXARG))
+        return exactSin(x);
+    return ultraSin1(x*static_cast<float>(FM_INV_2PI));
+}
+
+static float ultraCos(float x)
+{
+    if (!(fabsf(x) < FM_ULTRA_MAXARG))
+        return exactCos(x);
+    return ultraCos1(x*static_cast<float>(FM_INV_2PI));
+}
+
+static float ultraTanh(float x)
+{
+    // Pade approximant [7/6]
+    if (!(fabsf(x) < FM_PADE_MAXARG))
+        return (x == x) ? copysignf(1.0f, x) : x;
+    float x2 = x*x;
+    float num = x*(135135.0f + x2*(17325.0f + x2*(378.0f + x2)));
+    float den = 135135.0f + x2*(62370.0f + x2*(3150.0f + x2*28.0f));
+    return num/den;
+}
+
+static float ultraAtan2(float y, float x)
+{
+    if (!((fabsf(x) <= FM_FLT_MAX) && (fabsf(y) <= FM_FLT_MAX)) ||
+        ((x == 0.0f) && (y == 0.0f)))
+        return exactAtan2(y,x);
+    return atan2Poly<FM_LENGTH(c_atanUltra)>(c_atanUltra, y, x);
+}
+
+// **************************************************
+//   kernel tables
+// **************************************************
+
+// pow() uses the C library in every tier: the polynomial
+// and table-driven kernels that were tried were slower
+// than the single-precision pow of current C libraries.
+
+static const FastMath::kernels_t g_exact =
+    {exactSin, exactCos, exactSin1, exactCos1, exactTanh, exactPow, exactAtan2};
+
+static const FastMath::kernels_t g_fast =
+    {fastSin, fastCos, fastSin1, fastCos1, fastTanh, exactPow, fastAtan2};
+
+static const FastMath::kernels_t g_ultraFast =
+    {ultraSin, ultraCos, ultraSin1, ultraCos1, ultraTanh, exactPow, ultraAtan2};
+
+const FastMath::kernels_t& FastMath::getKernels(precision_t precision)
+{
+    switch(precision)
+    {
+    case PRECISION_FAST:
+        return g_fast;
+    case PRECISION_ULTRAFAST:
+        return g_ultraFast;
+    default:
+        return g_exact;
+    }
+}
+
+const char* FastMath::getPrecisionName(precision_t precision)
+{
+    switch(precision)
+    {
+    case PRECISION_FAST:
+        return "fast";
+    case PRECISION_ULTRAFAST:
+        return "ultra-fast";
+    default:
+        return "exact";
+    }
+}
@@ -0,0 +1,73 @@
+/*
+
+  Description:  Implementations of the transcendental
+                functions of the virtual machine in
+                three precision tiers.
+
+  License: GPLv2
+
+*/
+
+#ifndef fastmath_h
+#define fastmath_h
+
+/** The virtual machine calls its transcendental functions
+    through a table of kernels, which is selected once when
+    a program is loaded so the interpreters do not test the
+    precision for every instruction.
+
+      exact      - the C library, as in earlier versions.
+      fast       - polynomial kernels with an error close to
+                   single-precision rounding.
+      ultra-fast - low-order polynomial kernels, for programs
+                   that only need about four significant digits.
+
+    Generated by benchmark/mathbench: maximum absolute error
+    (relative error for pow) against the double-precision C
+    library, and the time per call through a kernel pointer
+    on an x86-64 server with glibc.
+
+                                  exact           fast            ultra-fast
+      function  range             error    ns     error    ns     error    ns
+      sin       [-100,100]        3.3e-08  7.2    2.0e-07  5.3    7.4e-05  3.9
+      cos       [-100,100]        3.3e-08  7.4    2.0e-07  5.9    7.4e-05  5.7
+      sin1      [-100,100]        3.0e-08  14.7   1.9e-07  4.0    6.8e-05  3.5
+      cos1      [-100,100]        3.0e-08  16.9   1.9e-07  4.8    6.8e-05  4.7
+      tanh      [-10,10]          1.0e-07  17.6   1.2e-07  4.6    9.6e-05  3.9
+      pow       [0.01,10]x[-8,8]  6.0e-08  6.0    6.0e-08  6.5    6.0e-08  6.3
+      atan2     [-10,10]^2        2.5e-07  27.2   3.1e-07  8.9    8.2e-05  7.8
+
+    pow uses the C library in every tier, as the kernels that
+    were tried were slower than its single-precision pow. The
+    fast and ultra-fast kernels fall back to the C library for
+    infinities, NaNs and arguments beyond the range of their
+    argument reduction. Constant expressions are folded by the
+    AST optimizer with the exact functions.
+*/
+namespace FastMath
+{
+    enum precision_t {PRECISION_EXACT, PRECISION_FAST, PRECISION_ULTRAFAST};
+
+    typedef float (*unary_t)(float x);
+    typedef float (*binary_t)(float a, float b);
+
+    /** the transcendental functions of one precision tier */
+    struct kernels_t
+    {
+        unary_t  sin;
+        unary_t  cos;
+        unary_t  sin1;      // sin(2*pi*x)
+        unary_t  cos1;      // cos(2*pi*x)
+        unary_t  tanh;
+        binary_t pow;       // pow(x, y)
+        binary_t atan2;     // atan2(y, x)
+    };
+
+    /** returns the kernels of a precision tier */
+    const kernels_t& getKernels(precision_t precision);
+
+    /** returns the name of a precision tier */
+    const char* getPrecisionName(precision_t precision);
+}
+
+#endif
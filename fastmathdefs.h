@@ -0,0 +1,72 @@
+/*
+
+  Description:  Constants and polynomial coefficients
+                shared by the scalar and the vector
+                implementations of the fast math kernels.
+
+  License: GPLv2
+
+*/
+
+#ifndef fastmathdefs_h
+#define fastmathdefs_h
+
+/* The vector kernels in vectormath_simd.h repeat the
+   operations of the scalar kernels in fastmath.cpp in the
+   same order, so both give bit-identical results. Any
+   change to a kernel must be made in both places.
+*/
+
+// adding and subtracting these constants rounds a value
+// to the nearest integer, for |x| < 2^22 (float) and
+// |x| < 2^51 (double), in the default rounding mode.
+#define FM_ROUND_FLOAT  12582912.0f
+#define FM_ROUND_DOUBLE 6755399441055744.0
+
+#define FM_INV_2PI      0.15915494309189535
+#define FM_LOG2E        1.4426950408889634
+#define FM_PI           3.14159265358979323846
+
+/* Polynomial coefficients, fitted with the minimax
+   (Lawson) algorithm on the intervals given.
+*/
+
+// sin(2*pi*r) = r*P(r^2), r in [-1/4, 1/4]
+static const float c_sin1Fast[]  = {6.283185160f, -41.34165503f, 81.60100408f, -76.54978238f, 39.53670668f};
+static const float c_sin1Ultra[] = {6.281280080f, -41.09524287f, 73.58551684f};
+
+// atan(a) = a*P(a^2), a in [0, 1]
+static const float c_atanFast[]  = {0.9999993356f, -0.3332986079f, 0.1994656569f, -0.1390862970f,
+                                    0.09642197630f, -0.05591233020f, 0.02186295989f, -0.004054567694f};
+static const float c_atanUltra[] = {0.9992138129f, -0.3211749695f, 0.1462644618f, -0.03898651241f};
+
+// tanh(x) = x*P(x^2), x in [-0.625, 0.625]
+static const float c_tanhFast[]  = {0.9999998993f, -0.3333200420f, 0.1330516196f, -0.05184783386f, 0.01508411218f};
+
+// 2^f = P(f), f in [-1/2, 1/2]
+static const float c_exp2Tanh[]  = {1.000000072f, 0.6931469671f, 0.2402211972f, 0.05550713274f,
+                                    0.009675541333f, 0.001327647178f};
+
+#define FM_LENGTH(a) (sizeof(a)/sizeof(a[0]))
+
+// the float argument reduction of sin1 and cos1 needs |x| < 2^22
+#define FM_SIN1_MAXARG  4194304.0f
+
+// the double argument reduction of sin and cos
+#define FM_SIN_MAXARG   1.0e9f
+
+// the argument is scaled by 1/(2*pi) in single precision,
+// which loses too much of the phase beyond this limit
+#define FM_ULTRA_MAXARG 256.0f
+
+// tanh uses the polynomial below this argument and
+// rounds to +-1 from the second limit on
+#define FM_TANH_POLYARG 0.625f
+#define FM_TANH_MAXARG  9.0f
+
+// the [7/6] Pade approximant of tanh reaches 1 here
+#define FM_PADE_MAXARG  4.97f
+
+#define FM_FLT_MAX      3.40282347e+38f
+
+#endif
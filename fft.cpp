@@ -10,6 +10,7 @@
 */
 
 #include "fft.h"
+#include "vectormath.h"
 
 #define fft_size 256
 
@@ -21,8 +22,9 @@ fft::fft()
     m_data.resize(fft_size);
     m_result.resize(fft_size);
 
-    // setup hamming & hann windows
-    m_window.resize(fft_size);
+    // setup hamming & hann windows, with each weight
+    // repeated for both channels
+    m_window.resize(2*fft_size);
     setWindow(WIN_FLATTOP);
 }
 
@@ -72,10 +74,14 @@ void fft::setWindow(windowType wintype)
     //
     // fft normalization factor is sqrt(2.0f)/fft_size
     // window normalization factor is 256/sum;
+    //
+    // the weights are interleaved in place, from the end.
 
-    for(uint32_t i=0; i<fft_size; i++)
+    for(uint32_t i=fft_size; i>0; i--)
     {
-        m_window[i] *= 256.0f/(float)fft_size/sum;
+        float w = m_window[i-1] * 256.0f/(float)fft_size/sum;
+        m_window[2*i-2] = w;
+        m_window[2*i-1] = w;
     }
     m_winType = wintype;
 }
@@ -91,11 +97,9 @@ void fft::process256(const VirtualMachine::ring_buffer_data_t *inbuffer,
         throw std::runtime_error("fft::process sizes of datatypes don't match!");
     }
 
-    for(uint32_t i=0; i<fft_size; i++)
-    {
-        m_data[i].s1 = inbuffer[i].s1 * m_window[i];
-        m_data[i].s2 = inbuffer[i].s2 * m_window[i];
-    }
+    // weight both channels at once
+    VectorMath::getKernels(FastMath::PRECISION_EXACT).mul((float *)&m_data[0],
+        (const float *)inbuffer, &m_window[0], 2*fft_size);
 
     switch(m_mode)
     {
@@ -0,0 +1,80 @@
+/*
+
+  Description:  FIR filter with a linear delay line and
+                folding of symmetric coefficients.
+
+  License: GPLv2
+
+*/
+
+#include <string.h>
+#include <algorithm>
+#include "firfilter.h"
+
+FIRFilter::FIRFilter()
+    : m_taps(NULL),
+      m_delay(NULL),
+      m_delayLength(0),
+      m_pos(0),
+      m_length(0),
+      m_symmetric(false),
+      m_dot(NULL)
+{
+}
+
+size_t FIRFilter::getDelayLength(uint32_t length)
+{
+    // room for the history and the span of new samples
+    size_t history = (length > 0) ? length-1 : 0;
+    return history + std::max<size_t>(length, FIR_MINSPAN);
+}
+
+size_t FIRFilter::getStateSize(uint32_t length)
+{
+    return StateArena::getSize<float>(std::max<uint32_t>(length, 1)) +
+           StateArena::getSize<float>(getDelayLength(length));
+}
+
+void FIRFilter::init(const std::vector<float> &coefficients, StateArena &arena)
+{
+    m_length = coefficients.size();
+    m_taps = arena.take<float>(std::max<uint32_t>(m_length, 1));
+    std::copy(coefficients.rbegin(), coefficients.rend(), m_taps);
+    if (m_length == 0)
+    {
+        m_taps[0] = 0.0f;
+    }
+
+    // the taps are reversed, so a symmetric
+    // filter has the same taps either way
+    m_symmetric = (m_length > 1) && std::equal(m_taps, m_taps + m_length, coefficients.begin());
+
+    // the dot products are the same in every precision tier
+    const VectorMath::kernels_t &kernels = VectorMath::getKernels(FastMath::PRECISION_EXACT);
+    m_dot = m_symmetric ? kernels.dotsym : kernels.dot;
+
+    m_delayLength = getDelayLength(m_length);
+    m_delay = arena.take<float>(m_delayLength);
+    reset();
+}
+
+void FIRFilter::reset()
+{
+    std::fill(m_delay, m_delay + m_delayLength, 0.0f);
+    m_pos = (m_length > 0) ? m_length-1 : 0;
+}
+
+void FIRFilter::wrap()
+{
+    size_t history = (m_length > 0) ? m_length-1 : 0;
+    memmove(&m_delay[0], &m_delay[m_pos - history], history*sizeof(float));
+    m_pos = history;
+}
+
+void FIRFilter::process(const float *in, float *out, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++)
+    {
+        out[i] = process(in[i]);
+    }
+}
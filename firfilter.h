@@ -0,0 +1,100 @@
+/*
+
+  Description:  FIR filter with a linear delay line and
+                folding of symmetric coefficients.
+
+  License: GPLv2
+
+*/
+
+#ifndef firfilter_h
+#define firfilter_h
+
+#include <stdint.h>
+#include <vector>
+#include "vectormath.h"
+#include "statearena.h"
+
+// maximum number of coefficients of a FIR filter
+#define FIR_MAXTAPS 32768
+
+// minimum number of samples between two moves of the delay line
+#define FIR_MINSPAN 1024
+
+/** A FIR filter computes y[n] = sum of h[k]*x[n-k].
+
+    The delay line is a linear buffer, so the most recent
+    samples are always contiguous and the output is a single
+    call of a dot product kernel of VectorMath. When the buffer
+    is full, its most recent samples are moved to the start,
+    once every FIR_MINSPAN samples or more.
+
+    Linear-phase filters have symmetric coefficients,
+    h[k] = h[len-1-k]. For these the two samples that share a
+    coefficient are added first, which halves the number of
+    multiplications.
+
+    The coefficients and the delay line are taken from a
+    StateArena by init(), so process() can be called from the
+    audio thread. The result does not depend on whether samples
+    are processed one by one or in blocks.
+*/
+class FIRFilter
+{
+public:
+    FIRFilter();
+
+    /** returns the number of bytes of the arena
+        that a filter of 'length' coefficients takes */
+    static size_t getStateSize(uint32_t length);
+
+    /** set the coefficients h[0], h[1], ... and
+        clear the delay line, which is taken from 'arena' */
+    void init(const std::vector<float> &coefficients, StateArena &arena);
+
+    /** clear the delay line */
+    void reset();
+
+    /** returns the number of coefficients */
+    uint32_t getLength() const
+    {
+        return m_length;
+    }
+
+    /** returns true if the coefficients are folded */
+    bool isSymmetric() const
+    {
+        return m_symmetric;
+    }
+
+    /** filter one sample */
+    inline float process(float x)
+    {
+        if (m_pos == m_delayLength)
+        {
+            wrap();
+        }
+        m_delay[m_pos++] = x;
+        return m_dot(&m_delay[m_pos - m_length], m_taps, m_length);
+    }
+
+    /** filter n samples. 'in' and 'out' may be the same array. */
+    void process(const float *in, float *out, uint32_t n);
+
+protected:
+    /** move the most recent samples to the start of the delay line */
+    void wrap();
+
+    /** returns the number of samples of the delay line */
+    static size_t getDelayLength(uint32_t length);
+
+    float               *m_taps;    // coefficients, last one first
+    float               *m_delay;   // delay line, oldest sample first
+    size_t              m_delayLength;
+    size_t              m_pos;      // where the next sample is written
+    uint32_t            m_length;   // number of coefficients
+    bool                m_symmetric;
+    VectorMath::dot_t   m_dot;      // dot or dotsym
+};
+
+#endif
@@ -26,6 +26,11 @@ const functionInfo_t g_functionDefs[] =
     {"atan2",P_atan2,2},
     {"sign",P_sign,1},
     {"noise",P_noise,0},
+    {"gaussnoise",P_gaussnoise,0},
+    {"pinknoise",P_pinknoise,0},
+    {"fir",P_firfilter,2},
+    {"biquad",P_biquadfilter,7},
+    {"conv",P_convolve,2},
     {"trunc",P_trunc,1},
     {"ceil",P_ceil,1},
     {"floor",P_floor,1}
@@ -42,3 +47,30 @@ int32_t functionDefs::getNumberOfArguments(uint32_t functionID)
     }
     return -1;
 }
+
+bool functionDefs::isNoise(uint32_t functionID)
+{
+    return (functionID == P_noise) || (functionID == P_gaussnoise) ||
+           (functionID == P_pinknoise);
+}
+
+bool functionDefs::isFilter(uint32_t functionID)
+{
+    return (functionID == P_firfilter) || (functionID == P_biquadfilter) ||
+           (functionID == P_convolve);
+}
+
+bool functionDefs::isVariadic(uint32_t functionID)
+{
+    return (functionID == P_firfilter) || (functionID == P_biquadfilter);
+}
+
+bool functionDefs::isConvolution(uint32_t functionID)
+{
+    return (functionID == P_convolve);
+}
+
+bool functionDefs::isStateful(uint32_t functionID)
+{
+    return isNoise(functionID) || isFilter(functionID);
+}
@@ -16,15 +16,34 @@ struct functionInfo_t
 {
     std::string   name;   // function name
     uint32_t      ID;     // function ID
-    uint32_t      nargs;  // expected number of arguments
+    uint32_t      nargs;  // expected number of arguments, the minimum if variadic
 };
 
-#define  g_functionDefsLen 18
+#define  g_functionDefsLen 23
 extern const functionInfo_t g_functionDefs[];
 
 namespace functionDefs
 {
     int32_t getNumberOfArguments(uint32_t functionID);
+
+    /** returns true for the noise functions, which give
+        a new value every time they are called */
+    bool isNoise(uint32_t functionID);
+
+    /** returns true for the filter functions: fir, biquad and conv */
+    bool isFilter(uint32_t functionID);
+
+    /** returns true for functions that take any number of
+        arguments from their minimum onwards */
+    bool isVariadic(uint32_t functionID);
+
+    /** returns true for conv, whose second argument is
+        the name of a WAV file with the impulse response */
+    bool isConvolution(uint32_t functionID);
+
+    /** returns true for functions whose result depends
+        on earlier calls: the noise functions and filters */
+    bool isStateful(uint32_t functionID);
 }
 
 #endif
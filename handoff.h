@@ -0,0 +1,113 @@
+/*
+
+  Description:  Lock-free handover of objects from the GUI
+                thread to the audio thread.
+
+  License: GPLv2
+
+*/
+
+#ifndef handoff_h
+#define handoff_h
+
+#include <atomic>
+#include <stddef.h>
+
+/** A handoff passes objects, such as a newly loaded program,
+    from the GUI thread to the audio thread without locks, in
+    the manner of read-copy-update: the GUI thread builds a new
+    object and publishes it, and the audio thread swaps it for
+    its current one between two buffers. The object that the
+    audio thread no longer uses is handed back to the GUI
+    thread, which deletes it, so the audio thread neither waits
+    nor frees memory.
+
+    There is one slot for the published object and one for the
+    retired one. The audio thread only takes a new object when
+    the retired slot is empty, and retires at most one object per
+    object it takes, so the retired slot is never overwritten
+    while it holds an object. The audio thread may keep the
+    object it replaces for a while, for instance to crossfade,
+    and retire it later.
+
+    publish() and collect() must be called from one thread,
+    and take() and retire() from another.
+*/
+template<typename T> class Handoff
+{
+public:
+    Handoff()
+        : m_pending(NULL),
+          m_retired(NULL)
+    {
+    }
+
+    /** deletes the objects that are still in the slots.
+        the audio thread must have stopped. */
+    ~Handoff()
+    {
+        delete m_pending.load();
+        delete m_retired.load();
+    }
+
+    /** GUI thread: offer 'object' to the audio thread. an object
+        that was published before and has not been taken yet is
+        deleted, as is the object that the audio thread retired. */
+    void publish(T *object)
+    {
+        collect();
+        delete m_pending.exchange(object, std::memory_order_acq_rel);
+    }
+
+    /** GUI thread: delete the object that the audio thread retired */
+    void collect()
+    {
+        delete m_retired.exchange(NULL, std::memory_order_acq_rel);
+    }
+
+    /** audio thread: returns the published object, or NULL if
+        nothing was published or the GUI thread has not collected
+        the previous object yet. the caller must retire() one
+        object, such as the one it replaces, before the next take. */
+    T* take()
+    {
+        if (m_retired.load(std::memory_order_acquire) != NULL)
+        {
+            return NULL;
+        }
+        return m_pending.exchange(NULL, std::memory_order_acq_rel);
+    }
+
+    /** audio thread: hand an object that is no longer used
+        back to the GUI thread, see take() */
+    void retire(T *object)
+    {
+        m_retired.store(object, std::memory_order_release);
+    }
+
+    /** audio thread: replace 'current' by the published object
+        and retire 'current'. returns false, leaving 'current'
+        alone, if nothing was published or the GUI thread has
+        not collected the previous object yet. */
+    bool take(T *&current)
+    {
+        T *next = take();
+        if (next == NULL)
+        {
+            return false;
+        }
+        retire(current);
+        current = next;
+        return true;
+    }
+
+protected:
+    std::atomic<T*> m_pending;  // published, not yet taken
+    std::atomic<T*> m_retired;  // no longer used by the audio thread
+
+private:
+    Handoff(const Handoff &);
+    Handoff& operator=(const Handoff &);
+};
+
+#endif
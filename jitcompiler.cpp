@@ -0,0 +1,613 @@
+/*
+
+  Description:  x86-64 JIT compiler that translates
+                stack-based VM programs into native
+                SSE code.
+
+  License: GPLv2
+
+*/
+
+#include <QDebug>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "jitcompiler.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// the interpreter gives up when the stack grows beyond this depth
+#define JIT_MAXDEPTH 2044
+
+// constant pool entries used by the generated code
+#define JIT_CONST_ONE    0
+#define JIT_CONST_MINONE 1
+
+// SSE opcodes, following the 0F escape byte
+#define SSE_MOVSS_LOAD  0x10
+#define SSE_MOVSS_STORE 0x11
+#define SSE_CVTSI2SS    0x2A
+#define SSE_CVTTSS2SI   0x2C
+#define SSE_MOVAPS      0x28
+#define SSE_SQRT        0x51
+#define SSE_AND         0x54
+#define SSE_XOR         0x57
+#define SSE_ADD         0x58
+#define SSE_MUL         0x59
+#define SSE_SUB         0x5C
+#define SSE_MIN         0x5D
+#define SSE_DIV         0x5E
+#define SSE_MAX         0x5F
+#define SSE_MOVD        0x6E
+
+/* Helper functions called by the native code.
+   They evaluate exactly the same expressions as
+   ProgramInstance::executeRange so the results are
+   bit-identical to the interpreter. The functions
+   with a precision tier are called through the
+   kernels of the program, see fastmath.h.
+*/
+static float jitTan(float x)   { return tan(x); }
+static float jitRound(float x) { return round(x); }
+static float jitTrunc(float x) { return std::trunc(x); }
+static float jitCeil(float x)  { return std::ceil(x); }
+static float jitFloor(float x) { return std::floor(x); }
+static float jitSign(float x)  { return (x >= 0.0f) ? 1.0f : -1.0f; }
+static float jitNoise(NoiseGenerator *g) { return g->next(); }
+static float jitFIR(FIRFilter *f, float x) { return f->process(x); }
+static float jitConv(Convolver *c, float x) { return c->process(x); }
+static float jitBiquad(BiquadFilter *f, float x, const float *coefficients)
+{
+    if (coefficients != NULL)
+    {
+        f->setCoefficients(coefficients);
+    }
+    return f->process(x);
+}
+
+JITCompiler::JITCompiler()
+    : m_function(NULL),
+      m_page(NULL),
+      m_pageSize(0)
+{
+}
+
+JITCompiler::~JITCompiler()
+{
+    clear();
+}
+
+bool JITCompiler::isSupported()
+{
+#ifdef JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+void JITCompiler::clear()
+{
+#ifdef JIT_X86_64
+    if (m_page != NULL)
+    {
+        munmap(m_page, m_pageSize);
+    }
+#endif
+    m_function = NULL;
+    m_page = NULL;
+    m_pageSize = 0;
+    m_code.clear();
+    m_constants.clear();
+    m_stack.clear();
+}
+
+void JITCompiler::emit8(uint8_t b)
+{
+    m_code.push_back(b);
+}
+
+void JITCompiler::emit32(uint32_t v)
+{
+    for(uint32_t i=0; i<4; i++)
+    {
+        emit8(static_cast<uint8_t>(v >> (i*8)));
+    }
+}
+
+void JITCompiler::emit64(uint64_t v)
+{
+    emit32(static_cast<uint32_t>(v));
+    emit32(static_cast<uint32_t>(v >> 32));
+}
+
+void JITCompiler::emitMem(uint8_t prefix, uint8_t opcode, uint32_t reg, base_t base, int32_t disp)
+{
+    if (prefix != 0)
+    {
+        emit8(prefix);
+    }
+    if (base == BASE_CONSTS)
+    {
+        emit8(0x41);    // REX.B to select r12
+    }
+    emit8(0x0F);
+    emit8(opcode);
+    if (base == BASE_VARS)
+    {
+        // [rbx + disp32]
+        emit8(0x80 | (reg << 3) | 3);
+    }
+    else
+    {
+        // [r12 + disp32] and [rsp + disp32] need a SIB byte
+        emit8(0x80 | (reg << 3) | 4);
+        emit8(0x24);
+    }
+    emit32(static_cast<uint32_t>(disp));
+}
+
+void JITCompiler::emitReg(uint8_t prefix, uint8_t opcode, uint32_t dst, uint32_t src)
+{
+    if (prefix != 0)
+    {
+        emit8(prefix);
+    }
+    emit8(0x0F);
+    emit8(opcode);
+    emit8(0xC0 | (dst << 3) | src);
+}
+
+void JITCompiler::emitEntry(uint8_t prefix, uint8_t opcode, uint32_t reg, size_t pos)
+{
+    const entry_t &e = m_stack[pos];
+    switch(e.kind)
+    {
+    case entry_t::E_VAR:
+        emitMem(prefix, opcode, reg, BASE_VARS, e.index*4);
+        break;
+    case entry_t::E_CONST:
+        emitMem(prefix, opcode, reg, BASE_CONSTS, e.index*4);
+        break;
+    case entry_t::E_SLOT:
+        emitMem(prefix, opcode, reg, BASE_STACK, pos*4);
+        break;
+    case entry_t::E_XMM0:
+        emitReg(prefix, opcode, reg, 0);
+        break;
+    }
+}
+
+void JITCompiler::spillXmm0(size_t keep)
+{
+    for(size_t i=0; i<m_stack.size(); i++)
+    {
+        if ((i != keep) && (m_stack[i].kind == entry_t::E_XMM0))
+        {
+            emitMem(0xF3, SSE_MOVSS_STORE, 0, BASE_STACK, i*4);
+            m_stack[i].kind = entry_t::E_SLOT;
+        }
+    }
+}
+
+void JITCompiler::loadXmm0(size_t pos)
+{
+    spillXmm0(pos);
+    if (m_stack[pos].kind != entry_t::E_XMM0)
+    {
+        emitEntry(0xF3, SSE_MOVSS_LOAD, 0, pos);
+        m_stack[pos].kind = entry_t::E_XMM0;
+    }
+}
+
+void JITCompiler::emitCall(const void *func)
+{
+    // mov rax, imm64
+    emit8(0x48);
+    emit8(0xB8);
+    emit64(reinterpret_cast<uint64_t>(func));
+    // call rax
+    emit8(0xFF);
+    emit8(0xD0);
+}
+
+void JITCompiler::pushEntry(entry_t::kind_t kind, uint32_t index)
+{
+    entry_t e = {kind, index};
+    m_stack.push_back(e);
+}
+
+void JITCompiler::emitBinary(uint8_t opcode)
+{
+    const size_t top = m_stack.size()-1;
+    if (m_stack[top].kind == entry_t::E_XMM0)
+    {
+        // right operand is in xmm0: move it out of the way
+        emitReg(0, SSE_MOVAPS, 1, 0);
+        emitEntry(0xF3, SSE_MOVSS_LOAD, 0, top-1);
+        emitReg(0xF3, opcode, 0, 1);
+    }
+    else
+    {
+        loadXmm0(top-1);
+        emitEntry(0xF3, opcode, 0, top);
+    }
+    m_stack.pop_back();
+    m_stack[top-1].kind = entry_t::E_XMM0;
+}
+
+void JITCompiler::emitWrite(uint32_t n)
+{
+    // entries that still refer to the variable
+    // must be read before it is overwritten
+    const size_t top = m_stack.size()-1;
+    for(size_t i=0; i<top; i++)
+    {
+        if ((m_stack[i].kind == entry_t::E_VAR) && (m_stack[i].index == n))
+        {
+            emitMem(0xF3, SSE_MOVSS_LOAD, 1, BASE_VARS, n*4);
+            emitMem(0xF3, SSE_MOVSS_STORE, 1, BASE_STACK, i*4);
+            m_stack[i].kind = entry_t::E_SLOT;
+        }
+    }
+    if (m_stack[top].kind == entry_t::E_XMM0)
+    {
+        emitMem(0xF3, SSE_MOVSS_STORE, 0, BASE_VARS, n*4);
+    }
+    else
+    {
+        emitEntry(0xF3, SSE_MOVSS_LOAD, 1, top);
+        emitMem(0xF3, SSE_MOVSS_STORE, 1, BASE_VARS, n*4);
+    }
+    m_stack.pop_back();
+}
+
+uint32_t JITCompiler::addConstant(float value)
+{
+    for(size_t i=0; i<m_constants.size(); i++)
+    {
+        if (memcmp(&m_constants[i], &value, sizeof(float)) == 0)
+        {
+            return i;
+        }
+    }
+    m_constants.push_back(value);
+    return m_constants.size()-1;
+}
+
+bool JITCompiler::compile(const VM::program_t &program, uint32_t nvars,
+                          const FastMath::kernels_t &math, NoiseGenerator *noise,
+                          FIRFilter *firs, BiquadFilter *biquads,
+                          Convolver *convs)
+{
+    clear();
+
+#ifdef JIT_X86_64
+    // determine the maximum stack depth and
+    // check that all instructions are supported
+    int32_t depth = 0;
+    int32_t maxDepth = 0;
+    for(size_t pc=0; pc<program.size(); pc+=VM::getInstructionLength(program[pc].icode))
+    {
+        uint32_t icode = program[pc].icode;
+        if (icode & 0x80000000)
+        {
+            uint32_t op = icode & 0xff000000;
+            bool twoVars = (op == P_addvv) || (op == P_mulvv) || (op == P_mac);
+            if (op == P_noisegen)
+            {
+                // the index refers to a noise generator
+                if (noise == NULL)
+                {
+                    qDebug() << "JITCompiler: missing noise generators";
+                    return false;
+                }
+            }
+            else if (op == P_fir)
+            {
+                // the index refers to a filter
+                if (firs == NULL)
+                {
+                    qDebug() << "JITCompiler: missing FIR filters";
+                    return false;
+                }
+            }
+            else if (op == P_conv)
+            {
+                if (convs == NULL)
+                {
+                    qDebug() << "JITCompiler: missing convolvers";
+                    return false;
+                }
+            }
+            else if (op == P_biquad)
+            {
+                if (biquads == NULL)
+                {
+                    qDebug() << "JITCompiler: missing biquad filters";
+                    return false;
+                }
+            }
+            else if (((icode & 0xFFFF) >= nvars) ||
+                (twoVars && ((pc+1 >= program.size()) || (program[pc+1].icode >= nvars))))
+            {
+                qDebug() << "JITCompiler: variable index out of range";
+                return false;
+            }
+        }
+        depth += VM::getStackEffect(icode);
+        if (depth < 0)
+        {
+            qDebug() << "JITCompiler: stack underflow";
+            return false;
+        }
+        maxDepth = std::max(depth, maxDepth);
+    }
+
+    if (maxDepth > JIT_MAXDEPTH)
+    {
+        qDebug() << "JITCompiler: stack depth exceeds interpreter limit";
+        return false;
+    }
+
+    m_constants.push_back(1.0f);    // JIT_CONST_ONE
+    m_constants.push_back(-1.0f);   // JIT_CONST_MINONE
+
+    // the stack slots live in the native stack frame, with room
+    // for the operands pushed by superinstructions.
+    // the frame size keeps rsp 16-byte aligned at calls.
+    const uint32_t frame = (((maxDepth+2)*4 + 15) & ~15) + 8;
+
+    // prologue: save callee-saved registers,
+    // rbx = variables, r12 = constants
+    emit8(0x53);                                // push rbx
+    emit8(0x41); emit8(0x54);                   // push r12
+    emit8(0x48); emit8(0x81); emit8(0xEC);      // sub rsp, frame
+    emit32(frame);
+    emit8(0x48); emit8(0x89); emit8(0xFB);      // mov rbx, rdi
+    emit8(0x49); emit8(0x89); emit8(0xF4);      // mov r12, rsi
+
+    for(size_t pc=0; pc<program.size(); pc++)
+    {
+        uint32_t icode = program[pc].icode;
+        size_t top = m_stack.size()-1;
+        if (icode & 0x80000000)
+        {
+            // superinstructions are compiled as the
+            // sequence of instructions they replace
+            uint32_t n = icode & 0xFFFF;
+            switch(icode & 0xff000000)
+            {
+            case P_readvar:
+                pushEntry(entry_t::E_VAR, n);
+                break;
+            case P_writevar:
+                emitWrite(n);
+                break;
+            case P_addvv:
+                pushEntry(entry_t::E_VAR, n);
+                pushEntry(entry_t::E_VAR, program[++pc].icode);
+                emitBinary(SSE_ADD);
+                break;
+            case P_mulvv:
+                pushEntry(entry_t::E_VAR, n);
+                pushEntry(entry_t::E_VAR, program[++pc].icode);
+                emitBinary(SSE_MUL);
+                break;
+            case P_mac:
+                pushEntry(entry_t::E_VAR, n);
+                pushEntry(entry_t::E_VAR, program[++pc].icode);
+                emitBinary(SSE_MUL);
+                emitBinary(SSE_ADD);
+                break;
+            case P_rmwadd:
+                pushEntry(entry_t::E_VAR, n);
+                pushEntry(entry_t::E_CONST, addConstant(program[++pc].value));
+                emitBinary(SSE_ADD);
+                emitWrite(n);
+                break;
+            case P_noisegen:
+                spillXmm0(m_stack.size());
+                emit8(0x48); emit8(0xBF);               // mov rdi, imm64
+                emit64(reinterpret_cast<uint64_t>(&noise[n]));
+                emitCall((const void*)jitNoise);
+                pushEntry(entry_t::E_XMM0, 0);
+                break;
+            case P_fir:
+                loadXmm0(top);
+                emit8(0x48); emit8(0xBF);               // mov rdi, imm64
+                emit64(reinterpret_cast<uint64_t>(&firs[n]));
+                emitCall((const void*)jitFIR);
+                break;
+            case P_conv:
+                loadXmm0(top);
+                emit8(0x48); emit8(0xBF);               // mov rdi, imm64
+                emit64(reinterpret_cast<uint64_t>(&convs[n]));
+                emitCall((const void*)jitConv);
+                break;
+            case P_biquad:
+            {
+                // changing coefficients are passed as an
+                // array of stack slots above the input
+                const size_t count = ((icode >> 16) & 0xFF)*BIQUAD_COEFFICIENTS;
+                const size_t pos = top - count;
+                loadXmm0(pos);
+                for(size_t i=pos+1; i<=top; i++)
+                {
+                    if (m_stack[i].kind != entry_t::E_SLOT)
+                    {
+                        emitEntry(0xF3, SSE_MOVSS_LOAD, 1, i);
+                        emitMem(0xF3, SSE_MOVSS_STORE, 1, BASE_STACK, i*4);
+                        m_stack[i].kind = entry_t::E_SLOT;
+                    }
+                }
+                if (count > 0)
+                {
+                    emit8(0x48); emit8(0x8D); emit8(0xB4);  // lea rsi, [rsp + disp32]
+                    emit8(0x24);
+                    emit32((pos+1)*4);
+                }
+                else
+                {
+                    emit8(0x31); emit8(0xF6);               // xor esi, esi
+                }
+                emit8(0x48); emit8(0xBF);                   // mov rdi, imm64
+                emit64(reinterpret_cast<uint64_t>(&biquads[n]));
+                emitCall((const void*)jitBiquad);
+                m_stack.resize(pos+1);
+                break;
+            }
+            default:
+                break;
+            }
+            continue;
+        }
+
+        switch(icode)
+        {
+        case P_literal:
+            pushEntry(entry_t::E_CONST, addConstant(program[++pc].value));
+            break;
+        case P_mullit:
+            pushEntry(entry_t::E_CONST, addConstant(program[++pc].value));
+            emitBinary(SSE_MUL);
+            break;
+        case P_addlit:
+            pushEntry(entry_t::E_CONST, addConstant(program[++pc].value));
+            emitBinary(SSE_ADD);
+            break;
+        case P_add:
+            emitBinary(SSE_ADD);
+            break;
+        case P_sub:
+            emitBinary(SSE_SUB);
+            break;
+        case P_mul:
+            emitBinary(SSE_MUL);
+            break;
+        case P_div:
+            emitBinary(SSE_DIV);
+            break;
+        case P_pow:
+        case P_atan2:
+            if (m_stack[top].kind == entry_t::E_XMM0)
+            {
+                emitReg(0, SSE_MOVAPS, 1, 0);
+                emitEntry(0xF3, SSE_MOVSS_LOAD, 0, top-1);
+            }
+            else
+            {
+                loadXmm0(top-1);
+                emitEntry(0xF3, SSE_MOVSS_LOAD, 1, top);
+            }
+            emitCall((icode == P_pow) ? (const void*)math.pow : (const void*)math.atan2);
+            m_stack.pop_back();
+            m_stack[top-1].kind = entry_t::E_XMM0;
+            break;
+        case P_neg:
+            loadXmm0(top);
+            emit8(0xB8); emit32(0x80000000);            // mov eax, sign bit
+            emitReg(0x66, SSE_MOVD, 1, 0);              // movd xmm1, eax
+            emitReg(0, SSE_XOR, 0, 1);                  // xorps xmm0, xmm1
+            break;
+        case P_abs:
+            loadXmm0(top);
+            emit8(0xB8); emit32(0x7FFFFFFF);            // mov eax, ~sign bit
+            emitReg(0x66, SSE_MOVD, 1, 0);              // movd xmm1, eax
+            emitReg(0, SSE_AND, 0, 1);                  // andps xmm0, xmm1
+            break;
+        case P_sqrt:
+            loadXmm0(top);
+            emitReg(0xF3, SSE_SQRT, 0, 0);              // sqrtss xmm0, xmm0
+            break;
+        case P_mod1:
+            loadXmm0(top);
+            emitReg(0xF3, SSE_CVTTSS2SI, 0, 0);         // cvttss2si eax, xmm0
+            emitReg(0xF3, SSE_CVTSI2SS, 1, 0);          // cvtsi2ss xmm1, eax
+            emitReg(0xF3, SSE_SUB, 0, 1);               // subss xmm0, xmm1
+            break;
+        case P_limit:
+            // minss/maxss return the second operand when the
+            // comparison fails, which matches std::min/std::max
+            // with the constant as first operand.
+            loadXmm0(top);
+            emitMem(0xF3, SSE_MOVSS_LOAD, 1, BASE_CONSTS, JIT_CONST_ONE*4);
+            emitReg(0xF3, SSE_MIN, 1, 0);               // xmm1 = min(1, x)
+            emitMem(0xF3, SSE_MOVSS_LOAD, 0, BASE_CONSTS, JIT_CONST_MINONE*4);
+            emitReg(0xF3, SSE_MAX, 0, 1);               // xmm0 = max(-1, xmm1)
+            break;
+        default:
+            {
+                const void *func = NULL;
+                switch(icode)
+                {
+                case P_sin:   func = (const void*)math.sin;   break;
+                case P_cos:   func = (const void*)math.cos;   break;
+                case P_tan:   func = (const void*)jitTan;   break;
+                case P_tanh:  func = (const void*)math.tanh;  break;
+                case P_sin1:  func = (const void*)math.sin1;  break;
+                case P_cos1:  func = (const void*)math.cos1;  break;
+                case P_round: func = (const void*)jitRound; break;
+                case P_trunc: func = (const void*)jitTrunc; break;
+                case P_ceil:  func = (const void*)jitCeil;  break;
+                case P_floor: func = (const void*)jitFloor; break;
+                case P_sign:  func = (const void*)jitSign;  break;
+                default:
+                    qDebug() << "JITCompiler: unsupported instruction" << icode;
+                    clear();
+                    return false;
+                }
+                loadXmm0(top);
+                emitCall(func);
+            }
+            break;
+        }
+    }
+
+    // epilogue
+    emit8(0x48); emit8(0x81); emit8(0xC4);      // add rsp, frame
+    emit32(frame);
+    emit8(0x41); emit8(0x5C);                   // pop r12
+    emit8(0x5B);                                // pop rbx
+    emit8(0xC3);                                // ret
+
+    // copy the code into a fresh page, then
+    // make it executable but no longer writable
+    long pageSize = sysconf(_SC_PAGESIZE);
+    m_pageSize = ((m_code.size() + pageSize - 1) / pageSize) * pageSize;
+    m_page = mmap(NULL, m_pageSize, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_page == MAP_FAILED)
+    {
+        qDebug() << "JITCompiler: cannot allocate memory";
+        m_page = NULL;
+        clear();
+        return false;
+    }
+    memcpy(m_page, &m_code[0], m_code.size());
+    if (mprotect(m_page, m_pageSize, PROT_READ | PROT_EXEC) != 0)
+    {
+        qDebug() << "JITCompiler: cannot make code executable";
+        clear();
+        return false;
+    }
+
+    m_function = reinterpret_cast<function_t>(m_page);
+    m_stack.clear();
+    return true;
+#else
+    (void)program;
+    (void)nvars;
+    (void)math;
+    (void)noise;
+    (void)firs;
+    (void)biquads;
+    (void)convs;
+    return false;
+#endif
+}
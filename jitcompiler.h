@@ -0,0 +1,126 @@
+/*
+
+  Description:  x86-64 JIT compiler that translates
+                stack-based VM programs into native
+                SSE code.
+
+  License: GPLv2
+
+*/
+
+#ifndef jitcompiler_h
+#define jitcompiler_h
+
+#include <stdint.h>
+#include <vector>
+#include "virtualmachine.h"
+
+/** The JIT compiler translates a VM program into a native
+    function operating on an array of floats that holds the
+    variables. Arithmetic is emitted inline, the built-in
+    math functions are called through helpers that evaluate
+    the same expressions as the interpreter, so the results
+    are bit-identical.
+
+    Only x86-64 with the System V calling convention is
+    supported. On other platforms compile() returns false
+    and the caller must use an interpreter.
+*/
+class JITCompiler
+{
+public:
+    JITCompiler();
+    virtual ~JITCompiler();
+
+    /** returns true if native code can be generated on this platform */
+    static bool isSupported();
+
+    /** translate a program into native code. the transcendental
+        functions are called through 'math', the noise functions
+        use the generators in 'noise', P_fir the filters in 'firs',
+        P_biquad those in 'biquads' and P_conv the convolvers in
+        'convs', which must not move while the code exists.
+        returns false if the program cannot be compiled. */
+    bool compile(const VM::program_t &program, uint32_t nvars,
+                 const FastMath::kernels_t &math, NoiseGenerator *noise,
+                 FIRFilter *firs, BiquadFilter *biquads, Convolver *convs);
+
+    /** release the native code */
+    void clear();
+
+    /** returns true if native code is available */
+    bool isCompiled() const
+    {
+        return m_function != NULL;
+    }
+
+    /** execute the native code once on the variable array */
+    void execute(float *vars) const
+    {
+        m_function(vars, &m_constants[0]);
+    }
+
+    /** returns the size of the native code in bytes */
+    size_t getCodeSize() const
+    {
+        return m_code.size();
+    }
+
+protected:
+    typedef void (*function_t)(float *vars, const float *constants);
+
+    /** location of a value on the compile-time stack */
+    struct entry_t
+    {
+        enum kind_t {E_VAR, E_CONST, E_SLOT, E_XMM0};
+        kind_t   kind;
+        uint32_t index;     // variable or constant index
+    };
+
+    /** base registers for memory operands */
+    enum base_t {BASE_VARS, BASE_CONSTS, BASE_STACK};
+
+    void emit8(uint8_t b);
+    void emit32(uint32_t v);
+    void emit64(uint64_t v);
+
+    /** emit 'prefix 0F opcode' with an xmm register and a [base+disp] operand */
+    void emitMem(uint8_t prefix, uint8_t opcode, uint32_t reg, base_t base, int32_t disp);
+
+    /** emit 'prefix 0F opcode' with two register operands */
+    void emitReg(uint8_t prefix, uint8_t opcode, uint32_t dst, uint32_t src);
+
+    /** emit an SSE instruction with xmm 'reg' and the stack entry at 'pos' */
+    void emitEntry(uint8_t prefix, uint8_t opcode, uint32_t reg, size_t pos);
+
+    /** store xmm0 to the stack slots of all entries held in xmm0, except 'keep' */
+    void spillXmm0(size_t keep);
+
+    /** make sure the entry at 'pos' is in xmm0 */
+    void loadXmm0(size_t pos);
+
+    /** push a value on the compile-time stack */
+    void pushEntry(entry_t::kind_t kind, uint32_t index);
+
+    /** emit a binary SSE operation on the two top entries */
+    void emitBinary(uint8_t opcode);
+
+    /** pop the top entry into a variable */
+    void emitWrite(uint32_t n);
+
+    /** emit a call to a helper function */
+    void emitCall(const void *func);
+
+    /** add a value to the constant pool, returns its index */
+    uint32_t addConstant(float value);
+
+    std::vector<entry_t>    m_stack;        // compile-time stack
+    std::vector<uint8_t>    m_code;         // generated code
+    std::vector<float>      m_constants;    // constant pool
+
+    function_t  m_function;     // entry point of the native code
+    void        *m_page;        // executable memory
+    size_t      m_pageSize;     // size of the executable memory in bytes
+};
+
+#endif
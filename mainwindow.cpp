@@ -2,7 +2,9 @@
 #include <QDebug>
 #include <QFontDialog>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QMessageBox>
+#include <QActionGroup>
 #include <QSplashScreen>
 
 #include "ui_mainwindow.h"
@@ -12,6 +14,9 @@
 #include "tokenizer.h"
 #include "parser.h"
 #include "asttovm.h"
+#include "astoptimizer.h"
+#include "rateanalyzer.h"
+#include "peephole.h"
 #include "mainwindow.h"
 #include "pa_ringbuffer.h"
 #include "portaudio_helper.h"
@@ -80,6 +85,12 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(m_scope, SIGNAL(channelChanged(uint32_t)), this, SLOT(scopeChannelChanged(uint32_t)));
     connect(m_spectrum, SIGNAL(channelChanged(uint32_t)), this, SLOT(spectrumChannelChanged(uint32_t)));
 
+    /** the math precision menu items are mutually exclusive */
+    QActionGroup *precisionGroup = new QActionGroup(this);
+    precisionGroup->addAction(ui->actionPrecisionExact);
+    precisionGroup->addAction(ui->actionPrecisionFast);
+    precisionGroup->addAction(ui->actionPrecisionUltraFast);
+
     /** get the progam setting */
     readSettings();
 }
@@ -104,8 +115,9 @@ void MainWindow::readSettings()
     PaDeviceIndex inDevice = PA_Helper::getDeviceIndexByName(inputDeviceName);
     PaDeviceIndex outDevice = PA_Helper::getDeviceIndexByName(outputDeviceName);
     m_machine->setupSoundcard(inDevice, outDevice, samplerate);
-    m_spectrum->setSampleRate(samplerate);
-    m_scope->setSampleRate(samplerate);
+    m_machine->setVirtualSamplerate(m_settings.value("vm/virtualRate", 0).toUInt());
+    m_spectrum->setSampleRate(m_machine->getProgramSamplerate());
+    m_scope->setSampleRate(m_machine->getProgramSamplerate());
 
     qDebug() << "Loading settings.. ";
     qDebug() << "input device : " << inputDeviceName;
@@ -120,6 +132,13 @@ void MainWindow::readSettings()
 
     m_lastDirectory = m_settings.value("lastdir", "").toString();
     m_lastAudioDirectory = m_settings.value("lastaudiodir","").toString();
+
+    int precision = m_settings.value("vm/precision", FastMath::PRECISION_EXACT).toInt();
+    setPrecision(static_cast<FastMath::precision_t>(precision));
+
+    m_machine->setNoiseSeed(m_settings.value("vm/noiseSeed", 1).toUInt());
+    m_machine->setCrossfadeLength(m_settings.value("vm/crossfade", VM_DEFAULTCROSSFADE).toUInt());
+    m_machine->setPipelineStages(m_settings.value("vm/pipelineStages", 1).toUInt());
 }
 
 void MainWindow::writeSettings()
@@ -134,6 +153,12 @@ void MainWindow::writeSettings()
 
     m_settings.setValue("lastdir", m_lastDirectory);
     m_settings.setValue("lastaudiodir", m_lastAudioDirectory);
+
+    m_settings.setValue("vm/precision", static_cast<int>(m_machine->getPrecision()));
+    m_settings.setValue("vm/noiseSeed", m_machine->getNoiseSeed());
+    m_settings.setValue("vm/virtualRate", m_machine->getVirtualSamplerate());
+    m_settings.setValue("vm/crossfade", m_machine->getCrossfadeLength());
+    m_settings.setValue("vm/pipelineStages", m_machine->getPipelineStages());
 }
 
 bool MainWindow::save()
@@ -300,14 +325,38 @@ void MainWindow::scopeChannelChanged(uint32_t channelID)
 {
     qDebug() << "scopeChannelChanged() " << channelID;
     std::string varname = m_scope->getChannelName(channelID);
-    m_machine->setMonitoringVariable(0, channelID, varname);
+    if (!m_machine->setMonitoringVariable(0, channelID, varname))
+    {
+        // the variable was optimized away; recompile
+        // so the optimizer keeps it.
+        if (m_machine->isRunning() && (m_removedVars.count(varname) != 0))
+        {
+            if (!compileAndRun())
+            {
+                ui->runButton->setText("Run");
+                ui->recompileButton->setEnabled(false);
+            }
+        }
+    }
 }
 
 void MainWindow::spectrumChannelChanged(uint32_t channelID)
 {
     qDebug() << "spectrumChannelChanged() " << channelID;
     std::string varname = m_spectrum->getChannelName(channelID);
-    m_machine->setMonitoringVariable(1, channelID, varname);
+    if (!m_machine->setMonitoringVariable(1, channelID, varname))
+    {
+        // the variable was optimized away; recompile
+        // so the optimizer keeps it.
+        if (m_machine->isRunning() && (m_removedVars.count(varname) != 0))
+        {
+            if (!compileAndRun())
+            {
+                ui->runButton->setText("Run");
+                ui->recompileButton->setEnabled(false);
+            }
+        }
+    }
 }
 
 bool MainWindow::compileAndRun()
@@ -315,9 +364,6 @@ bool MainWindow::compileAndRun()
     Parser    parser;
     Tokenizer tokenizer;
 
-    if (m_machine->isRunning())
-        m_machine->stop();
-
     QScopedPointer<Reader> reader(Reader::create(m_sourceEditor->toPlainText()));
     if (reader.isNull())
     {
@@ -350,6 +396,16 @@ bool MainWindow::compileAndRun()
         qDebug() << tokens[i].tokID;
     }
 
+    // files of filter coefficients are relative to the script
+    if (!m_filepath.isEmpty())
+    {
+        parser.setDirectory(QFileInfo(m_filepath).absolutePath().toLocal8Bit().constData());
+    }
+    else
+    {
+        parser.setDirectory(m_lastDirectory.toLocal8Bit().constData());
+    }
+
     statements_t statements;
     bool parseOK = parser.process(tokens, statements);
 
@@ -377,22 +433,63 @@ bool MainWindow::compileAndRun()
         m_sourceEditor->setErrorLine(0);
     }
 
+    // fold constants and remove dead statements. the variables
+    // shown by the scope and the spectrum must be kept.
+    ASTOptimizer optimizer;
+    optimizer.setSamplerate(m_machine->getProgramSamplerate());
+    optimizer.addObservedVariable(m_scope->getChannelName(0));
+    optimizer.addObservedVariable(m_scope->getChannelName(1));
+    optimizer.addObservedVariable(m_spectrum->getChannelName(0));
+    optimizer.addObservedVariable(m_spectrum->getChannelName(1));
+    uint32_t changes = optimizer.process(statements);
+    m_removedVars = optimizer.getRemovedVariables();
+
+    qDebug() << "-- AST OPTIMIZER -- ";
+    std::stringstream os;
+    optimizer.dump(os);
+    qDebug() << os.str().c_str();
+    qDebug() << "AST optimizer made" << changes << "changes";
+
+    // statements that only depend on the sliders and the
+    // samplerate are evaluated when a slider changes.
+    statements_t control;
+    uint32_t moved = RateAnalyzer::split(statements, control);
+    qDebug() << moved << "statements moved to the control program";
+
     VM::program_t program;
+    VM::program_t controlProgram;
+    VM::regprogram_t regprogram;
     VM::variables_t vars;
-    if (!ASTToVM::process(statements, program, vars))
+    VM::filters_t filters;
+    if (!ASTToVM::process(control, statements, controlProgram, program, regprogram, vars, filters))
     {
         qDebug() << "AST conversion failed! :(";
         return false;
     }
     else
     {
+        uint32_t fused = Peephole::process(program);
+        qDebug() << "Peephole optimizer removed" << fused << "instructions";
+
         ss.clear();
         if (m_machine != 0)
         {
             // dump the program for debugging and run!
+            // a running program is replaced without
+            // stopping the stream, see loadProgram
             std::stringstream ss;
-            m_machine->stop();
-            m_machine->loadProgram(program, vars);
+            if (!m_machine->loadProgram(program, regprogram, vars, controlProgram, filters))
+            {
+                ui->statusBar->showMessage("Error: program is too complex");
+                return false;
+            }
+            if (m_machine->getRequestedEngine() == VirtualMachine::ENGINE_NATIVE)
+            {
+                if (!m_machine->compileNative(statements, vars))
+                {
+                    ui->statusBar->showMessage("Native compilation failed, using the interpreter");
+                }
+            }
             m_machine->dump(ss);
             m_machine->setSlider(0, m_slider1->getValue());
             m_machine->setSlider(1, m_slider2->getValue());
@@ -405,7 +502,10 @@ bool MainWindow::compileAndRun()
             m_machine->setMonitoringVariable(1,0,m_spectrum->getChannelName(0));
             m_machine->setMonitoringVariable(1,1,m_spectrum->getChannelName(1));
 
-            m_machine->start();
+            if (!m_machine->isRunning())
+            {
+                m_machine->start();
+            }
             qDebug() << ss.str().c_str();
             qDebug() << " - Variables -";
             for(size_t i=0; i<vars.size(); i++)
@@ -558,8 +658,8 @@ void MainWindow::on_actionSoundcard_triggered()
                                   dialog->getOutputSource(),
                                   dialog->getSamplerate());
 
-        m_spectrum->setSampleRate(dialog->getSamplerate());
-        m_scope->setSampleRate(dialog->getSamplerate());
+        m_spectrum->setSampleRate(m_machine->getProgramSamplerate());
+        m_scope->setSampleRate(m_machine->getProgramSamplerate());
     }
     delete dialog;
 }
@@ -656,9 +756,10 @@ void MainWindow::on_actionClear_triggered()
 
 void MainWindow::on_recompileButton_clicked()
 {
-    // user pressed RUN
+    // user pressed RUN. a program that does not
+    // compile leaves the running one in place.
     bool ok = compileAndRun();
-    if (ok)
+    if (ok || m_machine->isRunning())
     {
         ui->runButton->setText("Stop");
         ui->recompileButton->setEnabled(true);
@@ -714,3 +815,108 @@ void MainWindow::on_actionAudio_file_triggered()
         }
     }
 }
+
+void MainWindow::on_actionPrecisionExact_triggered()
+{
+    setPrecision(FastMath::PRECISION_EXACT);
+}
+
+void MainWindow::on_actionPrecisionFast_triggered()
+{
+    setPrecision(FastMath::PRECISION_FAST);
+}
+
+void MainWindow::on_actionPrecisionUltraFast_triggered()
+{
+    setPrecision(FastMath::PRECISION_ULTRAFAST);
+}
+
+void MainWindow::on_actionNoiseSeed_triggered()
+{
+    // the noise functions restart from the new seed,
+    // so a program produces the same noise every run
+    bool ok;
+    int seed = QInputDialog::getInt(this, "Noise seed", "Seed of the noise generators:",
+                                    static_cast<int>(m_machine->getNoiseSeed()),
+                                    0, 2147483647, 1, &ok);
+    if (ok)
+    {
+        m_machine->setNoiseSeed(static_cast<uint32_t>(seed));
+    }
+}
+
+void MainWindow::on_actionVirtualRate_triggered()
+{
+    // the program runs at this rate, and the sound card
+    // at its own. 0 runs the program at the rate of the card.
+    bool ok;
+    int rate = QInputDialog::getInt(this, "Virtual sample rate",
+                                    "Sample rate of the program in Hz,\n0 for the rate of the sound card:",
+                                    static_cast<int>(m_machine->getVirtualSamplerate()),
+                                    0, VM_MAXVIRTUALRATIO*static_cast<int>(m_machine->getSamplerate()),
+                                    1000, &ok);
+    if (!ok || !m_machine->setVirtualSamplerate(static_cast<uint32_t>(rate)))
+    {
+        return;
+    }
+
+    m_spectrum->setSampleRate(m_machine->getProgramSamplerate());
+    m_scope->setSampleRate(m_machine->getProgramSamplerate());
+
+    // the rate is selected when a program is
+    // loaded, so a running program is recompiled.
+    if (m_machine->isRunning())
+    {
+        on_recompileButton_clicked();
+    }
+}
+
+void MainWindow::on_actionCrossfade_triggered()
+{
+    // a recompiled program fades in over this many
+    // samples while the previous one fades out
+    bool ok;
+    int frames = QInputDialog::getInt(this, "Crossfade",
+                                      "Length of the crossfade when a running\nprogram is recompiled, in samples:",
+                                      static_cast<int>(m_machine->getCrossfadeLength()),
+                                      0, VM_MAXCROSSFADE, 256, &ok);
+    if (ok)
+    {
+        m_machine->setCrossfadeLength(static_cast<uint32_t>(frames));
+    }
+}
+
+void MainWindow::on_actionPipelineStages_triggered()
+{
+    bool ok;
+    int stages = QInputDialog::getInt(this, "Pipeline stages",
+                                      "Number of cores to spread a program over.\n"
+                                      "Each stage after the first adds a latency\n"
+                                      "of " + QString::number(VM_BLOCKSIZE) + " samples:",
+                                      static_cast<int>(m_machine->getPipelineStages()),
+                                      1, VM_MAXSTAGES, 1, &ok);
+    if (ok && m_machine->setPipelineStages(static_cast<uint32_t>(stages)))
+    {
+        // the stages take effect when the program is
+        // loaded, so a running program is recompiled.
+        if (m_machine->isRunning())
+        {
+            on_recompileButton_clicked();
+        }
+    }
+}
+
+void MainWindow::setPrecision(FastMath::precision_t precision)
+{
+    m_machine->setPrecision(precision);
+    ui->actionPrecisionExact->setChecked(precision == FastMath::PRECISION_EXACT);
+    ui->actionPrecisionFast->setChecked(precision == FastMath::PRECISION_FAST);
+    ui->actionPrecisionUltraFast->setChecked(precision == FastMath::PRECISION_ULTRAFAST);
+
+    // the precision is selected when a program is
+    // loaded, so a running program is recompiled.
+    if (m_machine->isRunning())
+    {
+        on_recompileButton_clicked();
+    }
+}
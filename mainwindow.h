@@ -5,6 +5,8 @@
 #include <QTimer>
 #include <QFile>
 #include <QSettings>
+#include <set>
+#include <string>
 
 #include "codeeditor.h"
 #include "virtualmachine.h"
@@ -64,6 +66,20 @@ private slots:
 
     void on_actionAudio_file_triggered();
 
+    void on_actionPrecisionExact_triggered();
+
+    void on_actionPrecisionFast_triggered();
+
+    void on_actionPrecisionUltraFast_triggered();
+
+    void on_actionNoiseSeed_triggered();
+
+    void on_actionVirtualRate_triggered();
+
+    void on_actionCrossfade_triggered();
+
+    void on_actionPipelineStages_triggered();
+
 protected:
     virtual void closeEvent(QCloseEvent *event);
 
@@ -107,6 +123,10 @@ private:
     /** show a file dialog to open an audio file */
     QString openAudioFile();
 
+    /** select the precision of the transcendental functions,
+        update the menu and recompile the running program */
+    void setPrecision(FastMath::precision_t precision);
+
     Ui::MainWindow *ui;
 
     CodeEditor *m_sourceEditor;
@@ -126,6 +146,9 @@ private:
     SpectrumWindow *m_spectrum;
     ScopeWindow    *m_scope;
 
+    /** variables removed from the program by the AST optimizer */
+    std::set<std::string> m_removedVars;
+
     QSettings m_settings;
     QString   m_filepath;
     QString   m_lastDirectory;
@@ -0,0 +1,477 @@
+/*
+
+  Description:  Execution of one program on many channels at
+                once, with the variables of the channels side
+                by side in vectors.
+
+  License: GPLv2
+
+*/
+
+#include <QDebug>
+#include <string.h>
+#include <algorithm>
+#include "vectormath.h"
+#include "multiinstance.h"
+
+MultiInstance::MultiInstance()
+    : m_controlDirty(false),
+      m_channels(0),
+      m_stride(0),
+      m_vmath(&VectorMath::getKernels(FastMath::PRECISION_EXACT))
+{
+    for(uint32_t i=0; i<6; i++)
+    {
+        m_ioIdx[i] = -1;
+    }
+    for(uint32_t i=0; i<4; i++)
+    {
+        m_sliderIdx[i] = -1;
+    }
+}
+
+MultiInstance::~MultiInstance()
+{
+    releaseState();
+}
+
+void MultiInstance::releaseState()
+{
+    for(size_t c=0; c<m_arenas.size(); c++)
+    {
+        delete m_arenas[c];
+    }
+    m_arenas.clear();
+    m_state.clear();
+}
+
+bool MultiInstance::load(const VM::program_t &program,
+                         const VM::variables_t &variables,
+                         const VM::program_t &controlProgram,
+                         const VM::filters_t &filters,
+                         FastMath::precision_t precision,
+                         uint32_t noiseSeed, float programRate,
+                         uint32_t channels)
+{
+    if ((channels == 0) || (channels > VM_MAXCHANNELS))
+    {
+        qDebug() << "MultiInstance: program rejected," << channels << "channels";
+        return false;
+    }
+
+    uint32_t depth = 0;
+    if (!ProgramInstance::checkPrograms(program, controlProgram, filters, depth))
+    {
+        return false;
+    }
+
+    // every channel gets the state a ProgramInstance would have
+    std::vector<StateArena*> arenas;
+    std::vector<ProgramInstance::state_t> state(channels);
+    for(uint32_t c=0; c<channels; c++)
+    {
+        arenas.push_back(new StateArena());
+        if (!ProgramInstance::createState(program, VM::regprogram_t(), variables, filters,
+                                          0, noiseSeed + c, *arenas.back(), state[c]))
+        {
+            for(size_t i=0; i<arenas.size(); i++)
+            {
+                delete arenas[i];
+            }
+            return false;
+        }
+    }
+
+    releaseState();
+    m_arenas.swap(arenas);
+    m_state.swap(state);
+
+    m_program = program;
+    m_controlProgram = controlProgram;
+    m_controlDirty = true;
+    m_vars = variables;
+    m_channels = channels;
+    m_stride = (channels + VM_CHANNELALIGN - 1) & ~static_cast<uint32_t>(VM_CHANNELALIGN - 1);
+    m_vmath = &VectorMath::getKernels(precision);
+
+    int32_t idx = VM::findVariableByName(m_vars, "samplerate");
+    if (idx != -1)
+    {
+        m_vars[idx].value = programRate;
+    }
+
+    m_lanes.assign(m_vars.size()*m_stride, 0.0f);
+    for(size_t i=0; i<m_vars.size(); i++)
+    {
+        std::fill_n(getLane(i), m_stride, m_vars[i].value);
+    }
+    m_stackLanes.assign(std::max(depth, 1u)*m_stride, 0.0f);
+    m_stackPtrs.assign(std::max(depth, 1u), NULL);
+
+    uint32_t coefficients = 0;
+    for(size_t i=0; i<filters.biquad.size(); i++)
+    {
+        coefficients = std::max<uint32_t>(coefficients, filters.biquad[i].coefficients.size());
+    }
+    m_coefficients.assign(std::max(coefficients, 1u), 0.0f);
+
+    const char *io[6] = {"in", "inl", "inr", "out", "outl", "outr"};
+    for(uint32_t i=0; i<6; i++)
+    {
+        m_ioIdx[i] = VM::findVariableByName(m_vars, io[i]);
+    }
+    const char *sliders[4] = {"slider1", "slider2", "slider3", "slider4"};
+    for(uint32_t i=0; i<4; i++)
+    {
+        m_sliderIdx[i] = VM::findVariableByName(m_vars, sliders[i]);
+    }
+    return true;
+}
+
+void MultiInstance::setSlider(uint32_t id, float value)
+{
+    if ((id < 4) && (m_sliderIdx[id] != -1))
+    {
+        std::fill_n(getLane(m_sliderIdx[id]), m_stride, value);
+        m_controlDirty = true;
+    }
+}
+
+void MultiInstance::seedNoiseGenerators(uint32_t seed)
+{
+    for(uint32_t c=0; c<m_state.size(); c++)
+    {
+        ProgramInstance::state_t &state = m_state[c];
+        for(size_t n=0; n<state.noiseCount; n++)
+        {
+            state.noise[n].init(state.noise[n].getType(), seed + c, n);
+        }
+    }
+}
+
+float MultiInstance::getVariable(uint32_t channel, int32_t idx) const
+{
+    if ((idx < 0) || (static_cast<size_t>(idx) >= m_vars.size()) || (channel >= m_channels))
+    {
+        return 0.0f;
+    }
+    return m_lanes[idx*m_stride + channel];
+}
+
+void MultiInstance::setVariable(uint32_t channel, int32_t idx, float value)
+{
+    if ((idx < 0) || (static_cast<size_t>(idx) >= m_vars.size()) || (channel >= m_channels))
+    {
+        return;
+    }
+    m_lanes[idx*m_stride + channel] = value;
+    m_controlDirty = true;
+}
+
+void MultiInstance::process(const float * const *inLeft, const float * const *inRight,
+                            float * const *outLeft, float * const *outRight,
+                            uint32_t frames)
+{
+    if (m_program.empty())
+    {
+        for(uint32_t c=0; c<m_channels; c++)
+        {
+            memset(outLeft[c], 0, frames*sizeof(float));
+            if ((outRight != NULL) && (outRight[c] != NULL))
+            {
+                memset(outRight[c], 0, frames*sizeof(float));
+            }
+        }
+        return;
+    }
+
+    if (m_controlDirty)
+    {
+        executeLanes(m_controlProgram);
+        m_controlDirty = false;
+    }
+
+    float *lanes[6];
+    for(uint32_t i=0; i<6; i++)
+    {
+        lanes[i] = (m_ioIdx[i] != -1) ? getLane(m_ioIdx[i]) : NULL;
+    }
+
+    // 'out' is sent to both outputs, like in the interpreters
+    const float *left = (lanes[3] != NULL) ? lanes[3] : lanes[4];
+    const float *right = (lanes[3] != NULL) ? lanes[3] : lanes[5];
+
+    for(uint32_t i=0; i<frames; i++)
+    {
+        for(uint32_t c=0; c<m_channels; c++)
+        {
+            const float l = inLeft[c][i];
+            const float r = inRight[c][i];
+            if (lanes[0] != NULL)
+            {
+                lanes[0][c] = (l + r) / 2.0f;
+            }
+            if (lanes[1] != NULL)
+            {
+                lanes[1][c] = l;
+            }
+            if (lanes[2] != NULL)
+            {
+                lanes[2][c] = r;
+            }
+        }
+
+        executeLanes(m_program);
+
+        for(uint32_t c=0; c<m_channels; c++)
+        {
+            outLeft[c][i] = (left != NULL) ? left[c] : 0.0f;
+            if ((outRight != NULL) && (outRight[c] != NULL))
+            {
+                outRight[c][i] = (right != NULL) ? right[c] : 0.0f;
+            }
+        }
+    }
+}
+
+void MultiInstance::executeLanes(const VM::program_t &program)
+{
+    const float **ptr = &m_stackPtrs[0];   // vector stack of lane pointers
+    const VectorMath::kernels_t &vmath = *m_vmath;
+    const uint32_t channels = m_channels;
+    const size_t last = program.size();
+    size_t pc = 0;      // program counter
+    size_t sp = 0;      // stack pointer
+
+    while(pc < last)
+    {
+        VM::instruction_t instruction = program[pc++];
+        if (instruction.icode & 0x80000000)
+        {
+            uint32_t n = instruction.icode & 0xFFFF;
+            switch(instruction.icode & 0xff000000)
+            {
+            case P_readvar: // push
+                ptr[sp++] = getLane(n);
+                break;
+            case P_writevar:// pop
+            {
+                float *lane = getLane(n);
+                sp--;
+                if (lane != ptr[sp])
+                {
+                    memcpy(lane, ptr[sp], channels*sizeof(float));
+                }
+                break;
+            }
+            case P_addvv:
+            case P_mulvv:
+            {
+                float *dst = &m_stackLanes[sp*m_stride];
+                const float *a = getLane(n);
+                const float *b = getLane(program[pc++].icode);
+                if ((instruction.icode & 0xff000000) == P_addvv)
+                {
+                    vmath.add(dst, a, b, channels);
+                }
+                else
+                {
+                    vmath.mul(dst, a, b, channels);
+                }
+                ptr[sp++] = dst;
+                break;
+            }
+            case P_mac:
+            {
+                float *dst = &m_stackLanes[(sp-1)*m_stride];
+                const float *acc = ptr[sp-1];
+                const float *a = getLane(n);
+                const float *b = getLane(program[pc++].icode);
+                vmath.mac(dst, acc, a, b, channels);
+                ptr[sp-1] = dst;
+                break;
+            }
+            case P_rmwadd:
+            {
+                float *lane = getLane(n);
+                const float k = program[pc++].value;
+                vmath.addk(lane, lane, k, channels);
+                break;
+            }
+
+            // the stateful functions keep their state per
+            // channel and are applied channel by channel
+            case P_noisegen:
+            {
+                float *dst = &m_stackLanes[sp*m_stride];
+                for(uint32_t c=0; c<channels; c++)
+                {
+                    dst[c] = m_state[c].noise[n].next();
+                }
+                ptr[sp++] = dst;
+                break;
+            }
+            case P_fir:
+            {
+                float *dst = &m_stackLanes[(sp-1)*m_stride];
+                const float *src = ptr[sp-1];
+                for(uint32_t c=0; c<channels; c++)
+                {
+                    dst[c] = m_state[c].firs[n].process(src[c]);
+                }
+                ptr[sp-1] = dst;
+                break;
+            }
+            case P_conv:
+            {
+                float *dst = &m_stackLanes[(sp-1)*m_stride];
+                const float *src = ptr[sp-1];
+                for(uint32_t c=0; c<channels; c++)
+                {
+                    dst[c] = m_state[c].convs[n].process(src[c]);
+                }
+                ptr[sp-1] = dst;
+                break;
+            }
+            case P_biquad:
+            {
+                // the coefficients of a filter with sections
+                // are on the stack, above the input
+                const uint32_t count = ((instruction.icode >> 16) & 0xFF)*BIQUAD_COEFFICIENTS;
+                sp -= count;
+                float *dst = &m_stackLanes[(sp-1)*m_stride];
+                const float *src = ptr[sp-1];
+                for(uint32_t c=0; c<channels; c++)
+                {
+                    BiquadFilter &filter = m_state[c].biquads[n];
+                    if (count > 0)
+                    {
+                        for(uint32_t k=0; k<count; k++)
+                        {
+                            m_coefficients[k] = ptr[sp+k][c];
+                        }
+                        filter.setCoefficients(&m_coefficients[0]);
+                    }
+                    dst[c] = filter.process(src[c]);
+                }
+                ptr[sp-1] = dst;
+                break;
+            }
+            default:
+                break;
+            }
+            continue;
+        }
+
+        // the result of an operation is stored in the
+        // stack lane of its left-most operand, so
+        // in-place operations are always element-wise.
+        uint32_t nargs = 1;
+        switch(instruction.icode)
+        {
+        case P_add:
+        case P_sub:
+        case P_mul:
+        case P_div:
+        case P_pow:
+        case P_atan2:
+            nargs = 2;
+            break;
+        case P_literal:
+            nargs = 0;
+            break;
+        default:
+            break;
+        }
+
+        sp -= nargs;
+        float *dst = &m_stackLanes[sp*m_stride];
+        const float *a = ptr[sp];
+        const float *b = ptr[sp+1];
+
+        switch(instruction.icode)
+        {
+        case P_add:
+            vmath.add(dst, a, b, channels);
+            break;
+        case P_sub:
+            vmath.sub(dst, a, b, channels);
+            break;
+        case P_mul:
+            vmath.mul(dst, a, b, channels);
+            break;
+        case P_div:
+            vmath.div(dst, a, b, channels);
+            break;
+        case P_neg:
+            vmath.neg(dst, a, channels);
+            break;
+        case P_sin:
+            vmath.sin(dst, a, channels);
+            break;
+        case P_tan:
+            vmath.tan(dst, a, channels);
+            break;
+        case P_tanh:
+            vmath.tanh(dst, a, channels);
+            break;
+        case P_cos:
+            vmath.cos(dst, a, channels);
+            break;
+        case P_sin1:
+            vmath.sin1(dst, a, channels);
+            break;
+        case P_cos1:
+            vmath.cos1(dst, a, channels);
+            break;
+        case P_literal:
+            std::fill_n(dst, channels, program[pc].value);
+            pc++;
+            break;
+        case P_mullit:
+            vmath.mulk(dst, a, program[pc].value, channels);
+            pc++;
+            break;
+        case P_addlit:
+            vmath.addk(dst, a, program[pc].value, channels);
+            pc++;
+            break;
+        case P_mod1:
+            vmath.mod1(dst, a, channels);
+            break;
+        case P_abs:
+            vmath.abs(dst, a, channels);
+            break;
+        case P_sqrt:
+            vmath.sqrt(dst, a, channels);
+            break;
+        case P_round:
+            vmath.round(dst, a, channels);
+            break;
+        case P_pow:
+            vmath.pow(dst, a, b, channels);
+            break;
+        case P_limit:
+            vmath.limit(dst, a, channels);
+            break;
+        case P_atan2:
+            vmath.atan2(dst, a, b, channels);
+            break;
+        case P_sign:
+            vmath.sign(dst, a, channels);
+            break;
+        case P_trunc:
+            vmath.trunc(dst, a, channels);
+            break;
+        case P_ceil:
+            vmath.ceil(dst, a, channels);
+            break;
+        case P_floor:
+            vmath.floor(dst, a, channels);
+            break;
+        default:
+            break;
+        }
+        ptr[sp++] = dst;
+    }
+}
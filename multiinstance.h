@@ -0,0 +1,137 @@
+/*
+
+  Description:  Execution of one program on many channels at
+                once, with the variables of the channels side
+                by side in vectors.
+
+  License: GPLv2
+
+*/
+
+#ifndef multiinstance_h
+#define multiinstance_h
+
+#include <stdint.h>
+#include <vector>
+#include "programinstance.h"
+
+// maximum number of channels of a multi-instance
+#define VM_MAXCHANNELS 1024
+
+// the lanes of the variables are padded to a multiple
+// of the widest vector of the VectorMath kernels
+#define VM_CHANNELALIGN 16
+
+/** A multi-instance runs one program on many independent
+    channels, such as the microphones of an array, as if
+    every channel had its own ProgramInstance, but decodes
+    each instruction only once for all of them.
+
+    The variables are stored in a structure of arrays: every
+    variable has a lane with its value in each channel, and so
+    does every entry of the evaluation stack. An instruction is
+    applied to whole lanes by the VectorMath kernels, which
+    process 8 or 16 channels at a time with AVX2 or AVX-512.
+    The samples are executed one after the other, so variables
+    that hold the previous sample work as in the interpreters.
+
+    Every channel has the state of its noise generators,
+    filters and convolvers in its own StateArena, which the
+    stateful instructions visit channel by channel. The noise
+    generators of channel c start from the seed plus c.
+
+    The output of a channel is bit-identical to that of a
+    ProgramInstance with the stack engine on the same input.
+    The instance is not thread safe: it is loaded and
+    executed by the same thread.
+*/
+class MultiInstance
+{
+public:
+    MultiInstance();
+    virtual ~MultiInstance();
+
+    /** load a program for 'channels' channels, running at
+        'programRate'. returns false if the program is rejected. */
+    bool load(const VM::program_t &program,
+              const VM::variables_t &variables,
+              const VM::program_t &controlProgram,
+              const VM::filters_t &filters,
+              FastMath::precision_t precision,
+              uint32_t noiseSeed, float programRate,
+              uint32_t channels);
+
+    /** returns the number of channels */
+    uint32_t getChannelCount() const
+    {
+        return m_channels;
+    }
+
+    /** returns the index of a variable, or -1 if not found */
+    int32_t findVariable(const std::string &name) const
+    {
+        return VM::findVariableByName(m_vars, name);
+    }
+
+    /** set the value of a slider in all channels */
+    void setSlider(uint32_t id, float value);
+
+    /** restart the noise generators of all channels */
+    void seedNoiseGenerators(uint32_t seed);
+
+    /** returns the value of a variable in a channel */
+    float getVariable(uint32_t channel, int32_t idx) const;
+
+    /** set the value of a variable in a channel */
+    void setVariable(uint32_t channel, int32_t idx, float value);
+
+    /** execute the program on 'frames' samples of every channel.
+        channel c reads the planar input inLeft[c] and inRight[c],
+        which may be the same array, and writes outLeft[c] and
+        outRight[c]. 'outRight' may be NULL for channels without
+        a right output. */
+    void process(const float * const *inLeft, const float * const *inRight,
+                 float * const *outLeft, float * const *outRight,
+                 uint32_t frames);
+
+protected:
+    /** execute the instructions of a program once
+        on the lanes of all channels */
+    void executeLanes(const VM::program_t &program);
+
+    /** get the lane holding the values of a variable */
+    float* getLane(uint32_t varIdx)
+    {
+        return &m_lanes[varIdx*m_stride];
+    }
+
+    /** release the state of the channels */
+    void releaseState();
+
+    VM::program_t   m_program;          // VM byte code
+    VM::program_t   m_controlProgram;   // byte code of the control-rate statements
+    bool            m_controlDirty;     // true if the control program must be executed
+    VM::variables_t m_vars;             // names and initial values of the variables
+    uint32_t        m_channels;
+    uint32_t        m_stride;           // floats per lane, a multiple of VM_CHANNELALIGN
+
+    std::vector<float>          m_lanes;        // one lane per variable
+    std::vector<float>          m_stackLanes;   // one lane per stack entry
+    std::vector<const float*>   m_stackPtrs;    // vector stack of lane pointers
+    std::vector<float>          m_coefficients; // biquad coefficients of one channel
+
+    const VectorMath::kernels_t *m_vmath;       // kernels for the precision of the program
+
+    // the state of the stateful functions, per channel
+    std::vector<StateArena*>                m_arenas;
+    std::vector<ProgramInstance::state_t>   m_state;
+
+    int32_t     m_ioIdx[6];             // in, inl, inr, out, outl, outr or -1
+    int32_t     m_sliderIdx[4];         // slider1..4 or -1
+
+private:
+    MultiInstance(const MultiInstance &);
+    MultiInstance& operator=(const MultiInstance &);
+};
+
+#endif
@@ -0,0 +1,558 @@
+/*
+
+  Description:  Translate the AST of a BasicDSP program
+                into C, compile it with the system compiler
+                and load the result as a shared library.
+
+  License: GPLv2
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QStringList>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#if QT_VERSION >= 0x050000
+#include <QStandardPaths>
+#endif
+#include "functiondefs.h"
+#include "asttovm.h"
+#include "nativecompiler.h"
+
+#define NATIVE_FUNCTION "basicdsp_block"
+
+// time allowed for the compiler to finish, in milliseconds
+#define NATIVE_COMPILE_TIMEOUT 60000
+
+/* Prologue of the generated source. The helpers
+   evaluate the same expressions as the interpreter.
+*/
+static const char g_prologue[] =
+    "#include <math.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <stdint.h>\n"
+    "\n"
+    "#ifdef _WIN32\n"
+    "#define BDSP_EXPORT __declspec(dllexport)\n"
+    "#else\n"
+    "#define BDSP_EXPORT\n"
+    "#endif\n"
+    "\n"
+    "static inline float bdsp_limit(float x)\n"
+    "{\n"
+    "    x = (1.0f < x) ? 1.0f : x;\n"
+    "    return (x < -1.0f) ? -1.0f : x;\n"
+    "}\n"
+    "\n"
+    "static inline float bdsp_sign(float x)\n"
+    "{\n"
+    "    return (x >= 0.0f) ? 1.0f : -1.0f;\n"
+    "}\n"
+    "\n"
+    "/* infinities and NaNs from constant folding. the C compiler\n"
+    "   must not fold them in turn: it does not give a NaN the sign\n"
+    "   that the FPU gives it at run time. */\n"
+    "static inline float bdsp_bits(uint32_t bits)\n"
+    "{\n"
+    "    volatile union { uint32_t u; float f; } v;\n"
+    "    v.u = bits;\n"
+    "    return v.f;\n"
+    "}\n"
+    "\n"
+    "\n";
+
+/** returns the exact C representation of a float literal.
+    constant folding turns 1/0 into an infinity and 0/0 into
+    a NaN, which have no literal of their own in C. */
+static std::string floatLiteral(float value)
+{
+    char buffer[64];
+    if (!std::isfinite(value))
+    {
+        // the sign and payload of a NaN are kept
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        snprintf(buffer, sizeof(buffer), "bdsp_bits(0x%08Xu)", bits);
+        return std::string(buffer);
+    }
+
+    snprintf(buffer, sizeof(buffer), "%af", static_cast<double>(value));
+    return std::string(buffer);
+}
+
+/** returns the C name of a variable */
+static std::string varName(int32_t idx)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "v%d", idx);
+    return std::string(buffer);
+}
+
+NativeCompiler::NativeCompiler()
+    : m_function(NULL),
+      m_cached(false)
+{
+}
+
+NativeCompiler::~NativeCompiler()
+{
+    if (m_library.isLoaded())
+    {
+        m_library.unload();
+    }
+}
+
+bool NativeCompiler::generateNode(const ASTNode *node,
+                                  const VM::variables_t &variables,
+                                  std::string &code,
+                                  uint32_t &temps,
+                                  uint32_t &noise,
+                                  uint32_t &filters,
+                                  uint32_t &biquads,
+                                  uint32_t &convs,
+                                  std::string &result)
+{
+    if (node == 0)
+        return false;
+
+    std::string expr;
+    std::string op;
+    if ((node->type == ASTNode::NodeFunction) && (node->functionID == P_firfilter))
+    {
+        // the coefficients are part of the filter, and the
+        // filter is numbered after the ones in its input
+        if (node->function_args.empty() ||
+            !generateNode(node->function_args[0], variables, code, temps, noise, filters, biquads, convs, op))
+            return false;
+
+        expr = "fir(context, " + std::to_string(filters++) + "u, " + op + ")";
+        char name[32];
+        snprintf(name, sizeof(name), "t%u", temps++);
+        result = name;
+        code += "            const float " + result + " = " + expr + ";\n";
+        return true;
+    }
+
+    if ((node->type == ASTNode::NodeFunction) && (node->functionID == P_convolve))
+    {
+        // the impulse response is part of the convolver
+        if (node->function_args.empty() ||
+            !generateNode(node->function_args[0], variables, code, temps, noise, filters, biquads, convs, op))
+            return false;
+
+        expr = "conv(context, " + std::to_string(convs++) + "u, " + op + ")";
+        char name[32];
+        snprintf(name, sizeof(name), "t%u", temps++);
+        result = name;
+        code += "            const float " + result + " = " + expr + ";\n";
+        return true;
+    }
+
+    if ((node->type == ASTNode::NodeFunction) && (node->functionID == P_biquadfilter))
+    {
+        // changing coefficients are passed as an array,
+        // fixed ones are part of the filter
+        VM::biquad_t biquad;
+        if (!ASTToVM::getBiquad(node, biquad) ||
+            !generateNode(node->function_args[0], variables, code, temps, noise, filters, biquads, convs, op))
+            return false;
+
+        std::string coefficients = "NULL";
+        if (biquad.dynamic)
+        {
+            std::string values;
+            for(size_t i=1; i<node->function_args.size(); i++)
+            {
+                std::string value;
+                if (!generateNode(node->function_args[i], variables, code, temps, noise, filters, biquads, convs, value))
+                    return false;
+                values += ((i > 1) ? ", " : "") + value;
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "t%u", temps++);
+            coefficients = name;
+            code += "            const float " + coefficients + "[] = {" + values + "};\n";
+        }
+
+        expr = "biquad(context, " + std::to_string(biquads++) + "u, " + op + ", " + coefficients + ")";
+        char name[32];
+        snprintf(name, sizeof(name), "t%u", temps++);
+        result = name;
+        code += "            const float " + result + " = " + expr + ";\n";
+        return true;
+    }
+
+    // operands are evaluated in the same order
+    // as ASTToVM::convertNode pushes them
+    std::vector<std::string> ops;
+    if (node->left != 0)
+    {
+        if (!generateNode(node->left, variables, code, temps, noise, filters, biquads, convs, op))
+            return false;
+        ops.push_back(op);
+    }
+    if (node->right != 0)
+    {
+        if (!generateNode(node->right, variables, code, temps, noise, filters, biquads, convs, op))
+            return false;
+        ops.push_back(op);
+    }
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        if (!generateNode(node->function_args[i], variables, code, temps, noise, filters, biquads, convs, op))
+            return false;
+        ops.push_back(op);
+    }
+
+    switch(node->type)
+    {
+    case ASTNode::NodeFloat:
+        result = floatLiteral(node->info.floatVal);
+        return true;
+    case ASTNode::NodeInteger:
+        result = floatLiteral(static_cast<float>(node->info.intVal));
+        return true;
+    case ASTNode::NodeIdent:
+        {
+            int32_t idx = VM::findVariableByName(variables, node->info.txt);
+            if (idx == -1)
+                return false;
+            result = varName(idx);
+        }
+        return true;
+    case ASTNode::NodeAdd:
+    case ASTNode::NodeSub:
+    case ASTNode::NodeMul:
+    case ASTNode::NodeDiv:
+        {
+            if (ops.size() != 2)
+                return false;
+            const char *symbol = " + ";
+            if (node->type == ASTNode::NodeSub) symbol = " - ";
+            if (node->type == ASTNode::NodeMul) symbol = " * ";
+            if (node->type == ASTNode::NodeDiv) symbol = " / ";
+            expr = ops[0] + symbol + ops[1];
+        }
+        break;
+    case ASTNode::NodeUnaryMinus:
+        if (ops.size() != 1)
+            return false;
+        expr = "-(" + ops[0] + ")";
+        break;
+    case ASTNode::NodeFunction:
+        {
+            int32_t nargs = functionDefs::getNumberOfArguments(node->functionID);
+            if ((nargs < 0) || (ops.size() != static_cast<size_t>(nargs)))
+                return false;
+
+            switch(node->functionID)
+            {
+            case P_sin:   expr = "sinf(" + ops[0] + ")"; break;
+            case P_cos:   expr = "cosf(" + ops[0] + ")"; break;
+            case P_tan:   expr = "tanf(" + ops[0] + ")"; break;
+            case P_tanh:  expr = "tanhf(" + ops[0] + ")"; break;
+            case P_sin1:  expr = "sin(2.0f*BDSP_PI*" + ops[0] + ")"; break;
+            case P_cos1:  expr = "cos(2.0f*BDSP_PI*" + ops[0] + ")"; break;
+            case P_mod1:  expr = ops[0] + " - (int)" + ops[0]; break;
+            case P_abs:   expr = "fabsf(" + ops[0] + ")"; break;
+            case P_sqrt:  expr = "sqrtf(" + ops[0] + ")"; break;
+            case P_round: expr = "roundf(" + ops[0] + ")"; break;
+            case P_trunc: expr = "truncf(" + ops[0] + ")"; break;
+            case P_ceil:  expr = "ceilf(" + ops[0] + ")"; break;
+            case P_floor: expr = "floorf(" + ops[0] + ")"; break;
+            case P_pow:   expr = "powf(" + ops[0] + ", " + ops[1] + ")"; break;
+            case P_atan2: expr = "atan2f(" + ops[0] + ", " + ops[1] + ")"; break;
+            case P_limit: expr = "bdsp_limit(" + ops[0] + ")"; break;
+            case P_sign:  expr = "bdsp_sign(" + ops[0] + ")"; break;
+            case P_noise:
+            case P_gaussnoise:
+            case P_pinknoise:
+                expr = "noise(context, " + std::to_string(noise++) + "u)";
+                break;
+            default:
+                qDebug() << "NativeCompiler: unsupported function" << node->functionID;
+                return false;
+            }
+        }
+        break;
+    default:
+        return false;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "t%u", temps++);
+    result = name;
+    code += "            const float " + result + " = " + expr + ";\n";
+    return true;
+}
+
+bool NativeCompiler::generateSource(const statements_t &s,
+                                    const VM::variables_t &variables,
+                                    std::string &source)
+{
+    source = g_prologue;
+
+    // the interpreter uses M_PI in double precision
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "#define BDSP_PI %a\n\n", static_cast<double>(M_PI));
+    source += buffer;
+
+    source += "BDSP_EXPORT void " NATIVE_FUNCTION "(float *vars,\n"
+              "    const float *inLeft, const float *inRight,\n"
+              "    float *out, float *scope, float *spectrum,\n"
+              "    const int32_t *monitorIdx,\n"
+              "    float (*noise)(void *context, uint32_t n),\n"
+              "    float (*fir)(void *context, uint32_t n, float x),\n"
+              "    float (*biquad)(void *context, uint32_t n, float x, const float *coefficients),\n"
+              "    float (*conv)(void *context, uint32_t n, float x),\n"
+              "    void *context,\n"
+              "    uint32_t frames)\n"
+              "{\n";
+
+    // load the variables into locals
+    const int32_t nvars = variables.size();
+    for(int32_t i=0; i<nvars; i++)
+    {
+        source += "    float " + varName(i) + " = vars[" + std::to_string(i) + "]; /* "
+                + variables[i].name + " */\n";
+    }
+
+    source += "\n    for(uint32_t i=0; i<frames; i++)\n    {\n";
+
+    // inputs
+    int32_t in  = VM::findVariableByName(variables, "in");
+    int32_t inl = VM::findVariableByName(variables, "inl");
+    int32_t inr = VM::findVariableByName(variables, "inr");
+    if (in != -1)
+        source += "        " + varName(in) + " = (inLeft[i] + inRight[i]) / 2.0f;\n";
+    if (inl != -1)
+        source += "        " + varName(inl) + " = inLeft[i];\n";
+    if (inr != -1)
+        source += "        " + varName(inr) + " = inRight[i];\n";
+
+    // statements
+    uint32_t noise = 0;
+    uint32_t filters = 0;
+    uint32_t biquads = 0;
+    uint32_t convs = 0;
+    for(size_t i=0; i<s.size(); i++)
+    {
+        const ASTNode *node = s[i];
+        if ((node == 0) || (node->type != ASTNode::NodeAssign) || (node->right == 0))
+            return false;
+
+        int32_t idx = VM::findVariableByName(variables, node->info.txt);
+        if (idx == -1)
+            return false;
+
+        std::string code;
+        std::string result;
+        uint32_t temps = 0;
+        if (!generateNode(node->right, variables, code, temps, noise, filters, biquads, convs, result))
+            return false;
+
+        source += "        {\n" + code + "            " + varName(idx) + " = " + result + ";\n        }\n";
+    }
+
+    // outputs
+    int32_t out  = VM::findVariableByName(variables, "out");
+    int32_t outl = VM::findVariableByName(variables, "outl");
+    int32_t outr = VM::findVariableByName(variables, "outr");
+    std::string left = "0.0f";
+    std::string right = "0.0f";
+    if (out != -1)
+    {
+        left = varName(out);
+        right = left;
+    }
+    else
+    {
+        if (outl != -1)
+            left = varName(outl);
+        if (outr != -1)
+            right = varName(outr);
+    }
+    source += "        out[i<<1] = " + left + ";\n";
+    source += "        out[(i<<1)+1] = " + right + ";\n";
+
+    // monitors
+    const char *monitors[4] = {"scope[i<<1]", "scope[(i<<1)+1]",
+                               "spectrum[i<<1]", "spectrum[(i<<1)+1]"};
+    for(uint32_t m=0; m<4; m++)
+    {
+        snprintf(buffer, sizeof(buffer), "        switch(monitorIdx[%u])\n        {\n", m);
+        source += buffer;
+        for(int32_t i=0; i<nvars; i++)
+        {
+            source += "        case " + std::to_string(i) + ": " + monitors[m]
+                    + " = " + varName(i) + "; break;\n";
+        }
+        source += std::string("        default: ") + monitors[m] + " = 0.0f; break;\n        }\n";
+    }
+
+    source += "    }\n\n";
+
+    // store the variables
+    for(int32_t i=0; i<nvars; i++)
+    {
+        source += "    vars[" + std::to_string(i) + "] = " + varName(i) + ";\n";
+    }
+    source += "}\n";
+    return true;
+}
+
+QString NativeCompiler::getCacheDir()
+{
+#if QT_VERSION >= 0x050000
+    QString base = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+#else
+    QString base = QDir::homePath() + "/.basicdsp";
+#endif
+    if (base.isEmpty())
+    {
+        base = QDir::tempPath() + "/basicdsp";
+    }
+    return base + "/native";
+}
+
+bool NativeCompiler::runCompiler(const QString &compiler, const QStringList &args)
+{
+    QProcess process;
+    process.setProcessChannelMode(QProcess::MergedChannels);
+    process.start(compiler, args);
+    if (!process.waitForStarted())
+    {
+        qDebug() << "NativeCompiler: cannot start" << compiler;
+        return false;
+    }
+    if (!process.waitForFinished(NATIVE_COMPILE_TIMEOUT))
+    {
+        qDebug() << "NativeCompiler: compiler timed out";
+        process.kill();
+        return false;
+    }
+
+    QByteArray messages = process.readAll();
+    if ((process.exitStatus() != QProcess::NormalExit) || (process.exitCode() != 0))
+    {
+        qDebug() << "NativeCompiler: compilation failed";
+        qDebug() << messages.constData();
+        return false;
+    }
+    return true;
+}
+
+bool NativeCompiler::compile(const statements_t &s, const VM::variables_t &variables)
+{
+    if (m_library.isLoaded())
+    {
+        m_library.unload();
+    }
+    m_function = NULL;
+    m_cached = false;
+
+    std::string source;
+    if (!generateSource(s, variables, source))
+    {
+        qDebug() << "NativeCompiler: program cannot be translated";
+        return false;
+    }
+
+    QString compiler = qgetenv("BASICDSP_CC");
+    if (compiler.isEmpty())
+    {
+        compiler = qgetenv("CC");
+    }
+    if (compiler.isEmpty())
+    {
+        compiler = "cc";
+    }
+
+    // FMA contraction would change the results, and calls to the
+    // transcendental functions must not be folded at compile time
+    // as the interpreter evaluates them with the C library.
+    QStringList flags;
+    flags << "-O3" << "-march=native" << "-ffp-contract=off"
+          << "-fno-builtin-sinf" << "-fno-builtin-cosf" << "-fno-builtin-tanf"
+          << "-fno-builtin-tanhf" << "-fno-builtin-powf" << "-fno-builtin-atan2f"
+          << "-fno-builtin-sin" << "-fno-builtin-cos"
+          << "-fPIC" << "-shared";
+
+    // the cache key covers everything that affects the library
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(compiler.toUtf8());
+    hash.addData(flags.join(" ").toUtf8());
+    hash.addData(source.c_str(), source.size());
+    QString key = QString(hash.result().toHex());
+
+    QDir dir(getCacheDir());
+    if (!dir.exists() && !dir.mkpath("."))
+    {
+        qDebug() << "NativeCompiler: cannot create" << dir.path();
+        return false;
+    }
+
+#ifdef _WIN32
+    QString libName = dir.filePath(key + ".dll");
+#else
+    QString libName = dir.filePath(key + ".so");
+#endif
+
+    m_cached = QFileInfo(libName).exists();
+    if (!m_cached)
+    {
+        // compile under a unique name and rename the result,
+        // so a concurrent instance never loads a partial file
+        QString unique = QString("%1.%2").arg(key).arg(QCoreApplication::applicationPid());
+        QString srcName = dir.filePath(unique + ".c");
+        QString tmpName = dir.filePath(unique + ".tmp");
+
+        QFile srcFile(srcName);
+        if (!srcFile.open(QIODevice::WriteOnly))
+        {
+            qDebug() << "NativeCompiler: cannot write" << srcName;
+            return false;
+        }
+        srcFile.write(source.c_str(), source.size());
+        srcFile.close();
+
+        QStringList args = flags;
+        args << "-o" << tmpName << srcName << "-lm";
+        bool ok = runCompiler(compiler, args);
+        QFile::remove(srcName);
+        if (!ok)
+        {
+            QFile::remove(tmpName);
+            return false;
+        }
+        if (!QFile::rename(tmpName, libName))
+        {
+            // another instance was first
+            QFile::remove(tmpName);
+        }
+    }
+
+    m_library.setFileName(libName);
+    if (!m_library.load())
+    {
+        qDebug() << "NativeCompiler: cannot load" << libName;
+        return false;
+    }
+
+    m_function = reinterpret_cast<blockfunc_t>(m_library.resolve(NATIVE_FUNCTION));
+    if (m_function == NULL)
+    {
+        qDebug() << "NativeCompiler: " NATIVE_FUNCTION " not found in" << libName;
+        m_library.unload();
+        return false;
+    }
+    return true;
+}
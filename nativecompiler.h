@@ -0,0 +1,126 @@
+/*
+
+  Description:  Translate the AST of a BasicDSP program
+                into C, compile it with the system compiler
+                and load the result as a shared library.
+
+  License: GPLv2
+
+*/
+
+#ifndef nativecompiler_h
+#define nativecompiler_h
+
+#include <stdint.h>
+#include <string>
+#include <QString>
+#include <QStringList>
+#include <QLibrary>
+#include "virtualmachine.h"
+#include "parser.h"
+
+/** The native compiler turns a program into a C function that
+    processes a whole block of samples, with the variables held
+    in locals. The C code evaluates the same expressions in the
+    same order as the interpreter and is compiled without FMA
+    contraction, so the results are bit-identical.
+
+    Compiled libraries are cached on disk, keyed by a hash of
+    the generated source and the compiler command line, so a
+    known program is loaded without invoking the compiler.
+
+    The compiler is taken from the BASICDSP_CC or CC environment
+    variable and defaults to 'cc'.
+*/
+class NativeCompiler
+{
+public:
+    /** block function exported by the compiled library.
+        vars      - variable values, updated at the end of the block.
+        inLeft    - left input samples.
+        inRight   - right input samples.
+        out       - interleaved stereo output.
+        scope     - interleaved scope monitor samples.
+        spectrum  - interleaved spectrum monitor samples.
+        monitorIdx- variable index of the four monitors, or -1.
+        noise     - returns the next value of noise generator n,
+                    numbered like the noise functions of the VM program.
+        fir       - filters a sample with FIR filter n, numbered
+                    like the filters of the VM program.
+        biquad    - filters a sample with biquad filter n, after
+                    changing its coefficients unless they are NULL.
+        conv      - filters a sample with convolver n.
+        context   - first argument of 'noise', 'fir', 'biquad' and 'conv'.
+        frames    - number of frames to process.
+    */
+    typedef void (*blockfunc_t)(float *vars,
+                                const float *inLeft,
+                                const float *inRight,
+                                float *out,
+                                float *scope,
+                                float *spectrum,
+                                const int32_t *monitorIdx,
+                                float (*noise)(void *context, uint32_t n),
+                                float (*fir)(void *context, uint32_t n, float x),
+                                float (*biquad)(void *context, uint32_t n, float x,
+                                                const float *coefficients),
+                                float (*conv)(void *context, uint32_t n, float x),
+                                void *context,
+                                uint32_t frames);
+
+    NativeCompiler();
+    virtual ~NativeCompiler();
+
+    /** generate the C source of the block function.
+        returns false if the program contains unsupported operations. */
+    static bool generateSource(const statements_t &s,
+                               const VM::variables_t &variables,
+                               std::string &source);
+
+    /** generate, compile and load the program, using
+        the disk cache when possible. returns false on error. */
+    bool compile(const statements_t &s, const VM::variables_t &variables);
+
+    /** returns the block function, or NULL if nothing is loaded */
+    blockfunc_t getFunction() const
+    {
+        return m_function;
+    }
+
+    /** returns true if the last call to compile() used the cache */
+    bool isCached() const
+    {
+        return m_cached;
+    }
+
+    /** returns the directory where compiled programs are stored */
+    static QString getCacheDir();
+
+protected:
+    /** generate C code for an expression. Every operation is
+        assigned to a new temporary, so side effects happen in
+        the same order as in the interpreter. The name of the
+        result is returned in 'result'. 'noise' counts the noise
+        functions, 'filters' the calls of fir(), 'biquads' those
+        of biquad() and 'convs' those of conv(), to number their
+        generators and filters. */
+    static bool generateNode(const ASTNode *node,
+                             const VM::variables_t &variables,
+                             std::string &code,
+                             uint32_t &temps,
+                             uint32_t &noise,
+                             uint32_t &filters,
+                             uint32_t &biquads,
+                             uint32_t &convs,
+                             std::string &result);
+
+    /** run the compiler. returns false on error. */
+    static bool runCompiler(const QString &compiler,
+                            const QStringList &args);
+
+    QLibrary    m_library;
+    blockfunc_t m_function;
+    bool        m_cached;
+};
+
+#endif
@@ -0,0 +1,86 @@
+/*
+
+  Description:  Seedable generators of uniform, Gaussian
+                and pink noise.
+
+  License: GPLv2
+
+*/
+
+#include <math.h>
+#include "noisegenerator.h"
+
+/** splitmix64, used to expand the seed into the generator state */
+static uint64_t splitmix64(uint64_t &state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+NoiseGenerator::NoiseGenerator()
+{
+    init(NOISE_UNIFORM, 1, 0);
+}
+
+void NoiseGenerator::init(type_t type, uint32_t seed, uint32_t stream)
+{
+    uint64_t state = (static_cast<uint64_t>(seed) << 32) | stream;
+    uint64_t a = splitmix64(state);
+    uint64_t b = splitmix64(state);
+    m_s[0] = static_cast<uint32_t>(a);
+    m_s[1] = static_cast<uint32_t>(a >> 32);
+    m_s[2] = static_cast<uint32_t>(b);
+    m_s[3] = static_cast<uint32_t>(b >> 32);
+
+    // the all-zero state is the only one that
+    // xoshiro cannot leave
+    if ((m_s[0] | m_s[1] | m_s[2] | m_s[3]) == 0)
+    {
+        m_s[0] = 1;
+    }
+
+    m_type = type;
+    m_hasSpare = false;
+    m_spare = 0.0f;
+    for(uint32_t i=0; i<7; i++)
+    {
+        m_pink[i] = 0.0f;
+    }
+}
+
+float NoiseGenerator::gaussian()
+{
+    if (m_hasSpare)
+    {
+        m_hasSpare = false;
+        return m_spare;
+    }
+
+    // u is in (0, 1] so the logarithm is finite
+    const float u = static_cast<float>((random32() >> 8) + 1) * (1.0f/16777216.0f);
+    const float phi = static_cast<float>(random32() >> 8) * (6.2831853f/16777216.0f);
+    const float r = sqrtf(-2.0f*logf(u));
+    m_spare = r*sinf(phi);
+    m_hasSpare = true;
+    return r*cosf(phi);
+}
+
+void NoiseGenerator::generate(float *dst, uint32_t n)
+{
+    // one switch per block, the loops
+    // inline the generator
+    switch(m_type)
+    {
+    case NOISE_GAUSSIAN:
+        for(uint32_t i=0; i<n; i++) dst[i] = gaussian();
+        break;
+    case NOISE_PINK:
+        for(uint32_t i=0; i<n; i++) dst[i] = pink();
+        break;
+    default:
+        for(uint32_t i=0; i<n; i++) dst[i] = uniform();
+        break;
+    }
+}
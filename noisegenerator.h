@@ -0,0 +1,116 @@
+/*
+
+  Description:  Seedable generators of uniform, Gaussian
+                and pink noise.
+
+  License: GPLv2
+
+*/
+
+#ifndef noisegenerator_h
+#define noisegenerator_h
+
+#include <stdint.h>
+
+// scales the output of the pink noise filter to an RMS of about 0.2
+#define NOISE_PINK_GAIN 0.11f
+
+/** A noise generator produces white noise with a uniform or
+    Gaussian distribution, or pink noise, from a xoshiro128+
+    pseudo-random number generator.
+
+    The generators are cheap to copy and have no shared state,
+    so a virtual machine gives every noise function of a program
+    its own generator. The sequence of a generator depends only
+    on its seed and stream number, so a program produces the
+    same noise in every engine, in block mode and on every run.
+
+      uniform  - uniformly distributed in [-1, 1).
+      gaussian - normally distributed with zero mean and unit
+                 variance, by the Box-Muller transform.
+      pink     - uniform noise filtered with Paul Kellet's
+                 approximation of a -3 dB/octave slope, with an
+                 RMS value of about 0.2 so the peaks stay within
+                 [-1, 1] in practice.
+*/
+class NoiseGenerator
+{
+public:
+    enum type_t {NOISE_UNIFORM, NOISE_GAUSSIAN, NOISE_PINK};
+
+    NoiseGenerator();
+
+    /** restart the generator. generators with the same seed
+        but different stream numbers are independent. */
+    void init(type_t type, uint32_t seed, uint32_t stream);
+
+    type_t getType() const
+    {
+        return m_type;
+    }
+
+    /** returns the next value */
+    inline float next()
+    {
+        switch(m_type)
+        {
+        case NOISE_GAUSSIAN:
+            return gaussian();
+        case NOISE_PINK:
+            return pink();
+        default:
+            return uniform();
+        }
+    }
+
+    /** fill dst with the next n values. the result is
+        the same as calling next() n times. */
+    void generate(float *dst, uint32_t n);
+
+protected:
+    inline uint32_t random32()
+    {
+        const uint32_t result = m_s[0] + m_s[3];
+        const uint32_t t = m_s[1] << 9;
+        m_s[2] ^= m_s[0];
+        m_s[3] ^= m_s[1];
+        m_s[1] ^= m_s[2];
+        m_s[0] ^= m_s[3];
+        m_s[2] ^= t;
+        m_s[3] = (m_s[3] << 11) | (m_s[3] >> 21);
+        return result;
+    }
+
+    /** uniform in [-1, 1), from the upper 25 bits, which
+        are the best bits of xoshiro128+ */
+    inline float uniform()
+    {
+        int32_t r = static_cast<int32_t>(random32() >> 7) - 16777216;
+        return static_cast<float>(r) * (1.0f/16777216.0f);
+    }
+
+    float gaussian();
+
+    inline float pink()
+    {
+        const float white = uniform();
+        m_pink[0] = 0.99886f*m_pink[0] + white*0.0555179f;
+        m_pink[1] = 0.99332f*m_pink[1] + white*0.0750759f;
+        m_pink[2] = 0.96900f*m_pink[2] + white*0.1538520f;
+        m_pink[3] = 0.86650f*m_pink[3] + white*0.3104856f;
+        m_pink[4] = 0.55000f*m_pink[4] + white*0.5329522f;
+        m_pink[5] = -0.7616f*m_pink[5] - white*0.0168980f;
+        float sum = m_pink[0] + m_pink[1] + m_pink[2] + m_pink[3] + m_pink[4]
+                  + m_pink[5] + m_pink[6] + white*0.5362f;
+        m_pink[6] = white*0.115926f;
+        return sum*NOISE_PINK_GAIN;
+    }
+
+    uint32_t    m_s[4];         // xoshiro128+ state
+    type_t      m_type;
+    bool        m_hasSpare;     // the Box-Muller transform makes pairs
+    float       m_spare;
+    float       m_pink[7];      // state of the pink noise filter
+};
+
+#endif
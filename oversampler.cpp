@@ -0,0 +1,371 @@
+/*
+
+  Description:  Expansion of oversampled regions into
+                statements at the rate of the program.
+
+  License: GPLv2
+
+*/
+
+#include <math.h>
+#include <sstream>
+#include <algorithm>
+#include "virtualmachine.h"
+#include "functiondefs.h"
+#include "oversampler.h"
+
+// Kaiser window for a stopband of 80 dB: 0.1102*(80 - 8.7)
+#define OVERSAMPLE_BETA 7.857
+
+// length of the half-band filter of each doubling of the rate.
+// the first one has the narrowest transition band, the later
+// ones only have to remove the images of the earlier stages.
+static const uint32_t g_halfbandLength[] = {47, 19, 15};
+
+/** zeroth-order modified Bessel function of the first kind */
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for(uint32_t k=1; k<50; k++)
+    {
+        term *= (x / (2.0*k)) * (x / (2.0*k));
+        sum += term;
+        if (term < sum*1e-17)
+        {
+            break;
+        }
+    }
+    return sum;
+}
+
+bool Oversampler::isSupported(uint32_t factor)
+{
+    return (factor == 2) || (factor == 4) || (factor == 8);
+}
+
+void Oversampler::getFilter(uint32_t factor, std::vector<double> &h)
+{
+    h.assign(1, 1.0);
+
+    // stage s doubles the rate from factor/2^(s+1) to factor/2^s
+    // times that of the program, so at the oversampled rate
+    // its coefficients are 'spacing' samples apart.
+    uint32_t spacing = factor;
+    for(uint32_t stage=0; (spacing > 1) && (stage < 3); stage++)
+    {
+        spacing /= 2;
+        const uint32_t length = g_halfbandLength[stage];
+        const double center = 0.5*(length - 1);
+        const double norm = 1.0 / besselI0(OVERSAMPLE_BETA);
+
+        // a half-band filter is zero at the even
+        // distances from its center, but the center
+        std::vector<double> halfband((length-1)*spacing + 1, 0.0);
+        for(uint32_t n=0; n<length; n++)
+        {
+            const double t = n - center;
+            const double sinc = (t == 0.0) ? 1.0 : sin(0.5*M_PI*t) / (0.5*M_PI*t);
+            const double r = t / center;
+            const double window = besselI0(OVERSAMPLE_BETA*sqrt(std::max(0.0, 1.0 - r*r))) * norm;
+            halfband[n*spacing] = 0.5 * sinc * window;
+        }
+
+        std::vector<double> cascade(h.size() + halfband.size() - 1, 0.0);
+        for(size_t i=0; i<h.size(); i++)
+        {
+            for(size_t j=0; j<halfband.size(); j++)
+            {
+                cascade[i+j] += h[i]*halfband[j];
+            }
+        }
+        h.swap(cascade);
+    }
+
+    double sum = 0.0;
+    for(size_t i=0; i<h.size(); i++)
+    {
+        sum += h[i];
+    }
+    for(size_t i=0; i<h.size(); i++)
+    {
+        h[i] /= sum;
+    }
+}
+
+std::vector<float> Oversampler::getPhase(const std::vector<double> &h, uint32_t factor,
+                                         uint32_t p, double gain)
+{
+    std::vector<float> taps;
+    for(size_t k=p; k<h.size(); k+=factor)
+    {
+        taps.push_back(static_cast<float>(gain*h[k]));
+    }
+    while((taps.size() > 1) && (taps.back() == 0.0f))
+    {
+        taps.pop_back();
+    }
+    return taps;
+}
+
+void Oversampler::collectReads(const ASTNode *node, std::set<std::string> &reads)
+{
+    if (node == 0)
+        return;
+
+    if (node->type == ASTNode::NodeIdent)
+        reads.insert(node->info.txt);
+
+    collectReads(node->left, reads);
+    collectReads(node->right, reads);
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        collectReads(node->function_args[i], reads);
+    }
+}
+
+bool Oversampler::hasFilter(const ASTNode *node)
+{
+    if (node == 0)
+        return false;
+
+    if ((node->type == ASTNode::NodeFunction) && functionDefs::isFilter(node->functionID))
+        return true;
+
+    bool found = hasFilter(node->left) || hasFilter(node->right);
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        found = found || hasFilter(node->function_args[i]);
+    }
+    return found;
+}
+
+ASTNode* Oversampler::cloneNode(const ASTNode *node,
+                                const std::map<std::string, ASTNode*> &names)
+{
+    if (node == 0)
+        return 0;
+
+    if (node->type == ASTNode::NodeIdent)
+    {
+        std::map<std::string, ASTNode*>::const_iterator iter = names.find(node->info.txt);
+        if (iter != names.end())
+        {
+            return cloneNode(iter->second, std::map<std::string, ASTNode*>());
+        }
+    }
+
+    ASTNode *copy = new ASTNode(node->type);
+    copy->info = node->info;
+    copy->functionID = node->functionID;
+    copy->left = cloneNode(node->left, names);
+    copy->right = cloneNode(node->right, names);
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        copy->function_args.push_back(cloneNode(node->function_args[i], names));
+    }
+    return copy;
+}
+
+ASTNode* Oversampler::makeFilters(const std::string &name,
+                                  const std::vector<std::string> &inputs,
+                                  const std::vector< std::vector<float> > &taps)
+{
+    ASTNode *sum = 0;
+    for(size_t i=0; i<inputs.size(); i++)
+    {
+        ASTNode *fir = new ASTNode(ASTNode::NodeFunction);
+        fir->info.txt = "fir";
+        fir->functionID = P_firfilter;
+
+        ASTNode *input = new ASTNode(ASTNode::NodeIdent);
+        input->info.txt = inputs[i];
+        fir->function_args.push_back(input);
+        for(size_t k=0; k<taps[i].size(); k++)
+        {
+            ASTNode *tap = new ASTNode(ASTNode::NodeFloat);
+            tap->info.floatVal = taps[i][k];
+            fir->function_args.push_back(tap);
+        }
+
+        if (sum == 0)
+        {
+            sum = fir;
+        }
+        else
+        {
+            ASTNode *add = new ASTNode(ASTNode::NodeAdd);
+            add->left = sum;
+            add->right = fir;
+            sum = add;
+        }
+    }
+
+    ASTNode *assign = new ASTNode(ASTNode::NodeAssign);
+    assign->info.txt = name;
+    assign->right = sum;
+    return assign;
+}
+
+bool Oversampler::expand(statements_t &region, uint32_t factor, uint32_t number,
+                         const std::set<std::string> &usedOutside,
+                         const std::set<std::string> &held,
+                         statements_t &result, std::string &error)
+{
+    if (!isSupported(factor))
+    {
+        error = "The oversampling factor must be 2, 4 or 8";
+        return false;
+    }
+
+    // the variables of the region, in the order of the program
+    std::vector<std::string> inputs;
+    std::vector<std::string> assigned;
+    std::set<std::string> assignedSet;
+    for(size_t i=0; i<region.size(); i++)
+    {
+        if (hasFilter(region[i]->right))
+        {
+            error = "fir(), biquad() and conv() cannot be used in an oversampled region";
+            return false;
+        }
+        if (assignedSet.insert(region[i]->info.txt).second)
+        {
+            assigned.push_back(region[i]->info.txt);
+        }
+    }
+
+    std::set<std::string> seen;
+    for(size_t i=0; i<region.size(); i++)
+    {
+        std::set<std::string> reads;
+        collectReads(region[i]->right, reads);
+        for(std::set<std::string>::const_iterator iter = reads.begin(); iter != reads.end(); ++iter)
+        {
+            // the sliders and samplerate only change between blocks
+            const std::string &name = *iter;
+            const bool constant = (name == "slider1") || (name == "slider2") ||
+                                  (name == "slider3") || (name == "slider4") ||
+                                  (name == "samplerate") || (held.count(name) != 0);
+            if (!constant && (assignedSet.count(name) == 0) && seen.insert(name).second)
+            {
+                inputs.push_back(name);
+            }
+        }
+    }
+
+    std::vector<double> h;
+    getFilter(factor, h);
+
+    // names of the new variables: x~n is the oversampled
+    // signal of x in region n, x~n.j its sample j
+    std::stringstream ss;
+    ss << "~" << number;
+    const std::string suffix = ss.str();
+
+    // interpolate the inputs. the inserted zeros lower
+    // the gain by the factor, which the filters make up for.
+    for(size_t i=0; i<inputs.size(); i++)
+    {
+        for(uint32_t j=0; j<factor; j++)
+        {
+            std::stringstream name;
+            name << inputs[i] << suffix << "." << j;
+            std::vector< std::vector<float> > taps(1, getPhase(h, factor, j, factor));
+            result.push_back(makeFilters(name.str(), std::vector<std::string>(1, inputs[i]), taps));
+        }
+    }
+
+    // the variables that are decimated
+    std::vector<std::string> outputs;
+    for(size_t i=0; i<assigned.size(); i++)
+    {
+        const std::string &name = assigned[i];
+        if ((usedOutside.count(name) != 0) ||
+            (name == "out") || (name == "outl") || (name == "outr"))
+        {
+            outputs.push_back(name);
+        }
+    }
+
+    // inside the region samplerate is the oversampled rate
+    std::map<std::string, ASTNode*> names;
+    ASTNode *rate = new ASTNode(ASTNode::NodeMul);
+    rate->left = new ASTNode(ASTNode::NodeIdent);
+    rate->left->info.txt = "samplerate";
+    rate->right = new ASTNode(ASTNode::NodeFloat);
+    rate->right->info.floatVal = static_cast<float>(factor);
+    names["samplerate"] = rate;
+    for(size_t i=0; i<assigned.size(); i++)
+    {
+        ASTNode *ident = new ASTNode(ASTNode::NodeIdent);
+        ident->info.txt = assigned[i] + suffix;
+        names[assigned[i]] = ident;
+    }
+
+    // the statements once per oversampled sample. the last
+    // sample of an output stays in its oversampled variable.
+    for(uint32_t j=0; j<factor; j++)
+    {
+        for(size_t i=0; i<inputs.size(); i++)
+        {
+            std::stringstream name;
+            name << inputs[i] << suffix << "." << j;
+            delete names[inputs[i]];
+            names[inputs[i]] = new ASTNode(ASTNode::NodeIdent);
+            names[inputs[i]]->info.txt = name.str();
+        }
+
+        for(size_t i=0; i<region.size(); i++)
+        {
+            ASTNode *statement = new ASTNode(ASTNode::NodeAssign);
+            statement->info.txt = region[i]->info.txt + suffix;
+            statement->right = cloneNode(region[i]->right, names);
+            result.push_back(statement);
+        }
+
+        for(size_t i=0; (j+1 < factor) && (i<outputs.size()); i++)
+        {
+            std::stringstream name;
+            name << outputs[i] << suffix << "." << j;
+            ASTNode *statement = new ASTNode(ASTNode::NodeAssign);
+            statement->info.txt = name.str();
+            statement->right = new ASTNode(ASTNode::NodeIdent);
+            statement->right->info.txt = outputs[i] + suffix;
+            result.push_back(statement);
+        }
+    }
+
+    for(std::map<std::string, ASTNode*>::iterator iter = names.begin(); iter != names.end(); ++iter)
+    {
+        delete iter->second;
+    }
+
+    // decimate, keeping the last oversampled sample of
+    // every block: phase p of the filter applies to the
+    // sample p before it.
+    for(size_t i=0; i<outputs.size(); i++)
+    {
+        std::vector<std::string> samples;
+        std::vector< std::vector<float> > taps;
+        for(uint32_t p=0; p<factor; p++)
+        {
+            std::stringstream name;
+            name << outputs[i] << suffix;
+            if (p > 0)
+            {
+                name << "." << (factor-1-p);
+            }
+            samples.push_back(name.str());
+            taps.push_back(getPhase(h, factor, p, 1.0));
+        }
+        result.push_back(makeFilters(outputs[i], samples, taps));
+    }
+
+    for(size_t i=0; i<region.size(); i++)
+    {
+        delete region[i];
+    }
+    region.clear();
+    return true;
+}
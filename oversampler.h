@@ -0,0 +1,102 @@
+/*
+
+  Description:  Expansion of oversampled regions into
+                statements at the rate of the program.
+
+  License: GPLv2
+
+*/
+
+#ifndef oversampler_h
+#define oversampler_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "parser.h"
+
+// largest oversampling factor of a region
+#define OVERSAMPLE_MAXFACTOR 8
+
+/** An oversampled region is a list of statements that runs at
+    2, 4 or 8 times the rate of the program, so non-linear
+    functions such as tanh() alias less:
+
+      oversample 4
+      y = tanh(8*x)
+      end
+
+    The oversampler replaces a region by ordinary statements,
+    so every engine runs it without knowing about regions:
+
+    * every variable that the region reads but does not assign
+      is interpolated: sample j of the oversampled signal is
+      fir() of the variable with phase j of the lowpass filter.
+      The sliders, samplerate and the variables that only
+      depend on them are held instead.
+    * the statements are repeated once per oversampled sample.
+      The variables they assign are renamed, so they keep the
+      oversampled signal from one sample to the next.
+    * the variables that are used outside the region are
+      decimated: the sum of fir() of each oversampled sample
+      with the matching phase of the lowpass filter.
+
+    The lowpass filter is a cascade of half-band filters, one
+    per doubling of the rate, with a Kaiser window. Half of the
+    coefficients of a half-band filter are zero, and the
+    polyphase form skips them along with the inserted zeros:
+    one phase of each 2x stage is a plain delay.
+
+    Inside the region, samplerate is the oversampled rate.
+    The filters fir(), biquad() and conv() cannot be used in a
+    region, as every repetition of a statement would have its
+    own filter.
+*/
+class Oversampler
+{
+public:
+    /** returns true for the factors 2, 4 and 8 */
+    static bool isSupported(uint32_t factor);
+
+    /** get the lowpass filter of a factor at the oversampled rate,
+        with a gain of 1 at DC */
+    static void getFilter(uint32_t factor, std::vector<double> &h);
+
+    /** replace the statements of a region, which are deleted, by
+        equivalent statements in 'result'. 'number' makes the names
+        of the new variables unique, 'usedOutside' holds the names
+        of the variables that the rest of the program reads and
+        'held' those that only change with the sliders.
+        returns false with a description in 'error' if the region
+        cannot be oversampled. */
+    static bool expand(statements_t &region, uint32_t factor, uint32_t number,
+                       const std::set<std::string> &usedOutside,
+                       const std::set<std::string> &held,
+                       statements_t &result, std::string &error);
+
+    /** collect the names of the variables read by an expression */
+    static void collectReads(const ASTNode *node, std::set<std::string> &reads);
+
+protected:
+    /** copy an expression, renaming the variables in 'names' */
+    static ASTNode* cloneNode(const ASTNode *node,
+                              const std::map<std::string, ASTNode*> &names);
+
+    /** create the statement 'name = fir(input, taps...)', or a
+        sum of such filters for the phases in 'inputs' */
+    static ASTNode* makeFilters(const std::string &name,
+                                const std::vector<std::string> &inputs,
+                                const std::vector< std::vector<float> > &taps);
+
+    /** returns the taps of phase p of 'h' at 1/factor of its rate,
+        scaled by 'gain', without the trailing zeros */
+    static std::vector<float> getPhase(const std::vector<double> &h, uint32_t factor,
+                                       uint32_t p, double gain);
+
+    /** returns true if the expression calls a filter */
+    static bool hasFilter(const ASTNode *node);
+};
+
+#endif
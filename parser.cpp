@@ -9,8 +9,12 @@
 */
 
 #include <iostream>
+#include <fstream>
+#include <stdlib.h>
 #include "functiondefs.h"
 #include "parser.h"
+#include "oversampler.h"
+#include "rateanalyzer.h"
 
 Parser::Parser() : m_tokens(NULL)
 {
@@ -76,18 +80,35 @@ bool Parser::process(const std::vector<token_t> &tokens, statements_t &result)
 
 bool Parser::acceptProgram(state_t &s, statements_t &statements)
 {
-    // productions: assignment | NEWLINE | SEMICOL | EOF
+    // productions: region | assignment | NEWLINE | SEMICOL | EOF
 
     bool productionAccepted = true;
     token_t tok = getToken(s);
 
+    // the oversampled regions are expanded at the end,
+    // when it is known which of their variables are
+    // used by the rest of the program.
+    std::vector<region_t> regions;
 
     while(productionAccepted == true)
     {
         productionAccepted = false;
 
         ASTNode *node = 0;
-        if ((node=acceptAssignment(s)) != 0)
+        if (isOversample(s))
+        {
+            region_t region;
+            region.index = statements.size();
+            region.state = s;
+            if (!acceptOversample(s, region.statements, region.factor))
+            {
+                deleteRegions(regions);
+                return false;
+            }
+            regions.push_back(region);
+            productionAccepted = true;
+        }
+        else if ((node=acceptAssignment(s)) != 0)
         {
             productionAccepted = true;
             statements.push_back(node);
@@ -104,12 +125,142 @@ bool Parser::acceptProgram(state_t &s, statements_t &statements)
         }
         else if (match(s, TOK_EOF))
         {
-            return true;
+            return expandRegions(regions, statements);
         }
     }
+    deleteRegions(regions);
     return false;
 }
 
+bool Parser::isOversample(const state_t &s)
+{
+    token_t tok = getToken(s);
+    return (tok.tokID == TOK_IDENT) && (tok.txt == "oversample") &&
+           (getToken(s, 1).tokID != TOK_EQUAL);
+}
+
+bool Parser::acceptOversample(state_t &s, statements_t &region, uint32_t &factor)
+{
+    // production: 'oversample' INTEGER statement-list 'end'
+    next(s);
+    if (!match(s, TOK_INTEGER))
+    {
+        error(s, "Expected the oversampling factor: 2, 4 or 8");
+        return false;
+    }
+
+    factor = atoi(getToken(s, -1).txt.c_str());
+    if (!Oversampler::isSupported(factor))
+    {
+        error(s, "The oversampling factor must be 2, 4 or 8");
+        return false;
+    }
+
+    while(true)
+    {
+        token_t tok = getToken(s);
+        ASTNode *node = 0;
+        if ((tok.tokID == TOK_IDENT) && (tok.txt == "end") &&
+            (getToken(s, 1).tokID != TOK_EQUAL))
+        {
+            next(s);
+            return true;
+        }
+        else if (isOversample(s))
+        {
+            error(s, "Oversampled regions cannot be nested");
+            return false;
+        }
+        else if ((node=acceptAssignment(s)) != 0)
+        {
+            region.push_back(node);
+        }
+        else if (match(s, TOK_EOF))
+        {
+            error(s, "Expected 'end' after the oversampled statements");
+            return false;
+        }
+        else if (!match(s, TOK_NEWLINE) && !match(s, TOK_SEMICOL))
+        {
+            return false;
+        }
+    }
+}
+
+bool Parser::expandRegions(std::vector<region_t> &regions, statements_t &statements)
+{
+    if (regions.empty())
+    {
+        return true;
+    }
+
+    // the variables read by each region, and by the rest of the program
+    std::vector< std::set<std::string> > reads(regions.size());
+    std::set<std::string> programReads;
+    for(size_t i=0; i<statements.size(); i++)
+    {
+        Oversampler::collectReads(statements[i]->right, programReads);
+    }
+    for(size_t r=0; r<regions.size(); r++)
+    {
+        for(size_t i=0; i<regions[r].statements.size(); i++)
+        {
+            Oversampler::collectReads(regions[r].statements[i]->right, reads[r]);
+        }
+    }
+
+    // the control-rate variables that are assigned
+    // before a region are held instead of interpolated
+    std::vector<RateAnalyzer::rate_t> rates = RateAnalyzer::classify(statements);
+
+    statements_t result;
+    size_t copied = 0;
+    bool ok = true;
+    for(size_t r=0; r<regions.size(); r++)
+    {
+        result.insert(result.end(), statements.begin() + copied, statements.begin() + regions[r].index);
+        copied = regions[r].index;
+
+        std::set<std::string> usedOutside(programReads);
+        for(size_t k=0; k<regions.size(); k++)
+        {
+            if (k != r)
+                usedOutside.insert(reads[k].begin(), reads[k].end());
+        }
+
+        std::set<std::string> held;
+        for(size_t i=0; i<regions[r].index; i++)
+        {
+            if (rates[i] != RateAnalyzer::RATE_AUDIO)
+                held.insert(statements[i]->info.txt);
+        }
+
+        std::string message;
+        if (ok && !Oversampler::expand(regions[r].statements, regions[r].factor, r+1,
+                                       usedOutside, held, result, message))
+        {
+            error(regions[r].state, message);
+            ok = false;
+        }
+    }
+    result.insert(result.end(), statements.begin() + copied, statements.end());
+    statements.swap(result);
+    deleteRegions(regions);
+    return ok;
+}
+
+void Parser::deleteRegions(std::vector<region_t> &regions)
+{
+    for(size_t r=0; r<regions.size(); r++)
+    {
+        for(size_t i=0; i<regions[r].statements.size(); i++)
+        {
+            delete regions[r].statements[i];
+        }
+        regions[r].statements.clear();
+    }
+}
+
 ASTNode* Parser::acceptAssignment(state_t &s)
 {
     // production: IDENT EQUAL expr SEMICOL
@@ -491,22 +642,23 @@ ASTNode* Parser::acceptFactor1(state_t &s)
     factorNode->left = 0;
     factorNode->right = 0;
 
-    uint32_t argcnt = 0;
-    while(argcnt < nargs)
+    // the coefficients of a filter may come from a file
+    bool variadic = functionDefs::isVariadic(func.tokID);
+    bool files = variadic || functionDefs::isConvolution(func.tokID);
+
+    // a file counts as one argument per value it holds
+    while(factorNode->function_args.size() < nargs)
     {
-        ASTNode *exprNode = 0;
-        if ((exprNode=acceptExpr(s)) == NULL)
+        bool first = factorNode->function_args.empty();
+        if (!acceptArgument(s, factorNode, files && !first))
         {
-            error(s,"Invalid argument or number of arguments");
             s = savestate;
             delete factorNode;
             return NULL;
         }
-        factorNode->function_args.push_back(exprNode);
-        argcnt++;
 
         // if there are arguments left, we need to see a comma
-        if (argcnt != nargs)
+        if (factorNode->function_args.size() < nargs)
         {
             if (!match(s, TOK_COMMA))
             {
@@ -518,6 +670,18 @@ ASTNode* Parser::acceptFactor1(state_t &s)
         }
     }
 
+    // variadic functions take more arguments
+    // as long as they are separated by commas
+    while(variadic && match(s, TOK_COMMA))
+    {
+        if (!acceptArgument(s, factorNode, true))
+        {
+            s = savestate;
+            delete factorNode;
+            return NULL;
+        }
+    }
+
     if (!match(s, TOK_RPAREN))
     {
         delete factorNode;
@@ -529,6 +693,111 @@ ASTNode* Parser::acceptFactor1(state_t &s)
 }
 
 
+bool Parser::acceptArgument(state_t &s, ASTNode *functionNode, bool allowFile)
+{
+    if (allowFile && (getToken(s).tokID == TOK_STRING) &&
+        functionDefs::isConvolution(functionNode->functionID))
+    {
+        const std::string path = resolvePath(getToken(s).txt);
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file.is_open())
+        {
+            error(s, "Cannot open the impulse response " + getToken(s).txt);
+            return false;
+        }
+        ASTNode *fileNode = new ASTNode(ASTNode::NodeString);
+        fileNode->info.txt = path;
+        functionNode->function_args.push_back(fileNode);
+        next(s);
+        return true;
+    }
+
+    if (allowFile && (getToken(s).tokID == TOK_STRING))
+    {
+        std::vector<float> values;
+        if (!readCoefficients(s, getToken(s).txt, values))
+        {
+            return false;
+        }
+        next(s);
+
+        for(size_t i=0; i<values.size(); i++)
+        {
+            ASTNode *valueNode = new ASTNode(ASTNode::NodeFloat);
+            valueNode->info.floatVal = values[i];
+            functionNode->function_args.push_back(valueNode);
+        }
+        return true;
+    }
+
+    ASTNode *exprNode = 0;
+    if ((exprNode=acceptExpr(s)) == NULL)
+    {
+        error(s,"Invalid argument or number of arguments");
+        return false;
+    }
+    functionNode->function_args.push_back(exprNode);
+    return true;
+}
+
+std::string Parser::resolvePath(const std::string &filename) const
+{
+    bool absolute = (!filename.empty() && ((filename[0] == '/') || (filename[0] == '\\'))) ||
+                    ((filename.size() > 1) && (filename[1] == ':'));
+    if (!absolute && !m_directory.empty())
+    {
+        return m_directory + "/" + filename;
+    }
+    return filename;
+}
+
+bool Parser::readCoefficients(const state_t &s, const std::string &filename, std::vector<float> &values)
+{
+    std::string path = resolvePath(filename);
+    std::ifstream file(path.c_str());
+    if (!file.is_open())
+    {
+        error(s, "Cannot open the file of coefficients " + filename);
+        return false;
+    }
+
+    std::string line;
+    while(std::getline(file, line))
+    {
+        size_t comment = line.find('%');
+        if (comment != std::string::npos)
+        {
+            line.erase(comment);
+        }
+
+        const char *p = line.c_str();
+        while(*p != 0)
+        {
+            if ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == ','))
+            {
+                p++;
+                continue;
+            }
+            char *end;
+            float value = strtof(p, &end);
+            if (end == p)
+            {
+                error(s, "The file " + filename + " contains something that is not a number: " + line);
+                return false;
+            }
+            values.push_back(value);
+            p = end;
+        }
+    }
+
+    if (values.empty())
+    {
+        error(s, "The file " + filename + " has no coefficients");
+        return false;
+    }
+    return true;
+}
+
 ASTNode* Parser::acceptFactor2(state_t &s)
 {
     state_t savestate = s;
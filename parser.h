@@ -48,7 +48,8 @@ public:
                NodeUnaryMinus,
                NodeIdent,
                NodeInteger,
-               NodeFloat
+               NodeFloat,
+               NodeString
               };
 
     ASTNode(node_t nodeType = NodeUnknown)
@@ -123,6 +124,9 @@ public:
             stream << info.floatVal << "(FLOAT)";
             //stream << floatVal;
             break;
+        case NodeString:
+            stream << "\"" << info.txt << "\"(STRING)";
+            break;
         default:
             stream << "???";
             break;
@@ -168,6 +172,13 @@ public:
         return m_lastErrorPos;
     }
 
+    /** Set the directory of the program, which is where
+        the files of coefficients are looked up. */
+    void setDirectory(const std::string &directory)
+    {
+        m_directory = directory;
+    }
+
 protected:
     struct state_t
     {
@@ -175,6 +186,15 @@ protected:
         Reader::position_info tokPos;
     };
 
+    /** an oversampled region, see acceptOversample */
+    struct region_t
+    {
+        size_t        index;        // where the region goes in the program
+        uint32_t      factor;
+        statements_t  statements;
+        state_t       state;        // start of the region, for errors
+    };
+
     /* The following methods return true if the tokens starting from
        index 'tokIdx' are consistent with the production from the
        FPTOOL grammar.
@@ -188,6 +208,25 @@ protected:
     bool acceptProgram(state_t &s, statements_t &result);
     ASTNode* acceptDefinition(state_t &s);
 
+    /** returns true if the tokens start an oversampled region,
+        the identifier 'oversample' without an '=' after it */
+    bool isOversample(const state_t &s);
+
+    /** production: region -> 'oversample' INTEGER statement-list 'end'
+
+        The statements of the region are returned in 'region',
+        and expanded by the Oversampler once the whole program
+        has been parsed.
+    */
+    bool acceptOversample(state_t &s, statements_t &region, uint32_t &factor);
+
+    /** replace the regions by their expansion into ordinary
+        statements, see Oversampler, and delete them */
+    bool expandRegions(std::vector<region_t> &regions, statements_t &statements);
+
+    /** delete the statements of the regions */
+    void deleteRegions(std::vector<region_t> &regions);
+
     /** production: assignment -> IDENT = expr */
     ASTNode* acceptAssignment(state_t &s);
 
@@ -227,9 +266,29 @@ protected:
 
     ASTNode* acceptFactor(state_t &s);
 
-    /** production: FUNCTION ( expr ) */
+    /** production: FUNCTION ( expr ) and, for variadic
+        functions, FUNCTION ( expr , argument-list ) */
     ASTNode* acceptFactor1(state_t &s);
 
+    /** production: argument -> expr | STRING
+
+        A STRING is only accepted when 'allowFile' is true.
+        It names a file of coefficients, which are added to
+        the arguments as floats. For conv() it names a WAV
+        file, which is added as a NodeString with the path
+        of the file and loaded by ASTToVM.
+    */
+    bool acceptArgument(state_t &s, ASTNode *functionNode, bool allowFile);
+
+    /** returns the path of a file, relative names
+        are relative to the program */
+    std::string resolvePath(const std::string &filename) const;
+
+    /** read the numbers of a file of coefficients. they are
+        separated by whitespace or commas, and a '%' starts
+        a comment that runs to the end of the line. */
+    bool readCoefficients(const state_t &s, const std::string &filename, std::vector<float> &values);
+
     /** production: ( expr ) */
     ASTNode* acceptFactor2(state_t &s);
 
@@ -276,6 +335,7 @@ protected:
     std::string   m_lastError;
     Reader::position_info m_lastErrorPos;
     const std::vector<token_t>  *m_tokens;
+    std::string   m_directory;
 };
 
 #endif
@@ -0,0 +1,110 @@
+/*
+
+  Description:  Peephole optimizer that fuses common
+                instruction sequences of a VM program
+                into superinstructions.
+
+  License: GPLv2
+
+*/
+
+#include "peephole.h"
+
+bool Peephole::isOp(const VM::program_t &program, size_t pc, uint32_t icode)
+{
+    return (pc < program.size()) && (program[pc].icode == icode);
+}
+
+bool Peephole::isRead(const VM::program_t &program, size_t pc)
+{
+    return (pc < program.size()) && ((program[pc].icode & 0xff000000) == P_readvar);
+}
+
+void Peephole::emit(VM::program_t &program, uint32_t icode, VM::instruction_t operand)
+{
+    VM::instruction_t instr;
+    instr.icode = icode;
+    program.push_back(instr);
+    program.push_back(operand);
+}
+
+uint32_t Peephole::process(VM::program_t &program)
+{
+    VM::program_t result;
+    uint32_t removed = 0;
+
+    size_t pc = 0;
+    while(pc < program.size())
+    {
+        const uint32_t icode = program[pc].icode;
+
+        if (isRead(program, pc))
+        {
+            const uint32_t a = icode & 0xFFFF;
+
+            // READ x, LOAD k, ADD, WRITE x
+            if (isOp(program, pc+1, P_literal) &&
+                isOp(program, pc+3, P_add) &&
+                isOp(program, pc+4, P_writevar | a))
+            {
+                emit(result, P_rmwadd | a, program[pc+2]);
+                pc += 5;
+                removed += 3;
+                continue;
+            }
+
+            if (isRead(program, pc+1))
+            {
+                VM::instruction_t b;
+                b.icode = program[pc+1].icode & 0xFFFF;
+
+                // READ a, READ b, MUL, ADD
+                if (isOp(program, pc+2, P_mul) && isOp(program, pc+3, P_add))
+                {
+                    emit(result, P_mac | a, b);
+                    pc += 4;
+                    removed += 2;
+                    continue;
+                }
+                // READ a, READ b, ADD
+                if (isOp(program, pc+2, P_add))
+                {
+                    emit(result, P_addvv | a, b);
+                    pc += 3;
+                    removed += 1;
+                    continue;
+                }
+                // READ a, READ b, MUL
+                if (isOp(program, pc+2, P_mul))
+                {
+                    emit(result, P_mulvv | a, b);
+                    pc += 3;
+                    removed += 1;
+                    continue;
+                }
+            }
+        }
+        else if (icode == P_literal)
+        {
+            // LOAD k, MUL and LOAD k, ADD
+            if (isOp(program, pc+2, P_mul) || isOp(program, pc+2, P_add))
+            {
+                uint32_t fused = (program[pc+2].icode == P_mul) ? P_mullit : P_addlit;
+                emit(result, fused, program[pc+1]);
+                pc += 3;
+                removed += 1;
+                continue;
+            }
+        }
+
+        // copy the instruction and its operand word
+        const uint32_t length = VM::getInstructionLength(icode);
+        for(uint32_t i=0; (i<length) && (pc < program.size()); i++)
+        {
+            result.push_back(program[pc++]);
+        }
+    }
+
+    program.swap(result);
+    return removed;
+}
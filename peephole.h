@@ -0,0 +1,46 @@
+/*
+
+  Description:  Peephole optimizer that fuses common
+                instruction sequences of a VM program
+                into superinstructions.
+
+  License: GPLv2
+
+*/
+
+#ifndef peephole_h
+#define peephole_h
+
+#include "virtualmachine.h"
+
+/** The peephole optimizer replaces the following sequences:
+
+      READ x, LOAD k, ADD, WRITE x  ->  RMW_ADD x, k
+      READ a, READ b, MUL, ADD      ->  MAC a, b
+      READ a, READ b, ADD           ->  ADD_VV a, b
+      READ a, READ b, MUL           ->  MUL_VV a, b
+      LOAD k, MUL                   ->  MUL_LIT k
+      LOAD k, ADD                   ->  ADD_LIT k
+
+    The superinstructions evaluate their operands in the same
+    order as the original sequence, so results do not change.
+*/
+class Peephole
+{
+public:
+    /** optimize a program in place.
+        returns the number of instructions removed. */
+    static uint32_t process(VM::program_t &program);
+
+protected:
+    /** returns true if the instruction at pc exists and has the given opcode */
+    static bool isOp(const VM::program_t &program, size_t pc, uint32_t icode);
+
+    /** returns true if the instruction at pc reads a variable */
+    static bool isRead(const VM::program_t &program, size_t pc);
+
+    /** append an instruction with an operand word */
+    static void emit(VM::program_t &program, uint32_t icode, VM::instruction_t operand);
+};
+
+#endif
@@ -0,0 +1,609 @@
+/*
+
+  Description:  Pipelined execution of a program in stages
+                on several cores.
+
+  License: GPLv2
+
+*/
+
+#include <QDebug>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include "programinstance.h"
+#include "pipeline.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+// a worker that has had no block for this many milliseconds
+// sleeps between its checks instead of spinning, so an
+// instance that is loaded but not running uses no CPU
+#define PIPELINE_SPINTIME 50
+
+Pipeline::Pipeline()
+    : m_block(0),
+      m_sliderChanges(0),
+      m_reseed(false),
+      m_seed(0),
+      m_fifoFill(0),
+      m_generation(0),
+      m_done(0),
+      m_quit(false)
+{
+    for(uint32_t i=0; i<4; i++)
+    {
+        m_monitorIdx[i] = -1;
+        m_sliders[i] = 0.0f;
+    }
+}
+
+Pipeline::~Pipeline()
+{
+    m_quit = true;
+    for(size_t i=0; i<m_workers.size(); i++)
+    {
+        m_workers[i].join();
+    }
+    for(size_t i=0; i<m_stages.size(); i++)
+    {
+        delete m_stages[i].instance;
+    }
+}
+
+uint32_t Pipeline::getCost(uint32_t icode, const VM::filters_t &filters)
+{
+    const uint32_t n = icode & 0xFFFF;
+    switch(icode & 0xff000000)
+    {
+    case P_fir:
+        return (n < filters.fir.size()) ? filters.fir[n].size() : 1;
+    case P_biquad:
+        return (n < filters.biquad.size()) ? 5*filters.biquad[n].coefficients.size()/BIQUAD_COEFFICIENTS : 1;
+    case P_conv:
+        return 32;
+    case P_noisegen:
+        return 4;
+    default:
+        break;
+    }
+
+    // the functions call the C library
+    if ((icode >= P_sin) && (icode < P_literal))
+    {
+        return 8;
+    }
+    return 1;
+}
+
+VM::filters_t Pipeline::getUsedFilters(const VM::program_t &program,
+                                       size_t first, size_t last,
+                                       const VM::filters_t &filters)
+{
+    // the unused filters keep their number,
+    // with the smallest state possible
+    VM::filters_t used;
+    used.fir.assign(filters.fir.size(), std::vector<float>(1, 0.0f));
+    used.biquad.resize(filters.biquad.size());
+    for(size_t i=0; i<used.biquad.size(); i++)
+    {
+        const float unity[BIQUAD_COEFFICIENTS] = {1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f};
+        used.biquad[i].coefficients.assign(unity, unity + BIQUAD_COEFFICIENTS);
+        used.biquad[i].dynamic = false;
+    }
+    used.conv.assign(filters.conv.size(), std::vector<float>(1, 0.0f));
+
+    for(size_t pc=first; pc<last; pc+=VM::getInstructionLength(program[pc].icode))
+    {
+        const uint32_t icode = program[pc].icode;
+        const uint32_t n = icode & 0xFFFF;
+        if (((icode & 0xff000000) == P_fir) && (n < filters.fir.size()))
+        {
+            used.fir[n] = filters.fir[n];
+        }
+        if (((icode & 0xff000000) == P_biquad) && (n < filters.biquad.size()))
+        {
+            used.biquad[n] = filters.biquad[n];
+        }
+        if (((icode & 0xff000000) == P_conv) && (n < filters.conv.size()))
+        {
+            used.conv[n] = filters.conv[n];
+        }
+    }
+    return used;
+}
+
+Pipeline* Pipeline::create(const VM::program_t &program,
+                           const VM::variables_t &variables,
+                           const VM::program_t &controlProgram,
+                           const VM::filters_t &filters,
+                           FastMath::precision_t precision,
+                           uint32_t noiseSeed, float programRate,
+                           engine_t engine, uint32_t stages)
+{
+    const size_t nvars = variables.size();
+
+    // split the program into statements, as
+    // ProgramInstance::buildBlockSchedule does
+    std::vector<ProgramInstance::statement_t> statements;
+    ProgramInstance::splitStatements(program, statements);
+    if ((statements.size() < 2) || (statements.back().dst == -1))
+    {
+        return NULL;
+    }
+
+    std::vector<uint64_t> costs(statements.size(), 0);
+    for(size_t k=0; k<statements.size(); k++)
+    {
+        for(size_t pc=statements[k].first; pc<statements[k].last; pc+=VM::getInstructionLength(program[pc].icode))
+        {
+            costs[k] += getCost(program[pc].icode, filters);
+        }
+    }
+
+    // the input variables are written by the VM
+    std::vector<bool> written(nvars, false);
+    const char *inputs[3] = {"in", "inl", "inr"};
+    for(uint32_t i=0; i<3; i++)
+    {
+        const int32_t idx = VM::findVariableByName(variables, inputs[i]);
+        if (idx != -1)
+            written[idx] = true;
+    }
+
+    std::vector<int32_t> lastWriter(nvars, -1);
+    for(size_t k=0; k<statements.size(); k++)
+    {
+        if (statements[k].dst != -1)
+            lastWriter[statements[k].dst] = k;
+    }
+
+    // a variable that is read before it is written sees
+    // the value of the previous sample. no cut may be made
+    // between the read and the last write of the variable.
+    // canCut[k] is true if a stage may start at statement k.
+    std::vector<bool> canCut(statements.size(), true);
+    canCut[0] = false;
+    for(size_t k=0; k<statements.size(); k++)
+    {
+        const std::vector<uint32_t> &reads = statements[k].reads;
+        for(size_t r=0; r<reads.size(); r++)
+        {
+            const uint32_t v = reads[r];
+            for(int32_t j=k+1; (!written[v]) && (j<=lastWriter[v]); j++)
+            {
+                canCut[j] = false;
+            }
+        }
+        if (statements[k].dst != -1)
+            written[statements[k].dst] = true;
+    }
+
+    // cut where the cost of the statements before
+    // is closest to an equal share of the total
+    std::vector<uint64_t> prefix(statements.size()+1, 0);
+    for(size_t k=0; k<statements.size(); k++)
+    {
+        prefix[k+1] = prefix[k] + costs[k];
+    }
+
+    std::vector<size_t> cuts(1, 0);
+    for(uint32_t s=1; s<stages; s++)
+    {
+        const uint64_t target = (prefix.back()*s) / stages;
+        size_t best = 0;
+        for(size_t k=cuts.back()+1; k<statements.size(); k++)
+        {
+            const uint64_t distance = (prefix[k] > target) ? (prefix[k] - target) : (target - prefix[k]);
+            const uint64_t bestDistance = (prefix[best] > target) ? (prefix[best] - target) : (target - prefix[best]);
+            if (canCut[k] && ((best == 0) || (distance < bestDistance)))
+            {
+                best = k;
+            }
+        }
+        if (best == 0)
+        {
+            break;
+        }
+        cuts.push_back(best);
+    }
+    cuts.push_back(statements.size());
+
+    if (cuts.size() < 3)
+    {
+        qDebug() << "Pipeline: the program has no statement boundary outside a feedback loop";
+        return NULL;
+    }
+
+    Pipeline *pipeline = new Pipeline();
+    pipeline->m_lane.assign(nvars, -1);
+    pipeline->m_writer.assign(nvars, -1);
+    const char *outputs[3] = {"out", "outl", "outr"};
+    for(uint32_t i=0; i<3; i++)
+    {
+        pipeline->m_outIdx[i] = VM::findVariableByName(variables, outputs[i]);
+    }
+
+    // a stage imports the variables that it reads before writing
+    // them and that an earlier stage has written, and the last
+    // stage the outputs. the last of the earlier stages that
+    // writes such a variable exports it.
+    uint32_t lanes = 0;
+    std::vector<int32_t> &writer = pipeline->m_writer;
+    for(size_t s=0; s+1<cuts.size(); s++)
+    {
+        stage_t stage;
+        stage.instance = NULL;
+        stage.first = statements[cuts[s]].first;
+        stage.last = statements[cuts[s+1]-1].last;
+        stage.statements = cuts[s+1] - cuts[s];
+        stage.firstDst = statements[cuts[s]].dst;
+        stage.lastDst = statements[cuts[s+1]-1].dst;
+        stage.cost = prefix[cuts[s+1]] - prefix[cuts[s]];
+
+        std::vector<bool> local(nvars, false);
+        std::vector<bool> imported(nvars, false);
+        std::vector<uint32_t> reads;
+        for(size_t k=cuts[s]; k<cuts[s+1]; k++)
+        {
+            reads = statements[k].reads;
+            if (k+1 == statements.size())
+            {
+                // the VM reads the outputs after the program
+                for(uint32_t i=0; i<3; i++)
+                {
+                    if (pipeline->m_outIdx[i] != -1)
+                        reads.push_back(pipeline->m_outIdx[i]);
+                }
+            }
+            for(size_t r=0; r<reads.size(); r++)
+            {
+                const uint32_t v = reads[r];
+                if (local[v] || imported[v] || (writer[v] == -1))
+                {
+                    continue;
+                }
+                imported[v] = true;
+                stage.imports.push_back(v);
+
+                stage_t &source = pipeline->m_stages[writer[v]];
+                if (std::find(source.exports.begin(), source.exports.end(), v) == source.exports.end())
+                {
+                    source.exports.push_back(v);
+                }
+                if (pipeline->m_lane[v] == -1)
+                {
+                    pipeline->m_lane[v] = lanes++;
+                }
+            }
+            if (statements[k].dst != -1)
+            {
+                local[statements[k].dst] = true;
+            }
+        }
+
+        pipeline->m_stages.push_back(stage);
+        for(size_t k=cuts[s]; k<cuts[s+1]; k++)
+        {
+            if (statements[k].dst != -1)
+                writer[statements[k].dst] = s;
+        }
+    }
+
+    // load the statements of each stage into an instance.
+    // the register and native engines are not available.
+    VM::regprogram_t regprogram;
+    regprogram.temporaries = 0;
+    for(size_t s=0; s<pipeline->m_stages.size(); s++)
+    {
+        stage_t &stage = pipeline->m_stages[s];
+        VM::program_t part(program.begin() + stage.first, program.begin() + stage.last);
+        stage.instance = new ProgramInstance();
+        if (!stage.instance->load(part, regprogram, variables, controlProgram,
+                                  getUsedFilters(program, stage.first, stage.last, filters),
+                                  precision, noiseSeed, programRate, programRate,
+                                  engine, 1))
+        {
+            delete pipeline;
+            return NULL;
+        }
+        stage.importPtrs.resize(stage.imports.size());
+        stage.importLanes.resize(stage.imports.size());
+        stage.exportPtrs.resize(stage.exports.size());
+        stage.exportLanes.resize(stage.exports.size());
+    }
+
+    // each slot holds two input lanes, the interleaved
+    // output, four monitor lanes and the variable lanes
+    const uint32_t count = pipeline->m_stages.size();
+    pipeline->m_slots.resize(count);
+    for(uint32_t i=0; i<count; i++)
+    {
+        pipeline->m_slots[i].frames = 0;
+        pipeline->m_slots[i].sliderChanges = 0;
+        pipeline->m_slots[i].reseed = false;
+        pipeline->m_slots[i].data.assign((8+lanes)*VM_BLOCKSIZE, 0.0f);
+    }
+
+    // the output starts with the latency in silence
+    pipeline->m_fifoFill = pipeline->getLatency();
+    pipeline->m_fifo.assign(2*(pipeline->getLatency() + VM_BLOCKSIZE), 0.0f);
+
+    for(uint32_t k=1; k<count; k++)
+    {
+        pipeline->m_workers.push_back(std::thread(&Pipeline::run, pipeline, k));
+    }
+    return pipeline;
+}
+
+bool Pipeline::isEngineAvailable(engine_t engine) const
+{
+    switch(engine)
+    {
+    case VirtualMachine::ENGINE_STACK:
+        return true;
+    case VirtualMachine::ENGINE_THREADED:
+    case VirtualMachine::ENGINE_JIT:
+        for(size_t i=0; i<m_stages.size(); i++)
+        {
+            if (!m_stages[i].instance->isEngineAvailable(engine))
+                return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+void Pipeline::activateEngine(engine_t engine)
+{
+    if (isEngineAvailable(engine))
+    {
+        for(size_t i=0; i<m_stages.size(); i++)
+        {
+            m_stages[i].instance->activateEngine(engine);
+        }
+    }
+}
+
+void Pipeline::setSlider(uint32_t id, float value)
+{
+    if (id < 4)
+    {
+        m_sliders[id] = value;
+        m_sliderChanges |= (1u << id);
+    }
+}
+
+void Pipeline::seedNoiseGenerators(uint32_t seed)
+{
+    m_seed = seed;
+    m_reseed = true;
+}
+
+float Pipeline::getVariable(int32_t idx) const
+{
+    const int32_t stage = std::max(m_writer[idx], 0);
+    return m_stages[stage].instance->getVariable(idx);
+}
+
+void Pipeline::setVariable(int32_t idx, float value)
+{
+    for(size_t i=0; i<m_stages.size(); i++)
+    {
+        *m_stages[i].instance->getVariablePtr(idx) = value;
+        m_stages[i].instance->m_controlDirty = true;
+    }
+}
+
+void Pipeline::executeStage(uint32_t k)
+{
+    const uint32_t count = m_slots.size();
+    slot_t &slot = m_slots[((m_block % count) + count - k) % count];
+    if (slot.frames == 0)
+    {
+        return;
+    }
+
+    stage_t &stage = m_stages[k];
+    ProgramInstance *instance = stage.instance;
+    for(uint32_t id=0; id<4; id++)
+    {
+        if ((slot.sliderChanges & (1u << id)) != 0)
+            instance->setSlider(id, slot.sliders[id]);
+    }
+    if (slot.reseed)
+    {
+        instance->seedNoiseGenerators(slot.seed);
+    }
+    if (instance->m_controlDirty)
+    {
+        instance->executeControl();
+    }
+
+    // the storage of the variables depends on the engine
+    for(size_t j=0; j<stage.imports.size(); j++)
+    {
+        stage.importPtrs[j] = instance->getVariablePtr(stage.imports[j]);
+        stage.importLanes[j] = getLane(slot, stage.imports[j]);
+    }
+    for(size_t j=0; j<stage.exports.size(); j++)
+    {
+        stage.exportPtrs[j] = instance->getVariablePtr(stage.exports[j]);
+        stage.exportLanes[j] = getLane(slot, stage.exports[j]);
+    }
+
+    // a monitor is sampled by the last stage that
+    // writes its variable, or else by the first
+    const float *monitor[4];
+    float *monitorLane[4];
+    for(uint32_t c=0; c<4; c++)
+    {
+        const int32_t idx = m_monitorIdx[c];
+        const bool owner = (idx != -1) && (std::max(m_writer[idx], 0) == static_cast<int32_t>(k));
+        monitor[c] = owner ? instance->getVariablePtr(idx) : NULL;
+        monitorLane[c] = getMonitor(slot, c);
+    }
+
+    const float *left = getInput(slot, 0);
+    const float *right = getInput(slot, 1);
+    float *out = getOutput(slot);
+    const size_t nimports = stage.imports.size();
+    const size_t nexports = stage.exports.size();
+    for(uint32_t i=0; i<slot.frames; i++)
+    {
+        for(size_t j=0; j<nimports; j++)
+        {
+            *stage.importPtrs[j] = stage.importLanes[j][i];
+        }
+
+        // only the output of the last stage is used
+        instance->executeProgram(left[i], right[i], out[i<<1], out[(i<<1)+1]);
+
+        for(size_t j=0; j<nexports; j++)
+        {
+            stage.exportLanes[j][i] = *stage.exportPtrs[j];
+        }
+        for(uint32_t c=0; c<4; c++)
+        {
+            if (monitor[c] != NULL)
+                monitorLane[c][i] = *monitor[c];
+        }
+    }
+}
+
+uint32_t Pipeline::process(const float *inLeft, const float *inRight,
+                           uint32_t frames, float *outbuf,
+                           const int32_t monitorIdx[4],
+                           ring_buffer_data_t *scope,
+                           ring_buffer_data_t *spectrum)
+{
+    const uint32_t count = m_slots.size();
+    slot_t &slot = m_slots[m_block % count];
+    slot.frames = frames;
+    for(uint32_t id=0; id<4; id++)
+    {
+        slot.sliders[id] = m_sliders[id];
+    }
+    slot.sliderChanges = m_sliderChanges;
+    slot.reseed = m_reseed;
+    slot.seed = m_seed;
+    m_sliderChanges = 0;
+    m_reseed = false;
+    memcpy(getInput(slot, 0), inLeft, frames*sizeof(float));
+    memcpy(getInput(slot, 1), inRight, frames*sizeof(float));
+    for(uint32_t c=0; c<4; c++)
+    {
+        m_monitorIdx[c] = monitorIdx[c];
+    }
+
+    // hand the block to the workers, execute
+    // the first stage and wait for the others
+    m_generation.fetch_add(1, std::memory_order_release);
+    executeStage(0);
+    while(m_done.load(std::memory_order_acquire) < count-1)
+    {
+        std::this_thread::yield();
+    }
+    m_done.store(0, std::memory_order_relaxed);
+
+    // the block that has passed the last stage
+    slot_t &last = m_slots[(m_block + 1) % count];
+    const uint32_t done = last.frames;
+    memcpy(&m_fifo[2*m_fifoFill], getOutput(last), 2*done*sizeof(float));
+    m_fifoFill += done;
+    for(uint32_t i=0; i<done; i++)
+    {
+        scope[i].s1 = getMonitor(last, 0)[i];
+        scope[i].s2 = getMonitor(last, 1)[i];
+        spectrum[i].s1 = getMonitor(last, 2)[i];
+        spectrum[i].s2 = getMonitor(last, 3)[i];
+    }
+    m_block++;
+
+    // the fifo holds at least the latency, which is at
+    // least as long as a block, see getLatency()
+    memcpy(outbuf, &m_fifo[0], 2*frames*sizeof(float));
+    m_fifoFill -= frames;
+    memmove(&m_fifo[0], &m_fifo[2*frames], 2*m_fifoFill*sizeof(float));
+    return done;
+}
+
+void Pipeline::run(uint32_t k)
+{
+    pinThread(k);
+
+    typedef std::chrono::steady_clock clock_t;
+    clock_t::time_point active = clock_t::now();
+    // the first block may have been handed
+    // out before the thread has started
+    uint32_t seen = 0;
+    while(!m_quit.load(std::memory_order_acquire))
+    {
+        const uint32_t generation = m_generation.load(std::memory_order_acquire);
+        if (generation == seen)
+        {
+            if (clock_t::now() - active > std::chrono::milliseconds(PIPELINE_SPINTIME))
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            else
+                std::this_thread::yield();
+            continue;
+        }
+
+        seen = generation;
+        executeStage(k);
+        m_done.fetch_add(1, std::memory_order_release);
+        active = clock_t::now();
+    }
+}
+
+void Pipeline::pinThread(uint32_t core)
+{
+    const uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << ((core % cores) % 64));
+#else
+    // threads cannot be pinned on this platform
+    (void)cores;
+#endif
+}
+
+void Pipeline::dump(std::ostream &s, const VM::variables_t &variables) const
+{
+    uint64_t total = 0;
+    for(size_t k=0; k<m_stages.size(); k++)
+    {
+        total += m_stages[k].cost;
+    }
+
+    s << "\n-- PIPELINE --\n\n";
+    for(size_t k=0; k<m_stages.size(); k++)
+    {
+        const stage_t &stage = m_stages[k];
+        s << "stage " << k+1 << ": " << stage.statements << " statements from "
+          << ((stage.firstDst != -1) ? variables[stage.firstDst].name : "?") << " to "
+          << ((stage.lastDst != -1) ? variables[stage.lastDst].name : "?")
+          << ", instructions " << stage.first << "-" << stage.last-1 << ", "
+          << (100*stage.cost) / std::max<uint64_t>(total, 1) << "% of the cost\n";
+        if (!stage.imports.empty())
+        {
+            s << "  reads";
+            for(size_t j=0; j<stage.imports.size(); j++)
+            {
+                s << " " << variables[stage.imports[j]].name;
+            }
+            s << " from the earlier stages\n";
+        }
+    }
+    s << "\n" << m_stages.size() << " stages, " << getLatency() << " samples of latency\n";
+}
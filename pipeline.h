@@ -0,0 +1,211 @@
+/*
+
+  Description:  Pipelined execution of a program in stages
+                on several cores.
+
+  License: GPLv2
+
+*/
+
+#ifndef pipeline_h
+#define pipeline_h
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <ostream>
+#include "virtualmachine.h"
+
+class ProgramInstance;
+
+/** A pipeline splits a program into stages of consecutive
+    statements, which execute on successive blocks at the same
+    time: while the first stage computes block b, the second
+    computes block b-1 and so on. Each stage after the first runs
+    on its own worker thread, pinned to a core, and the first on
+    the thread that calls process(). The output is delayed by
+    (stages-1)*VM_BLOCKSIZE samples in exchange.
+
+    Every stage is a ProgramInstance with the statements of the
+    stage and its own copy of the variables. A variable that a
+    stage reads after an earlier stage has written it is passed
+    from one to the other in a lane of VM_BLOCKSIZE samples, in
+    one of 'stages' slots. A block travels through the slots with
+    its input, lanes, monitor samples and output, and the stages
+    hand the slots on through atomics without locks.
+
+    A cut is only made between two statements that are not part
+    of a feedback loop: a variable that is read before it is
+    written, and so holds the value of the previous sample, is
+    read and written in the same stage.
+
+    The stages execute sample by sample, with the stack,
+    threaded or JIT engine.
+*/
+class Pipeline
+{
+public:
+    typedef VirtualMachine::engine_t engine_t;
+    typedef VirtualMachine::ring_buffer_data_t ring_buffer_data_t;
+
+    virtual ~Pipeline();
+
+    /** split a program into at most 'stages' stages of about the
+        same cost and load them, see ProgramInstance::load for the
+        other arguments. returns NULL if the program cannot be
+        split. */
+    static Pipeline* create(const VM::program_t &program,
+                            const VM::variables_t &variables,
+                            const VM::program_t &controlProgram,
+                            const VM::filters_t &filters,
+                            FastMath::precision_t precision,
+                            uint32_t noiseSeed, float programRate,
+                            engine_t engine, uint32_t stages);
+
+    /** returns the number of stages */
+    uint32_t getStageCount() const
+    {
+        return m_stages.size();
+    }
+
+    /** returns the delay of the output in samples */
+    uint32_t getLatency() const
+    {
+        return (m_stages.size()-1)*VM_BLOCKSIZE;
+    }
+
+    /** returns true if all stages can execute on the engine */
+    bool isEngineAvailable(engine_t engine) const;
+
+    /** switch the stages to an engine, if they can execute on it */
+    void activateEngine(engine_t engine);
+
+    /** set the value of a slider. every stage sees the new
+        value from the next block on, like the unpipelined program. */
+    void setSlider(uint32_t id, float value);
+
+    /** restart the noise generators of every stage
+        from the next block on */
+    void seedNoiseGenerators(uint32_t seed);
+
+    /** returns the value of a variable, from the stage that
+        writes it last */
+    float getVariable(int32_t idx) const;
+
+    /** set the value of a variable in every stage */
+    void setVariable(int32_t idx, float value);
+
+    /** execute the next block on the planar input and write
+        the interleaved output, delayed by getLatency(). the
+        samples of the variables 'monitorIdx' of the block that
+        leaves the pipeline are written to 'scope' and
+        'spectrum', and their number is returned. */
+    uint32_t process(const float *inLeft, const float *inRight,
+                     uint32_t frames, float *outbuf,
+                     const int32_t monitorIdx[4],
+                     ring_buffer_data_t *scope,
+                     ring_buffer_data_t *spectrum);
+
+    /** write the stages in human readable form */
+    void dump(std::ostream &s, const VM::variables_t &variables) const;
+
+protected:
+    Pipeline();
+
+    /** a block travelling through the stages. the changes
+        of the controls travel with it, so that each stage
+        applies them to the same block. */
+    struct slot_t
+    {
+        uint32_t            frames;     // frames of the block, 0 for none
+        std::vector<float>  data;       // input, output, monitor and variable lanes
+        float               sliders[4];
+        uint32_t            sliderChanges;  // bit n is set when slider n has changed
+        bool                reseed;         // true if the noise generators restart
+        uint32_t            seed;
+    };
+
+    struct stage_t
+    {
+        ProgramInstance         *instance;
+        size_t                  first;      // first instruction of the stage
+        size_t                  last;       // one past the last instruction
+        uint32_t                statements;
+        int32_t                 firstDst;   // variable of the first statement
+        int32_t                 lastDst;    // variable of the last statement
+        uint64_t                cost;       // estimated cost, see getCost()
+        std::vector<uint32_t>   imports;    // variables read from the lanes
+        std::vector<uint32_t>   exports;    // variables written to the lanes
+
+        // set up for each block by executeStage()
+        std::vector<float*>     importPtrs; // storage of the imports in 'instance'
+        std::vector<const float*> importLanes;
+        std::vector<const float*> exportPtrs;
+        std::vector<float*>     exportLanes;
+    };
+
+    /** returns the estimated cost of an instruction */
+    static uint32_t getCost(uint32_t icode, const VM::filters_t &filters);
+
+    /** returns the filters of a program, without the coefficients
+        of those that the instructions first..last-1 do not use */
+    static VM::filters_t getUsedFilters(const VM::program_t &program,
+                                        size_t first, size_t last,
+                                        const VM::filters_t &filters);
+
+    /** the lanes of a slot */
+    float* getInput(slot_t &slot, uint32_t channel)
+    {
+        return &slot.data[channel*VM_BLOCKSIZE];
+    }
+    float* getOutput(slot_t &slot)
+    {
+        return &slot.data[2*VM_BLOCKSIZE];
+    }
+    float* getMonitor(slot_t &slot, uint32_t channel)
+    {
+        return &slot.data[(4+channel)*VM_BLOCKSIZE];
+    }
+    float* getLane(slot_t &slot, uint32_t varIdx)
+    {
+        return &slot.data[(8+m_lane[varIdx])*VM_BLOCKSIZE];
+    }
+
+    /** execute stage k on its slot of the current block */
+    void executeStage(uint32_t k);
+
+    /** worker thread of stage k */
+    void run(uint32_t k);
+
+    /** pin the calling thread to a core */
+    static void pinThread(uint32_t core);
+
+    std::vector<stage_t>    m_stages;
+    std::vector<int32_t>    m_lane;         // lane of each variable, or -1
+    std::vector<int32_t>    m_writer;       // last stage that writes each variable, or -1
+    std::vector<slot_t>     m_slots;        // one per stage
+    uint32_t                m_block;        // number of the current block
+    int32_t                 m_monitorIdx[4];// variables sampled into the monitor lanes
+    int32_t                 m_outIdx[3];    // out, outl, outr or -1
+
+    // control changes for the next block
+    float                   m_sliders[4];
+    uint32_t                m_sliderChanges;
+    bool                    m_reseed;
+    uint32_t                m_seed;
+
+    std::vector<float>      m_fifo;         // interleaved output, see process()
+    uint32_t                m_fifoFill;     // frames in m_fifo
+
+    std::vector<std::thread> m_workers;
+    std::atomic<uint32_t>   m_generation;   // incremented for every block
+    std::atomic<uint32_t>   m_done;         // stages done with the current block
+    std::atomic<bool>       m_quit;         // tells the workers to end
+
+private:
+    Pipeline(const Pipeline &);
+    Pipeline& operator=(const Pipeline &);
+};
+
+#endif
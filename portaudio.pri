@@ -0,0 +1,75 @@
+# PortAudio sources and platform settings,
+# shared by BasicDSP.pro and the tools that link the VM.
+
+INCLUDEPATH += $$PWD/contrib/portaudio/include \
+               $$PWD/contrib/portaudio/src/common
+
+SOURCES +=  $$PWD/contrib/portaudio/src/common/pa_allocation.c \
+            $$PWD/contrib/portaudio/src/common/pa_converters.c \
+            $$PWD/contrib/portaudio/src/common/pa_cpuload.c \
+            $$PWD/contrib/portaudio/src/common/pa_debugprint.c \
+            $$PWD/contrib/portaudio/src/common/pa_dither.c \
+            $$PWD/contrib/portaudio/src/common/pa_front.c \
+            $$PWD/contrib/portaudio/src/common/pa_process.c \
+            $$PWD/contrib/portaudio/src/common/pa_ringbuffer.c \
+            $$PWD/contrib/portaudio/src/common/pa_stream.c \
+            $$PWD/contrib/portaudio/src/common/pa_trace.c
+
+## Windows specific stuff
+win32 {
+    DEFINES += PA_USE_WMME
+    DEFINES += PA_USE_WASAPI
+    DEFINES += PA_USE_DS
+    DEFINES += PA_USE_WDMKS PA_WDMKS_NO_KSGUID_LIB
+    DEFINES += PAWIN_USE_DIRECTSOUNDFULLDUPLEXCREATE
+    DEFINES += _CRT_SECURE_NO_WARNINGS
+
+    INCLUDEPATH += $$PWD/contrib/portaudio/src/os/win
+
+    SOURCES += $$PWD/contrib/portaudio/src/os/win/pa_win_hostapis.c \
+               $$PWD/contrib/portaudio/src/os/win/pa_win_util.c \
+               $$PWD/contrib/portaudio/src/os/win/pa_win_waveformat.c \
+               $$PWD/contrib/portaudio/src/os/win/pa_x86_plain_converters.c \
+               $$PWD/contrib/portaudio/src/os/win/pa_win_coinitialize.c
+
+    SOURCES += $$PWD/contrib/portaudio/src/hostapi/dsound/pa_win_ds.c \
+               $$PWD/contrib/portaudio/src/hostapi/dsound/pa_win_ds_dynlink.c \
+               $$PWD/contrib/portaudio/src/hostapi/wdmks/pa_win_wdmks.c \
+               $$PWD/contrib/portaudio/src/hostapi/wasapi/pa_win_wasapi.c \
+               $$PWD/contrib/portaudio/src/hostapi/wmme/pa_win_wmme.c
+
+    LIBS += winmm.lib dsound.lib user32.lib Advapi32.lib
+}
+
+## linux make
+## needs: libasound2-dev
+unix:!macx {
+    DEFINES += PA_USE_ALSA
+
+    INCLUDEPATH += $$PWD/contrib/portaudio/src/os/unix
+
+    SOURCES += $$PWD/contrib/portaudio/src/os/unix/pa_unix_hostapis.c \
+               $$PWD/contrib/portaudio/src/os/unix/pa_unix_util.c
+
+    SOURCES += $$PWD/contrib/portaudio/src/hostapi/alsa/pa_linux_alsa.c
+
+    LIBS += -lasound
+}
+
+## OSX
+macx {
+    DEFINES -= __linux__
+    DEFINES += PA_USE_COREAUDIO
+
+    INCLUDEPATH += $$PWD/contrib/portaudio/src/hostapi/coreaudio
+    INCLUDEPATH += $$PWD/contrib/portaudio/src/os/unix
+
+    SOURCES += $$PWD/contrib/portaudio/src/hostapi/coreaudio/pa_mac_core.c \
+               $$PWD/contrib/portaudio/src/hostapi/coreaudio/pa_mac_core_blocking.c \
+               $$PWD/contrib/portaudio/src/hostapi/coreaudio/pa_mac_core_utilities.c \
+               $$PWD/contrib/portaudio/src/os/unix/pa_unix_util.c \
+               $$PWD/contrib/portaudio/src/os/unix/pa_unix_hostapis.c
+
+    LIBS += -framework CoreAudio -framework CoreServices
+    LIBS += -framework AudioUnit -framework AudioToolbox
+}
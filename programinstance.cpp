@@ -0,0 +1,2305 @@
+/*
+
+  Description:  A program loaded for execution, with its
+                variables, state and the code of the engines.
+
+  License: GPLv2
+
+*/
+
+#include <QDebug>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <ostream>
+#include <sstream>
+#include <algorithm>
+#include <new>
+#include <string.h>
+#include "functiondefs.h"
+#include "fastmath.h"
+#include "vectormath.h"
+#include "jitcompiler.h"
+#include "nativecompiler.h"
+#include "programinstance.h"
+#include "pipeline.h"
+
+ProgramInstance::ProgramInstance()
+    : m_controlDirty(false),
+      m_stack(1),
+      m_programRate(0.0f),
+      m_migrateFrom(NULL),
+      m_engine(VirtualMachine::ENGINE_STACK),
+      m_jit(new JITCompiler()),
+      m_native(NULL),
+      m_precision(FastMath::PRECISION_EXACT),
+      m_math(&FastMath::getKernels(FastMath::PRECISION_EXACT)),
+      m_vmath(&VectorMath::getKernels(FastMath::PRECISION_EXACT)),
+      m_noise(NULL),
+      m_noiseCount(0),
+      m_firs(NULL),
+      m_biquads(NULL),
+      m_biquadCoefficients(NULL),
+      m_convs(NULL),
+      m_lout(NULL),
+      m_lin(NULL),
+      m_rout(NULL),
+      m_rin(NULL),
+      m_in(NULL),
+      m_out(NULL),
+      m_inLeft(NULL),
+      m_inRight(NULL),
+      m_resampling(false),
+      m_resampleChunk(VM_BLOCKSIZE),
+      m_resampleFill(0),
+      m_pipeline(NULL)
+{
+    m_regprogram.temporaries = 0;
+
+    for(uint32_t i=0; i<4; i++)
+    {
+        m_slider[i] = NULL;
+        m_monitorVar[i] = NULL;
+        m_monitorIdx[i] = -1;
+        m_monitorRequest[i].store(-1);
+    }
+    for(uint32_t i=0; i<6; i++)
+    {
+        m_ioIdx[i] = -1;
+    }
+
+    m_scopeBlock.resize(VM_BLOCKSIZE);
+    m_spectrumBlock.resize(VM_BLOCKSIZE);
+}
+
+ProgramInstance::~ProgramInstance()
+{
+    delete m_pipeline;
+    delete m_jit;
+    delete m_native.load();
+}
+
+bool ProgramInstance::checkPrograms(const VM::program_t &program,
+                                    const VM::program_t &controlProgram,
+                                    const VM::filters_t &filters,
+                                    uint32_t &depth)
+{
+    // the interpreters do not check the stack pointer,
+    // so the stack must be large enough for both programs.
+    uint32_t controlDepth = 0;
+    if (!VM::getStackDepth(program, depth) ||
+        !VM::getStackDepth(controlProgram, controlDepth) ||
+        (std::max(depth, controlDepth) > VM_MAXSTACKDEPTH))
+    {
+        qDebug() << "ProgramInstance: program rejected, stack depth check failed";
+        return false;
+    }
+
+    // nor the filter numbers
+    const VM::program_t *programs[2] = {&program, &controlProgram};
+    for(uint32_t k=0; k<2; k++)
+    {
+        const VM::program_t &p = *programs[k];
+        for(size_t pc=0; pc<p.size(); pc+=VM::getInstructionLength(p[pc].icode))
+        {
+            if (((p[pc].icode & 0xff000000) == P_fir) &&
+                ((p[pc].icode & 0xFFFF) >= filters.fir.size()))
+            {
+                qDebug() << "ProgramInstance: program rejected, unknown FIR filter";
+                return false;
+            }
+            if (((p[pc].icode & 0xff000000) == P_conv) &&
+                ((p[pc].icode & 0xFFFF) >= filters.conv.size()))
+            {
+                qDebug() << "ProgramInstance: program rejected, unknown impulse response";
+                return false;
+            }
+            if ((p[pc].icode & 0xff000000) == P_biquad)
+            {
+                uint32_t n = p[pc].icode & 0xFFFF;
+                uint32_t sections = (p[pc].icode >> 16) & 0xFF;
+                if ((n >= filters.biquad.size()) ||
+                    ((sections != 0) && (sections*BIQUAD_COEFFICIENTS != filters.biquad[n].coefficients.size())))
+                {
+                    qDebug() << "ProgramInstance: program rejected, unknown biquad filter";
+                    return false;
+                }
+            }
+        }
+    }
+    depth = std::max(depth, controlDepth);
+    return true;
+}
+
+bool ProgramInstance::load(const VM::program_t &program,
+                           const VM::regprogram_t &regprogram,
+                           const VM::variables_t &variables,
+                           const VM::program_t &controlProgram,
+                           const VM::filters_t &filters,
+                           FastMath::precision_t precision,
+                           uint32_t noiseSeed,
+                           double deviceRate, float programRate,
+                           engine_t engine, uint32_t stages)
+{
+    uint32_t depth = 0;
+    if (!checkPrograms(program, controlProgram, filters, depth))
+    {
+        return false;
+    }
+
+    // executeRegisters() checks neither the
+    // instructions nor the register numbers
+    const uint32_t registers = variables.size() + regprogram.constants.size() + regprogram.temporaries;
+
+    // the register program passes the coefficients of
+    // the dynamic biquad filters in regprogram.operands
+    std::vector<int32_t> biquadOperands(filters.biquad.size(), -1);
+    uint32_t operands = 0;
+    for(size_t i=0; i<regprogram.code.size(); i++)
+    {
+        const VM::reginstr_t &instr = regprogram.code[i];
+        if (!VM::isRegisterInstruction(instr.opcode))
+        {
+            qDebug() << "ProgramInstance: program rejected, unknown register instruction";
+            return false;
+        }
+        if ((instr.dst >= registers) || (instr.srcA >= registers) || (instr.srcB >= registers))
+        {
+            qDebug() << "ProgramInstance: program rejected, unknown register";
+            return false;
+        }
+
+        size_t count;
+        switch(instr.opcode)
+        {
+        case P_firfilter:
+            count = filters.fir.size();
+            break;
+        case P_biquadfilter:
+            count = filters.biquad.size();
+            break;
+        case P_convolve:
+            count = filters.conv.size();
+            break;
+        default:
+            continue;
+        }
+        uint32_t c = instr.srcB - variables.size();
+        if ((instr.srcB < variables.size()) || (c >= regprogram.constants.size()) ||
+            (static_cast<uint32_t>(regprogram.constants[c]) >= count))
+        {
+            qDebug() << "ProgramInstance: program rejected, unknown filter";
+            return false;
+        }
+        uint32_t n = static_cast<uint32_t>(regprogram.constants[c]);
+        if ((instr.opcode == P_biquadfilter) && filters.biquad[n].dynamic)
+        {
+            biquadOperands[n] = operands;
+            operands += filters.biquad[n].coefficients.size();
+        }
+    }
+    if (operands != regprogram.operands.size())
+    {
+        qDebug() << "ProgramInstance: program rejected, wrong number of biquad coefficients";
+        return false;
+    }
+    for(size_t i=0; i<regprogram.operands.size(); i++)
+    {
+        if (regprogram.operands[i] >= registers)
+        {
+            qDebug() << "ProgramInstance: program rejected, unknown register";
+            return false;
+        }
+    }
+
+    StateArena arena;
+    state_t state;
+    if (!createState(program, regprogram, variables, filters, operands, noiseSeed, arena, state))
+    {
+        return false;
+    }
+
+    // the threaded engine keeps the top of stack in a register
+    // and one junk entry below the first value, so it spills
+    // one entry beyond the depth when a biquad filter
+    // takes its coefficients from the stack
+    m_stack.assign(depth + 1, 0.0f);
+
+    m_vars = variables;
+    m_program = program;
+    m_regprogram = regprogram;
+    m_controlProgram = controlProgram;
+    m_controlDirty = true;
+
+    // setup sample rate
+    m_programRate = programRate;
+    setupResampling(deviceRate, programRate);
+    int32_t idx = VM::findVariableByName(m_vars, "samplerate");
+    if (idx != -1)
+    {
+        m_vars[idx].value = programRate;
+    }
+
+    // setup the register file:
+    // variables, constants and temporaries.
+    m_regs.clear();
+    for(size_t i=0; i<m_vars.size(); i++)
+    {
+        m_regs.push_back(m_vars[i].value);
+    }
+    m_regs.insert(m_regs.end(), m_regprogram.constants.begin(), m_regprogram.constants.end());
+    m_regs.resize(m_regs.size() + m_regprogram.temporaries, 0.0f);
+
+    m_arena.swap(arena);
+    m_noise = state.noise;
+    m_noiseCount = state.noiseCount;
+    m_firs = state.firs;
+    m_biquads = state.biquads;
+    m_biquadCoefficients = state.biquadCoefficients;
+    m_convs = state.convs;
+    m_biquadOperands.swap(biquadOperands);
+
+    // the precision is fixed for the lifetime of the
+    // program so the interpreters do not have to test it
+    m_precision = precision;
+    m_math = &FastMath::getKernels(m_precision);
+    m_vmath = &VectorMath::getKernels(m_precision);
+
+    decodeThreaded();
+    m_jit->compile(m_program, m_vars.size(), *m_math,
+                   m_noise, m_firs, m_biquads, m_convs);
+
+    // fall back to the stack engine if the
+    // selected engine cannot run this program
+    m_engine = isEngineAvailable(engine) ? engine : VirtualMachine::ENGINE_STACK;
+
+    bindVariables();
+    buildBlockSchedule();
+
+    if (stages > 1)
+    {
+        m_pipeline = Pipeline::create(program, variables, controlProgram, filters,
+                                      precision, noiseSeed, programRate, engine, stages);
+        if (m_pipeline != NULL)
+        {
+            m_engine = m_pipeline->isEngineAvailable(engine) ? engine : VirtualMachine::ENGINE_STACK;
+            m_pipeline->activateEngine(m_engine);
+            bindVariables();
+            qDebug() << "ProgramInstance: pipelined in" << m_pipeline->getStageCount()
+                     << "stages," << m_pipeline->getLatency() << "samples of latency";
+        }
+    }
+    return true;
+}
+
+void ProgramInstance::mapVariables(const ProgramInstance &previous)
+{
+    // the names are matched here, so the audio thread
+    // only copies the values. samplerate keeps the rate
+    // of this instance.
+    m_migrateFrom = &previous;
+    m_migration.assign(m_vars.size(), -1);
+    for(size_t i=0; i<m_vars.size(); i++)
+    {
+        if (m_vars[i].name != "samplerate")
+        {
+            m_migration[i] = previous.findVariable(m_vars[i].name);
+        }
+    }
+}
+
+bool ProgramInstance::migrate(const ProgramInstance &previous)
+{
+    if (m_migrateFrom != &previous)
+    {
+        return false;
+    }
+
+    // the block executor keeps its state in m_vars
+    // as well, so both storages are written
+    for(size_t i=0; i<m_migration.size(); i++)
+    {
+        if (m_migration[i] >= 0)
+        {
+            const float value = previous.getVariable(m_migration[i]);
+            m_vars[i].value = value;
+            if (!m_regs.empty())
+            {
+                m_regs[i] = value;
+            }
+            if (m_pipeline != NULL)
+            {
+                m_pipeline->setVariable(i, value);
+            }
+        }
+    }
+    m_controlDirty = true;
+    return true;
+}
+
+bool ProgramInstance::setNative(NativeCompiler *native)
+{
+    NativeCompiler *expected = NULL;
+    return m_native.compare_exchange_strong(expected, native, std::memory_order_acq_rel);
+}
+
+void ProgramInstance::setSlider(uint32_t id, float value)
+{
+    if ((id < 4) && (m_slider[id] != NULL))
+    {
+        *m_slider[id] = value;
+        m_controlDirty = true;
+    }
+    if (m_pipeline != NULL)
+    {
+        m_pipeline->setSlider(id, value);
+    }
+}
+
+void ProgramInstance::updateMonitors()
+{
+    for(uint32_t i=0; i<4; i++)
+    {
+        const int32_t idx = m_monitorRequest[i].load(std::memory_order_acquire);
+        if (idx != m_monitorIdx[i])
+        {
+            m_monitorIdx[i] = idx;
+            m_monitorVar[i] = getVariablePtr(idx);
+        }
+    }
+}
+
+void ProgramInstance::process(const float *inLeft, const float *inRight,
+                              uint32_t frames, float *outbuf, bool blockMode,
+                              PaUtilRingBuffer *rings)
+{
+    m_inLeft = inLeft;
+    m_inRight = inRight;
+    updateMonitors();
+
+    if (m_resampling)
+    {
+        executeResampled(frames, outbuf, blockMode, rings);
+    }
+    else
+    {
+        executeFrames(frames, outbuf, blockMode, rings);
+    }
+}
+
+void ProgramInstance::bindVariables()
+{
+    // find the lout, rout, lin, rin, in, out
+    // variables.
+    m_ioIdx[0] = VM::findVariableByName(m_vars, "in");
+    m_ioIdx[1] = VM::findVariableByName(m_vars, "inl");
+    m_ioIdx[2] = VM::findVariableByName(m_vars, "inr");
+    m_ioIdx[3] = VM::findVariableByName(m_vars, "out");
+    m_ioIdx[4] = VM::findVariableByName(m_vars, "outl");
+    m_ioIdx[5] = VM::findVariableByName(m_vars, "outr");
+
+    m_in   = getVariablePtr(m_ioIdx[0]);
+    m_lin  = getVariablePtr(m_ioIdx[1]);
+    m_rin  = getVariablePtr(m_ioIdx[2]);
+    m_out  = getVariablePtr(m_ioIdx[3]);
+    m_lout = getVariablePtr(m_ioIdx[4]);
+    m_rout = getVariablePtr(m_ioIdx[5]);
+
+    // setup sliders
+    m_slider[0] = getVariablePtr(VM::findVariableByName(m_vars, "slider1"));
+    m_slider[1] = getVariablePtr(VM::findVariableByName(m_vars, "slider2"));
+    m_slider[2] = getVariablePtr(VM::findVariableByName(m_vars, "slider3"));
+    m_slider[3] = getVariablePtr(VM::findVariableByName(m_vars, "slider4"));
+
+    for(uint32_t i=0; i<4; i++)
+    {
+        m_monitorVar[i] = getVariablePtr(m_monitorIdx[i]);
+    }
+}
+
+float* ProgramInstance::getVariablePtr(int32_t idx)
+{
+    if (idx < 0)
+    {
+        return NULL;
+    }
+    if (usesRegisterFile(m_engine))
+    {
+        return &m_regs[idx];
+    }
+    return &(m_vars[idx].value);
+}
+
+float ProgramInstance::getVariable(int32_t idx) const
+{
+    if (m_pipeline != NULL)
+    {
+        return m_pipeline->getVariable(idx);
+    }
+    return usesRegisterFile(m_engine) ? m_regs[idx] : m_vars[idx].value;
+}
+
+uint32_t ProgramInstance::getLatency() const
+{
+    if (m_pipeline == NULL)
+    {
+        return 0;
+    }
+    if (m_resampling)
+    {
+        const uint64_t up = m_upsampler[0].getUp();
+        const uint64_t down = m_upsampler[0].getDown();
+        return static_cast<uint32_t>((m_pipeline->getLatency()*up + down - 1) / down);
+    }
+    return m_pipeline->getLatency();
+}
+
+bool ProgramInstance::isEngineAvailable(engine_t engine) const
+{
+    if (m_pipeline != NULL)
+    {
+        return m_pipeline->isEngineAvailable(engine);
+    }
+
+    switch(engine)
+    {
+    case VirtualMachine::ENGINE_REGISTER:
+        return !m_regprogram.code.empty() || m_program.empty();
+    case VirtualMachine::ENGINE_THREADED:
+        return !m_threaded.empty();
+    case VirtualMachine::ENGINE_JIT:
+        return m_jit->isCompiled();
+    case VirtualMachine::ENGINE_NATIVE:
+        return m_native.load(std::memory_order_acquire) != NULL;
+    default:
+        return true;
+    }
+}
+
+void ProgramInstance::activateEngine(engine_t engine)
+{
+    if (engine == m_engine)
+    {
+        return;
+    }
+
+    // carry the variable values over to the
+    // storage of the new engine
+    const bool fromRegs = usesRegisterFile(m_engine);
+    const bool toRegs = usesRegisterFile(engine);
+    for(size_t i=0; (i<m_vars.size()) && (fromRegs != toRegs); i++)
+    {
+        if (toRegs)
+            m_regs[i] = m_vars[i].value;
+        else
+            m_vars[i].value = m_regs[i];
+    }
+
+    m_engine = engine;
+    bindVariables();
+    if (m_pipeline != NULL)
+    {
+        m_pipeline->activateEngine(engine);
+    }
+}
+
+void ProgramInstance::setupResampling(double sampleRate, float rate)
+{
+    const uint32_t deviceRate = static_cast<uint32_t>(sampleRate + 0.5);
+    m_resampling = (rate != sampleRate);
+    m_resampleChunk = VM_BLOCKSIZE;
+    m_resampleFill = 0;
+    if (!m_resampling)
+    {
+        return;
+    }
+
+    const uint32_t virtualRate = static_cast<uint32_t>(rate);
+    for(uint32_t i=0; i<2; i++)
+    {
+        m_downsampler[i].init(virtualRate, deviceRate);
+        m_upsampler[i].init(deviceRate, virtualRate);
+    }
+
+    // the input of a block at the virtual rate must fit the
+    // planar buffers, which hold VM_BLOCKSIZE samples
+    const uint32_t up = m_downsampler[0].getUp();
+    const uint32_t down = m_downsampler[0].getDown();
+    m_resampleChunk = std::min<uint32_t>(((VM_BLOCKSIZE-1)*down) / up, VM_BLOCKSIZE);
+
+    m_resampleBuffer.resize(2*VM_BLOCKSIZE);
+    m_resampleOutput.resize(2*VM_BLOCKSIZE);
+
+    // the output of the upsamplers runs ahead of the sound
+    // card by less than one sample at the virtual rate
+    const uint32_t fifo = VM_BLOCKSIZE + m_upsampler[0].getMaxOutput(VM_BLOCKSIZE);
+    m_resampleFifo[0].resize(fifo);
+    m_resampleFifo[1].resize(fifo);
+}
+
+void ProgramInstance::executeFrames(uint32_t frames, float *outbuf, bool blockMode, PaUtilRingBuffer *rings)
+{
+    if (m_pipeline != NULL)
+    {
+        // the monitor samples leave the pipeline with the output
+        const uint32_t done = m_pipeline->process(m_inLeft, m_inRight, frames, outbuf, m_monitorIdx,
+                                                  &m_scopeBlock[0], &m_spectrumBlock[0]);
+        if (rings != NULL)
+        {
+            PaUtil_WriteRingBuffer(&rings[0], &m_scopeBlock[0], done);
+            PaUtil_WriteRingBuffer(&rings[1], &m_spectrumBlock[0], done);
+        }
+        return;
+    }
+
+    if (m_controlDirty)
+    {
+        executeControl();
+    }
+
+    if (blockMode && (m_engine == VirtualMachine::ENGINE_STACK))
+    {
+        executeBlock(frames, outbuf);
+    }
+    else if (m_engine == VirtualMachine::ENGINE_NATIVE)
+    {
+        executeNative(frames, outbuf);
+    }
+    else
+    {
+        for(uint32_t i=0; i<frames; i++)
+        {
+            executeProgram(m_inLeft[i], m_inRight[i], outbuf[i<<1], outbuf[(i<<1)+1]);
+
+            m_scopeBlock[i].s1 = (m_monitorVar[0] != NULL) ? *m_monitorVar[0] : 0.0f;
+            m_scopeBlock[i].s2 = (m_monitorVar[1] != NULL) ? *m_monitorVar[1] : 0.0f;
+            m_spectrumBlock[i].s1 = (m_monitorVar[2] != NULL) ? *m_monitorVar[2] : 0.0f;
+            m_spectrumBlock[i].s2 = (m_monitorVar[3] != NULL) ? *m_monitorVar[3] : 0.0f;
+        }
+    }
+
+    if (rings != NULL)
+    {
+        PaUtil_WriteRingBuffer(&rings[0], &m_scopeBlock[0], frames);
+        PaUtil_WriteRingBuffer(&rings[1], &m_spectrumBlock[0], frames);
+    }
+}
+
+void ProgramInstance::executeResampled(uint32_t frames, float *outbuf, bool blockMode, PaUtilRingBuffer *rings)
+{
+    // the input at the virtual rate replaces that of the sound card
+    float *left = &m_resampleBuffer[0];
+    float *right = &m_resampleBuffer[VM_BLOCKSIZE];
+    const uint32_t n = m_downsampler[0].process(m_inLeft, frames, left);
+    m_downsampler[1].process(m_inRight, frames, right);
+    m_inLeft = left;
+    m_inRight = right;
+
+    // below the rate of the sound card, a short callback
+    // may not complete a sample at the virtual rate
+    if (n > 0)
+    {
+        executeFrames(n, &m_resampleOutput[0], blockMode, rings);
+    }
+
+    for(uint32_t i=0; i<n; i++)
+    {
+        left[i] = m_resampleOutput[i<<1];
+        right[i] = m_resampleOutput[(i<<1)+1];
+    }
+    const uint32_t produced = m_upsampler[0].process(left, n, &m_resampleFifo[0][m_resampleFill]);
+    m_upsampler[1].process(right, n, &m_resampleFifo[1][m_resampleFill]);
+    m_resampleFill += produced;
+
+    // the upsamplers always produce at least as many
+    // samples as the sound card has consumed
+    for(uint32_t i=0; i<frames; i++)
+    {
+        outbuf[i<<1] = m_resampleFifo[0][i];
+        outbuf[(i<<1)+1] = m_resampleFifo[1][i];
+    }
+    m_resampleFill -= frames;
+    memmove(&m_resampleFifo[0][0], &m_resampleFifo[0][frames], m_resampleFill*sizeof(float));
+    memmove(&m_resampleFifo[1][0], &m_resampleFifo[1][frames], m_resampleFill*sizeof(float));
+}
+
+void ProgramInstance::executeNative(uint32_t frames, float *outbuf)
+{
+    m_native.load(std::memory_order_acquire)->getFunction()(m_regs.empty() ? NULL : &m_regs[0],
+                            &m_inLeft[0], &m_inRight[0], outbuf,
+                            &m_scopeBlock[0].s1, &m_spectrumBlock[0].s1,
+                            m_monitorIdx, nativeNoise, nativeFIR, nativeBiquad,
+                            nativeConv, this, frames);
+}
+
+bool ProgramInstance::createState(const VM::program_t &program,
+                                 const VM::regprogram_t &regprogram,
+                                 const VM::variables_t &variables,
+                                 const VM::filters_t &filters,
+                                 uint32_t operands, uint32_t noiseSeed,
+                                 StateArena &arena, state_t &state)
+{
+    // the noise functions of the program, by generator number
+    std::vector<NoiseGenerator::type_t> noise;
+    for(size_t pc=0; pc<program.size(); pc+=VM::getInstructionLength(program[pc].icode))
+    {
+        uint32_t icode = program[pc].icode;
+        if ((icode & 0xff000000) == P_noisegen)
+        {
+            uint32_t n = icode & 0xFFFF;
+            if (n >= noise.size())
+            {
+                noise.resize(n+1, NoiseGenerator::NOISE_UNIFORM);
+            }
+            noise[n] = static_cast<NoiseGenerator::type_t>((icode >> 16) & 0xFF);
+        }
+    }
+
+    // the register program numbers its noise functions the
+    // same way, but must not index beyond the generators
+    for(size_t i=0; i<regprogram.code.size(); i++)
+    {
+        const VM::reginstr_t &instr = regprogram.code[i];
+        NoiseGenerator::type_t type;
+        switch(instr.opcode)
+        {
+        case P_noise:
+            type = NoiseGenerator::NOISE_UNIFORM;
+            break;
+        case P_gaussnoise:
+            type = NoiseGenerator::NOISE_GAUSSIAN;
+            break;
+        case P_pinknoise:
+            type = NoiseGenerator::NOISE_PINK;
+            break;
+        default:
+            continue;
+        }
+        const float index = (instr.srcA < variables.size()) ? variables[instr.srcA].value :
+                            regprogram.constants[instr.srcA - variables.size()];
+        uint32_t n = static_cast<uint32_t>(index);
+        if (n >= noise.size())
+        {
+            noise.resize(n+1, type);
+        }
+    }
+
+    // the objects first, so those of a kind are
+    // contiguous, followed by the state of each
+    size_t bytes = StateArena::getSize<NoiseGenerator>(noise.size()) +
+                   StateArena::getSize<FIRFilter>(filters.fir.size()) +
+                   StateArena::getSize<BiquadFilter>(filters.biquad.size()) +
+                   StateArena::getSize<float>(operands) +
+                   StateArena::getSize<Convolver>(filters.conv.size());
+    for(size_t i=0; i<filters.fir.size(); i++)
+    {
+        bytes += FIRFilter::getStateSize(filters.fir[i].size());
+    }
+    for(size_t i=0; i<filters.biquad.size(); i++)
+    {
+        bytes += BiquadFilter::getStateSize(filters.biquad[i].coefficients.size() / BIQUAD_COEFFICIENTS);
+    }
+    for(size_t i=0; i<filters.conv.size(); i++)
+    {
+        bytes += Convolver::getStateSize(filters.conv[i].size());
+    }
+
+    if (!arena.allocate(bytes))
+    {
+        qDebug() << "ProgramInstance: program rejected, cannot allocate" << bytes << "bytes of state";
+        return false;
+    }
+
+    state.noise = arena.take<NoiseGenerator>(noise.size());
+    state.noiseCount = noise.size();
+    state.firs = arena.take<FIRFilter>(filters.fir.size());
+    state.biquads = arena.take<BiquadFilter>(filters.biquad.size());
+    state.biquadCoefficients = arena.take<float>(operands);
+    state.convs = arena.take<Convolver>(filters.conv.size());
+
+    for(size_t n=0; n<noise.size(); n++)
+    {
+        new (&state.noise[n]) NoiseGenerator();
+        state.noise[n].init(noise[n], noiseSeed, n);
+    }
+    for(size_t i=0; i<filters.fir.size(); i++)
+    {
+        new (&state.firs[i]) FIRFilter();
+        state.firs[i].init(filters.fir[i], arena);
+    }
+    for(size_t i=0; i<filters.biquad.size(); i++)
+    {
+        new (&state.biquads[i]) BiquadFilter();
+        state.biquads[i].init(filters.biquad[i].coefficients, arena);
+    }
+    for(size_t i=0; i<filters.conv.size(); i++)
+    {
+        new (&state.convs[i]) Convolver();
+        state.convs[i].init(filters.conv[i], arena);
+    }
+    return true;
+}
+
+void ProgramInstance::seedNoiseGenerators(uint32_t seed)
+{
+    for(size_t n=0; n<m_noiseCount; n++)
+    {
+        m_noise[n].init(m_noise[n].getType(), seed, n);
+    }
+    if (m_pipeline != NULL)
+    {
+        m_pipeline->seedNoiseGenerators(seed);
+    }
+}
+
+float ProgramInstance::nativeNoise(void *context, uint32_t n)
+{
+    return static_cast<ProgramInstance*>(context)->m_noise[n].next();
+}
+
+float ProgramInstance::nativeFIR(void *context, uint32_t n, float x)
+{
+    return static_cast<ProgramInstance*>(context)->m_firs[n].process(x);
+}
+
+float ProgramInstance::nativeBiquad(void *context, uint32_t n, float x, const float *coefficients)
+{
+    BiquadFilter &biquad = static_cast<ProgramInstance*>(context)->m_biquads[n];
+    if (coefficients != NULL)
+    {
+        biquad.setCoefficients(coefficients);
+    }
+    return biquad.process(x);
+}
+
+float ProgramInstance::nativeConv(void *context, uint32_t n, float x)
+{
+    return static_cast<ProgramInstance*>(context)->m_convs[n].process(x);
+}
+
+void ProgramInstance::executeProgram(float inLeft, float inRight, float &outLeft, float &outRight)
+{
+    const size_t instructions = m_program.size();
+
+    // check if we have a program
+    if (instructions == 0)
+    {
+        outLeft = 0.0f;
+        outRight = 0.0f;
+        return;
+    }
+
+    // setup input signal
+    if (m_in != 0)
+    {
+        *m_in = (inLeft + inRight) / 2.0f;
+    }
+    if (m_lin != 0)
+    {
+        *m_lin = inLeft;
+    }
+    if (m_rin != 0)
+    {
+        *m_rin = inRight;
+    }
+
+    switch(m_engine)
+    {
+    case VirtualMachine::ENGINE_REGISTER:
+        executeRegisters();
+        break;
+    case VirtualMachine::ENGINE_THREADED:
+        executeThreaded(NULL);
+        break;
+    case VirtualMachine::ENGINE_JIT:
+        m_jit->execute(m_regs.empty() ? NULL : &m_regs[0]);
+        break;
+    default:
+        executeRange(m_program, 0, instructions, &m_stack[0]);
+        break;
+    }
+
+    if (m_out != 0)
+    {
+        outLeft = *m_out;
+        outRight = *m_out;
+    }
+    else
+    {
+        if (m_lout != 0)
+        {
+            outLeft = *m_lout;
+        }
+        else
+        {
+            outLeft = 0.0f;
+        }
+        if (m_rout != 0)
+        {
+            outRight = *m_rout;
+        }
+        else
+        {
+            outRight = 0.0f;
+        }
+    }
+}
+
+void ProgramInstance::executeRange(const VM::program_t &program, size_t first, size_t last, float *stack)
+{
+    size_t pc = first;  // program counter
+    size_t sp = 0;      // stack pointer
+
+    while(pc < last)
+    {
+        VM::instruction_t instruction = program[pc++];
+        if (instruction.icode & 0x80000000)
+        {
+            // special instruction with additional parameter
+            uint32_t n = instruction.icode & 0xFFFF;
+            switch(instruction.icode & 0xff000000)
+            {
+            case P_readvar: // push
+                stack[sp++] = m_vars[n].value;
+                break;
+            case P_writevar:// pop
+                m_vars[n].value = stack[--sp];
+                break;
+            case P_fir:
+                stack[sp-1] = m_firs[n].process(stack[sp-1]);
+                break;
+            case P_conv:
+                stack[sp-1] = m_convs[n].process(stack[sp-1]);
+                break;
+            case P_biquad:
+                sp-=execBiquad(n, (instruction.icode >> 16) & 0xFF, stack+sp);
+                break;
+            case P_addvv:
+                stack[sp++] = m_vars[n].value + m_vars[program[pc++].icode].value;
+                break;
+            case P_mulvv:
+                stack[sp++] = m_vars[n].value * m_vars[program[pc++].icode].value;
+                break;
+            case P_mac:
+                stack[sp-1] += m_vars[n].value * m_vars[program[pc++].icode].value;
+                break;
+            case P_rmwadd:
+                m_vars[n].value = m_vars[n].value + program[pc++].value;
+                break;
+            case P_noisegen:
+                stack[sp++] = m_noise[n].next();
+                break;
+            default:
+                // TODO: produce error
+                break;
+            }
+        }
+        else
+        {
+            switch(instruction.icode)
+            {
+            case P_add:
+                sp--;
+                stack[sp-1]+=stack[sp];
+                break;
+            case P_sub:
+                sp--;
+                stack[sp-1]=stack[sp-1]-stack[sp];
+                //qDebug() << stack[sp-1];
+                break;
+            case P_mul:
+                sp--;
+                stack[sp-1]*=stack[sp];
+                break;
+            case P_div:
+                sp--;
+                stack[sp-1]/=stack[sp];
+                break;
+            case P_neg:
+                stack[sp-1]=-stack[sp-1];
+                break;
+            case P_sin:
+                stack[sp-1]=m_math->sin(stack[sp-1]);
+                break;
+            case P_tan:
+                stack[sp-1]=tan(stack[sp-1]);
+                break;
+            case P_tanh:
+                stack[sp-1]=m_math->tanh(stack[sp-1]);
+                break;
+            case P_cos:
+                stack[sp-1]=m_math->cos(stack[sp-1]);
+                break;
+            case P_sin1:
+                stack[sp-1]=m_math->sin1(stack[sp-1]);
+                break;
+            case P_cos1:
+                stack[sp-1]=m_math->cos1(stack[sp-1]);
+                break;
+            case P_literal:
+                stack[sp++]=program[pc].value;
+                pc++;
+                break;
+            case P_mullit:
+                stack[sp-1]*=program[pc].value;
+                pc++;
+                break;
+            case P_addlit:
+                stack[sp-1]+=program[pc].value;
+                pc++;
+                break;
+            //case P_print:
+            //  printf("%f\n",stack[--sp]);
+            //    break;
+            case P_mod1:
+                stack[sp-1]=stack[sp-1]-(int)stack[sp-1];
+                break;
+            case P_abs:
+                stack[sp-1]=fabs(stack[sp-1]);
+                break;
+            case P_sqrt:
+                stack[sp-1]=sqrt(stack[sp-1]);
+                break;
+            case P_round:
+                //sp--;
+                //if (stack[sp]!=0.0f)
+                //    stack[sp-1]=stack[sp]*round(stack[sp-1]/stack[sp]);
+                stack[sp-1]=round(stack[sp-1]);
+                break;
+            case P_pow:
+                sp--;
+                stack[sp-1]=m_math->pow(stack[sp-1],stack[sp]);
+                break;
+            case P_limit:
+                stack[sp-1]=std::min(stack[sp-1],1.0f);
+                stack[sp-1]=std::max(stack[sp-1],-1.0f);
+                break;
+            case P_atan2:
+                sp--;
+                stack[sp-1]=m_math->atan2(stack[sp-1],stack[sp]);
+                break;
+            case P_sign:
+                if (stack[sp-1] >= 0.0f)
+                    stack[sp-1]=1.0f;
+                else
+                    stack[sp-1]=-1.0f;
+                break;
+            case P_trunc:
+                stack[sp-1] = std::trunc(stack[sp-1]);
+                break;
+            case P_ceil:
+                stack[sp-1] = std::ceil(stack[sp-1]);
+                break;
+            case P_floor:
+                stack[sp-1] = std::floor(stack[sp-1]);
+                break;
+            default:
+                // TODO: produce error
+                break;
+            }
+        }
+    }
+}
+
+void ProgramInstance::executeControl()
+{
+    // the control program runs on m_vars. the register
+    // file engines keep the sliders and the results in m_regs.
+    const bool registers = usesRegisterFile(m_engine);
+    const size_t nvars = m_vars.size();
+    if (registers)
+    {
+        for(size_t i=0; i<nvars; i++)
+            m_vars[i].value = m_regs[i];
+    }
+
+    executeRange(m_controlProgram, 0, m_controlProgram.size(), &m_stack[0]);
+
+    if (registers)
+    {
+        for(size_t i=0; i<nvars; i++)
+            m_regs[i] = m_vars[i].value;
+    }
+    m_controlDirty = false;
+}
+
+void ProgramInstance::executeRegisters()
+{
+    float *r = &m_regs[0];
+    const VM::reginstr_t *instr = &m_regprogram.code[0];
+    const VM::reginstr_t *end = instr + m_regprogram.code.size();
+
+    while(instr < end)
+    {
+        const uint32_t dst = instr->dst;
+        const float a = r[instr->srcA];
+        const float b = r[instr->srcB];
+        switch(instr->opcode)
+        {
+        case P_add:
+            r[dst] = a + b;
+            break;
+        case P_sub:
+            r[dst] = a - b;
+            break;
+        case P_mul:
+            r[dst] = a * b;
+            break;
+        case P_div:
+            r[dst] = a / b;
+            break;
+        case P_neg:
+            r[dst] = -a;
+            break;
+        case P_mov:
+            r[dst] = a;
+            break;
+        case P_sin:
+            r[dst] = m_math->sin(a);
+            break;
+        case P_tan:
+            r[dst] = tan(a);
+            break;
+        case P_tanh:
+            r[dst] = m_math->tanh(a);
+            break;
+        case P_cos:
+            r[dst] = m_math->cos(a);
+            break;
+        case P_sin1:
+            r[dst] = m_math->sin1(a);
+            break;
+        case P_cos1:
+            r[dst] = m_math->cos1(a);
+            break;
+        case P_mod1:
+            r[dst] = a-(int)a;
+            break;
+        case P_abs:
+            r[dst] = fabs(a);
+            break;
+        case P_sqrt:
+            r[dst] = sqrt(a);
+            break;
+        case P_round:
+            r[dst] = round(a);
+            break;
+        case P_pow:
+            r[dst] = m_math->pow(a,b);
+            break;
+        case P_limit:
+            r[dst] = std::max(std::min(a,1.0f),-1.0f);
+            break;
+        case P_atan2:
+            r[dst] = m_math->atan2(a,b);
+            break;
+        case P_sign:
+            r[dst] = (a >= 0.0f) ? 1.0f : -1.0f;
+            break;
+        case P_noise:
+        case P_gaussnoise:
+        case P_pinknoise:
+            r[dst] = m_noise[static_cast<uint32_t>(a)].next();
+            break;
+        case P_firfilter:
+            r[dst] = m_firs[static_cast<uint32_t>(b)].process(a);
+            break;
+        case P_convolve:
+            r[dst] = m_convs[static_cast<uint32_t>(b)].process(a);
+            break;
+        case P_biquadfilter:
+            {
+                uint32_t n = static_cast<uint32_t>(b);
+                if (m_biquadOperands[n] >= 0)
+                {
+                    // gather the coefficients from their registers
+                    const uint16_t *operands = &m_regprogram.operands[m_biquadOperands[n]];
+                    const uint32_t count = m_biquads[n].getSections()*BIQUAD_COEFFICIENTS;
+                    for(uint32_t k=0; k<count; k++)
+                    {
+                        m_biquadCoefficients[k] = r[operands[k]];
+                    }
+                    m_biquads[n].setCoefficients(&m_biquadCoefficients[0]);
+                }
+                r[dst] = m_biquads[n].process(a);
+            }
+            break;
+        case P_trunc:
+            r[dst] = std::trunc(a);
+            break;
+        case P_ceil:
+            r[dst] = std::ceil(a);
+            break;
+        case P_floor:
+            r[dst] = std::floor(a);
+            break;
+        default:
+            // not reached: load() rejects the instructions
+            // that VM::isRegisterInstruction does not know
+            break;
+        }
+        instr++;
+    }
+}
+
+// dense handler indices of the threaded interpreter.
+// the order must match the handler table in executeThreaded.
+enum threadedOp_t
+{
+    T_end = 0,
+    T_nop,
+    T_readvar,
+    T_writevar,
+    T_literal,
+    T_fir,
+    T_biquad,
+    T_add,
+    T_sub,
+    T_mul,
+    T_div,
+    T_neg,
+    T_sin,
+    T_cos,
+    T_sin1,
+    T_cos1,
+    T_mod1,
+    T_abs,
+    T_round,
+    T_sqrt,
+    T_tan,
+    T_tanh,
+    T_pow,
+    T_limit,
+    T_atan2,
+    T_sign,
+    T_noise,
+    T_trunc,
+    T_ceil,
+    T_floor,
+    T_mullit,
+    T_addlit,
+    T_addvv,
+    T_mulvv,
+    T_mac,
+    T_rmwadd,
+    T_conv
+};
+
+void ProgramInstance::decodeThreaded()
+{
+    const void * const *labels = NULL;
+    executeThreaded(&labels);
+
+    m_threaded.clear();
+
+    const size_t instructions = m_program.size();
+    size_t pc = 0;
+    while(pc < instructions)
+    {
+        threaded_t t;
+        t.index = 0;
+        t.index2 = 0;
+        t.op = T_nop;
+
+        uint32_t icode = m_program[pc++].icode;
+
+        if (icode & 0x80000000)
+        {
+            t.index = icode & 0xFFFF;
+            switch(icode & 0xff000000)
+            {
+            case P_readvar:
+                t.op = T_readvar;
+                break;
+            case P_writevar:
+                t.op = T_writevar;
+                break;
+            case P_fir:
+                t.op = T_fir;
+                break;
+            case P_conv:
+                t.op = T_conv;
+                break;
+            case P_biquad:
+                t.op = T_biquad;
+                t.index2 = (icode >> 16) & 0xFF;
+                break;
+            case P_addvv:
+                t.op = T_addvv;
+                t.index2 = m_program[pc++].icode;
+                break;
+            case P_mulvv:
+                t.op = T_mulvv;
+                t.index2 = m_program[pc++].icode;
+                break;
+            case P_mac:
+                t.op = T_mac;
+                t.index2 = m_program[pc++].icode;
+                break;
+            case P_rmwadd:
+                t.op = T_rmwadd;
+                t.value = m_program[pc++].value;
+                break;
+            case P_noisegen:
+                t.op = T_noise;
+                break;
+            default:
+                break;
+            }
+        }
+        else
+        {
+            switch(icode)
+            {
+            case P_literal:
+                t.op = T_literal;
+                t.value = m_program[pc++].value;
+                break;
+            case P_mullit:
+                t.op = T_mullit;
+                t.value = m_program[pc++].value;
+                break;
+            case P_addlit:
+                t.op = T_addlit;
+                t.value = m_program[pc++].value;
+                break;
+            case P_add:     t.op = T_add;   break;
+            case P_sub:     t.op = T_sub;   break;
+            case P_mul:     t.op = T_mul;   break;
+            case P_div:     t.op = T_div;   break;
+            case P_neg:     t.op = T_neg;   break;
+            case P_sin:     t.op = T_sin;   break;
+            case P_cos:     t.op = T_cos;   break;
+            case P_sin1:    t.op = T_sin1;  break;
+            case P_cos1:    t.op = T_cos1;  break;
+            case P_mod1:    t.op = T_mod1;  break;
+            case P_abs:     t.op = T_abs;   break;
+            case P_round:   t.op = T_round; break;
+            case P_sqrt:    t.op = T_sqrt;  break;
+            case P_tan:     t.op = T_tan;   break;
+            case P_tanh:    t.op = T_tanh;  break;
+            case P_pow:     t.op = T_pow;   break;
+            case P_limit:   t.op = T_limit; break;
+            case P_atan2:   t.op = T_atan2; break;
+            case P_sign:    t.op = T_sign;  break;
+            case P_trunc:   t.op = T_trunc; break;
+            case P_ceil:    t.op = T_ceil;  break;
+            case P_floor:   t.op = T_floor; break;
+            default:
+                break;
+            }
+        }
+        t.handler = (labels != NULL) ? labels[t.op] : NULL;
+        m_threaded.push_back(t);
+    }
+
+    threaded_t t;
+    t.index = 0;
+    t.index2 = 0;
+    t.op = T_end;
+    t.handler = (labels != NULL) ? labels[T_end] : NULL;
+    m_threaded.push_back(t);
+}
+
+// GCC and Clang support taking the address of a label,
+// which allows each handler to jump directly to the next one.
+// Other compilers use a switch on the dense handler index.
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define HANDLER(op) L_##op
+#define DISPATCH()  goto *ip->handler
+#else
+#define HANDLER(op) case T_##op
+#define DISPATCH()  continue
+#endif
+
+void ProgramInstance::executeThreaded(const void * const **labels)
+{
+#ifdef VM_COMPUTED_GOTO
+    static const void * const handlers[] =
+    {
+        &&L_end, &&L_nop, &&L_readvar, &&L_writevar, &&L_literal,
+        &&L_fir, &&L_biquad, &&L_add, &&L_sub, &&L_mul, &&L_div,
+        &&L_neg, &&L_sin, &&L_cos, &&L_sin1, &&L_cos1, &&L_mod1,
+        &&L_abs, &&L_round, &&L_sqrt, &&L_tan, &&L_tanh, &&L_pow,
+        &&L_limit, &&L_atan2, &&L_sign, &&L_noise, &&L_trunc,
+        &&L_ceil, &&L_floor, &&L_mullit, &&L_addlit, &&L_addvv,
+        &&L_mulvv, &&L_mac, &&L_rmwadd, &&L_conv
+    };
+
+    if (labels != NULL)
+    {
+        *labels = handlers;
+        return;
+    }
+#else
+    if (labels != NULL)
+    {
+        *labels = NULL;
+        return;
+    }
+#endif
+
+    const threaded_t *ip = &m_threaded[0];
+    float   *stack = &m_stack[0];
+    size_t  sp = 0;         // stack pointer, excluding the top of stack
+    float   tos = 0.0f;     // cached top of stack
+
+#ifdef VM_COMPUTED_GOTO
+    DISPATCH();
+#else
+    for(;;)
+    {
+        switch(ip->op)
+        {
+#endif
+    HANDLER(end):
+        return;
+    HANDLER(nop):
+        ip++;
+        DISPATCH();
+    HANDLER(readvar):
+        stack[sp++] = tos;
+        tos = m_vars[ip->index].value;
+        ip++;
+        DISPATCH();
+    HANDLER(writevar):
+        m_vars[ip->index].value = tos;
+        tos = stack[--sp];
+        ip++;
+        DISPATCH();
+    HANDLER(literal):
+        stack[sp++] = tos;
+        tos = ip->value;
+        ip++;
+        DISPATCH();
+    HANDLER(fir):
+        tos = m_firs[ip->index].process(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(conv):
+        tos = m_convs[ip->index].process(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(biquad):
+        if (ip->index2 == 0)
+        {
+            tos = m_biquads[ip->index].process(tos);
+        }
+        else
+        {
+            // the coefficients must be contiguous, so the
+            // top of stack goes into the spare slot of m_stack
+            stack[sp++] = tos;
+            sp -= execBiquad(ip->index, ip->index2, stack+sp);
+            tos = stack[--sp];
+        }
+        ip++;
+        DISPATCH();
+    HANDLER(add):
+        tos = stack[--sp] + tos;
+        ip++;
+        DISPATCH();
+    HANDLER(sub):
+        tos = stack[--sp] - tos;
+        ip++;
+        DISPATCH();
+    HANDLER(mul):
+        tos = stack[--sp] * tos;
+        ip++;
+        DISPATCH();
+    HANDLER(div):
+        tos = stack[--sp] / tos;
+        ip++;
+        DISPATCH();
+    HANDLER(neg):
+        tos = -tos;
+        ip++;
+        DISPATCH();
+    HANDLER(sin):
+        tos = m_math->sin(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(cos):
+        tos = m_math->cos(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(sin1):
+        tos = m_math->sin1(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(cos1):
+        tos = m_math->cos1(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(mod1):
+        tos = tos-(int)tos;
+        ip++;
+        DISPATCH();
+    HANDLER(abs):
+        tos = fabs(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(round):
+        tos = round(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(sqrt):
+        tos = sqrt(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(tan):
+        tos = tan(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(tanh):
+        tos = m_math->tanh(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(pow):
+        tos = m_math->pow(stack[--sp], tos);
+        ip++;
+        DISPATCH();
+    HANDLER(limit):
+        tos = std::max(std::min(tos,1.0f),-1.0f);
+        ip++;
+        DISPATCH();
+    HANDLER(atan2):
+        tos = m_math->atan2(stack[--sp], tos);
+        ip++;
+        DISPATCH();
+    HANDLER(sign):
+        tos = (tos >= 0.0f) ? 1.0f : -1.0f;
+        ip++;
+        DISPATCH();
+    HANDLER(noise):
+        stack[sp++] = tos;
+        tos = m_noise[ip->index].next();
+        ip++;
+        DISPATCH();
+    HANDLER(trunc):
+        tos = std::trunc(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(ceil):
+        tos = std::ceil(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(floor):
+        tos = std::floor(tos);
+        ip++;
+        DISPATCH();
+    HANDLER(mullit):
+        tos = tos * ip->value;
+        ip++;
+        DISPATCH();
+    HANDLER(addlit):
+        tos = tos + ip->value;
+        ip++;
+        DISPATCH();
+    HANDLER(addvv):
+        stack[sp++] = tos;
+        tos = m_vars[ip->index].value + m_vars[ip->index2].value;
+        ip++;
+        DISPATCH();
+    HANDLER(mulvv):
+        stack[sp++] = tos;
+        tos = m_vars[ip->index].value * m_vars[ip->index2].value;
+        ip++;
+        DISPATCH();
+    HANDLER(mac):
+        tos = tos + m_vars[ip->index].value * m_vars[ip->index2].value;
+        ip++;
+        DISPATCH();
+    HANDLER(rmwadd):
+        m_vars[ip->index].value = m_vars[ip->index].value + ip->value;
+        ip++;
+        DISPATCH();
+#ifndef VM_COMPUTED_GOTO
+        }
+    }
+#endif
+}
+
+#undef HANDLER
+#undef DISPATCH
+
+void ProgramInstance::splitStatements(const VM::program_t &program,
+                                      std::vector<statement_t> &statements)
+{
+    const size_t instructions = program.size();
+
+    statements.clear();
+    statement_t stmt;
+    stmt.first = 0;
+    stmt.dst = -1;
+    stmt.stateful = false;
+
+    size_t pc = 0;
+    while(pc < instructions)
+    {
+        uint32_t icode = program[pc].icode;
+        uint32_t operand = (pc+1 < instructions) ? program[pc+1].icode : 0;
+        pc += VM::getInstructionLength(icode);
+
+        if ((icode & 0x80000000) == 0)
+            continue;
+
+        uint32_t n = icode & 0xFFFF;
+        switch(icode & 0xff000000)
+        {
+        case P_readvar:
+            stmt.reads.push_back(n);
+            break;
+        case P_addvv:
+        case P_mulvv:
+        case P_mac:
+            stmt.reads.push_back(n);
+            stmt.reads.push_back(operand);
+            break;
+        case P_rmwadd:
+            // read and write: the statement ends here
+            stmt.reads.push_back(n);
+            // fall through
+        case P_writevar:
+            stmt.dst = n;
+            stmt.last = pc;
+            statements.push_back(stmt);
+            stmt.first = pc;
+            stmt.dst = -1;
+            stmt.stateful = false;
+            stmt.reads.clear();
+            break;
+        case P_noisegen:
+            // the generators are independent, so a whole
+            // block of values can be generated at once
+            break;
+        case P_fir:
+        case P_conv:
+            // FIR filters and convolvers only depend on their
+            // own input, so a block of input gives the same
+            // output as filtering sample by sample
+            break;
+        case P_biquad:
+            // so does a biquad filter with fixed coefficients.
+            // changing coefficients are computed per sample.
+            if ((icode >> 16) & 0xFF)
+            {
+                stmt.stateful = true;
+            }
+            break;
+        default:
+            stmt.stateful = true;
+            break;
+        }
+    }
+
+    if (stmt.first < instructions)
+    {
+        // trailing instructions without an assignment
+        stmt.last = instructions;
+        stmt.stateful = true;
+        statements.push_back(stmt);
+    }
+}
+
+void ProgramInstance::buildBlockSchedule()
+{
+    const size_t nvars = m_vars.size();
+
+    m_blockRegions.clear();
+    m_blockConsts.clear();
+    m_blockCarry.clear();
+
+    std::vector<statement_t> statements;
+    splitStatements(m_program, statements);
+
+    uint32_t maxDepth = 1;
+    VM::getStackDepth(m_program, maxDepth);
+    maxDepth = std::max(maxDepth, 1u);
+
+    // the input variables are written by the VM before
+    // the program starts, all others by their statements.
+    std::vector<bool> isInput(nvars, false);
+    for(uint32_t i=0; i<3; i++)
+    {
+        if (m_ioIdx[i] != -1)
+            isInput[m_ioIdx[i]] = true;
+    }
+
+    std::vector<int32_t> lastWriter(nvars, -1);
+    for(size_t k=0; k<statements.size(); k++)
+    {
+        if (statements[k].dst != -1)
+            lastWriter[statements[k].dst] = k;
+    }
+
+    // a statement that reads a variable before it is
+    // written in the same sample sees the value of the
+    // previous sample. all statements up to the last
+    // writer of that variable are part of the feedback
+    // loop and must be executed sample by sample.
+    std::vector<int32_t> feedbackEnd(statements.size(), -1);
+    std::vector<bool> written = isInput;
+    for(size_t k=0; k<statements.size(); k++)
+    {
+        if (statements[k].stateful)
+            feedbackEnd[k] = k;
+
+        const std::vector<uint32_t> &reads = statements[k].reads;
+        for(size_t r=0; r<reads.size(); r++)
+        {
+            uint32_t v = reads[r];
+            if ((!written[v]) && (lastWriter[v] != -1))
+            {
+                feedbackEnd[k] = std::max(feedbackEnd[k], lastWriter[v]);
+            }
+        }
+
+        if (statements[k].dst != -1)
+            written[statements[k].dst] = true;
+    }
+
+    // merge the statements into regions
+    written = isInput;
+    size_t k = 0;
+    while(k < statements.size())
+    {
+        blockRegion_t region;
+        region.first = statements[k].first;
+        region.perSample = (feedbackEnd[k] != -1);
+
+        size_t end = k;
+        if (region.perSample)
+        {
+            // extend the region until all
+            // feedback loops are closed.
+            int32_t loopEnd = feedbackEnd[k];
+            while(end < (size_t)loopEnd)
+            {
+                end++;
+                loopEnd = std::max(loopEnd, feedbackEnd[end]);
+            }
+
+            std::vector<bool> isLoad(nvars, false);
+            std::vector<bool> isStore(nvars, false);
+            for(size_t j=k; j<=end; j++)
+            {
+                const std::vector<uint32_t> &reads = statements[j].reads;
+                for(size_t r=0; r<reads.size(); r++)
+                {
+                    uint32_t v = reads[r];
+                    if (written[v] && !isLoad[v])
+                    {
+                        isLoad[v] = true;
+                        region.loads.push_back(v);
+                    }
+                }
+                int32_t dst = statements[j].dst;
+                if ((dst != -1) && !isStore[dst])
+                {
+                    isStore[dst] = true;
+                    region.stores.push_back(dst);
+                }
+            }
+        }
+        else
+        {
+            // consecutive feedback-free statements
+            // form a single vector region
+            while(((end+1) < statements.size()) && (feedbackEnd[end+1] == -1))
+            {
+                end++;
+            }
+        }
+
+        for(size_t j=k; j<=end; j++)
+        {
+            if (statements[j].dst != -1)
+                written[statements[j].dst] = true;
+        }
+
+        region.last = statements[end].last;
+        m_blockRegions.push_back(region);
+        k = end+1;
+    }
+
+    for(uint32_t v=0; v<nvars; v++)
+    {
+        if (written[v])
+            m_blockCarry.push_back(v);
+        else
+            m_blockConsts.push_back(v);
+    }
+
+    m_blockVars.resize(nvars*VM_BLOCKSIZE);
+    m_blockStack.resize(maxDepth*VM_BLOCKSIZE);
+    m_blockPtrs.resize(maxDepth+2);
+}
+
+void ProgramInstance::executeBlock(uint32_t frames, float *outbuf)
+{
+    // an empty block has no last sample to carry over
+    if (frames == 0)
+    {
+        return;
+    }
+
+    // check if we have a program
+    if (m_program.size() == 0)
+    {
+        memset(outbuf, 0, frames*2*sizeof(float));
+        memset(&m_scopeBlock[0], 0, frames*sizeof(ring_buffer_data_t));
+        memset(&m_spectrumBlock[0], 0, frames*sizeof(ring_buffer_data_t));
+        return;
+    }
+
+    // setup input signal
+    if (m_ioIdx[0] != -1)
+    {
+        float *lane = getLane(m_ioIdx[0]);
+        for(uint32_t i=0; i<frames; i++)
+        {
+            lane[i] = (m_inLeft[i] + m_inRight[i]) / 2.0f;
+        }
+    }
+    if (m_ioIdx[1] != -1)
+    {
+        memcpy(getLane(m_ioIdx[1]), &m_inLeft[0], frames*sizeof(float));
+    }
+    if (m_ioIdx[2] != -1)
+    {
+        memcpy(getLane(m_ioIdx[2]), &m_inRight[0], frames*sizeof(float));
+    }
+
+    // variables that are never written, such as sliders
+    // and samplerate, are constant during the block.
+    for(size_t i=0; i<m_blockConsts.size(); i++)
+    {
+        uint32_t v = m_blockConsts[i];
+        std::fill_n(getLane(v), frames, m_vars[v].value);
+    }
+
+    float *stack = &m_stack[0];
+    for(size_t r=0; r<m_blockRegions.size(); r++)
+    {
+        const blockRegion_t &region = m_blockRegions[r];
+        if (!region.perSample)
+        {
+            executeVectorRange(region.first, region.last, frames);
+            continue;
+        }
+
+        // the variables in m_vars hold the state of the
+        // feedback loop from one sample to the next.
+        const size_t nloads = region.loads.size();
+        const size_t nstores = region.stores.size();
+        for(uint32_t i=0; i<frames; i++)
+        {
+            for(size_t j=0; j<nloads; j++)
+            {
+                uint32_t v = region.loads[j];
+                m_vars[v].value = getLane(v)[i];
+            }
+
+            executeRange(m_program, region.first, region.last, stack);
+
+            for(size_t j=0; j<nstores; j++)
+            {
+                uint32_t v = region.stores[j];
+                getLane(v)[i] = m_vars[v].value;
+            }
+        }
+    }
+
+    // keep the last value of each variable for the
+    // next block and for the GUI.
+    for(size_t i=0; i<m_blockCarry.size(); i++)
+    {
+        uint32_t v = m_blockCarry[i];
+        m_vars[v].value = getLane(v)[frames-1];
+    }
+
+    // write the interleaved output
+    if (m_ioIdx[3] != -1)
+    {
+        const float *lane = getLane(m_ioIdx[3]);
+        for(uint32_t i=0; i<frames; i++)
+        {
+            outbuf[i<<1] = lane[i];
+            outbuf[(i<<1)+1] = lane[i];
+        }
+    }
+    else
+    {
+        const float *left = (m_ioIdx[4] != -1) ? getLane(m_ioIdx[4]) : NULL;
+        const float *right = (m_ioIdx[5] != -1) ? getLane(m_ioIdx[5]) : NULL;
+        for(uint32_t i=0; i<frames; i++)
+        {
+            outbuf[i<<1] = (left != NULL) ? left[i] : 0.0f;
+            outbuf[(i<<1)+1] = (right != NULL) ? right[i] : 0.0f;
+        }
+    }
+
+    // fill the monitor buffers
+    const float *mon[4];
+    for(uint32_t ch=0; ch<4; ch++)
+    {
+        mon[ch] = (m_monitorIdx[ch] != -1) ? getLane(m_monitorIdx[ch]) : NULL;
+    }
+    for(uint32_t i=0; i<frames; i++)
+    {
+        m_scopeBlock[i].s1 = (mon[0] != NULL) ? mon[0][i] : 0.0f;
+        m_scopeBlock[i].s2 = (mon[1] != NULL) ? mon[1][i] : 0.0f;
+        m_spectrumBlock[i].s1 = (mon[2] != NULL) ? mon[2][i] : 0.0f;
+        m_spectrumBlock[i].s2 = (mon[3] != NULL) ? mon[3][i] : 0.0f;
+    }
+}
+
+void ProgramInstance::executeVectorRange(size_t first, size_t last, uint32_t frames)
+{
+    const float **ptr = &m_blockPtrs[0];   // vector stack of lane pointers
+    const VectorMath::kernels_t &vmath = *m_vmath;
+    size_t pc = first;  // program counter
+    size_t sp = 0;      // stack pointer
+
+    while(pc < last)
+    {
+        VM::instruction_t instruction = m_program[pc++];
+        if (instruction.icode & 0x80000000)
+        {
+            uint32_t n = instruction.icode & 0xFFFF;
+            switch(instruction.icode & 0xff000000)
+            {
+            case P_readvar: // push
+                ptr[sp++] = getLane(n);
+                break;
+            case P_writevar:// pop
+            {
+                float *lane = getLane(n);
+                sp--;
+                if (lane != ptr[sp])
+                {
+                    memcpy(lane, ptr[sp], frames*sizeof(float));
+                }
+                break;
+            }
+            case P_addvv:
+            case P_mulvv:
+            {
+                float *dst = &m_blockStack[sp*VM_BLOCKSIZE];
+                const float *a = getLane(n);
+                const float *b = getLane(m_program[pc++].icode);
+                if ((instruction.icode & 0xff000000) == P_addvv)
+                {
+                    vmath.add(dst, a, b, frames);
+                }
+                else
+                {
+                    vmath.mul(dst, a, b, frames);
+                }
+                ptr[sp++] = dst;
+                break;
+            }
+            case P_mac:
+            {
+                float *dst = &m_blockStack[(sp-1)*VM_BLOCKSIZE];
+                const float *acc = ptr[sp-1];
+                const float *a = getLane(n);
+                const float *b = getLane(m_program[pc++].icode);
+                vmath.mac(dst, acc, a, b, frames);
+                ptr[sp-1] = dst;
+                break;
+            }
+            case P_rmwadd:
+            {
+                float *lane = getLane(n);
+                const float k = m_program[pc++].value;
+                vmath.addk(lane, lane, k, frames);
+                break;
+            }
+            case P_noisegen:
+            {
+                float *dst = &m_blockStack[sp*VM_BLOCKSIZE];
+                m_noise[n].generate(dst, frames);
+                ptr[sp++] = dst;
+                break;
+            }
+            case P_fir:
+            {
+                float *dst = &m_blockStack[(sp-1)*VM_BLOCKSIZE];
+                m_firs[n].process(ptr[sp-1], dst, frames);
+                ptr[sp-1] = dst;
+                break;
+            }
+            case P_conv:
+            {
+                float *dst = &m_blockStack[(sp-1)*VM_BLOCKSIZE];
+                m_convs[n].process(ptr[sp-1], dst, frames);
+                ptr[sp-1] = dst;
+                break;
+            }
+            case P_biquad:
+            {
+                float *dst = &m_blockStack[(sp-1)*VM_BLOCKSIZE];
+                m_biquads[n].process(ptr[sp-1], dst, frames);
+                ptr[sp-1] = dst;
+                break;
+            }
+            default:
+                // stateful instructions never end up
+                // in a vector region.
+                break;
+            }
+            continue;
+        }
+
+        // the result of an operation is stored in the
+        // stack lane of its left-most operand, so
+        // in-place operations are always element-wise.
+        uint32_t nargs = 1;
+        switch(instruction.icode)
+        {
+        case P_add:
+        case P_sub:
+        case P_mul:
+        case P_div:
+        case P_pow:
+        case P_atan2:
+            nargs = 2;
+            break;
+        case P_literal:
+            nargs = 0;
+            break;
+        default:
+            break;
+        }
+
+        sp -= nargs;
+        float *dst = &m_blockStack[sp*VM_BLOCKSIZE];
+        const float *a = ptr[sp];
+        const float *b = ptr[sp+1];
+
+        switch(instruction.icode)
+        {
+        case P_add:
+            vmath.add(dst, a, b, frames);
+            break;
+        case P_sub:
+            vmath.sub(dst, a, b, frames);
+            break;
+        case P_mul:
+            vmath.mul(dst, a, b, frames);
+            break;
+        case P_div:
+            vmath.div(dst, a, b, frames);
+            break;
+        case P_neg:
+            vmath.neg(dst, a, frames);
+            break;
+        case P_sin:
+            vmath.sin(dst, a, frames);
+            break;
+        case P_tan:
+            vmath.tan(dst, a, frames);
+            break;
+        case P_tanh:
+            vmath.tanh(dst, a, frames);
+            break;
+        case P_cos:
+            vmath.cos(dst, a, frames);
+            break;
+        case P_sin1:
+            vmath.sin1(dst, a, frames);
+            break;
+        case P_cos1:
+            vmath.cos1(dst, a, frames);
+            break;
+        case P_literal:
+            std::fill_n(dst, frames, m_program[pc].value);
+            pc++;
+            break;
+        case P_mullit:
+            vmath.mulk(dst, a, m_program[pc].value, frames);
+            pc++;
+            break;
+        case P_addlit:
+            vmath.addk(dst, a, m_program[pc].value, frames);
+            pc++;
+            break;
+        case P_mod1:
+            vmath.mod1(dst, a, frames);
+            break;
+        case P_abs:
+            vmath.abs(dst, a, frames);
+            break;
+        case P_sqrt:
+            vmath.sqrt(dst, a, frames);
+            break;
+        case P_round:
+            vmath.round(dst, a, frames);
+            break;
+        case P_pow:
+            vmath.pow(dst, a, b, frames);
+            break;
+        case P_limit:
+            vmath.limit(dst, a, frames);
+            break;
+        case P_atan2:
+            vmath.atan2(dst, a, b, frames);
+            break;
+        case P_sign:
+            vmath.sign(dst, a, frames);
+            break;
+        case P_trunc:
+            vmath.trunc(dst, a, frames);
+            break;
+        case P_ceil:
+            vmath.ceil(dst, a, frames);
+            break;
+        case P_floor:
+            vmath.floor(dst, a, frames);
+            break;
+        default:
+            // not reached: checkPrograms() rejects the instructions
+            // that VM::isStackInstruction does not know
+            break;
+        }
+        ptr[sp++] = dst;
+    }
+}
+
+static const char* getOpcodeName(uint32_t icode)
+{
+    switch(icode)
+    {
+    case P_add:
+        return "ADD";
+    case P_sub:
+        return "SUB";
+    case P_mul:
+        return "MUL";
+    case P_div:
+        return "DIV";
+    case P_neg:
+        return "NEG";
+    case P_mov:
+        return "MOV";
+    case P_sin:
+        return "SIN";
+    case P_cos:
+        return "COS";
+    case P_sin1:
+        return "SIN1";
+    case P_cos1:
+        return "COS1";
+    case P_mod1:
+        return "MOD1";
+    case P_abs:
+        return "ABS";
+    case P_tan:
+        return "TAN";
+    case P_tanh:
+        return "TANH";
+    case P_pow:
+        return "POW";
+    case P_sqrt:
+        return "SQRT";
+    case P_round:
+        return "ROUND";
+    case P_limit:
+        return "LIMIT";
+    case P_atan2:
+        return "ATAN2";
+    case P_sign:
+        return "SIGN";
+    case P_noise:
+        return "NOISE";
+    case P_gaussnoise:
+        return "GAUSSNOISE";
+    case P_pinknoise:
+        return "PINKNOISE";
+    case P_firfilter:
+        return "FIR";
+    case P_biquadfilter:
+        return "BIQUAD";
+    case P_convolve:
+        return "CONV";
+    case P_trunc:
+        return "TRUNC";
+    case P_ceil:
+        return "CEIL";
+    case P_floor:
+        return "FLOOR";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+size_t ProgramInstance::dumpProgram(std::ostream &s, const VM::program_t &program)
+{
+    size_t N = program.size();
+    size_t count = 0;
+    for(size_t i=0; i<N; i+=VM::getInstructionLength(program[i].icode))
+    {
+        count++;
+        uint32_t n = program[i].icode & 0xFFFF; // variable index)
+        if (program[i].icode & 0x80000000)
+        {
+            switch(program[i].icode & 0xff000000)
+            {
+            case P_readvar:
+                s << "READ " << m_vars[n].name.c_str() << "\n";
+                break;
+            case P_writevar:
+                s << "WRITE " << m_vars[n].name.c_str() << "\n";
+                break;
+            case P_addvv:
+                s << "ADD_VV " << m_vars[n].name.c_str() << ", "
+                  << m_vars[program[i+1].icode].name.c_str() << "\n";
+                break;
+            case P_mulvv:
+                s << "MUL_VV " << m_vars[n].name.c_str() << ", "
+                  << m_vars[program[i+1].icode].name.c_str() << "\n";
+                break;
+            case P_mac:
+                s << "MAC " << m_vars[n].name.c_str() << ", "
+                  << m_vars[program[i+1].icode].name.c_str() << "\n";
+                break;
+            case P_rmwadd:
+                s << "RMW_ADD " << m_vars[n].name.c_str() << ", "
+                  << program[i+1].value << "\n";
+                break;
+            case P_noisegen:
+                switch((program[i].icode >> 16) & 0xFF)
+                {
+                case NoiseGenerator::NOISE_GAUSSIAN:
+                    s << "GAUSSNOISE " << n << "\n";
+                    break;
+                case NoiseGenerator::NOISE_PINK:
+                    s << "PINKNOISE " << n << "\n";
+                    break;
+                default:
+                    s << "NOISE " << n << "\n";
+                    break;
+                }
+                break;
+            case P_fir:
+                s << "FIR " << n << " (" << m_firs[n].getLength() << " taps"
+                  << (m_firs[n].isSymmetric() ? ", symmetric" : "") << ") at "
+                  << m_arena.getOffset(&m_firs[n]) << "\n";
+                break;
+            case P_conv:
+                s << "CONV " << n << " (" << m_convs[n].getLength() << " samples, "
+                  << m_convs[n].getPartitions() << " partitions of " << m_convs[n].getBlockSize() << ") at "
+                  << m_arena.getOffset(&m_convs[n]) << "\n";
+                break;
+            case P_biquad:
+                s << "BIQUAD " << n << " (" << m_biquads[n].getSections() << " sections"
+                  << (((program[i].icode >> 16) & 0xFF) ? ", variable" : "") << ") at "
+                  << m_arena.getOffset(&m_biquads[n]) << "\n";
+                break;
+            default:
+                s << "UNKNOWN\n";
+                break;
+            }
+        }
+        else if (program[i].icode == P_literal)
+        {
+            s << "LOAD " << program[i+1].value << "\n";
+        }
+        else if (program[i].icode == P_mullit)
+        {
+            s << "MUL_LIT " << program[i+1].value << "\n";
+        }
+        else if (program[i].icode == P_addlit)
+        {
+            s << "ADD_LIT " << program[i+1].value << "\n";
+        }
+        else
+        {
+            s << getOpcodeName(program[i].icode) << "\n";
+        }
+    }
+
+    return count;
+}
+
+void ProgramInstance::dump(std::ostream &s)
+{
+    if (!m_controlProgram.empty())
+    {
+        s << "-- CONTROL PROGRAM --\n\n";
+        size_t count = dumpProgram(s, m_controlProgram);
+        s << "\n" << count << " control instructions\n\n";
+    }
+
+    s << "-- VIRTUAL MACHINE PROGRAM --\n\n";
+    size_t count = dumpProgram(s, m_program);
+    s << "\n" << count << " instructions\n";
+    s << m_stack.size() << " stack entries\n";
+    s << m_arena.getSize() << " bytes of state\n";
+    s << FastMath::getPrecisionName(m_precision) << " transcendental functions\n";
+    s << VectorMath::getISAName(VectorMath::getISA()) << " vector kernels\n";
+    if (m_resampling)
+    {
+        s << "virtual rate " << m_programRate << " Hz, resampled by "
+          << m_upsampler[0].getUp() << "/" << m_upsampler[0].getDown() << "\n";
+    }
+
+    if (m_jit->isCompiled())
+    {
+        s << m_jit->getCodeSize() << " bytes of native code\n";
+    }
+    const NativeCompiler *native = m_native.load(std::memory_order_acquire);
+    if (native != NULL)
+    {
+        s << "native block function loaded" << (native->isCached() ? " from the cache" : "") << "\n";
+    }
+    if (m_pipeline != NULL)
+    {
+        m_pipeline->dump(s, m_vars);
+    }
+
+    if (m_regprogram.code.empty())
+    {
+        return;
+    }
+
+    // registers are named after their variable,
+    // their constant value or their temporary index
+    const size_t nvars = m_vars.size();
+    const size_t nconsts = m_regprogram.constants.size();
+    std::vector<std::string> names(m_regs.size());
+    for(size_t r=0; r<names.size(); r++)
+    {
+        std::stringstream ss;
+        if (r < nvars)
+            ss << m_vars[r].name;
+        else if (r < (nvars+nconsts))
+            ss << m_regprogram.constants[r-nvars];
+        else
+            ss << "t" << (r-nvars-nconsts);
+        names[r] = ss.str();
+    }
+
+    s << "\n-- REGISTER PROGRAM --\n\n";
+    const size_t M = m_regprogram.code.size();
+    for(size_t i=0; i<M; i++)
+    {
+        const VM::reginstr_t &instr = m_regprogram.code[i];
+        s << names[instr.dst] << " = " << getOpcodeName(instr.opcode);
+
+        // the number of source operands follows from the stack effect
+        int32_t nargs = 1 - VM::getStackEffect(instr.opcode);
+        if (nargs > 0)
+            s << " " << names[instr.srcA];
+        if (nargs > 1)
+            s << ", " << names[instr.srcB];
+        s << "\n";
+    }
+    s << "\n" << M << " register instructions\n";
+}
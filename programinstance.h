@@ -0,0 +1,412 @@
+/*
+
+  Description:  A program loaded for execution, with its
+                variables, state and the code of the engines.
+
+  License: GPLv2
+
+*/
+
+#ifndef programinstance_h
+#define programinstance_h
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <ostream>
+#include "virtualmachine.h"
+
+class Pipeline;
+
+/** A program instance holds everything that belongs to one
+    loaded program: the byte code, the variables, the state of
+    its filters, the code of the engines and the resamplers of
+    a virtual sample rate.
+
+    An instance is built and loaded by the GUI thread and then
+    handed to the audio thread, see VirtualMachine::loadProgram.
+    From then on only the audio thread executes it or changes
+    its variables. The GUI thread may still read what load()
+    has set up, such as the names of the variables and the
+    byte code, and change the monitors and the native code,
+    which the audio thread picks up through atomics.
+*/
+class ProgramInstance
+{
+public:
+    typedef VirtualMachine::engine_t engine_t;
+    typedef VirtualMachine::ring_buffer_data_t ring_buffer_data_t;
+
+    /** an instance without a program, which outputs silence */
+    ProgramInstance();
+    virtual ~ProgramInstance();
+
+    /** load a program, see VirtualMachine::loadProgram. the program
+        runs at 'programRate', which is resampled to and from
+        'deviceRate' when the two differ. the noise generators start
+        from 'noiseSeed' and 'engine' is used if it can run the
+        program, otherwise the stack interpreter. with 'stages' above
+        one the program is split into as many stages, if possible,
+        which execute in a Pipeline on worker threads.
+        returns false if the program is rejected. */
+    bool load(const VM::program_t &program,
+              const VM::regprogram_t &regprogram,
+              const VM::variables_t &variables,
+              const VM::program_t &controlProgram,
+              const VM::filters_t &filters,
+              FastMath::precision_t precision,
+              uint32_t noiseSeed,
+              double deviceRate, float programRate,
+              engine_t engine, uint32_t stages);
+
+    /** prepare to carry the values of the variables of 'previous'
+        over to the variables of this instance with the same name,
+        when this instance replaces it in a running VM, see
+        migrate(). GUI thread, after load(). */
+    void mapVariables(const ProgramInstance &previous);
+
+    /** copy the values of the variables that mapVariables() has
+        found in 'previous'. returns false, copying nothing, if
+        this instance was not mapped to 'previous'.
+        audio thread only. */
+    bool migrate(const ProgramInstance &previous);
+
+    /** returns the index of a variable, or -1 if not found */
+    int32_t findVariable(const std::string &name) const
+    {
+        return VM::findVariableByName(m_vars, name);
+    }
+
+    /** returns the number of variables */
+    size_t getVariableCount() const
+    {
+        return m_vars.size();
+    }
+
+    /** returns the precision the program was loaded with */
+    FastMath::precision_t getPrecision() const
+    {
+        return m_precision;
+    }
+
+    /** returns true if the engine can execute the program */
+    bool isEngineAvailable(engine_t engine) const;
+
+    /** returns the delay of the output by a pipeline
+        in frames of the sound card, or 0 */
+    uint32_t getLatency() const;
+
+    /** returns the engine that executes the program */
+    engine_t getEngine() const
+    {
+        return m_engine;
+    }
+
+    /** switch to an available engine, carrying
+        the variable values over to its storage.
+        audio thread only. */
+    void activateEngine(engine_t engine);
+
+    /** hand over the native code of the program, see
+        VirtualMachine::compileNative. The instance deletes it.
+        returns false if the instance already has native code,
+        in which case 'native' is not taken. */
+    bool setNative(NativeCompiler *native);
+
+    /** set the value of a slider. audio thread only. */
+    void setSlider(uint32_t id, float value);
+
+    /** monitor variable 'idx', or nothing for -1, on channel
+        0 and 1 of the scope or 2 and 3 of the spectrum. */
+    void setMonitor(uint32_t channel, int32_t idx)
+    {
+        m_monitorRequest[channel].store(idx, std::memory_order_release);
+    }
+
+    /** restart all noise generators. audio thread only. */
+    void seedNoiseGenerators(uint32_t seed);
+
+    /** returns the largest number of frames of the sound card
+        that process() accepts at a time */
+    uint32_t getChunkSize() const
+    {
+        return m_resampleChunk;
+    }
+
+    /** execute the program on the planar input at the rate of the
+        sound card, write the interleaved output to outbuf and send
+        the monitor samples to 'rings', unless it is NULL.
+        audio thread only. */
+    void process(const float *inLeft, const float *inRight,
+                 uint32_t frames, float *outbuf, bool blockMode,
+                 PaUtilRingBuffer *rings);
+
+    /** dump the (human readable) program to an output stream */
+    void dump(std::ostream &s);
+
+protected:
+    /** execute the program once */
+    void executeProgram(float inLeft, float inRight, float &outLeft, float &outRight);
+
+    /** execute the program on the planar input buffers with the
+        selected engine, write the interleaved output to outbuf and
+        send the monitor samples to the ring buffers */
+    void executeFrames(uint32_t frames, float *outbuf, bool blockMode, PaUtilRingBuffer *rings);
+
+    /** as executeFrames, for input and output at the rate of the
+        sound card and a program at the virtual rate */
+    void executeResampled(uint32_t frames, float *outbuf, bool blockMode, PaUtilRingBuffer *rings);
+
+    /** set up the resamplers for the virtual rate */
+    void setupResampling(double deviceRate, float programRate);
+
+    /** point the monitors at the variables that the
+        GUI thread has selected */
+    void updateMonitors();
+
+    /** execute the instructions first..last-1 of a program once,
+        operating on the scalar variables in m_vars */
+    void executeRange(const VM::program_t &program, size_t first, size_t last, float *stack);
+
+    /** execute the control program on the variable
+        storage of the selected engine */
+    void executeControl();
+
+    /** write a program in human readable form.
+        returns the number of instructions. */
+    size_t dumpProgram(std::ostream &s, const VM::program_t &program);
+
+    /** execute the register program once */
+    void executeRegisters();
+
+    /** pre-decoded instruction of the threaded interpreter */
+    struct threaded_t
+    {
+        const void  *handler;   // handler address (computed goto only)
+        uint32_t    op;         // dense handler index
+        uint32_t    index;      // variable or filter index
+        union
+        {
+            uint32_t index2;    // second variable index, or biquad sections
+            float    value;     // literal value
+        };
+    };
+
+    /** decode m_program into m_threaded */
+    void decodeThreaded();
+
+    /** execute the threaded program once.
+        when 'labels' is not NULL, the table of handler
+        addresses is returned instead and nothing is executed. */
+    void executeThreaded(const void * const **labels);
+
+    /** point the I/O, slider and monitor pointers at the
+        variable storage of the selected engine */
+    void bindVariables();
+
+    /** get a pointer to the storage of a variable for the selected engine */
+    float* getVariablePtr(int32_t idx);
+
+    /** returns the value of a variable in the storage of the selected engine */
+    float getVariable(int32_t idx) const;
+
+    /** returns true if the engine keeps its variables in m_regs */
+    static bool usesRegisterFile(engine_t engine)
+    {
+        return (engine == VirtualMachine::ENGINE_REGISTER) ||
+               (engine == VirtualMachine::ENGINE_JIT) ||
+               (engine == VirtualMachine::ENGINE_NATIVE);
+    }
+
+    /** execute the native block function on the planar input
+        buffers, write the interleaved output to outbuf and
+        fill the monitor buffers */
+    void executeNative(uint32_t frames, float *outbuf);
+
+    /** a statement of a program: the instructions first..last-1,
+        which end with the assignment of 'dst' */
+    struct statement_t
+    {
+        size_t  first;
+        size_t  last;
+        int32_t dst;        // variable assigned, or -1
+        bool    stateful;   // true if it must execute sample by sample
+        std::vector<uint32_t> reads;    // variables read, in order
+    };
+
+    /** split a program into statements, each of which ends with
+        a P_writevar or P_rmwadd. instructions after the last
+        assignment form a stateful statement with dst -1. */
+    static void splitStatements(const VM::program_t &program,
+                                std::vector<statement_t> &statements);
+
+    /** divide the program into vector and per-sample regions
+        and allocate the planar block buffers */
+    void buildBlockSchedule();
+
+    /** execute the program on the planar input buffers
+        m_inLeft and m_inRight, write the interleaved
+        output to outbuf and fill the monitor buffers */
+    void executeBlock(uint32_t frames, float *outbuf);
+
+    /** execute the instructions first..last-1 on vectors of
+        'frames' samples, operating on the variable lanes */
+    void executeVectorRange(size_t first, size_t last, uint32_t frames);
+
+    /** get the block lane holding the samples of a variable */
+    float* getLane(uint32_t varIdx)
+    {
+        return &m_blockVars[varIdx*VM_BLOCKSIZE];
+    }
+
+    /** filter the input below the top of the stack with biquad
+        filter n. the coefficients of 'sections' sections are on
+        top of it, or none for a filter with fixed coefficients.
+        returns the number of stack elements that are popped.
+    */
+    uint32_t execBiquad(uint32_t n, uint32_t sections, float *stack)
+    {
+        const uint32_t count = sections*BIQUAD_COEFFICIENTS;
+        if (count > 0)
+        {
+            m_biquads[n].setCoefficients(stack - count);
+        }
+        stack[-1-static_cast<int32_t>(count)] = m_biquads[n].process(stack[-1-static_cast<int32_t>(count)]);
+        return count;
+    }
+
+    /** native callback: returns the next value of noise generator n */
+    static float nativeNoise(void *context, uint32_t n);
+
+    /** native callback: filter x with FIR filter n */
+    static float nativeFIR(void *context, uint32_t n, float x);
+
+    /** native callback: filter x with biquad filter n, after
+        changing its coefficients if they are not NULL */
+    static float nativeBiquad(void *context, uint32_t n, float x, const float *coefficients);
+
+    /** native callback: convolve x with impulse response n */
+    static float nativeConv(void *context, uint32_t n, float x);
+
+    /** the stateful functions of a program, in a StateArena */
+    struct state_t
+    {
+        NoiseGenerator  *noise;
+        uint32_t        noiseCount;
+        FIRFilter       *firs;
+        BiquadFilter    *biquads;
+        float           *biquadCoefficients;
+        Convolver       *convs;
+    };
+
+    /** check that the interpreters can execute a program and its
+        control program without checks of the stack pointer or the
+        filter numbers, and return the stack depth they need.
+        returns false if the programs are rejected. */
+    static bool checkPrograms(const VM::program_t &program,
+                              const VM::program_t &controlProgram,
+                              const VM::filters_t &filters,
+                              uint32_t &depth);
+
+    /** lay out the noise generators, filters and convolvers of a
+        program in 'arena' and initialize them. 'operands' is the
+        number of coefficients that the register engine gathers.
+        returns false if the arena cannot be allocated. */
+    static bool createState(const VM::program_t &program,
+                            const VM::regprogram_t &regprogram,
+                            const VM::variables_t &variables,
+                            const VM::filters_t &filters,
+                            uint32_t operands, uint32_t noiseSeed,
+                            StateArena &arena, state_t &state);
+
+
+    VM::program_t   m_program;  // VM byte code
+    VM::program_t   m_controlProgram;   // byte code of the control-rate statements
+    bool            m_controlDirty;     // true if the control program must be executed
+    std::vector<float> m_stack; // evaluation stack, sized for the deepest program
+    VM::variables_t m_vars;     // VM program variables
+    float           m_programRate;      // the value of 'samplerate'
+    const ProgramInstance *m_migrateFrom;   // instance this one replaces, or NULL
+    std::vector<int32_t> m_migration;   // variable of m_migrateFrom for each of m_vars, or -1
+
+    engine_t           m_engine;        // interpreter executing the program
+    VM::regprogram_t   m_regprogram;    // register-based byte code
+    std::vector<float> m_regs;          // register file of the register and JIT engines
+    JITCompiler        *m_jit;          // native code of the JIT engine
+    std::atomic<NativeCompiler*> m_native; // compiled program of the native engine, or NULL
+    std::vector<threaded_t> m_threaded; // pre-decoded program of the threaded engine
+    FastMath::precision_t   m_precision; // precision the program was loaded with
+    const FastMath::kernels_t *m_math;  // transcendental functions of the program
+    const VectorMath::kernels_t *m_vmath; // vector kernels of block mode for the program
+    StateArena         m_arena;           // holds everything below up to m_convs
+    NoiseGenerator     *m_noise;          // one generator per noise function of the program
+    uint32_t           m_noiseCount;
+    FIRFilter          *m_firs;           // one filter per fir() of the program
+    BiquadFilter       *m_biquads;        // one filter per biquad() of the program
+    std::vector<int32_t> m_biquadOperands; // first entry of a biquad filter in
+                                           // m_regprogram.operands, or -1
+    float              *m_biquadCoefficients; // coefficients gathered by the register engine
+    Convolver          *m_convs;          // one convolver per conv() of the program
+
+    // the following pointers are variables in
+    // m_vars, or NULL if the variable does not exist
+    // in the program
+    float   *m_lout;            // pointer to left OUT variable
+    float   *m_lin;             // pointer to left IN variable
+    float   *m_rout;            // pointer to right OUT variable
+    float   *m_rin;             // pointer to right IN variable
+    float   *m_in;              // pointer to mono IN variable
+    float   *m_out;             // pointer to mono OUT variable
+    float   *m_slider[4];       // pointers to slider variables
+
+    // variables to send to spectrum & scope displays
+    // can be NULL if nothing is selected
+    float   *m_monitorVar[4];
+    int32_t m_monitorIdx[4];    // variable index of the monitors, or -1
+    std::atomic<int32_t> m_monitorRequest[4]; // set by setMonitor
+
+    // planar input of the current block, and the monitor buffers
+    const float *m_inLeft;
+    const float *m_inRight;
+    std::vector<ring_buffer_data_t> m_scopeBlock;
+    std::vector<ring_buffer_data_t> m_spectrumBlock;
+
+    // block execution state, see buildBlockSchedule()
+    struct blockRegion_t
+    {
+        size_t  first;                  // first instruction of the region
+        size_t  last;                   // one past the last instruction
+        bool    perSample;              // true if the region has feedback
+        std::vector<uint32_t> loads;    // lanes to copy to m_vars before each sample
+        std::vector<uint32_t> stores;   // m_vars to copy to lanes after each sample
+    };
+
+    std::vector<blockRegion_t>  m_blockRegions;
+    std::vector<float>          m_blockVars;    // one lane of VM_BLOCKSIZE samples per variable
+    std::vector<float>          m_blockStack;   // one lane per vector stack entry
+    std::vector<const float*>   m_blockPtrs;    // vector stack of lane pointers
+    std::vector<uint32_t>       m_blockConsts;  // variables the program never writes
+    std::vector<uint32_t>       m_blockCarry;   // variables whose last value must be kept
+    int32_t m_ioIdx[6];                         // in, inl, inr, out, outl, outr or -1
+
+    // execution at the virtual rate, see setupResampling()
+    bool        m_resampling;               // true if the program runs at the virtual rate
+    uint32_t    m_resampleChunk;            // frames of the sound card per block
+    Resampler   m_downsampler[2];           // left and right input to the virtual rate
+    Resampler   m_upsampler[2];             // left and right output to the device rate
+    std::vector<float> m_resampleBuffer;    // planar left and right samples of a block
+    std::vector<float> m_resampleOutput;    // interleaved output of the program
+    std::vector<float> m_resampleFifo[2];   // left and right output at the device rate
+    uint32_t    m_resampleFill;             // samples in m_resampleFifo
+
+    Pipeline    *m_pipeline;                // executes the program in stages, or NULL
+
+    friend class Pipeline;
+    friend class MultiInstance;
+
+private:
+    ProgramInstance(const ProgramInstance &);
+    ProgramInstance& operator=(const ProgramInstance &);
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+
+  Description:  Classify the statements of a program by
+                the rate at which their value can change.
+
+  License: GPLv2
+
+*/
+
+#include <map>
+#include "functiondefs.h"
+#include "virtualmachine.h"
+#include "rateanalyzer.h"
+
+bool RateAnalyzer::isControlInput(const std::string &name)
+{
+    return (name == "slider1") || (name == "slider2") ||
+           (name == "slider3") || (name == "slider4") ||
+           (name == "samplerate");
+}
+
+bool RateAnalyzer::isAudioIO(const std::string &name)
+{
+    return (name == "in") || (name == "inl") || (name == "inr") ||
+           (name == "out") || (name == "outl") || (name == "outr");
+}
+
+bool RateAnalyzer::collectReads(const ASTNode *node, std::set<std::string> &reads)
+{
+    if (node == 0)
+        return true;
+
+    if ((node->type == ASTNode::NodeFunction) && functionDefs::isStateful(node->functionID))
+        return false;
+
+    if (node->type == ASTNode::NodeIdent)
+        reads.insert(node->info.txt);
+
+    bool ok = collectReads(node->left, reads);
+    ok = collectReads(node->right, reads) && ok;
+    for(size_t i=0; i<node->function_args.size(); i++)
+    {
+        ok = collectReads(node->function_args[i], reads) && ok;
+    }
+    return ok;
+}
+
+std::vector<RateAnalyzer::rate_t> RateAnalyzer::classify(const statements_t &statements)
+{
+    const size_t N = statements.size();
+    std::vector<rate_t> rates(N, RATE_AUDIO);
+
+    // count the assignments of each variable
+    std::map<std::string, uint32_t> writes;
+    for(size_t i=0; i<N; i++)
+    {
+        if (statements[i] != 0)
+            writes[statements[i]->info.txt]++;
+    }
+
+    std::map<std::string, rate_t> known; // rate of the variables assigned so far
+    std::set<std::string> readSoFar;     // variables read by the statements so far
+    for(size_t i=0; i<N; i++)
+    {
+        const ASTNode *s = statements[i];
+        if ((s == 0) || (s->type != ASTNode::NodeAssign))
+            continue;
+
+        std::set<std::string> reads;
+        bool ok = collectReads(s->right, reads);
+
+        const std::string &target = s->info.txt;
+        ok = ok && (writes[target] == 1) && !isAudioIO(target) &&
+             !isControlInput(target) && (readSoFar.count(target) == 0) &&
+             (reads.count(target) == 0);
+
+        rate_t rate = RATE_CONSTANT;
+        std::set<std::string>::const_iterator iter;
+        for(iter = reads.begin(); ok && (iter != reads.end()); ++iter)
+        {
+            std::map<std::string, rate_t>::const_iterator k = known.find(*iter);
+            if (k != known.end())
+            {
+                if (k->second == RATE_CONTROL)
+                    rate = RATE_CONTROL;
+            }
+            else if (isControlInput(*iter) && (writes.count(*iter) == 0))
+            {
+                // samplerate only changes when the program is loaded
+                if (*iter != "samplerate")
+                    rate = RATE_CONTROL;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+
+        if (ok)
+        {
+            rates[i] = rate;
+            known[target] = rate;
+        }
+        readSoFar.insert(reads.begin(), reads.end());
+    }
+    return rates;
+}
+
+uint32_t RateAnalyzer::split(statements_t &statements, statements_t &control)
+{
+    std::vector<rate_t> rates = classify(statements);
+
+    statements_t audio;
+    uint32_t moved = 0;
+    for(size_t i=0; i<statements.size(); i++)
+    {
+        if (rates[i] == RATE_AUDIO)
+        {
+            audio.push_back(statements[i]);
+        }
+        else
+        {
+            control.push_back(statements[i]);
+            moved++;
+        }
+    }
+    statements.swap(audio);
+    return moved;
+}
@@ -0,0 +1,61 @@
+/*
+
+  Description:  Classify the statements of a program by
+                the rate at which their value can change.
+
+  License: GPLv2
+
+*/
+
+#ifndef rateanalyzer_h
+#define rateanalyzer_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <set>
+#include "parser.h"
+
+/** The rate analyzer finds statements that do not have to
+    be evaluated for every sample:
+
+      constant     - the value only depends on literals and
+                     the samplerate.
+      control-rate - the value also depends on the sliders
+                     or on other control-rate values.
+      audio-rate   - everything else.
+
+    A statement is only constant or control-rate when its
+    variable is assigned once, is not an input or output, and
+    is not read by the program before it has been assigned.
+    Evaluating it once before the first sample, and again when
+    a slider changes, then gives the same results as evaluating
+    it for every sample.
+*/
+class RateAnalyzer
+{
+public:
+    enum rate_t {RATE_CONSTANT, RATE_CONTROL, RATE_AUDIO};
+
+    /** determine the rate of each statement */
+    static std::vector<rate_t> classify(const statements_t &statements);
+
+    /** move the constant and control-rate statements to 'control',
+        keeping the program order. returns the number of statements moved. */
+    static uint32_t split(statements_t &statements, statements_t &control);
+
+protected:
+    /** returns true for the variables set by the
+        virtual machine: sliders and samplerate */
+    static bool isControlInput(const std::string &name);
+
+    /** returns true for the input and output variables */
+    static bool isAudioIO(const std::string &name);
+
+    /** collect the names of the variables read by an expression.
+        returns false if the expression calls a noise function
+        or a filter. */
+    static bool collectReads(const ASTNode *node, std::set<std::string> &reads);
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+
+  Description:  Polyphase resampler for rational ratios.
+
+  License: GPLv2
+
+*/
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "resampler.h"
+
+// Kaiser window for a stopband of 80 dB: 0.1102*(80 - 8.7)
+#define RESAMPLE_BETA 7.857
+
+// cutoff as a fraction of the Nyquist frequency of the lower rate,
+// so that the transition band ends at the Nyquist frequency.
+#define RESAMPLE_CUTOFF 0.92
+
+/** zeroth-order modified Bessel function of the first kind */
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for(uint32_t k=1; k<50; k++)
+    {
+        term *= (x / (2.0*k)) * (x / (2.0*k));
+        sum += term;
+        if (term < sum*1e-17)
+        {
+            break;
+        }
+    }
+    return sum;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while(b != 0)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+Resampler::Resampler()
+{
+    init(1, 1);
+}
+
+bool Resampler::isSupported(uint32_t up, uint32_t down)
+{
+    if ((up == 0) || (down == 0))
+    {
+        return false;
+    }
+
+    const uint32_t g = gcd(up, down);
+    return (up/g <= RESAMPLE_MAXFACTOR) && (down/g <= RESAMPLE_MAXFACTOR);
+}
+
+bool Resampler::init(uint32_t up, uint32_t down)
+{
+    if (!isSupported(up, down))
+    {
+        return false;
+    }
+
+    const uint32_t g = gcd(up, down);
+    up /= g;
+    down /= g;
+
+    m_up = up;
+    m_down = down;
+
+    // the filter runs at up times the input rate and spans
+    // RESAMPLE_TAPS samples of the lower rate
+    const uint32_t factor = std::max(up, down);
+    m_length = (RESAMPLE_TAPS*factor + up - 1) / up;
+    const uint32_t total = m_length*up;
+    const double fc = 0.5*RESAMPLE_CUTOFF / factor;
+    const double center = 0.5*(total - 1);
+    const double norm = 1.0 / besselI0(RESAMPLE_BETA);
+
+    // phase p holds h[p], h[p+up], h[p+2*up], ...
+    // in reverse, for the dot product with the delay line.
+    // the gain of 'up' makes up for the inserted zeros.
+    m_taps.resize(total);
+    for(uint32_t j=0; j<total; j++)
+    {
+        const double t = j - center;
+        const double sinc = (t == 0.0) ? 1.0 : sin(2.0*M_PI*fc*t) / (2.0*M_PI*fc*t);
+        const double r = (total > 1) ? t / center : 0.0;
+        const double window = besselI0(RESAMPLE_BETA*sqrt(std::max(0.0, 1.0 - r*r))) * norm;
+        const double h = up * 2.0*fc * sinc * window;
+
+        const uint32_t p = j % up;
+        const uint32_t k = j / up;
+        m_taps[p*m_length + (m_length-1-k)] = static_cast<float>(h);
+    }
+
+    // the filter is the same in every precision tier
+    m_dot = VectorMath::getKernels(FastMath::PRECISION_EXACT).dot;
+
+    // room for the history and the span of new samples
+    m_delay.resize(m_length - 1 + std::max<size_t>(m_length, RESAMPLE_MINSPAN));
+    reset();
+    return true;
+}
+
+void Resampler::reset()
+{
+    std::fill(m_delay.begin(), m_delay.end(), 0.0f);
+    m_pos = m_length - 1;
+    m_phase = 0;
+}
+
+void Resampler::wrap()
+{
+    const size_t history = m_length - 1;
+    memmove(&m_delay[0], &m_delay[m_pos - history], history*sizeof(float));
+    m_pos = history;
+}
+
+uint32_t Resampler::process(const float *in, uint32_t n, float *out)
+{
+    uint32_t count = 0;
+    for(uint32_t i=0; i<n; i++)
+    {
+        if (m_pos == m_delay.size())
+        {
+            wrap();
+        }
+        m_delay[m_pos++] = in[i];
+
+        // the outputs between this input and the next one
+        const float *x = &m_delay[m_pos - m_length];
+        while(m_phase < m_up)
+        {
+            out[count++] = m_dot(x, &m_taps[m_phase*m_length], m_length);
+            m_phase += m_down;
+        }
+        m_phase -= m_up;
+    }
+    return count;
+}
@@ -0,0 +1,105 @@
+/*
+
+  Description:  Polyphase resampler for rational ratios.
+
+  License: GPLv2
+
+*/
+
+#ifndef resampler_h
+#define resampler_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "vectormath.h"
+
+// largest up or down factor after the ratio has been reduced
+#define RESAMPLE_MAXFACTOR 1024
+
+// length of the lowpass filter in samples of the lower rate
+#define RESAMPLE_TAPS 64
+
+// minimum number of samples between two moves of the delay line
+#define RESAMPLE_MINSPAN 1024
+
+/** A resampler changes the sample rate of a signal by the
+    ratio up/down. Conceptually the input is upsampled by
+    inserting up-1 zeros after every sample, filtered with a
+    lowpass filter below the Nyquist frequency of the lower of
+    the two rates, and downsampled by keeping every down'th
+    sample.
+
+    The polyphase form only computes the samples that are kept,
+    and skips the inserted zeros: output sample n is the dot
+    product of the input samples before n*down/up with phase
+    (n*down) % up of the filter. The delay line is linear, as
+    in FIRFilter, so each output is a single dot product kernel
+    of VectorMath.
+
+    The filter spans RESAMPLE_TAPS samples of the lower rate,
+    with a Kaiser window for about 80 dB of stopband rejection.
+    The delay is RESAMPLE_TAPS/2 samples of the lower rate.
+
+    All memory is allocated by init(), so process() can be
+    called from the audio thread. The result does not depend
+    on how the input is divided into blocks.
+*/
+class Resampler
+{
+public:
+    Resampler();
+
+    /** set the ratio up/down and clear the delay line.
+        the ratio is reduced first. returns false if
+        a factor is zero or larger than RESAMPLE_MAXFACTOR
+        after the reduction. */
+    bool init(uint32_t up, uint32_t down);
+
+    /** returns true if init accepts the ratio up/down */
+    static bool isSupported(uint32_t up, uint32_t down);
+
+    /** clear the delay line */
+    void reset();
+
+    /** returns the reduced up factor */
+    uint32_t getUp() const
+    {
+        return m_up;
+    }
+
+    /** returns the reduced down factor */
+    uint32_t getDown() const
+    {
+        return m_down;
+    }
+
+    /** returns the largest number of output samples
+        that n input samples can produce */
+    uint32_t getMaxOutput(uint32_t n) const
+    {
+        return static_cast<uint32_t>((static_cast<uint64_t>(n)*m_up + m_down - 1) / m_down) + 1;
+    }
+
+    /** resample n input samples. returns the number of
+        samples written to 'out', at most getMaxOutput(n).
+        'in' and 'out' must not overlap. */
+    uint32_t process(const float *in, uint32_t n, float *out);
+
+protected:
+    /** move the most recent samples to the start of the delay line */
+    void wrap();
+
+    std::vector<float>  m_taps;     // the phases one after the other,
+                                    // each with its last coefficient first
+    std::vector<float>  m_delay;    // delay line, oldest sample first
+    size_t              m_pos;      // where the next sample is written
+    uint32_t            m_length;   // coefficients per phase
+    uint32_t            m_up;
+    uint32_t            m_down;
+    uint32_t            m_phase;    // phase of the next output, >= m_up
+                                    // when the next input is needed
+    VectorMath::dot_t   m_dot;
+};
+
+#endif
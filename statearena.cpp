@@ -0,0 +1,61 @@
+/*
+
+  Description:  Contiguous, cache-line aligned memory for the
+                state of the stateful functions of a program.
+
+  License: GPLv2
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "statearena.h"
+
+StateArena::StateArena()
+    : m_memory(NULL),
+      m_base(NULL),
+      m_size(0),
+      m_used(0)
+{
+}
+
+StateArena::~StateArena()
+{
+    release();
+}
+
+bool StateArena::allocate(size_t bytes)
+{
+    release();
+
+    // malloc only guarantees the alignment of the
+    // largest basic type, so round up the address
+    m_memory = static_cast<uint8_t*>(malloc(bytes + STATE_ALIGNMENT));
+    if (m_memory == NULL)
+    {
+        return false;
+    }
+    const uintptr_t address = reinterpret_cast<uintptr_t>(m_memory);
+    m_base = m_memory + (align(address) - address);
+    m_size = bytes;
+    memset(m_base, 0, bytes);
+    return true;
+}
+
+void StateArena::release()
+{
+    free(m_memory);
+    m_memory = NULL;
+    m_base = NULL;
+    m_size = 0;
+    m_used = 0;
+}
+
+void StateArena::swap(StateArena &other)
+{
+    std::swap(m_memory, other.m_memory);
+    std::swap(m_base, other.m_base);
+    std::swap(m_size, other.m_size);
+    std::swap(m_used, other.m_used);
+}
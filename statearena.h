@@ -0,0 +1,107 @@
+/*
+
+  Description:  Contiguous, cache-line aligned memory for the
+                state of the stateful functions of a program.
+
+  License: GPLv2
+
+*/
+
+#ifndef statearena_h
+#define statearena_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+// alignment of every block of the arena: one cache line
+#define STATE_ALIGNMENT 64
+
+/** A state arena holds the state of the noise generators,
+    filters and convolvers of a program in a single block of
+    memory, so the audio thread never allocates and the layout
+    does not depend on the heap.
+
+    The virtual machine sums the sizes that the functions of a
+    program need, allocates the arena once in loadProgram, and
+    takes the blocks in the order of the program. Every block
+    starts on a cache line, so the state of two functions never
+    shares one and the vector kernels get aligned data.
+
+    The arena does not call destructors: only objects without
+    resources of their own are placed in it.
+*/
+class StateArena
+{
+public:
+    StateArena();
+    ~StateArena();
+
+    /** returns the number of bytes that take() uses for 'bytes' */
+    static size_t align(size_t bytes)
+    {
+        return (bytes + STATE_ALIGNMENT - 1) & ~static_cast<size_t>(STATE_ALIGNMENT - 1);
+    }
+
+    /** returns the number of bytes that take() uses for
+        'count' objects of type T */
+    template<typename T> static size_t getSize(size_t count)
+    {
+        return align(count*sizeof(T));
+    }
+
+    /** release the previous memory and allocate 'bytes'
+        of zeroed memory. returns false if out of memory. */
+    bool allocate(size_t bytes);
+
+    /** release the memory */
+    void release();
+
+    /** exchange the memory of two arenas. the blocks
+        keep their addresses. */
+    void swap(StateArena &other);
+
+    /** take the next block of 'count' objects of type T.
+        returns NULL if the arena is too small, which means
+        that the sizes passed to allocate() were wrong. */
+    template<typename T> T* take(size_t count)
+    {
+        const size_t bytes = getSize<T>(count);
+        if (m_used + bytes > m_size)
+        {
+            return NULL;
+        }
+        T *block = reinterpret_cast<T*>(m_base + m_used);
+        m_used += bytes;
+        return block;
+    }
+
+    /** returns the size of the arena in bytes */
+    size_t getSize() const
+    {
+        return m_size;
+    }
+
+    /** returns the number of bytes taken */
+    size_t getUsed() const
+    {
+        return m_used;
+    }
+
+    /** returns the offset of a block from the start of the arena */
+    size_t getOffset(const void *block) const
+    {
+        return static_cast<const uint8_t*>(block) - m_base;
+    }
+
+protected:
+    uint8_t     *m_memory;  // as returned by malloc
+    uint8_t     *m_base;    // the first aligned byte of m_memory
+    size_t      m_size;
+    size_t      m_used;
+
+private:
+    StateArena(const StateArena &);
+    StateArena& operator=(const StateArena &);
+};
+
+#endif
@@ -230,6 +230,12 @@ bool Tokenizer::process(Reader *r, std::vector<token_t> &result)
                 result.push_back(tok);
                 r->accept();
             }
+            else if (c == '"')
+            {
+                // the quotes are not part of the string
+                r->accept();
+                state = S_STRING;
+            }
             else if (isNumeric(c))
             {
                 // we could have an integer,
@@ -387,6 +393,28 @@ bool Tokenizer::process(Reader *r, std::vector<token_t> &result)
                 state = S_BEGIN;
             }
             break;
+        case S_STRING:
+            // a string must end on the line it starts
+            if ((c == 0) || (c == 10) || (c == 13))
+            {
+                std::stringstream ss;
+                ss << "String is not terminated on line: " << tok.pos.line+1 << " column " << tok.pos.pos+1;
+                m_lastError = ss.str();
+                m_lastErrorPos = tok.pos;
+                return false;
+            }
+            else if (c == '"')
+            {
+                tok.tokID = TOK_STRING;
+                result.push_back(tok);
+                r->accept();
+                state = S_BEGIN;
+            }
+            else
+            {
+                tok.txt += r->accept();
+            }
+            break;
         case S_DONE:
             break;
         default:
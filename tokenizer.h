@@ -35,6 +35,7 @@
 #define TOK_INTEGER 30
 #define TOK_FLOAT   31
 #define TOK_IDENT   32
+#define TOK_STRING  33
 
 #define TOK_EOF     99
 
@@ -93,6 +94,7 @@ protected:
                     S_LARGER,
                     S_SMALLER,
                     S_COMMENT,
+                    S_STRING,
                     S_DONE};
 
   std::string                   m_lastError;
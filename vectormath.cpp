@@ -0,0 +1,377 @@
+/*
+
+  Description:  Vector implementations of the arithmetic
+                and the built-in functions of the virtual
+                machine, with runtime CPU dispatch.
+
+  License: GPLv2
+
+*/
+
+#include <math.h>
+#include <algorithm>
+#include "vectormath.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#define VM_ISA_COUNT    4
+#define VM_TIER_COUNT   3
+
+// **************************************************
+//   portable kernels, written as the interpreters
+//   evaluate the instructions
+// **************************************************
+
+static void genAdd(float *dst, const float *a, const float *b, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = a[i] + b[i];
+}
+
+static void genSub(float *dst, const float *a, const float *b, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = a[i] - b[i];
+}
+
+static void genMul(float *dst, const float *a, const float *b, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = a[i] * b[i];
+}
+
+static void genDiv(float *dst, const float *a, const float *b, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = a[i] / b[i];
+}
+
+static void genAddk(float *dst, const float *a, float k, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = a[i] + k;
+}
+
+static void genMulk(float *dst, const float *a, float k, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = a[i] * k;
+}
+
+static void genMac(float *dst, const float *acc, const float *a, const float *b, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = acc[i] + a[i] * b[i];
+}
+
+static void genCmac(float *accRe, float *accIm, const float *aRe, const float *aIm,
+                    const float *bRe, const float *bIm, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++)
+    {
+        const float re = aRe[i]*bRe[i] - aIm[i]*bIm[i];
+        const float im = aRe[i]*bIm[i] + aIm[i]*bRe[i];
+        accRe[i] = accRe[i] + re;
+        accIm[i] = accIm[i] + im;
+    }
+}
+
+static void genNeg(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = -a[i];
+}
+
+static void genAbs(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = fabs(a[i]);
+}
+
+static void genSqrt(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = sqrt(a[i]);
+}
+
+static void genLimit(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = std::max(std::min(a[i], 1.0f), -1.0f);
+}
+
+static void genSign(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = (a[i] >= 0.0f) ? 1.0f : -1.0f;
+}
+
+static void genMod1(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = a[i]-(int)a[i];
+}
+
+static void genTrunc(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = std::trunc(a[i]);
+}
+
+static void genFloor(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = std::floor(a[i]);
+}
+
+static void genCeil(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = std::ceil(a[i]);
+}
+
+static void genRound(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = round(a[i]);
+}
+
+static void genTan(float *dst, const float *a, uint32_t n)
+{
+    for(uint32_t i=0; i<n; i++) dst[i] = tan(a[i]);
+}
+
+static float genDot(const float *a, const float *b, uint32_t n)
+{
+    float acc[VM_DOT_LANES] = {0.0f};
+    return VectorMath::finishDot(acc, a, b, 0, n);
+}
+
+static float genDotSym(const float *a, const float *b, uint32_t n)
+{
+    float acc[VM_DOT_LANES] = {0.0f};
+    return VectorMath::finishDotSym(acc, a, b, 0, n);
+}
+
+static void genSOS(float *dst, const float *src, uint32_t n, float *sos, uint32_t sections)
+{
+    VectorMath::finishSOS(dst, src, n, sos, 0, sections);
+}
+
+/** add the partial sums pairwise, leaving the result in acc[0] */
+static float sumLanes(float *acc)
+{
+    for(uint32_t w=VM_DOT_LANES/2; w>0; w/=2)
+    {
+        for(uint32_t i=0; i<w; i++) acc[i] = acc[i] + acc[i+w];
+    }
+    return acc[0];
+}
+
+float VectorMath::finishDot(float *acc, const float *a, const float *b, uint32_t first, uint32_t n)
+{
+    for(uint32_t i=first; i<n; i++)
+    {
+        acc[i % VM_DOT_LANES] = acc[i % VM_DOT_LANES] + a[i] * b[i];
+    }
+    return sumLanes(acc);
+}
+
+float VectorMath::finishDotSym(float *acc, const float *a, const float *b, uint32_t first, uint32_t n)
+{
+    const uint32_t half = n/2;
+    for(uint32_t i=first; i<half; i++)
+    {
+        acc[i % VM_DOT_LANES] = acc[i % VM_DOT_LANES] + b[i] * (a[i] + a[n-1-i]);
+    }
+    float sum = sumLanes(acc);
+    if (n & 1)
+    {
+        sum = sum + b[half] * a[half];
+    }
+    return sum;
+}
+
+void VectorMath::finishSOS(float *dst, const float *src, uint32_t n, float *sos,
+                           uint32_t first, uint32_t sections)
+{
+    const uint32_t stride = VM_SOS_STRIDE(sections);
+    for(uint32_t k=first; k<sections; k++)
+    {
+        const float b0 = sos[VM_SOS_B0*stride + k];
+        const float b1 = sos[VM_SOS_B1*stride + k];
+        const float b2 = sos[VM_SOS_B2*stride + k];
+        const float a1 = sos[VM_SOS_A1*stride + k];
+        const float a2 = sos[VM_SOS_A2*stride + k];
+        float s1 = sos[VM_SOS_S1*stride + k];
+        float s2 = sos[VM_SOS_S2*stride + k];
+        for(uint32_t i=0; i<n; i++)
+        {
+            const float x = src[i];
+            const float y = b0*x + s1;
+            s1 = b1*x - a1*y + s2;
+            s2 = b2*x - a2*y;
+            dst[i] = y;
+        }
+        sos[VM_SOS_S1*stride + k] = s1;
+        sos[VM_SOS_S2*stride + k] = s2;
+        src = dst;
+    }
+    if (dst != src)
+    {
+        // no sections left, the input passes unchanged
+        for(uint32_t i=0; i<n; i++) dst[i] = src[i];
+    }
+}
+
+/** the transcendental functions of a precision tier,
+    one element at a time */
+template<FastMath::precision_t P> struct Tier
+{
+    static void sin(float *dst, const float *a, uint32_t n)
+    {
+        FastMath::unary_t f = FastMath::getKernels(P).sin;
+        for(uint32_t i=0; i<n; i++) dst[i] = f(a[i]);
+    }
+
+    static void cos(float *dst, const float *a, uint32_t n)
+    {
+        FastMath::unary_t f = FastMath::getKernels(P).cos;
+        for(uint32_t i=0; i<n; i++) dst[i] = f(a[i]);
+    }
+
+    static void sin1(float *dst, const float *a, uint32_t n)
+    {
+        FastMath::unary_t f = FastMath::getKernels(P).sin1;
+        for(uint32_t i=0; i<n; i++) dst[i] = f(a[i]);
+    }
+
+    static void cos1(float *dst, const float *a, uint32_t n)
+    {
+        FastMath::unary_t f = FastMath::getKernels(P).cos1;
+        for(uint32_t i=0; i<n; i++) dst[i] = f(a[i]);
+    }
+
+    static void tanh(float *dst, const float *a, uint32_t n)
+    {
+        FastMath::unary_t f = FastMath::getKernels(P).tanh;
+        for(uint32_t i=0; i<n; i++) dst[i] = f(a[i]);
+    }
+
+    static void pow(float *dst, const float *a, const float *b, uint32_t n)
+    {
+        FastMath::binary_t f = FastMath::getKernels(P).pow;
+        for(uint32_t i=0; i<n; i++) dst[i] = f(a[i], b[i]);
+    }
+
+    static void atan2(float *dst, const float *a, const float *b, uint32_t n)
+    {
+        FastMath::binary_t f = FastMath::getKernels(P).atan2;
+        for(uint32_t i=0; i<n; i++) dst[i] = f(a[i], b[i]);
+    }
+
+    static VectorMath::kernels_t kernels()
+    {
+        VectorMath::kernels_t k =
+        {
+            genAdd, genSub, genMul, genDiv, genAddk, genMulk, genMac,
+            genNeg, genAbs, genSqrt, genLimit, genSign, genMod1,
+            genTrunc, genFloor, genCeil, genRound,
+            sin, cos, sin1, cos1, genTan, tanh, pow, atan2,
+            genDot, genDotSym, genSOS, genCmac
+        };
+        return k;
+    }
+};
+
+// **************************************************
+//   CPU dispatch
+// **************************************************
+
+static VectorMath::isa_t detectISA()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // these also check that the OS saves the vector registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return VectorMath::ISA_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return VectorMath::ISA_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return VectorMath::ISA_SSE2;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if ((maxLeaf >= 7) && osxsave)
+    {
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        if (((xcr0 & 0xe6) == 0xe6) && (info[1] & (1 << 16)))
+            return VectorMath::ISA_AVX512;
+        if (((xcr0 & 0x06) == 0x06) && (info[1] & (1 << 5)))
+            return VectorMath::ISA_AVX2;
+    }
+    if (sse2)
+        return VectorMath::ISA_SSE2;
+#endif
+    return VectorMath::ISA_GENERIC;
+}
+
+/** the kernel tables of all instruction sets, built
+    on first use */
+struct KernelTables
+{
+    KernelTables()
+    {
+        isa = detectISA();
+        for(uint32_t i=0; i<VM_ISA_COUNT; i++)
+        {
+            kernels[i][FastMath::PRECISION_EXACT]     = Tier<FastMath::PRECISION_EXACT>::kernels();
+            kernels[i][FastMath::PRECISION_FAST]      = Tier<FastMath::PRECISION_FAST>::kernels();
+            kernels[i][FastMath::PRECISION_ULTRAFAST] = Tier<FastMath::PRECISION_ULTRAFAST>::kernels();
+            valid[i] = (i <= static_cast<uint32_t>(isa));
+        }
+
+        for(uint32_t t=0; t<VM_TIER_COUNT; t++)
+        {
+            FastMath::precision_t precision = static_cast<FastMath::precision_t>(t);
+            valid[VectorMath::ISA_SSE2]   &= VectorMath::setKernelsSSE2(kernels[VectorMath::ISA_SSE2][t], precision);
+            valid[VectorMath::ISA_AVX2]   &= VectorMath::setKernelsAVX2(kernels[VectorMath::ISA_AVX2][t], precision);
+            valid[VectorMath::ISA_AVX512] &= VectorMath::setKernelsAVX512(kernels[VectorMath::ISA_AVX512][t], precision);
+        }
+    }
+
+    VectorMath::isa_t       isa;
+    bool                    valid[VM_ISA_COUNT];
+    VectorMath::kernels_t   kernels[VM_ISA_COUNT][VM_TIER_COUNT];
+};
+
+static const KernelTables& getTables()
+{
+    static const KernelTables tables;
+    return tables;
+}
+
+const VectorMath::kernels_t& VectorMath::getKernels(FastMath::precision_t precision)
+{
+    const KernelTables &tables = getTables();
+    return tables.kernels[tables.isa][precision];
+}
+
+const VectorMath::kernels_t* VectorMath::getKernels(FastMath::precision_t precision, isa_t isa)
+{
+    const KernelTables &tables = getTables();
+    if (!tables.valid[isa])
+        return NULL;
+    return &tables.kernels[isa][precision];
+}
+
+VectorMath::isa_t VectorMath::getISA()
+{
+    return getTables().isa;
+}
+
+const char* VectorMath::getISAName(isa_t isa)
+{
+    switch(isa)
+    {
+    case ISA_SSE2:
+        return "SSE2";
+    case ISA_AVX2:
+        return "AVX2";
+    case ISA_AVX512:
+        return "AVX-512";
+    default:
+        return "generic";
+    }
+}
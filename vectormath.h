@@ -0,0 +1,159 @@
+/*
+
+  Description:  Vector implementations of the arithmetic
+                and the built-in functions of the virtual
+                machine, with runtime CPU dispatch.
+
+  License: GPLv2
+
+*/
+
+#ifndef vectormath_h
+#define vectormath_h
+
+#include <stdint.h>
+#include "fastmath.h"
+
+// number of partial sums of the dot products
+#define VM_DOT_LANES 32
+
+// rows of the coefficients and the state of a cascade of
+// second-order sections, with one column per section.
+// the coefficients are normalized so that a0 = 1.
+#define VM_SOS_B0   0
+#define VM_SOS_B1   1
+#define VM_SOS_B2   2
+#define VM_SOS_A1   3
+#define VM_SOS_A2   4
+#define VM_SOS_S1   5
+#define VM_SOS_S2   6
+#define VM_SOS_ROWS 7
+
+// length of a row of the cascade, padded for the widest vector
+#define VM_SOS_STRIDE(sections) (((sections) + 15) & ~15u)
+
+/** The vector math library applies an operation to arrays of
+    floats. It is used by the block execution of the virtual
+    machine and by the spectrum analyser.
+
+    Each kernel is available as portable C++ and, on x86, in
+    SSE2, AVX2 and AVX-512 versions that process 4, 8 or 16
+    elements at once. The best version supported by the CPU
+    is selected the first time getKernels is called.
+
+    All versions produce results that are bit-identical to
+    the scalar code of the interpreters, and to the kernels
+    of FastMath for the transcendental functions:
+    * the fast and ultra-fast kernels of FastMath are vectorized
+      with the same operations in the same order. Elements that
+      the scalar kernel hands to the C library are passed to it
+      one by one.
+    * the exact functions, tan and pow call the C library for
+      every element, as there is no vector version with the same
+      rounding.
+    * the dot products add term i to partial sum i % VM_DOT_LANES
+      and then add the partial sums pairwise, see finishDot. Every
+      version follows this order, whatever its vector width.
+    * the cascades of second-order sections evaluate every section
+      with the operations of finishSOS. The vector versions run
+      several sections side by side, each one sample behind the
+      previous one, instead of vectorizing over the samples.
+
+    The destination may be the same array as an operand, but
+    must not otherwise overlap it.
+*/
+namespace VectorMath
+{
+    enum isa_t {ISA_GENERIC, ISA_SSE2, ISA_AVX2, ISA_AVX512};
+
+    typedef void (*unary_t)(float *dst, const float *a, uint32_t n);
+    typedef void (*binary_t)(float *dst, const float *a, const float *b, uint32_t n);
+    typedef void (*scalar_t)(float *dst, const float *a, float k, uint32_t n);
+    typedef void (*ternary_t)(float *dst, const float *acc, const float *a, const float *b, uint32_t n);
+    typedef float (*dot_t)(const float *a, const float *b, uint32_t n);
+    typedef void (*sos_t)(float *dst, const float *src, uint32_t n, float *sos, uint32_t sections);
+    typedef void (*cmac_t)(float *accRe, float *accIm, const float *aRe, const float *aIm,
+                           const float *bRe, const float *bIm, uint32_t n);
+
+    /** kernels for one instruction set and precision tier */
+    struct kernels_t
+    {
+        binary_t  add;      // a + b
+        binary_t  sub;      // a - b
+        binary_t  mul;      // a * b
+        binary_t  div;      // a / b
+        scalar_t  addk;     // a + k
+        scalar_t  mulk;     // a * k
+        ternary_t mac;      // acc + a * b
+        unary_t   neg;
+        unary_t   abs;
+        unary_t   sqrt;
+        unary_t   limit;    // clamp to [-1, 1]
+        unary_t   sign;     // 1 for a >= 0, -1 otherwise
+        unary_t   mod1;     // a - (int)a
+        unary_t   trunc;
+        unary_t   floor;
+        unary_t   ceil;
+        unary_t   round;    // halfway cases away from zero
+        unary_t   sin;
+        unary_t   cos;
+        unary_t   sin1;     // sin(2*pi*a)
+        unary_t   cos1;     // cos(2*pi*a)
+        unary_t   tan;
+        unary_t   tanh;
+        binary_t  pow;      // pow(a, b)
+        binary_t  atan2;    // atan2(a, b)
+        dot_t     dot;      // sum of a[i]*b[i]
+        dot_t     dotsym;   // sum of b[i]*(a[i] + a[n-1-i]) for i < n/2,
+                            // plus b[n/2]*a[n/2] when n is odd
+        sos_t     sos;      // filter with a cascade of second-order
+                            // sections, see finishSOS
+        cmac_t    cmac;     // acc + a * b for complex numbers with
+                            // their real and imaginary parts in
+                            // separate arrays:
+                            //   accRe + (aRe*bRe - aIm*bIm)
+                            //   accIm + (aRe*bIm + aIm*bRe)
+    };
+
+    /** returns the kernels of the best instruction set
+        supported by the CPU, for a precision tier */
+    const kernels_t& getKernels(FastMath::precision_t precision);
+
+    /** returns the kernels of an instruction set, or NULL
+        when the CPU or the compiler does not support it */
+    const kernels_t* getKernels(FastMath::precision_t precision, isa_t isa);
+
+    /** returns the best instruction set supported by the CPU */
+    isa_t getISA();
+
+    /** returns the name of an instruction set */
+    const char* getISAName(isa_t isa);
+
+    /** used by the dot products: add the terms first..n-1 to the
+        partial sums in 'acc' and return the sum of the partial sums.
+        'acc' holds VM_DOT_LANES values and is overwritten. */
+    float finishDot(float *acc, const float *a, const float *b, uint32_t first, uint32_t n);
+
+    /** as finishDot, for the terms of dotsym */
+    float finishDotSym(float *acc, const float *a, const float *b, uint32_t first, uint32_t n);
+
+    /** used by the sos kernels: filter n samples with the sections
+        first..sections-1 of a cascade, one section after the other.
+        'sos' holds VM_SOS_ROWS rows of VM_SOS_STRIDE(sections)
+        floats. Each section is in transposed direct form II:
+          y  = b0*x + s1
+          s1 = b1*x - a1*y + s2
+          s2 = b2*x - a2*y
+        'dst' may be the same array as 'src'. */
+    void finishSOS(float *dst, const float *src, uint32_t n, float *sos,
+                   uint32_t first, uint32_t sections);
+
+    /** used by getKernels: replace the kernels of a table that
+        have a version for an instruction set. return false when
+        the compiler does not target x86. */
+    bool setKernelsSSE2(kernels_t &kernels, FastMath::precision_t precision);
+    bool setKernelsAVX2(kernels_t &kernels, FastMath::precision_t precision);
+    bool setKernelsAVX512(kernels_t &kernels, FastMath::precision_t precision);
+}
+
+#endif
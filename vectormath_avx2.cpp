@@ -0,0 +1,122 @@
+/*
+
+  Description:  AVX2 kernels of the vector math library.
+
+  License: GPLv2
+
+*/
+
+#include "vectormath.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+
+// this file is compiled for the instruction set of its
+// kernels, which are only called when the CPU supports it.
+// multiply and add must stay separate instructions, as
+// in the scalar code.
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to=function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC target("avx2")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include <math.h>
+#include <immintrin.h>
+
+namespace
+{
+
+struct Traits
+{
+    typedef __m256  V;
+    typedef __m256  M;
+    typedef __m256i I;
+    typedef __m256d D;
+
+    static const uint32_t WIDTH = 8;
+
+    static inline V load(const float *p)        { return _mm256_loadu_ps(p); }
+    static inline void store(float *p, V x)     { _mm256_storeu_ps(p, x); }
+    static inline V set1(float x)               { return _mm256_set1_ps(x); }
+    static inline V setBits(uint32_t x)         { return _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(x))); }
+
+    static inline V add(V a, V b)               { return _mm256_add_ps(a, b); }
+    static inline V sub(V a, V b)               { return _mm256_sub_ps(a, b); }
+    static inline V mul(V a, V b)               { return _mm256_mul_ps(a, b); }
+    static inline V div(V a, V b)               { return _mm256_div_ps(a, b); }
+    static inline V sqrt(V x)                   { return _mm256_sqrt_ps(x); }
+    static inline V min(V a, V b)               { return _mm256_min_ps(a, b); }
+    static inline V max(V a, V b)               { return _mm256_max_ps(a, b); }
+
+    static inline V band(V a, V b)              { return _mm256_and_ps(a, b); }
+    static inline V bor(V a, V b)               { return _mm256_or_ps(a, b); }
+    static inline V bxor(V a, V b)              { return _mm256_xor_ps(a, b); }
+    static inline V bandnot(V a, V b)           { return _mm256_andnot_ps(a, b); }
+
+    static inline M lt(V a, V b)                { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static inline M le(V a, V b)                { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static inline M gt(V a, V b)                { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static inline M ge(V a, V b)                { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static inline M eq(V a, V b)                { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static inline M mnot(M m)                   { return _mm256_xor_ps(m, setBits(0xffffffffu)); }
+    static inline M mand(M a, M b)              { return _mm256_and_ps(a, b); }
+    static inline M mor(M a, M b)               { return _mm256_or_ps(a, b); }
+    static inline V select(M m, V a, V b)       { return _mm256_blendv_ps(b, a, m); }
+    static inline uint32_t bits(M m)            { return static_cast<uint32_t>(_mm256_movemask_ps(m)); }
+
+    static inline I cvtt(V x)                   { return _mm256_cvttps_epi32(x); }
+    static inline V cvt(I x)                    { return _mm256_cvtepi32_ps(x); }
+    static inline I iadd(I a, I b)              { return _mm256_add_epi32(a, b); }
+    static inline I iset1(int32_t x)            { return _mm256_set1_epi32(x); }
+    static inline I shl23(I x)                  { return _mm256_slli_epi32(x, 23); }
+    static inline V castToFloat(I x)            { return _mm256_castsi256_ps(x); }
+    static inline V reverse(V x)                { return _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0)); }
+    static inline V shiftIn(V x, float first)
+    {
+        V shifted = _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6));
+        return _mm256_blend_ps(shifted, _mm256_set1_ps(first), 1);
+    }
+
+    static inline V trunc(V x)                  { return _mm256_round_ps(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+    static inline V floor(V x)                  { return _mm256_round_ps(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    static inline V ceil(V x)                   { return _mm256_round_ps(x, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+
+    static inline void toDouble(V x, D &lo, D &hi)
+    {
+        lo = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+        hi = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+    }
+    static inline V fromDouble(D lo, D hi)
+    {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1);
+    }
+    static inline D dset1(double x)             { return _mm256_set1_pd(x); }
+    static inline D dadd(D a, D b)              { return _mm256_add_pd(a, b); }
+    static inline D dsub(D a, D b)              { return _mm256_sub_pd(a, b); }
+    static inline D dmul(D a, D b)              { return _mm256_mul_pd(a, b); }
+};
+
+} // namespace
+
+#include "vectormath_simd.h"
+
+bool VectorMath::setKernelsAVX2(kernels_t &kernels, FastMath::precision_t precision)
+{
+    setVectorKernels(kernels, precision);
+    return true;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#else
+
+bool VectorMath::setKernelsAVX2(kernels_t &, FastMath::precision_t)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,140 @@
+/*
+
+  Description:  AVX-512 kernels of the vector math library.
+
+  License: GPLv2
+
+*/
+
+#include "vectormath.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+
+// this file is compiled for the instruction set of its
+// kernels, which are only called when the CPU supports it.
+// multiply and add must stay separate instructions, as
+// in the scalar code.
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f"))), apply_to=function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include <math.h>
+#include <immintrin.h>
+
+namespace
+{
+
+struct Traits
+{
+    typedef __m512    V;
+    typedef __mmask16 M;
+    typedef __m512i   I;
+    typedef __m512d   D;
+
+    static const uint32_t WIDTH = 16;
+
+    static inline V load(const float *p)        { return _mm512_loadu_ps(p); }
+    static inline void store(float *p, V x)     { _mm512_storeu_ps(p, x); }
+    static inline V set1(float x)               { return _mm512_set1_ps(x); }
+    static inline V setBits(uint32_t x)         { return _mm512_castsi512_ps(_mm512_set1_epi32(static_cast<int>(x))); }
+
+    static inline V add(V a, V b)               { return _mm512_add_ps(a, b); }
+    static inline V sub(V a, V b)               { return _mm512_sub_ps(a, b); }
+    static inline V mul(V a, V b)               { return _mm512_mul_ps(a, b); }
+    static inline V div(V a, V b)               { return _mm512_div_ps(a, b); }
+    static inline V sqrt(V x)                   { return _mm512_sqrt_ps(x); }
+    static inline V min(V a, V b)               { return _mm512_min_ps(a, b); }
+    static inline V max(V a, V b)               { return _mm512_max_ps(a, b); }
+
+    // AVX512F has the bitwise operations on integers only
+    static inline V band(V a, V b)
+    {
+        return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+    }
+    static inline V bor(V a, V b)
+    {
+        return _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+    }
+    static inline V bxor(V a, V b)
+    {
+        return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+    }
+    static inline V bandnot(V a, V b)
+    {
+        return _mm512_castsi512_ps(_mm512_andnot_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+    }
+
+    static inline M lt(V a, V b)                { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static inline M le(V a, V b)                { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static inline M gt(V a, V b)                { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static inline M ge(V a, V b)                { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    static inline M eq(V a, V b)                { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+    static inline M mnot(M m)                   { return static_cast<M>(~m); }
+    static inline M mand(M a, M b)              { return static_cast<M>(a & b); }
+    static inline M mor(M a, M b)               { return static_cast<M>(a | b); }
+    static inline V select(M m, V a, V b)       { return _mm512_mask_blend_ps(m, b, a); }
+    static inline uint32_t bits(M m)            { return static_cast<uint32_t>(m); }
+
+    static inline I cvtt(V x)                   { return _mm512_cvttps_epi32(x); }
+    static inline V cvt(I x)                    { return _mm512_cvtepi32_ps(x); }
+    static inline I iadd(I a, I b)              { return _mm512_add_epi32(a, b); }
+    static inline I iset1(int32_t x)            { return _mm512_set1_epi32(x); }
+    static inline I shl23(I x)                  { return _mm512_slli_epi32(x, 23); }
+    static inline V castToFloat(I x)            { return _mm512_castsi512_ps(x); }
+    static inline V reverse(V x)
+    {
+        return _mm512_permutexvar_ps(_mm512_setr_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0), x);
+    }
+    static inline V shiftIn(V x, float first)
+    {
+        V shifted = _mm512_permutexvar_ps(_mm512_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14), x);
+        return _mm512_mask_mov_ps(shifted, 1, _mm512_set1_ps(first));
+    }
+
+    static inline V trunc(V x)                  { return _mm512_roundscale_ps(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+    static inline V floor(V x)                  { return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    static inline V ceil(V x)                   { return _mm512_roundscale_ps(x, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+
+    static inline void toDouble(V x, D &lo, D &hi)
+    {
+        lo = _mm512_cvtps_pd(_mm512_castps512_ps256(x));
+        hi = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1)));
+    }
+    static inline V fromDouble(D lo, D hi)
+    {
+        __m256 l = _mm512_cvtpd_ps(lo);
+        __m256 h = _mm512_cvtpd_ps(hi);
+        return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(l)), _mm256_castps_pd(h), 1));
+    }
+    static inline D dset1(double x)             { return _mm512_set1_pd(x); }
+    static inline D dadd(D a, D b)              { return _mm512_add_pd(a, b); }
+    static inline D dsub(D a, D b)              { return _mm512_sub_pd(a, b); }
+    static inline D dmul(D a, D b)              { return _mm512_mul_pd(a, b); }
+};
+
+} // namespace
+
+#include "vectormath_simd.h"
+
+bool VectorMath::setKernelsAVX512(kernels_t &kernels, FastMath::precision_t precision)
+{
+    setVectorKernels(kernels, precision);
+    return true;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#else
+
+bool VectorMath::setKernelsAVX512(kernels_t &, FastMath::precision_t)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,773 @@
+/*
+
+  Description:  Vector kernels of the vector math library,
+                written against a traits class that wraps
+                the intrinsics of one instruction set.
+
+  License: GPLv2
+
+*/
+
+/* This file is included by vectormath_sse2.cpp,
+   vectormath_avx2.cpp and vectormath_avx512.cpp after they
+   have defined the class 'Traits' in an anonymous namespace.
+   Everything below has internal linkage, so no function
+   compiled for one instruction set can be picked by the
+   linker for another one.
+
+   Traits provides:
+     V, M, I, D       float vector, lane mask, int32 vector and
+                      double vector of half the width
+     WIDTH            number of float lanes
+     load, store, set1, setBits
+     add, sub, mul, div, sqrt
+     min, max         with the operand order of minps/maxps:
+                      min(a,b) = (a < b) ? a : b
+     band, bor, bxor, bandnot(a,b) = ~a & b
+     lt, le, gt, ge, eq, mnot, mand, mor, select(m,a,b), bits
+     cvtt, cvt, iadd, iset1, shl23, castToFloat
+     reverse          the lanes in reverse order
+     shiftIn(x, f)    the lanes moved up by one, with f in lane 0
+     trunc, floor, ceil
+     toDouble, fromDouble, dset1, dadd, dsub, dmul
+
+   The kernels repeat the operations of fastmath.cpp and of
+   the interpreters in the same order, without fused
+   multiply-adds, so the results are bit-identical.
+*/
+
+#include "fastmathdefs.h"
+#include "vectormath.h"
+
+namespace
+{
+
+typedef Traits::V V;
+typedef Traits::M M;
+typedef Traits::D D;
+
+static inline V signBit()
+{
+    return Traits::setBits(0x80000000u);
+}
+
+static inline V vabs(V x)
+{
+    return Traits::bandnot(signBit(), x);
+}
+
+static inline V copySign(V magnitude, V sign)
+{
+    return Traits::bor(Traits::bandnot(signBit(), magnitude), Traits::band(signBit(), sign));
+}
+
+/** (x + 1.5*2^23) - 1.5*2^23, see FM_ROUND_FLOAT */
+static inline V roundFloat(V x)
+{
+    return Traits::sub(Traits::add(x, Traits::set1(FM_ROUND_FLOAT)), Traits::set1(FM_ROUND_FLOAT));
+}
+
+static inline D roundDouble(D x)
+{
+    return Traits::dsub(Traits::dadd(x, Traits::dset1(FM_ROUND_DOUBLE)), Traits::dset1(FM_ROUND_DOUBLE));
+}
+
+/** Horner's rule, as the Polynomial class of fastmath.cpp */
+template<uint32_t N> static inline V polynomial(const float *c, V x)
+{
+    V p = Traits::set1(c[N-1]);
+    for(uint32_t i=N-1; i>0; i--)
+    {
+        p = Traits::add(Traits::set1(c[i-1]), Traits::mul(x, p));
+    }
+    return p;
+}
+
+/** sin(2*pi*r) for r in [-1/2, 1/2] */
+template<uint32_t N> static inline V sinTurns(const float *c, V r)
+{
+    V a = vabs(r);
+    V b = Traits::sub(Traits::set1(0.5f), a);
+    r = copySign(Traits::min(a, b), r);
+    return Traits::mul(r, polynomial<N>(c, Traits::mul(r, r)));
+}
+
+/** x - round(x) + 0.25, wrapped into [-1/2, 1/2] */
+static inline V cosTurns(V x)
+{
+    V r = Traits::add(Traits::sub(x, roundFloat(x)), Traits::set1(0.25f));
+    V one = Traits::select(Traits::gt(r, Traits::set1(0.5f)), Traits::set1(1.0f), Traits::set1(0.0f));
+    return Traits::sub(r, one);
+}
+
+/** returns (m ? offset - v : v), as reflect() in fastmath.cpp */
+static inline V reflect(M m, V v, float offset)
+{
+    V o = Traits::select(m, Traits::set1(offset), Traits::set1(0.0f));
+    return Traits::add(o, Traits::select(m, Traits::bxor(v, signBit()), v));
+}
+
+// **************************************************
+//   fast and ultra-fast kernels. lanes set in
+//   'fallback' are recomputed by the scalar kernel.
+// **************************************************
+
+struct FastSin1
+{
+    static V eval(V x, M &fallback)
+    {
+        fallback = Traits::mnot(Traits::lt(vabs(x), Traits::set1(FM_SIN1_MAXARG)));
+        return sinTurns<FM_LENGTH(c_sin1Fast)>(c_sin1Fast, Traits::sub(x, roundFloat(x)));
+    }
+};
+
+struct FastCos1
+{
+    static V eval(V x, M &fallback)
+    {
+        fallback = Traits::mnot(Traits::lt(vabs(x), Traits::set1(FM_SIN1_MAXARG)));
+        return sinTurns<FM_LENGTH(c_sin1Fast)>(c_sin1Fast, cosTurns(x));
+    }
+};
+
+struct FastSin
+{
+    static V eval(V x, M &fallback)
+    {
+        fallback = Traits::mnot(Traits::lt(vabs(x), Traits::set1(FM_SIN_MAXARG)));
+        D lo, hi;
+        Traits::toDouble(x, lo, hi);
+        lo = Traits::dmul(lo, Traits::dset1(FM_INV_2PI));
+        hi = Traits::dmul(hi, Traits::dset1(FM_INV_2PI));
+        V r = Traits::fromDouble(Traits::dsub(lo, roundDouble(lo)), Traits::dsub(hi, roundDouble(hi)));
+        return sinTurns<FM_LENGTH(c_sin1Fast)>(c_sin1Fast, r);
+    }
+};
+
+struct FastCos
+{
+    static V eval(V x, M &fallback)
+    {
+        fallback = Traits::mnot(Traits::lt(vabs(x), Traits::set1(FM_SIN_MAXARG)));
+        D lo, hi;
+        Traits::toDouble(x, lo, hi);
+        lo = Traits::dadd(Traits::dmul(lo, Traits::dset1(FM_INV_2PI)), Traits::dset1(0.25));
+        hi = Traits::dadd(Traits::dmul(hi, Traits::dset1(FM_INV_2PI)), Traits::dset1(0.25));
+        V r = Traits::fromDouble(Traits::dsub(lo, roundDouble(lo)), Traits::dsub(hi, roundDouble(hi)));
+        return sinTurns<FM_LENGTH(c_sin1Fast)>(c_sin1Fast, r);
+    }
+};
+
+struct FastTanh
+{
+    static V eval(V x, M &fallback)
+    {
+        V a = vabs(x);
+        fallback = Traits::mnot(Traits::lt(a, Traits::set1(FM_TANH_MAXARG)));
+
+        V p = Traits::mul(x, polynomial<FM_LENGTH(c_tanhFast)>(c_tanhFast, Traits::mul(x, x)));
+
+        // 1 - 2/(2^z + 1) with z = 2*log2(e)*a
+        V z = Traits::mul(Traits::set1(2.0f*static_cast<float>(FM_LOG2E)), a);
+        V n = roundFloat(z);
+        V e = polynomial<FM_LENGTH(c_exp2Tanh)>(c_exp2Tanh, Traits::sub(z, n));
+        V scale = Traits::castToFloat(Traits::shl23(Traits::iadd(Traits::cvtt(n), Traits::iset1(127))));
+        e = Traits::mul(e, scale);
+        V q = Traits::sub(Traits::set1(1.0f), Traits::div(Traits::set1(2.0f), Traits::add(e, Traits::set1(1.0f))));
+
+        return Traits::select(Traits::lt(a, Traits::set1(FM_TANH_POLYARG)), p, copySign(q, x));
+    }
+};
+
+template<uint32_t N> static inline V atan2Poly(const float *c, V y, V x, M &fallback)
+{
+    V ax = vabs(x);
+    V ay = vabs(y);
+    M finite = Traits::mand(Traits::le(ax, Traits::set1(FM_FLT_MAX)), Traits::le(ay, Traits::set1(FM_FLT_MAX)));
+    M zero = Traits::mand(Traits::eq(x, Traits::set1(0.0f)), Traits::eq(y, Traits::set1(0.0f)));
+    fallback = Traits::mor(Traits::mnot(finite), zero);
+
+    V a = Traits::div(Traits::min(ay, ax), Traits::max(ay, ax));
+    V r = Traits::mul(a, polynomial<N>(c, Traits::mul(a, a)));
+    r = reflect(Traits::gt(ay, ax), r, static_cast<float>(FM_PI/2.0));
+    r = reflect(Traits::lt(x, Traits::set1(0.0f)), r, static_cast<float>(FM_PI));
+    return copySign(r, y);
+}
+
+struct FastAtan2
+{
+    static V eval(V y, V x, M &fallback)
+    {
+        return atan2Poly<FM_LENGTH(c_atanFast)>(c_atanFast, y, x, fallback);
+    }
+};
+
+struct UltraSin1
+{
+    static V eval(V x, M &fallback)
+    {
+        fallback = Traits::mnot(Traits::lt(vabs(x), Traits::set1(FM_SIN1_MAXARG)));
+        return sinTurns<FM_LENGTH(c_sin1Ultra)>(c_sin1Ultra, Traits::sub(x, roundFloat(x)));
+    }
+};
+
+struct UltraCos1
+{
+    static V eval(V x, M &fallback)
+    {
+        fallback = Traits::mnot(Traits::lt(vabs(x), Traits::set1(FM_SIN1_MAXARG)));
+        return sinTurns<FM_LENGTH(c_sin1Ultra)>(c_sin1Ultra, cosTurns(x));
+    }
+};
+
+struct UltraSin
+{
+    static V eval(V x, M &fallback)
+    {
+        fallback = Traits::mnot(Traits::lt(vabs(x), Traits::set1(FM_ULTRA_MAXARG)));
+        V t = Traits::mul(x, Traits::set1(static_cast<float>(FM_INV_2PI)));
+        return sinTurns<FM_LENGTH(c_sin1Ultra)>(c_sin1Ultra, Traits::sub(t, roundFloat(t)));
+    }
+};
+
+struct UltraCos
+{
+    static V eval(V x, M &fallback)
+    {
+        fallback = Traits::mnot(Traits::lt(vabs(x), Traits::set1(FM_ULTRA_MAXARG)));
+        V t = Traits::mul(x, Traits::set1(static_cast<float>(FM_INV_2PI)));
+        return sinTurns<FM_LENGTH(c_sin1Ultra)>(c_sin1Ultra, cosTurns(t));
+    }
+};
+
+struct UltraTanh
+{
+    static V eval(V x, M &fallback)
+    {
+        fallback = Traits::mnot(Traits::lt(vabs(x), Traits::set1(FM_PADE_MAXARG)));
+        V x2 = Traits::mul(x, x);
+        V num = Traits::add(Traits::set1(378.0f), x2);
+        num = Traits::add(Traits::set1(17325.0f), Traits::mul(x2, num));
+        num = Traits::mul(x, Traits::add(Traits::set1(135135.0f), Traits::mul(x2, num)));
+        V den = Traits::add(Traits::set1(3150.0f), Traits::mul(x2, Traits::set1(28.0f)));
+        den = Traits::add(Traits::set1(62370.0f), Traits::mul(x2, den));
+        den = Traits::add(Traits::set1(135135.0f), Traits::mul(x2, den));
+        return Traits::div(num, den);
+    }
+};
+
+struct UltraAtan2
+{
+    static V eval(V y, V x, M &fallback)
+    {
+        return atan2Poly<FM_LENGTH(c_atanUltra)>(c_atanUltra, y, x, fallback);
+    }
+};
+
+/** apply a kernel with fallback lanes to an array */
+template<class K> static void unaryLoop(float *dst, const float *a, uint32_t n, FastMath::unary_t scalar)
+{
+    uint32_t i = 0;
+    for(; i+Traits::WIDTH <= n; i+=Traits::WIDTH)
+    {
+        M fallback;
+        V x = Traits::load(a+i);
+        V y = K::eval(x, fallback);
+        uint32_t lanes = Traits::bits(fallback);
+        if (lanes == 0)
+        {
+            Traits::store(dst+i, y);
+            continue;
+        }
+
+        // dst may be a, so keep the arguments
+        float args[Traits::WIDTH];
+        Traits::store(args, x);
+        Traits::store(dst+i, y);
+        for(uint32_t l=0; l<Traits::WIDTH; l++)
+        {
+            if (lanes & (1u << l))
+                dst[i+l] = scalar(args[l]);
+        }
+    }
+    for(; i<n; i++)
+    {
+        dst[i] = scalar(a[i]);
+    }
+}
+
+template<class K> static void binaryLoop(float *dst, const float *a, const float *b, uint32_t n,
+                                         FastMath::binary_t scalar)
+{
+    uint32_t i = 0;
+    for(; i+Traits::WIDTH <= n; i+=Traits::WIDTH)
+    {
+        M fallback;
+        V x = Traits::load(a+i);
+        V y = Traits::load(b+i);
+        V r = K::eval(x, y, fallback);
+        uint32_t lanes = Traits::bits(fallback);
+        if (lanes == 0)
+        {
+            Traits::store(dst+i, r);
+            continue;
+        }
+
+        float args1[Traits::WIDTH];
+        float args2[Traits::WIDTH];
+        Traits::store(args1, x);
+        Traits::store(args2, y);
+        Traits::store(dst+i, r);
+        for(uint32_t l=0; l<Traits::WIDTH; l++)
+        {
+            if (lanes & (1u << l))
+                dst[i+l] = scalar(args1[l], args2[l]);
+        }
+    }
+    for(; i<n; i++)
+    {
+        dst[i] = scalar(a[i], b[i]);
+    }
+}
+
+#define VM_UNARY_KERNEL(name, kernel, tier, function) \
+    static void name(float *dst, const float *a, uint32_t n) \
+    { \
+        unaryLoop<kernel>(dst, a, n, FastMath::getKernels(FastMath::tier).function); \
+    }
+
+#define VM_BINARY_KERNEL(name, kernel, tier, function) \
+    static void name(float *dst, const float *a, const float *b, uint32_t n) \
+    { \
+        binaryLoop<kernel>(dst, a, b, n, FastMath::getKernels(FastMath::tier).function); \
+    }
+
+VM_UNARY_KERNEL(fastSin,  FastSin,  PRECISION_FAST, sin)
+VM_UNARY_KERNEL(fastCos,  FastCos,  PRECISION_FAST, cos)
+VM_UNARY_KERNEL(fastSin1, FastSin1, PRECISION_FAST, sin1)
+VM_UNARY_KERNEL(fastCos1, FastCos1, PRECISION_FAST, cos1)
+VM_UNARY_KERNEL(fastTanh, FastTanh, PRECISION_FAST, tanh)
+VM_BINARY_KERNEL(fastAtan2, FastAtan2, PRECISION_FAST, atan2)
+
+VM_UNARY_KERNEL(ultraSin,  UltraSin,  PRECISION_ULTRAFAST, sin)
+VM_UNARY_KERNEL(ultraCos,  UltraCos,  PRECISION_ULTRAFAST, cos)
+VM_UNARY_KERNEL(ultraSin1, UltraSin1, PRECISION_ULTRAFAST, sin1)
+VM_UNARY_KERNEL(ultraCos1, UltraCos1, PRECISION_ULTRAFAST, cos1)
+VM_UNARY_KERNEL(ultraTanh, UltraTanh, PRECISION_ULTRAFAST, tanh)
+VM_BINARY_KERNEL(ultraAtan2, UltraAtan2, PRECISION_ULTRAFAST, atan2)
+
+// **************************************************
+//   arithmetic and rounding, the same in every tier
+// **************************************************
+
+/** apply an element-wise operation to an array. the
+    scalar version handles the remaining elements. */
+template<class Op> static void mapLoop(float *dst, const float *a, uint32_t n)
+{
+    uint32_t i = 0;
+    for(; i+Traits::WIDTH <= n; i+=Traits::WIDTH)
+    {
+        Traits::store(dst+i, Op::eval(Traits::load(a+i)));
+    }
+    for(; i<n; i++)
+    {
+        dst[i] = Op::scalar(a[i]);
+    }
+}
+
+template<class Op> static void mapLoop2(float *dst, const float *a, const float *b, uint32_t n)
+{
+    uint32_t i = 0;
+    for(; i+Traits::WIDTH <= n; i+=Traits::WIDTH)
+    {
+        Traits::store(dst+i, Op::eval(Traits::load(a+i), Traits::load(b+i)));
+    }
+    for(; i<n; i++)
+    {
+        dst[i] = Op::scalar(a[i], b[i]);
+    }
+}
+
+struct OpAdd
+{
+    static V eval(V a, V b)             { return Traits::add(a, b); }
+    static float scalar(float a, float b) { return a + b; }
+};
+
+struct OpSub
+{
+    static V eval(V a, V b)             { return Traits::sub(a, b); }
+    static float scalar(float a, float b) { return a - b; }
+};
+
+struct OpMul
+{
+    static V eval(V a, V b)             { return Traits::mul(a, b); }
+    static float scalar(float a, float b) { return a * b; }
+};
+
+struct OpDiv
+{
+    static V eval(V a, V b)             { return Traits::div(a, b); }
+    static float scalar(float a, float b) { return a / b; }
+};
+
+struct OpNeg
+{
+    static V eval(V x)                  { return Traits::bxor(x, signBit()); }
+    static float scalar(float x)        { return -x; }
+};
+
+struct OpAbs
+{
+    static V eval(V x)                  { return vabs(x); }
+    static float scalar(float x)        { return fabsf(x); }
+};
+
+struct OpSqrt
+{
+    static V eval(V x)                  { return Traits::sqrt(x); }
+    static float scalar(float x)        { return sqrtf(x); }
+};
+
+struct OpLimit
+{
+    // std::max(std::min(x, 1), -1), with min(a,b) = (b < a) ? b : a
+    static V eval(V x)
+    {
+        return Traits::max(Traits::set1(-1.0f), Traits::min(Traits::set1(1.0f), x));
+    }
+    static float scalar(float x)
+    {
+        float t = (1.0f < x) ? 1.0f : x;
+        return (t < -1.0f) ? -1.0f : t;
+    }
+};
+
+struct OpSign
+{
+    static V eval(V x)
+    {
+        return Traits::select(Traits::ge(x, Traits::set1(0.0f)), Traits::set1(1.0f), Traits::set1(-1.0f));
+    }
+    static float scalar(float x)        { return (x >= 0.0f) ? 1.0f : -1.0f; }
+};
+
+struct OpMod1
+{
+    // cvttps2dq returns the same value as the scalar
+    // conversion for arguments outside the int range
+    static V eval(V x)                  { return Traits::sub(x, Traits::cvt(Traits::cvtt(x))); }
+    static float scalar(float x)        { return x-(int)x; }
+};
+
+struct OpTrunc
+{
+    static V eval(V x)                  { return Traits::trunc(x); }
+    static float scalar(float x)        { return truncf(x); }
+};
+
+struct OpFloor
+{
+    static V eval(V x)                  { return Traits::floor(x); }
+    static float scalar(float x)        { return floorf(x); }
+};
+
+struct OpCeil
+{
+    static V eval(V x)                  { return Traits::ceil(x); }
+    static float scalar(float x)        { return ceilf(x); }
+};
+
+struct OpRound
+{
+    // round half away from zero: the difference between x and
+    // trunc(x) is exact, and zero for |x| >= 2^23, infinities
+    // and NaNs.
+    static V eval(V x)
+    {
+        V t = Traits::trunc(x);
+        M up = Traits::ge(vabs(Traits::sub(x, t)), Traits::set1(0.5f));
+        return Traits::select(up, Traits::add(t, copySign(Traits::set1(1.0f), x)), t);
+    }
+    static float scalar(float x)        { return roundf(x); }
+};
+
+static void vecAdd(float *dst, const float *a, const float *b, uint32_t n) { mapLoop2<OpAdd>(dst, a, b, n); }
+static void vecSub(float *dst, const float *a, const float *b, uint32_t n) { mapLoop2<OpSub>(dst, a, b, n); }
+static void vecMul(float *dst, const float *a, const float *b, uint32_t n) { mapLoop2<OpMul>(dst, a, b, n); }
+static void vecDiv(float *dst, const float *a, const float *b, uint32_t n) { mapLoop2<OpDiv>(dst, a, b, n); }
+
+static void vecAddk(float *dst, const float *a, float k, uint32_t n)
+{
+    uint32_t i = 0;
+    V vk = Traits::set1(k);
+    for(; i+Traits::WIDTH <= n; i+=Traits::WIDTH)
+    {
+        Traits::store(dst+i, Traits::add(Traits::load(a+i), vk));
+    }
+    for(; i<n; i++)
+    {
+        dst[i] = a[i] + k;
+    }
+}
+
+static void vecMulk(float *dst, const float *a, float k, uint32_t n)
+{
+    uint32_t i = 0;
+    V vk = Traits::set1(k);
+    for(; i+Traits::WIDTH <= n; i+=Traits::WIDTH)
+    {
+        Traits::store(dst+i, Traits::mul(Traits::load(a+i), vk));
+    }
+    for(; i<n; i++)
+    {
+        dst[i] = a[i] * k;
+    }
+}
+
+static void vecMac(float *dst, const float *acc, const float *a, const float *b, uint32_t n)
+{
+    uint32_t i = 0;
+    for(; i+Traits::WIDTH <= n; i+=Traits::WIDTH)
+    {
+        V p = Traits::mul(Traits::load(a+i), Traits::load(b+i));
+        Traits::store(dst+i, Traits::add(Traits::load(acc+i), p));
+    }
+    for(; i<n; i++)
+    {
+        dst[i] = acc[i] + a[i] * b[i];
+    }
+}
+
+static void vecCmac(float *accRe, float *accIm, const float *aRe, const float *aIm,
+                    const float *bRe, const float *bIm, uint32_t n)
+{
+    uint32_t i = 0;
+    for(; i+Traits::WIDTH <= n; i+=Traits::WIDTH)
+    {
+        V ar = Traits::load(aRe+i);
+        V ai = Traits::load(aIm+i);
+        V br = Traits::load(bRe+i);
+        V bi = Traits::load(bIm+i);
+        V re = Traits::sub(Traits::mul(ar, br), Traits::mul(ai, bi));
+        V im = Traits::add(Traits::mul(ar, bi), Traits::mul(ai, br));
+        Traits::store(accRe+i, Traits::add(Traits::load(accRe+i), re));
+        Traits::store(accIm+i, Traits::add(Traits::load(accIm+i), im));
+    }
+    for(; i<n; i++)
+    {
+        const float re = aRe[i]*bRe[i] - aIm[i]*bIm[i];
+        const float im = aRe[i]*bIm[i] + aIm[i]*bRe[i];
+        accRe[i] = accRe[i] + re;
+        accIm[i] = accIm[i] + im;
+    }
+}
+
+// **************************************************
+//   dot products. every group of VM_DOT_LANES terms
+//   is added to the partial sums, the remaining
+//   terms are left to the portable code.
+// **************************************************
+
+static const uint32_t DOT_REGS = VM_DOT_LANES/Traits::WIDTH;
+
+static float vecDot(const float *a, const float *b, uint32_t n)
+{
+    V acc[DOT_REGS];
+    for(uint32_t r=0; r<DOT_REGS; r++)
+    {
+        acc[r] = Traits::set1(0.0f);
+    }
+
+    uint32_t i = 0;
+    for(; i+VM_DOT_LANES <= n; i+=VM_DOT_LANES)
+    {
+        for(uint32_t r=0; r<DOT_REGS; r++)
+        {
+            const uint32_t k = i + r*Traits::WIDTH;
+            acc[r] = Traits::add(acc[r], Traits::mul(Traits::load(a+k), Traits::load(b+k)));
+        }
+    }
+
+    float sums[VM_DOT_LANES];
+    for(uint32_t r=0; r<DOT_REGS; r++)
+    {
+        Traits::store(sums + r*Traits::WIDTH, acc[r]);
+    }
+    return VectorMath::finishDot(sums, a, b, i, n);
+}
+
+static float vecDotSym(const float *a, const float *b, uint32_t n)
+{
+    V acc[DOT_REGS];
+    for(uint32_t r=0; r<DOT_REGS; r++)
+    {
+        acc[r] = Traits::set1(0.0f);
+    }
+
+    // a[n-1-k] for the lanes k..k+WIDTH-1 is a reversed load
+    const uint32_t half = n/2;
+    uint32_t i = 0;
+    for(; i+VM_DOT_LANES <= half; i+=VM_DOT_LANES)
+    {
+        for(uint32_t r=0; r<DOT_REGS; r++)
+        {
+            const uint32_t k = i + r*Traits::WIDTH;
+            V mirror = Traits::reverse(Traits::load(a + n - k - Traits::WIDTH));
+            V folded = Traits::add(Traits::load(a+k), mirror);
+            acc[r] = Traits::add(acc[r], Traits::mul(Traits::load(b+k), folded));
+        }
+    }
+
+    float sums[VM_DOT_LANES];
+    for(uint32_t r=0; r<DOT_REGS; r++)
+    {
+        Traits::store(sums + r*Traits::WIDTH, acc[r]);
+    }
+    return VectorMath::finishDotSym(sums, a, b, i, n);
+}
+
+// **************************************************
+//   cascades of second-order sections. a group of up
+//   to WIDTH sections runs as a wavefront: lane j holds
+//   section first+j, which is j samples behind lane 0
+//   and takes its input from lane j-1 of the previous
+//   step. lanes that have no sample yet, or no longer,
+//   keep their state.
+// **************************************************
+
+static const float g_laneIndex[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+static void sosGroup(float *dst, const float *src, uint32_t n, float *sos,
+                     uint32_t stride, uint32_t first, uint32_t m)
+{
+    float *row[VM_SOS_ROWS];
+    for(uint32_t r=0; r<VM_SOS_ROWS; r++)
+    {
+        row[r] = sos + r*stride + first;
+    }
+
+    const V b0 = Traits::load(row[VM_SOS_B0]);
+    const V b1 = Traits::load(row[VM_SOS_B1]);
+    const V b2 = Traits::load(row[VM_SOS_B2]);
+    const V a1 = Traits::load(row[VM_SOS_A1]);
+    const V a2 = Traits::load(row[VM_SOS_A2]);
+    const V index = Traits::load(g_laneIndex);
+    V s1 = Traits::load(row[VM_SOS_S1]);
+    V s2 = Traits::load(row[VM_SOS_S2]);
+    V y = Traits::set1(0.0f);
+
+    float lanes[Traits::WIDTH];
+    const uint32_t steps = n + m - 1;
+    for(uint32_t t=0; t<steps; t++)
+    {
+        V x = Traits::shiftIn(y, (t < n) ? src[t] : 0.0f);
+        y = Traits::add(Traits::mul(b0, x), s1);
+        V n1 = Traits::add(Traits::sub(Traits::mul(b1, x), Traits::mul(a1, y)), s2);
+        V n2 = Traits::sub(Traits::mul(b2, x), Traits::mul(a2, y));
+        if ((t >= m-1) && (t < n))
+        {
+            s1 = n1;
+            s2 = n2;
+        }
+        else
+        {
+            // lane j is at sample t-j
+            const float tf = static_cast<float>(t);
+            M active = Traits::mand(Traits::le(index, Traits::set1(tf)),
+                                    Traits::gt(index, Traits::set1(tf - static_cast<float>(n))));
+            s1 = Traits::select(active, n1, s1);
+            s2 = Traits::select(active, n2, s2);
+        }
+        if (t >= m-1)
+        {
+            Traits::store(lanes, y);
+            dst[t-(m-1)] = lanes[m-1];
+        }
+    }
+
+    // only the state of the sections of the group
+    float state[Traits::WIDTH];
+    Traits::store(state, s1);
+    for(uint32_t j=0; j<m; j++) row[VM_SOS_S1][j] = state[j];
+    Traits::store(state, s2);
+    for(uint32_t j=0; j<m; j++) row[VM_SOS_S2][j] = state[j];
+}
+
+static void vecSOS(float *dst, const float *src, uint32_t n, float *sos, uint32_t sections)
+{
+    // a single section gains nothing from the wavefront
+    const uint32_t stride = VM_SOS_STRIDE(sections);
+    uint32_t first = 0;
+    while((n > 0) && (sections - first >= 2))
+    {
+        const uint32_t m = (sections - first < Traits::WIDTH) ? sections - first : Traits::WIDTH;
+        sosGroup(dst, src, n, sos, stride, first, m);
+        src = dst;
+        first += m;
+    }
+    VectorMath::finishSOS(dst, src, n, sos, first, sections);
+}
+
+static void vecNeg(float *dst, const float *a, uint32_t n)   { mapLoop<OpNeg>(dst, a, n); }
+static void vecAbs(float *dst, const float *a, uint32_t n)   { mapLoop<OpAbs>(dst, a, n); }
+static void vecSqrt(float *dst, const float *a, uint32_t n)  { mapLoop<OpSqrt>(dst, a, n); }
+static void vecLimit(float *dst, const float *a, uint32_t n) { mapLoop<OpLimit>(dst, a, n); }
+static void vecSign(float *dst, const float *a, uint32_t n)  { mapLoop<OpSign>(dst, a, n); }
+static void vecMod1(float *dst, const float *a, uint32_t n)  { mapLoop<OpMod1>(dst, a, n); }
+static void vecTrunc(float *dst, const float *a, uint32_t n) { mapLoop<OpTrunc>(dst, a, n); }
+static void vecFloor(float *dst, const float *a, uint32_t n) { mapLoop<OpFloor>(dst, a, n); }
+static void vecCeil(float *dst, const float *a, uint32_t n)  { mapLoop<OpCeil>(dst, a, n); }
+static void vecRound(float *dst, const float *a, uint32_t n) { mapLoop<OpRound>(dst, a, n); }
+
+/** replace the kernels of a table that have a vector
+    version for this instruction set and precision */
+static void setVectorKernels(VectorMath::kernels_t &k, FastMath::precision_t precision)
+{
+    k.add   = vecAdd;
+    k.sub   = vecSub;
+    k.mul   = vecMul;
+    k.div   = vecDiv;
+    k.addk  = vecAddk;
+    k.mulk  = vecMulk;
+    k.mac   = vecMac;
+    k.neg   = vecNeg;
+    k.abs   = vecAbs;
+    k.sqrt  = vecSqrt;
+    k.limit = vecLimit;
+    k.sign  = vecSign;
+    k.mod1  = vecMod1;
+    k.trunc = vecTrunc;
+    k.floor = vecFloor;
+    k.ceil  = vecCeil;
+    k.round = vecRound;
+    k.dot   = vecDot;
+    k.dotsym = vecDotSym;
+    k.sos   = vecSOS;
+    k.cmac  = vecCmac;
+
+    switch(precision)
+    {
+    case FastMath::PRECISION_FAST:
+        k.sin   = fastSin;
+        k.cos   = fastCos;
+        k.sin1  = fastSin1;
+        k.cos1  = fastCos1;
+        k.tanh  = fastTanh;
+        k.atan2 = fastAtan2;
+        break;
+    case FastMath::PRECISION_ULTRAFAST:
+        k.sin   = ultraSin;
+        k.cos   = ultraCos;
+        k.sin1  = ultraSin1;
+        k.cos1  = ultraCos1;
+        k.tanh  = ultraTanh;
+        k.atan2 = ultraAtan2;
+        break;
+    default:
+        break;
+    }
+}
+
+} // namespace
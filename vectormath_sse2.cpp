@@ -0,0 +1,136 @@
+/*
+
+  Description:  SSE2 kernels of the vector math library.
+
+  License: GPLv2
+
+*/
+
+#include "vectormath.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+
+// this file is compiled for the instruction set of its
+// kernels, which are only called when the CPU supports it.
+// multiply and add must stay separate instructions, as
+// in the scalar code.
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse2"))), apply_to=function)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC target("sse2")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include <math.h>
+#include <emmintrin.h>
+
+namespace
+{
+
+struct Traits
+{
+    typedef __m128  V;
+    typedef __m128  M;
+    typedef __m128i I;
+    typedef __m128d D;
+
+    static const uint32_t WIDTH = 4;
+
+    static inline V load(const float *p)        { return _mm_loadu_ps(p); }
+    static inline void store(float *p, V x)     { _mm_storeu_ps(p, x); }
+    static inline V set1(float x)               { return _mm_set1_ps(x); }
+    static inline V setBits(uint32_t x)         { return _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(x))); }
+
+    static inline V add(V a, V b)               { return _mm_add_ps(a, b); }
+    static inline V sub(V a, V b)               { return _mm_sub_ps(a, b); }
+    static inline V mul(V a, V b)               { return _mm_mul_ps(a, b); }
+    static inline V div(V a, V b)               { return _mm_div_ps(a, b); }
+    static inline V sqrt(V x)                   { return _mm_sqrt_ps(x); }
+    static inline V min(V a, V b)               { return _mm_min_ps(a, b); }
+    static inline V max(V a, V b)               { return _mm_max_ps(a, b); }
+
+    static inline V band(V a, V b)              { return _mm_and_ps(a, b); }
+    static inline V bor(V a, V b)               { return _mm_or_ps(a, b); }
+    static inline V bxor(V a, V b)              { return _mm_xor_ps(a, b); }
+    static inline V bandnot(V a, V b)           { return _mm_andnot_ps(a, b); }
+
+    static inline M lt(V a, V b)                { return _mm_cmplt_ps(a, b); }
+    static inline M le(V a, V b)                { return _mm_cmple_ps(a, b); }
+    static inline M gt(V a, V b)                { return _mm_cmpgt_ps(a, b); }
+    static inline M ge(V a, V b)                { return _mm_cmpge_ps(a, b); }
+    static inline M eq(V a, V b)                { return _mm_cmpeq_ps(a, b); }
+    static inline M mnot(M m)                   { return _mm_xor_ps(m, setBits(0xffffffffu)); }
+    static inline M mand(M a, M b)              { return _mm_and_ps(a, b); }
+    static inline M mor(M a, M b)               { return _mm_or_ps(a, b); }
+    static inline V select(M m, V a, V b)       { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    static inline uint32_t bits(M m)            { return static_cast<uint32_t>(_mm_movemask_ps(m)); }
+
+    static inline I cvtt(V x)                   { return _mm_cvttps_epi32(x); }
+    static inline V cvt(I x)                    { return _mm_cvtepi32_ps(x); }
+    static inline I iadd(I a, I b)              { return _mm_add_epi32(a, b); }
+    static inline I iset1(int32_t x)            { return _mm_set1_epi32(x); }
+    static inline I shl23(I x)                  { return _mm_slli_epi32(x, 23); }
+    static inline V castToFloat(I x)            { return _mm_castsi128_ps(x); }
+    static inline V reverse(V x)                { return _mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 1, 2, 3)); }
+    static inline V shiftIn(V x, float first)
+    {
+        return _mm_move_ss(_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)), _mm_set_ss(first));
+    }
+
+    // SSE2 has no rounding instruction: values of 2^23 and
+    // more are integers, and the others fit in an int.
+    static inline V trunc(V x)
+    {
+        V sign = setBits(0x80000000u);
+        M small = lt(_mm_andnot_ps(sign, x), set1(8388608.0f));
+        V t = _mm_or_ps(cvt(cvtt(x)), _mm_and_ps(sign, x));
+        return select(small, t, x);
+    }
+
+    static inline V floor(V x)
+    {
+        V t = trunc(x);
+        return select(gt(t, x), sub(t, set1(1.0f)), t);
+    }
+
+    static inline V ceil(V x)
+    {
+        V t = trunc(x);
+        return select(lt(t, x), add(t, set1(1.0f)), t);
+    }
+
+    static inline void toDouble(V x, D &lo, D &hi)
+    {
+        lo = _mm_cvtps_pd(x);
+        hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+    }
+    static inline V fromDouble(D lo, D hi)      { return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)); }
+    static inline D dset1(double x)             { return _mm_set1_pd(x); }
+    static inline D dadd(D a, D b)              { return _mm_add_pd(a, b); }
+    static inline D dsub(D a, D b)              { return _mm_sub_pd(a, b); }
+    static inline D dmul(D a, D b)              { return _mm_mul_pd(a, b); }
+};
+
+} // namespace
+
+#include "vectormath_simd.h"
+
+bool VectorMath::setKernelsSSE2(kernels_t &kernels, FastMath::precision_t precision)
+{
+    setVectorKernels(kernels, precision);
+    return true;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#else
+
+bool VectorMath::setKernelsSSE2(kernels_t &, FastMath::precision_t)
+{
+    return false;
+}
+
+#endif
@@ -11,27 +11,16 @@
 */
 
 #include <QDebug>
-#include <QMutexLocker>
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <ostream>
 #include <algorithm>
+#include <string.h>
+#include "nativecompiler.h"
+#include "programinstance.h"
 #include "virtualmachine.h"
 
-int32_t VM::findVariableByName(const variables_t &vars, const std::string &name)
-{
-    size_t N = vars.size();
-    size_t i=0;
-    while(i<N)
-    {
-        if (vars[i].name == name)
-            return (int32_t)i;
-        i++;
-    }
-    return -1;
-}
-
 static int portaudioCallback(
         const void *inputBuffer,
         void *outputBuffer,
@@ -58,21 +47,52 @@ static int portaudioCallback(
 
 
 
+
 VirtualMachine::VirtualMachine(QMainWindow *guiWindow)
     : m_guiWindow(guiWindow),
       m_stream(0),
-      m_runState(false)
+      m_leftLevel(0.0f),
+      m_rightLevel(0.0f),
+      m_vuSequence(0),
+      m_vuLeft(0.0f),
+      m_vuRight(0.0f),
+      m_runState(false),
+      m_current(new ProgramInstance()),
+      m_fading(NULL),
+      m_fadePosition(0),
+      m_fadeDelay(0),
+      m_fadeLength(0),
+      m_crossfadeLength(VM_DEFAULTCROSSFADE),
+      m_wavstreamer(new WavStreamer()),
+      m_hasAudioFile(false),
+      m_sliderChanges(0),
+      m_slidersSet(0),
+      m_requestedEngine(ENGINE_STACK),
+      m_blockMode(true),
+      m_source(SRC_SOUNDCARD),
+      m_freq(0.0f),
+      m_noiseSeed(1),
+      m_reseed(false),
+      m_precision(FastMath::PRECISION_EXACT),
+      m_pipelineStages(1),
+      m_phaseaccu(0.0f)
 {
     Pa_Initialize();
 
+    m_loaded = m_current;
     for(uint32_t i=0; i<4; i++)
     {
-        m_monitorVar[i] = NULL;
+        m_sliderValue[i].store(0.0f);
     }
 
+    m_inLeft.resize(VM_BLOCKSIZE);
+    m_inRight.resize(VM_BLOCKSIZE);
+    m_fadeBuffer.resize(2*VM_BLOCKSIZE);
+
     m_inDevice = Pa_GetDefaultInputDevice();
     m_outDevice = Pa_GetDefaultOutputDevice();
     m_sampleRate = 44100.0f;
+    m_virtualRate = 0;
 
     /* Allocate ring buffers for GUI I/O.
 
@@ -91,15 +111,20 @@ VirtualMachine::VirtualMachine(QMainWindow *guiWindow)
                                     32768, dataptr);
     }
 
-    init();
-
-    m_source = SRC_SOUNDCARD;
+    seedNoiseGenerators();
 }
 
 VirtualMachine::~VirtualMachine()
 {
+    stop();
     Pa_Terminate();
 
+    // the handoffs delete the objects that
+    // the audio thread has not taken
+    delete m_current;
+    delete m_fading;
+    delete m_wavstreamer;
+
     // de-allocate the ring buffer data
     for(uint32_t i=0; i<2; i++)
     {
@@ -107,34 +132,6 @@ VirtualMachine::~VirtualMachine()
     }
 }
 
-
-
-void VirtualMachine::init()
-{
-    m_lout = 0;
-    m_lin  = 0;
-    m_rout = 0;
-    m_rin  = 0;
-    m_in   = 0;
-    m_out  = 0;
-    m_slider[0] = 0;
-    m_slider[1] = 0;
-    m_slider[2] = 0;
-    m_slider[3] = 0;
-
-    m_leftLevel = 0.0f;
-    m_rightLevel = 0.0f;
-
-    m_phaseaccu = 0.0f;
-    m_freq = 0.0f;
-
-    // flush the data in the ring buffers
-    for(uint32_t i=0; i<2; i++)
-    {
-        PaUtil_FlushRingBuffer(&m_ringbuffer[i]);
-    }
-}
-
 PaUtilRingBuffer* VirtualMachine::getRingBufferPtr(uint32_t ringBufID)
 {
     if (ringBufID<2)
@@ -146,8 +143,6 @@ PaUtilRingBuffer* VirtualMachine::getRingBufferPtr(uint32_t ringBufID)
 
 bool VirtualMachine::setMonitoringVariable(uint32_t ringBufID, uint32_t channel, const std::string &varname)
 {
-    QMutexLocker lock(&m_controlMutex);
-
     qDebug() << "setMonitoringVariable called";
 
     if (ringBufID > 1)
@@ -155,80 +150,166 @@ bool VirtualMachine::setMonitoringVariable(uint32_t ringBufID, uint32_t channel,
     if (channel > 1)
         return false;
 
-    int32_t idx = VM::findVariableByName(m_vars, varname);
+    // the audio thread points the monitor
+    // at the variable before the next buffer
+    int32_t idx = m_loaded->findVariable(varname);
+    m_loaded->setMonitor(ringBufID*2 + channel, idx);
     if (idx < 0)
     {
         // variable not found
-        m_monitorVar[ringBufID*2 + channel] = NULL;
         return false;
     }
 
     qDebug() << "setMonitoringVariable " << varname.c_str();
-
-    m_monitorVar[ringBufID*2 + channel] = &(m_vars[idx].value);
     return true;
 }
 
 bool VirtualMachine::hasAudioFile()
 {
-    QMutexLocker lock(&m_controlMutex);
-    if (m_wavstreamer.isOK())
+    return m_hasAudioFile.load();
+}
+
+bool VirtualMachine::setAudioFile(const QString &filename)
+{
+    // the file is opened by the GUI thread,
+    // then handed to the audio thread
+    WavStreamer *wavstreamer = new WavStreamer();
+    if (wavstreamer->openFile(filename) != 0)
     {
-        return true;
+        delete wavstreamer;
+        return false;
     }
-    return false;
+    m_wavstreamers.publish(wavstreamer);
+    m_hasAudioFile = true;
+    return true;
 }
 
-bool VirtualMachine::setAudioFile(const QString &filename)
+bool VirtualMachine::loadProgram(const VM::program_t &program, const VM::variables_t &variables)
+{
+    VM::regprogram_t regprogram;
+    regprogram.temporaries = 0;
+    return loadProgram(program, regprogram, variables);
+}
+
+bool VirtualMachine::loadProgram(const VM::program_t &program,
+                                 const VM::regprogram_t &regprogram,
+                                 const VM::variables_t &variables)
+{
+    return loadProgram(program, regprogram, variables, VM::program_t());
+}
+
+bool VirtualMachine::loadProgram(const VM::program_t &program,
+                                 const VM::regprogram_t &regprogram,
+                                 const VM::variables_t &variables,
+                                 const VM::program_t &controlProgram)
 {
-    QMutexLocker lock(&m_controlMutex);
-    if (m_wavstreamer.openFile(filename) != 0)
+    return loadProgram(program, regprogram, variables, controlProgram, VM::filters_t());
+}
+
+bool VirtualMachine::loadProgram(const VM::program_t &program,
+                                 const VM::regprogram_t &regprogram,
+                                 const VM::variables_t &variables,
+                                 const VM::program_t &controlProgram,
+                                 const VM::filters_t &filters)
+{
+    const float rate = getProgramSamplerate();
+    if ((m_virtualRate != 0) && (rate == m_sampleRate))
+    {
+        qDebug() << "VirtualMachine: cannot resample from" << m_sampleRate << "Hz to" << m_virtualRate << "Hz";
+    }
+
+    // the program is set up while the audio thread
+    // keeps executing the previous one, so it does not
+    // wait for the FFTs of the impulse responses
+    ProgramInstance *instance = new ProgramInstance();
+    if (!instance->load(program, regprogram, variables, controlProgram, filters,
+                        m_precision, m_noiseSeed.load(), m_sampleRate, rate,
+                        getRequestedEngine(), m_pipelineStages))
     {
+        delete instance;
         return false;
     }
+
+    // a running program is replaced without a gap
+    if (isRunning())
+    {
+        instance->mapVariables(*m_loaded);
+    }
+    else
+    {
+        // discard the monitor data of the previous program. the
+        // audio thread writes the ring buffers, so the GUI thread
+        // can only skip what it has not read.
+        for(uint32_t i=0; i<2; i++)
+        {
+            PaUtil_AdvanceRingBufferReadIndex(&m_ringbuffer[i],
+                                              PaUtil_GetRingBufferReadAvailable(&m_ringbuffer[i]));
+        }
+    }
+
+    m_programs.publish(instance);
+    m_loaded = instance;
     return true;
 }
 
-void VirtualMachine::loadProgram(const VM::program_t &program, const VM::variables_t &variables)
+bool VirtualMachine::setCrossfadeLength(uint32_t frames)
 {
-    QMutexLocker lock(&m_controlMutex);
+    if (frames > VM_MAXCROSSFADE)
+    {
+        return false;
+    }
+    m_crossfadeLength = frames;
+    return true;
+}
+
+bool VirtualMachine::setPipelineStages(uint32_t stages)
+{
+    if ((stages == 0) || (stages > VM_MAXSTAGES))
+    {
+        return false;
+    }
+    m_pipelineStages = stages;
+    return true;
+}
 
-    init();
+bool VirtualMachine::setEngine(engine_t engine)
+{
+    // the audio thread switches before the next buffer
+    m_requestedEngine = engine;
+    return m_loaded->isEngineAvailable(engine);
+}
 
-    m_vars = variables;
-    m_program = program;
+VirtualMachine::engine_t VirtualMachine::getEngine() const
+{
+    const engine_t engine = getRequestedEngine();
+    return m_loaded->isEngineAvailable(engine) ? engine : ENGINE_STACK;
+}
 
-    // find the lout, rout, lin, rin, in, out
-    // variables.
-    int32_t idx = VM::findVariableByName(m_vars, "inl");
-    if (idx != -1) m_lin = &(m_vars[idx].value);
-    idx = VM::findVariableByName(m_vars, "inr");
-    if (idx != -1) m_rin = &(m_vars[idx].value);
-    idx = VM::findVariableByName(m_vars, "outl");
-    if (idx != -1) m_lout = &(m_vars[idx].value);
-    idx = VM::findVariableByName(m_vars, "outr");
-    if (idx != -1) m_rout = &(m_vars[idx].value);
-    idx = VM::findVariableByName(m_vars, "out");
-    if (idx != -1) m_out = &(m_vars[idx].value);
-    idx = VM::findVariableByName(m_vars, "in");
-    if (idx != -1) m_in = &(m_vars[idx].value);
+bool VirtualMachine::compileNative(const statements_t &statements,
+                                   const VM::variables_t &variables)
+{
+    // the generated C code calls the C library
+    if (m_loaded->getPrecision() != FastMath::PRECISION_EXACT)
+    {
+        qDebug() << "VirtualMachine::compileNative: the native engine requires exact precision";
+        return false;
+    }
 
-    // setup sliders
-    idx = VM::findVariableByName(m_vars, "slider1");
-    if (idx != -1) m_slider[0] = &(m_vars[idx].value);
-    idx = VM::findVariableByName(m_vars, "slider2");
-    if (idx != -1) m_slider[1] = &(m_vars[idx].value);
-    idx = VM::findVariableByName(m_vars, "slider3");
-    if (idx != -1) m_slider[2] = &(m_vars[idx].value);
-    idx = VM::findVariableByName(m_vars, "slider4");
-    if (idx != -1) m_slider[3] = &(m_vars[idx].value);
+    if (variables.size() != m_loaded->getVariableCount())
+    {
+        qDebug() << "VirtualMachine::compileNative: variables do not match the loaded program";
+        return false;
+    }
 
-    // setup sample rate
-    idx = VM::findVariableByName(m_vars, "samplerate");
-    if (idx != -1)
+    // compiling can take a while, but the
+    // audio thread does not wait for it
+    NativeCompiler *native = new NativeCompiler();
+    if (!native->compile(statements, variables) || !m_loaded->setNative(native))
     {
-        m_vars[idx].value = m_sampleRate;
+        delete native;
+        return false;
     }
+    return true;
 }
 
 void VirtualMachine::setupSoundcard(PaDeviceIndex inDevice, PaDeviceIndex outDevice, float sampleRate)
@@ -249,12 +330,32 @@ void VirtualMachine::setupSoundcard(PaDeviceIndex inDevice, PaDeviceIndex outDev
     m_sampleRate = sampleRate;
 }
 
+bool VirtualMachine::setVirtualSamplerate(uint32_t rate)
+{
+    if (rate > VM_MAXVIRTUALRATIO*m_sampleRate)
+    {
+        return false;
+    }
+    m_virtualRate = rate;
+    return true;
+}
+
+float VirtualMachine::getProgramSamplerate() const
+{
+    const uint32_t deviceRate = static_cast<uint32_t>(m_sampleRate + 0.5);
+    if ((m_virtualRate == 0) || (m_virtualRate == deviceRate) ||
+        (m_virtualRate > VM_MAXVIRTUALRATIO*deviceRate) ||
+        !Resampler::isSupported(m_virtualRate, deviceRate))
+    {
+        return m_sampleRate;
+    }
+    return m_virtualRate;
+}
+
 bool VirtualMachine::start()
 {
     qDebug() << "VirtualMachine::start()";
 
-    QMutexLocker lock(&m_controlMutex);
-
     // check if portaudio is already running
     if (m_stream != 0)
     {
@@ -312,10 +413,22 @@ bool VirtualMachine::start()
     return false;
 }
 
-void VirtualMachine::stop()
+void VirtualMachine::startOffline()
 {
-    QMutexLocker lock(&m_controlMutex);
+    if (m_stream != 0)
+    {
+        Pa_AbortStream(m_stream);
+        Pa_CloseStream(m_stream);
+        m_stream = 0;
+    }
+
+    m_leftLevel = 0.0f;
+    m_rightLevel = 0.0f;
+    m_runState = true;
+}
 
+void VirtualMachine::stop()
+{
     if (m_stream != 0)
     {
         Pa_AbortStream(m_stream);
@@ -330,80 +443,221 @@ void VirtualMachine::stop()
 
 void VirtualMachine::setSlider(uint32_t id, float value)
 {
-    QMutexLocker lock(&m_controlMutex);
     if (id < 4)
     {
-        if (m_slider[id] != 0)
-        {
-            *m_slider[id]=value;
-        }
+        m_sliderValue[id].store(value, std::memory_order_relaxed);
+        m_slidersSet.fetch_or(1u << id, std::memory_order_relaxed);
+        m_sliderChanges.fetch_or(1u << id, std::memory_order_release);
     }
 }
 
+void VirtualMachine::setBlockMode(bool enabled)
+{
+    m_blockMode = enabled;
+}
+
 void VirtualMachine::setSource(src_t source)
 {
-    QMutexLocker locker(&m_controlMutex);
     m_source = source;
 }
 
 void VirtualMachine::setFrequency(double Hz)
 {
-    QMutexLocker locker(&m_controlMutex);
-    m_freq = Hz;
+    m_freq = static_cast<float>(Hz);
+}
+
+void VirtualMachine::getVU(float &left, float &right) const
+{
+    // retry while the audio thread writes the levels
+    uint32_t sequence;
+    do
+    {
+        sequence = m_vuSequence.load(std::memory_order_acquire);
+        left = m_vuLeft.load(std::memory_order_relaxed);
+        right = m_vuRight.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while(((sequence & 1) != 0) || (sequence != m_vuSequence.load(std::memory_order_relaxed)));
+}
+
+void VirtualMachine::applyControls()
+{
+    // a crossfade cannot continue while stopped
+    if ((m_fading != NULL) && !m_runState.load(std::memory_order_relaxed))
+    {
+        m_programs.retire(m_fading);
+        m_fading = NULL;
+    }
+
+    // a new program starts with the current sliders. the
+    // next one is only taken when the crossfade has ended.
+    uint32_t sliders = m_sliderChanges.exchange(0, std::memory_order_acquire);
+    ProgramInstance *next = (m_fading == NULL) ? m_programs.take() : NULL;
+    if (next != NULL)
+    {
+        sliders = m_slidersSet.load(std::memory_order_relaxed);
+        const uint32_t fade = m_crossfadeLength.load(std::memory_order_relaxed);
+        if (next->migrate(*m_current) && ((fade > 0) || (next->getLatency() > 0)))
+        {
+            // the previous program keeps running until
+            // the crossfade has ended. the output of a
+            // pipelined program starts after its latency.
+            m_fading = m_current;
+            m_fadePosition = 0;
+            m_fadeDelay = next->getLatency();
+            m_fadeLength = fade;
+        }
+        else
+        {
+            m_programs.retire(m_current);
+            m_leftLevel = 0.0f;
+            m_rightLevel = 0.0f;
+            m_phaseaccu = 0.0f;
+        }
+        m_current = next;
+    }
+
+    m_wavstreamers.take(m_wavstreamer);
+
+    if (m_reseed.exchange(false, std::memory_order_acquire))
+    {
+        m_current->seedNoiseGenerators(m_noiseSeed.load(std::memory_order_relaxed));
+        seedNoiseGenerators();
+    }
+
+    const engine_t engine = getRequestedEngine();
+    if ((engine != m_current->getEngine()) && m_current->isEngineAvailable(engine))
+    {
+        m_current->activateEngine(engine);
+    }
+
+    for(uint32_t i=0; i<4; i++)
+    {
+        if ((sliders & (1u << i)) != 0)
+        {
+            m_current->setSlider(i, m_sliderValue[i].load(std::memory_order_relaxed));
+        }
+    }
 }
 
 void VirtualMachine::processSamples(float *inbuf, float *outbuf,
                                     uint32_t framesPerBuffer)
 {
     // as this is a time-critical function that is
-    // called by the audio subsystem
-    // blocking it is not a good idea
-    // therefore, we'll try to lock the mutex
-    // but if that fails, we return a muted buffer
-    //
+    // called by the audio subsystem, it never waits
+    // for the GUI thread, see applyControls()
+    applyControls();
 
-    bool success = m_controlMutex.tryLock();
-    if (!success)
+    if (!m_runState.load(std::memory_order_relaxed))
     {
-        for(uint32_t i=0; i<framesPerBuffer; i++)
-        {
-            *outbuf++ = 0.0f;
-            *outbuf++ = 0.0f;
-        }
+        memset(outbuf, 0, 2*framesPerBuffer*sizeof(float));
         return;
     }
 
+    const src_t source = static_cast<src_t>(m_source.load(std::memory_order_relaxed));
+    const float freq = m_freq.load(std::memory_order_relaxed);
+    const bool blockMode = m_blockMode.load(std::memory_order_relaxed);
+
     // todo: make multiplier respect the frames per buffer
     // so we get block-size independent VU meter behaviour.
     m_leftLevel *= 0.9f;
     m_rightLevel *= 0.9f;
 
+    // the buffer is processed in chunks of at most
+    // VM_BLOCKSIZE frames so the planar buffers,
+    // which are allocated in advance, never need to grow.
+    // at a virtual rate, the chunks are shorter
+    // when the program runs faster than the sound card.
+    uint32_t offset = 0;
+    while(offset < framesPerBuffer)
+    {
+        uint32_t chunk = m_current->getChunkSize();
+        if (m_fading != NULL)
+        {
+            chunk = std::min(chunk, m_fading->getChunkSize());
+        }
+        uint32_t frames = std::min(framesPerBuffer - offset, chunk);
+        float *out = outbuf + 2*offset;
+
+        generateInput(inbuf + 2*offset, frames, source, freq);
+        m_current->process(&m_inLeft[0], &m_inRight[0], frames, out,
+                           blockMode, m_ringbuffer);
+
+        // the monitors show the new program
+        if (m_fading != NULL)
+        {
+            m_fading->process(&m_inLeft[0], &m_inRight[0], frames, &m_fadeBuffer[0],
+                              blockMode, NULL);
+            crossfade(out, &m_fadeBuffer[0], frames);
+        }
+
+        offset += frames;
+    }
+
+    // publish the VU levels, see getVU()
+    const uint32_t sequence = m_vuSequence.load(std::memory_order_relaxed);
+    m_vuSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_vuLeft.store(m_leftLevel, std::memory_order_relaxed);
+    m_vuRight.store(m_rightLevel, std::memory_order_relaxed);
+    m_vuSequence.store(sequence + 2, std::memory_order_release);
+}
+
+void VirtualMachine::crossfade(float *outbuf, const float *previous, uint32_t frames)
+{
+    // the programs compute the same kind of signal, which
+    // is correlated, so the gains add up to one
+    const float step = (m_fadeLength > 0) ? 1.0f / static_cast<float>(m_fadeLength) : 0.0f;
+    for(uint32_t i=0; i<frames; i++)
+    {
+        const uint32_t position = m_fadePosition - std::min(m_fadePosition, m_fadeDelay);
+        const float gain = (m_fadePosition < m_fadeDelay) ? 0.0f :
+                           (position < m_fadeLength) ? position*step : 1.0f;
+        outbuf[i<<1] = previous[i<<1] + gain*(outbuf[i<<1] - previous[i<<1]);
+        outbuf[(i<<1)+1] = previous[(i<<1)+1] + gain*(outbuf[(i<<1)+1] - previous[(i<<1)+1]);
+        m_fadePosition++;
+    }
+
+    if (m_fadePosition >= m_fadeDelay + m_fadeLength)
+    {
+        m_programs.retire(m_fading);
+        m_fading = NULL;
+    }
+}
+
+void VirtualMachine::generateInput(const float *inbuf, uint32_t frames, src_t source, float freq)
+{
+    if (source == SRC_NOISE)
+    {
+        m_sourceNoise[0].generate(&m_inLeft[0], frames);
+        m_sourceNoise[1].generate(&m_inRight[0], frames);
+    }
+
     float wavBuffer[2];
-    for(uint32_t i=0; i<framesPerBuffer; i++)
+    for(uint32_t i=0; i<frames; i++)
     {
         float left;
         float right;
 
-        switch(m_source)
+        switch(source)
         {
         default:
         case SRC_SOUNDCARD:
             left = *inbuf++;
             right = *inbuf++;
             break;
-        case SRC_WAV:           
-            m_wavstreamer.fillBuffer(wavBuffer, 1);
+        case SRC_WAV:
+            m_wavstreamer->fillBuffer(wavBuffer, 1);
             left = wavBuffer[0];
             right = wavBuffer[1];
             break;
         case SRC_NOISE:
-            left = -1.0f+2.0f*static_cast<float>(rand())/RAND_MAX;
-            right = -1.0f+2.0f*static_cast<float>(rand())/RAND_MAX;
+            left = m_inLeft[i];
+            right = m_inRight[i];
             break;
         case SRC_SINE:
             left = cos(2.0f*3.1415927f*m_phaseaccu);
             right = left;
-            m_phaseaccu += (m_freq / m_sampleRate);
+            m_phaseaccu += (freq / m_sampleRate);
             if (m_phaseaccu > 1.0f)
             {
                 m_phaseaccu -= 1.0f;
@@ -417,7 +671,7 @@ void VirtualMachine::processSamples(float *inbuf, float *outbuf,
         case SRC_QUADSINE:
             left = cos(2.0f*3.1415927f*m_phaseaccu);
             right = sin(2.0f*3.1415927f*m_phaseaccu);
-            m_phaseaccu += (m_freq / m_sampleRate);
+            m_phaseaccu += (freq / m_sampleRate);
             if (m_phaseaccu > 1.0f)
             {
                 m_phaseaccu -= 1.0f;
@@ -443,350 +697,29 @@ void VirtualMachine::processSamples(float *inbuf, float *outbuf,
         {
             m_rightLevel = right_abs;
         }
-        executeProgram(left, right, outbuf[i<<1], outbuf[(i<<1)+1]);
-
-        ring_buffer_data_t scope;
-        ring_buffer_data_t spectrum;
-
-        if (m_monitorVar[0] != NULL)
-        {
-            scope.s1 = *m_monitorVar[0];
-        }
-        else
-        {
-            scope.s1 = 0;
-        }
-
-        if (m_monitorVar[1] != NULL)
-        {
-            scope.s2 = *m_monitorVar[1];
-        }
-        else
-        {
-            scope.s2 = 0;
-        }
-
-        if (m_monitorVar[2] != NULL)
-        {
-            spectrum.s1 = *m_monitorVar[2];
-        }
-        else
-        {
-            spectrum.s1 = 0;
-        }
 
-        if (m_monitorVar[3] != NULL)
-        {
-            spectrum.s2 = *m_monitorVar[3];
-        }
-        else
-        {
-            spectrum.s2 = 0;
-        }
-
-        PaUtil_WriteRingBuffer(&m_ringbuffer[0], &scope, 1);
-        PaUtil_WriteRingBuffer(&m_ringbuffer[1], &spectrum, 1);
+        m_inLeft[i] = left;
+        m_inRight[i] = right;
     }
-    m_controlMutex.unlock();
-}
-
-uint32_t VirtualMachine::execFIR(uint32_t n, float *stack)
-{
-    return 0;
 }
 
-uint32_t VirtualMachine::execBiquad(uint32_t n, float *stack)
+void VirtualMachine::setNoiseSeed(uint32_t seed)
 {
-    return 0;
+    // the generators restart before the next buffer
+    m_noiseSeed = seed;
+    m_reseed = true;
 }
 
-void VirtualMachine::executeProgram(float inLeft, float inRight, float &outLeft, float &outRight)
+void VirtualMachine::seedNoiseGenerators()
 {
-    const size_t instructions = m_program.size();
-    size_t pc = 0;    // program counter
-    size_t sp = 0;    // stack pointer
-    float stack[2048];
-
-    // check if we have a program ..
-    // or if we're not running...
-    if ((instructions == 0) || (!m_runState))
-    {
-        outLeft = 0.0f;
-        outRight = 0.0f;
-        return;
-    }
-
-    // setup input signal
-    if (m_in != 0)
-    {
-        *m_in = (inLeft + inRight) / 2.0f;
-    }
-    if (m_lin != 0)
-    {
-        *m_lin = inLeft;
-    }
-    if (m_rin != 0)
-    {
-        *m_rin = inRight;
-    }
-
-    while(pc < instructions)
-    {
-        VM::instruction_t instruction = m_program[pc++];
-        if (instruction.icode & 0x80000000)
-        {
-            // special instruction with additional parameter
-            uint32_t n = instruction.icode & 0xFFFF;
-            switch(instruction.icode & 0xff000000)
-            {
-            case P_readvar: // push
-                stack[sp++] = m_vars[n].value;
-                break;
-            case P_writevar:// pop
-                m_vars[n].value = stack[--sp];
-                break;
-            case P_fir:
-                sp-=execFIR(n, stack+sp);
-                break;
-            case P_biquad:
-                sp-=execBiquad(n, stack+sp);
-                break;
-            default:
-                // TODO: produce error
-                break;
-            }
-        }
-        else
-        {
-            switch(instruction.icode)
-            {
-            case P_add:
-                sp--;
-                stack[sp-1]+=stack[sp];
-                break;
-            case P_sub:
-                sp--;
-                stack[sp-1]=stack[sp-1]-stack[sp];
-                //qDebug() << stack[sp-1];
-                break;
-            case P_mul:
-                sp--;
-                stack[sp-1]*=stack[sp];
-                break;
-            case P_div:
-                sp--;
-                stack[sp-1]/=stack[sp];
-                break;
-            case P_neg:
-                stack[sp-1]=-stack[sp-1];
-                break;
-            case P_sin:
-                stack[sp-1]=sin(stack[sp-1]);
-                break;
-            case P_tan:
-                stack[sp-1]=tan(stack[sp-1]);
-                break;
-            case P_tanh:
-                stack[sp-1]=tanh(stack[sp-1]);
-                break;
-            case P_cos:
-                stack[sp-1]=cos(stack[sp-1]);
-                break;
-            case P_sin1:
-                stack[sp-1]=sin(2.0f*M_PI*stack[sp-1]);
-                break;
-            case P_cos1:
-                stack[sp-1]=cos(2.0f*M_PI*stack[sp-1]);
-                break;
-            case P_literal:
-                stack[sp++]=m_program[pc].value;
-                pc++;
-                break;
-            //case P_print:
-            //  printf("%f\n",stack[--sp]);
-            //    break;
-            case P_mod1:
-                stack[sp-1]=stack[sp-1]-(int)stack[sp-1];
-                break;
-            case P_abs:
-                stack[sp-1]=fabs(stack[sp-1]);
-                break;
-            case P_sqrt:
-                stack[sp-1]=sqrt(stack[sp-1]);
-                break;
-            case P_round:
-                //sp--;
-                //if (stack[sp]!=0.0f)
-                //    stack[sp-1]=stack[sp]*round(stack[sp-1]/stack[sp]);
-                stack[sp-1]=round(stack[sp-1]);
-                break;
-            case P_pow:
-                sp--;
-                stack[sp-1]=pow(stack[sp-1],stack[sp]);
-                break;
-            case P_limit:
-                stack[sp-1]=std::min(stack[sp-1],1.0f);
-                stack[sp-1]=std::max(stack[sp-1],-1.0f);
-                break;
-            case P_atan2:
-                sp--;
-                stack[sp-1]=atan2(stack[sp-1],stack[sp]);
-                break;
-            case P_sign:
-                if (stack[sp-1] >= 0.0f)
-                    stack[sp-1]=1.0f;
-                else
-                    stack[sp-1]=-1.0f;
-                break;
-            case P_noise:
-                stack[sp++]=-1.0f+2.0f*static_cast<float>(rand())/RAND_MAX;
-                break;
-            case P_trunc:
-                stack[sp-1] = std::trunc(stack[sp-1]);
-                break;
-            case P_ceil:
-                stack[sp-1] = std::ceil(stack[sp-1]);
-                break;
-            case P_floor:
-                stack[sp-1] = std::floor(stack[sp-1]);
-                break;
-            default:
-                // TODO: produce error
-                break;
-            }
-        }
-        if (sp>2044)
-        {
-            // stack overflow!
-            return;
-        }
-    }
-
-    if (m_out != 0)
-    {
-        outLeft = *m_out;
-        outRight = *m_out;
-    }
-    else
-    {
-        if (m_lout != 0)
-        {
-            outLeft = *m_lout;
-        }
-        else
-        {
-            outLeft = 0.0f;
-        }
-        if (m_rout != 0)
-        {
-            outRight = *m_rout;
-        }
-        else
-        {
-            outRight = 0.0f;
-        }
-    }
+    // the noise source uses the streams after the
+    // largest possible generator number
+    const uint32_t seed = m_noiseSeed.load(std::memory_order_relaxed);
+    m_sourceNoise[0].init(NoiseGenerator::NOISE_UNIFORM, seed, VM_MAXNOISE);
+    m_sourceNoise[1].init(NoiseGenerator::NOISE_UNIFORM, seed, VM_MAXNOISE+1);
 }
 
 void VirtualMachine::dump(std::ostream &s)
 {
-    QMutexLocker lock(&m_controlMutex);
-
-    s << "-- VIRTUAL MACHINE PROGRAM --\n\n";
-    size_t N = m_program.size();
-    for(size_t i=0; i<N; i++)
-    {
-        uint32_t n = m_program[i].icode & 0xFFFF; // variable index)
-        if (m_program[i].icode & 0x80000000)
-        {
-            switch(m_program[i].icode & 0xff000000)
-            {
-            case P_readvar:
-                s << "READ " << m_vars[n].name.c_str() << "\n";
-                break;
-            case P_writevar:
-                s << "WRITE " << m_vars[n].name.c_str() << "\n";
-                break;
-            default:
-                s << "UNKNOWN\n";
-                break;
-            }
-        }
-        else
-        {
-            switch(m_program[i].icode)
-            {
-            case P_add:
-                s << "ADD\n";
-                break;
-            case P_sub:
-                s << "SUB\n";
-                break;
-            case P_mul:
-                s << "MUL\n";
-                break;
-            case P_div:
-                s << "DIV\n";
-                break;
-            case P_literal:
-                s << "LOAD " << m_program[i+1].value << "\n";
-                i++;
-                break;
-            case P_sin:
-                s << "SIN\n";
-                break;
-            case P_cos:
-                s << "COS\n";
-                break;
-            case P_sin1:
-                s << "SIN1\n";
-                break;
-            case P_cos1:
-                s << "COS1\n";
-                break;
-            case P_mod1:
-                s << "MOD1\n";
-                break;
-            case P_abs:
-                s << "ABS\n";
-                break;
-            case P_tan:
-                s << "TAN\n";
-                break;
-            case P_tanh:
-                s << "TANH\n";
-                break;
-            case P_pow:
-                s << "POW\n";
-                break;
-            case P_sqrt:
-                s << "SQRT\n";
-                break;
-            case P_round:
-                s << "ROUND\n";
-                break;
-            case P_limit:
-                s << "LIMIT\n";
-                break;
-            case P_atan2:
-                s << "ATAN2\n";
-                break;
-            case P_noise:
-                s << "NOISE\n";
-                break;
-            case P_trunc:
-                s << "TRUNC\n";
-                break;
-            case P_ceil:
-                s << "CEIL\n";
-                break;
-            case P_floor:
-                s << "FLOOR\n";
-                break;
-            default:
-                s << "UNKNOWN\n";
-                break;
-            }
-        }
-    }
+    m_loaded->dump(s);
 }
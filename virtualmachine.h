@@ -15,12 +15,22 @@
 
 #include <stdint.h>
 #include <vector>
-#include <QMutex>
-#include "qmainwindow.h"
+#include <atomic>
+class QMainWindow;
 #include "portaudio.h"
 #include "portaudio_helper.h"
 #include "pa_ringbuffer.h"
 #include "wavstreamer.h"
+#include "parser.h"
+#include "fastmath.h"
+#include "vectormath.h"
+#include "noisegenerator.h"
+#include "firfilter.h"
+#include "biquadfilter.h"
+#include "convolver.h"
+#include "resampler.h"
+#include "statearena.h"
+#include "handoff.h"
 
 #ifndef M_PI
 #define M_PI 3.1415927
@@ -32,9 +42,15 @@
 #define P_mul 3
 #define P_div 4
 #define P_neg 5
+#define P_mov 6     // register programs only: dst = srcA
 
 #define P_literal 200
 
+// superinstructions produced by the peephole optimizer.
+// the literal operand follows in the next instruction word.
+#define P_mullit 201    // top of stack * literal
+#define P_addlit 202    // top of stack + literal
+
 #define P_sin   100
 #define P_cos   101
 #define P_sin1  102
@@ -53,6 +69,11 @@
 #define P_trunc 115
 #define P_ceil  116
 #define P_floor 117
+#define P_gaussnoise 118
+#define P_pinknoise  119
+#define P_firfilter  120   // fir(), compiled to P_fir
+#define P_biquadfilter 121 // biquad(), compiled to P_biquad
+#define P_convolve   122   // conv(), compiled to P_conv
 
 //#define P_print 102
 
@@ -60,9 +81,48 @@
 // the following opcodes use the lower 16 bits for further identifying a variable or FIR
 #define P_writevar 0x81000000
 #define P_readvar  0x82000000
-#define P_fir      0x83000000
+#define P_fir      0x83000000   // filter the top of the stack with FIR filter n
+// filter with biquad filter n. when bits 16-23 hold the number of
+// sections, their coefficients are on the stack above the input.
 #define P_biquad   0x84000000
 
+// indexed superinstructions produced by the peephole optimizer.
+// the second operand follows in the next instruction word.
+#define P_addvv    0x85000000   // push var + var
+#define P_mulvv    0x86000000   // push var * var
+#define P_mac      0x87000000   // top of stack + var * var
+#define P_rmwadd   0x88000000   // var = var + literal
+
+// push the next value of noise generator n. the function
+// (P_noise, P_gaussnoise, P_pinknoise) is compiled to this
+// instruction with the NoiseGenerator::type_t in bits 16-23.
+// every call gets its own generator, see NoiseGenerator.
+#define P_noisegen 0x89000000
+
+#define P_conv     0x8A000000   // convolve the top of the stack with impulse response n
+
+// maximum number of noise generators of a program
+#define VM_MAXNOISE 65536
+
+// maximum number of filters of a program
+#define VM_MAXFILTERS 65536
+
+// maximum number of frames processed by the block executor in one go
+#define VM_BLOCKSIZE 256
+
+// maximum stack depth of a program, see VM::getStackDepth
+#define VM_MAXSTACKDEPTH 2048
+
+// maximum ratio of the virtual sample rate to that of the sound card
+#define VM_MAXVIRTUALRATIO 8
+
+// default and maximum length of the crossfade of a hot reload in frames
+#define VM_DEFAULTCROSSFADE 1024
+#define VM_MAXCROSSFADE 1048576
+
+// maximum number of stages of a pipelined program, see Pipeline
+#define VM_MAXSTAGES 8
+
 namespace VM
 {
     union instruction_t
@@ -80,14 +140,114 @@ namespace VM
     typedef std::vector<instruction_t> program_t;
     typedef std::vector<variable_t>    variables_t;
 
+    /** three-address instruction of a register program.
+        the operands index the register file, which holds
+        the variables, followed by the constants and the
+        temporaries. The noise functions read the index of
+        their generator from the constant register srcA,
+        P_firfilter filters srcA with the filter whose index
+        is in the constant register srcB, and so do
+        P_biquadfilter and P_convolve. When the coefficients of a biquad
+        filter change, their registers are listed in
+        regprogram_t::operands.
+    */
+    struct reginstr_t
+    {
+        uint16_t opcode;    // P_add, P_mov, P_sin etc.
+        uint16_t dst;       // destination register
+        uint16_t srcA;      // first source register
+        uint16_t srcB;      // second source register
+    };
+
+    /** register-based equivalent of a program_t */
+    struct regprogram_t
+    {
+        std::vector<reginstr_t> code;
+        std::vector<float>      constants;      // initial values of the constant registers
+        uint32_t                temporaries;    // number of temporary registers
+        std::vector<uint16_t>   operands;       // coefficient registers of the biquad
+                                                // filters whose coefficients change,
+                                                // in the order of the filters
+    };
+
+    /** coefficients of a biquad filter, BIQUAD_COEFFICIENTS
+        per section. When 'dynamic' is true, the program passes
+        the coefficients with every sample and these are only
+        the initial ones. */
+    struct biquad_t
+    {
+        std::vector<float> coefficients;
+        bool               dynamic;
+    };
+
+    /** coefficients of the filters of a program. P_fir with
+        index n, and P_firfilter with n in srcB, use fir[n].
+        P_biquad and P_biquadfilter use biquad[n], P_conv and
+        P_convolve the impulse response conv[n]. */
+    struct filters_t
+    {
+        std::vector< std::vector<float> > fir;
+        std::vector<biquad_t>             biquad;
+        std::vector< std::vector<float> > conv;
+    };
+
     /** find a variable by name. returns -1 if not found */
     int32_t findVariableByName(const variables_t &vars, const std::string &name);
+
+    /** returns the change in stack depth caused by an instruction */
+    int32_t getStackEffect(uint32_t icode);
+
+    /** returns true if 'icode' is an instruction
+        of a stack program */
+    bool isStackInstruction(uint32_t icode);
+
+    /** returns true if 'opcode' is an instruction
+        of a register program */
+    bool isRegisterInstruction(uint16_t opcode);
+
+    /** returns the number of instruction words used by an
+        instruction, including its operand word, if any */
+    uint32_t getInstructionLength(uint32_t icode);
+
+    /** determine the maximum stack depth of a program.
+        returns false if an instruction is unknown, takes more
+        values than there are on the stack or misses its operand
+        word, or if the stack is not empty at the end of the
+        program. */
+    bool getStackDepth(const program_t &program, uint32_t &maxDepth);
+
+    /** determine whether a program has finite memory: whether its
+        state, after 'samples' samples of input, is the same as that
+        of a run from the first sample, whatever came before. Such a
+        program can render a signal in chunks that start 'samples'
+        samples early. A variable that is read before it is assigned
+        is a delay of one sample, and the length of a fir() or conv()
+        is added to its input. A filter's state is only the same when
+        its blocks line up as well, so the chunks must start at a
+        multiple of CONV_MAXBLOCK. returns false for a program with
+        recursive state (a variable that depends on its own previous
+        value, or biquad()) or noise, which only an uninterrupted run
+        reproduces. */
+    bool getMemoryLength(const program_t &program, const filters_t &filters, uint32_t &samples);
 }
 
+class JITCompiler;
+class NativeCompiler;
+class ProgramInstance;
+
 /** Virtual machine that executes BasicDSP programs.
     The VM runs in a different thread (due to PortAudio)
     and care must be taken to avoid data corruption
     caused by multi-threading.
+
+    The audio thread never waits for the GUI thread: the
+    controls, such as the sliders and the source, are atomics
+    that processSamples reads once per buffer, and a program
+    is loaded into a new ProgramInstance that is handed over
+    through a Handoff, as are the WAV files. The audio thread
+    swaps in the new object at the start of a buffer and hands
+    the old one back to the GUI thread, which deletes it.
+    The VU levels are published through a sequence lock.
 */
 class VirtualMachine
 {
@@ -95,33 +255,164 @@ public:
     VirtualMachine(QMainWindow *guiWindow);
     virtual ~VirtualMachine();
 
-    /** load a program consisting of byte code */
-    void loadProgram(const VM::program_t &program, const VM::variables_t &variables);
+    /** load a program consisting of byte code.
+        returns false if the program fails the stack depth check,
+        in which case the previous program stays loaded.
+        When the VM is running, the program replaces the previous
+        one without stopping the stream: the variables with the
+        same name keep their values and the outputs of the two
+        programs are crossfaded, see setCrossfadeLength. */
+    bool loadProgram(const VM::program_t &program, const VM::variables_t &variables);
+
+    /** load a program consisting of byte code and its register-based
+        equivalent, which is used when the register engine is selected */
+    bool loadProgram(const VM::program_t &program,
+                     const VM::regprogram_t &regprogram,
+                     const VM::variables_t &variables);
+
+    /** load a program together with its control program, which
+        holds the statements that only depend on the sliders, the
+        samplerate and literals, see RateAnalyzer. The control
+        program is executed by the stack interpreter before the
+        first sample and after a slider has changed, whatever
+        engine is selected. */
+    bool loadProgram(const VM::program_t &program,
+                     const VM::regprogram_t &regprogram,
+                     const VM::variables_t &variables,
+                     const VM::program_t &controlProgram);
+
+    /** as above, for a program that uses filters. returns false
+        if the program uses a filter that is not in 'filters'. */
+    bool loadProgram(const VM::program_t &program,
+                     const VM::regprogram_t &regprogram,
+                     const VM::variables_t &variables,
+                     const VM::program_t &controlProgram,
+                     const VM::filters_t &filters);
+
+    /** interpreter used to execute the program.
+        ENGINE_STACK    - switch-based stack interpreter, supports block mode.
+        ENGINE_REGISTER - interpreter for the register program.
+        ENGINE_THREADED - threaded stack interpreter with the top of the
+                          stack cached in a register. The program is
+                          decoded into handler addresses by loadProgram.
+        ENGINE_JIT      - native x86-64 code generated by loadProgram.
+        ENGINE_NATIVE   - the program translated to C and compiled by
+                          the system compiler, see compileNative.
+    */
+    enum engine_t {ENGINE_STACK, ENGINE_REGISTER, ENGINE_THREADED, ENGINE_JIT,
+                   ENGINE_NATIVE};
+
+    /** select the interpreter. The register engine is only
+        available when a register program has been loaded,
+        the JIT engine only when the program could be
+        translated to native code and the native engine
+        only after a successful call to compileNative.
+        The register, threaded and JIT engines always execute
+        sample by sample.
+        The engine is remembered: when a later program can
+        run on it, loadProgram selects it again, otherwise
+        the stack interpreter is used.
+        returns false if the engine is not available. */
+    bool setEngine(engine_t engine);
+
+    /** returns the interpreter that executes the loaded program */
+    engine_t getEngine() const;
+
+    /** returns the interpreter selected by setEngine */
+    engine_t getRequestedEngine() const
+    {
+        return static_cast<engine_t>(m_requestedEngine.load());
+    }
+
+    /** select the precision of the transcendental functions
+        (sin, cos, sin1, cos1, tanh, pow, atan2), see fastmath.h.
+        The precision takes effect when the next program is
+        loaded. The native engine is only available for
+        programs loaded with PRECISION_EXACT. */
+    void setPrecision(FastMath::precision_t precision)
+    {
+        m_precision = precision;
+    }
+
+    /** returns the precision selected by setPrecision */
+    FastMath::precision_t getPrecision() const
+    {
+        return m_precision;
+    }
+
+    /** set the seed of the noise generators of the program and
+        of the noise source, and restart them. The generators also
+        restart when a program is loaded, so a program produces
+        the same noise on every run with the same seed. */
+    void setNoiseSeed(uint32_t seed);
+
+    /** returns the seed set by setNoiseSeed */
+    uint32_t getNoiseSeed() const
+    {
+        return m_noiseSeed.load();
+    }
+
+    /** compile the loaded program with the system compiler, or load
+        it from the cache, for the native engine. 'statements' and
+        'variables' must be the ones the loaded program was generated
+        from. The compiler runs without blocking the audio thread.
+        The native engine is activated when it has been selected.
+        returns false if the program could not be compiled. */
+    bool compileNative(const statements_t &statements,
+                       const VM::variables_t &variables);
+
+    /** set the length of the crossfade from a running program
+        to the next in frames of the sound card, or 0 to switch
+        at once. returns false if it exceeds VM_MAXCROSSFADE. */
+    bool setCrossfadeLength(uint32_t frames);
+
+    /** returns the length set by setCrossfadeLength */
+    uint32_t getCrossfadeLength() const
+    {
+        return m_crossfadeLength.load();
+    }
+
+    /** split the programs loaded from now on into up to 'stages'
+        stages of consecutive statements, which execute on
+        successive blocks on worker threads, see Pipeline. This
+        spreads a heavy program over several cores at the cost of
+        (stages-1)*VM_BLOCKSIZE samples of latency. A pipelined
+        program executes sample by sample with the stack,
+        threaded or JIT engine. 1 disables pipelining.
+        returns false if 'stages' is 0 or exceeds VM_MAXSTAGES. */
+    bool setPipelineStages(uint32_t stages);
+
+    /** returns the number set by setPipelineStages */
+    uint32_t getPipelineStages() const
+    {
+        return m_pipelineStages;
+    }
 
     /** start the execution of the program */
     bool start();
 
+    /** start the execution of the program without an audio stream.
+        the caller drives the VM by calling processSamples,
+        for instance to benchmark the interpreters. */
+    void startOffline();
+
     /** stop the execution of the program */
     void stop();
 
     /** returns true if the virtual machine is running */
     bool isRunning() const
     {
-        return m_runState;
+        return m_runState.load();
     }
 
-    /** execute VM */
+    /** execute VM. this is called by the audio thread and
+        neither locks nor allocates memory. */
     void processSamples(float *inbuf,
                         float *outbuf,
                         uint32_t framesPerBuffer);
 
     /** get the current VU levels */
-    void getVU(float &left, float &right)
-    {
-        QMutexLocker locker(&m_controlMutex);
-        left = m_leftLevel;
-        right = m_rightLevel;
-    }
+    void getVU(float &left, float &right) const;
 
     /** set the value of a slider */
     void setSlider(uint32_t id, float value);
@@ -133,6 +424,21 @@ public:
     /** set the frequency for the sine or quadsine generator in Hertz */
     void setFrequency(double Hz);
 
+    /** enable or disable block-based execution.
+        In block mode, each instruction operates on a vector
+        of up to VM_BLOCKSIZE samples. Only statements that
+        have sample-to-sample feedback are evaluated per sample.
+        The vector instructions use the kernels of vectormath.h
+        for the instruction set of the CPU.
+    */
+    void setBlockMode(bool enabled);
+
+    /** returns true if block-based execution is enabled */
+    bool isBlockMode() const
+    {
+        return m_blockMode.load();
+    }
+
     /** dump the (human readable) VM program to an output stream */
     void dump(std::ostream &s);
 
@@ -168,6 +474,29 @@ public:
         return m_sampleRate;
     }
 
+    /** run the program at a virtual sample rate in Hz instead of
+        the rate of the sound card, or at the rate of the sound card
+        for 0. The input is resampled to the virtual rate and the
+        output back to the rate of the sound card by polyphase
+        filters, see Resampler, so a program at 8000 Hz executes a
+        sixth as often as one at 48000 Hz. The 'samplerate' variable,
+        the scope and the spectrum use the virtual rate.
+        The rate takes effect when the next program is loaded.
+        returns false if the rate is higher than VM_MAXVIRTUALRATIO
+        times that of the sound card. */
+    bool setVirtualSamplerate(uint32_t rate);
+
+    /** returns the rate set by setVirtualSamplerate */
+    uint32_t getVirtualSamplerate() const
+    {
+        return m_virtualRate;
+    }
+
+    /** returns the rate at which the next program runs: the virtual
+        rate if the rates of the program and the sound card can be
+        converted, otherwise the rate of the sound card */
+    float getProgramSamplerate() const;
+
     struct ring_buffer_data_t
     {
         float s1;
@@ -175,21 +504,22 @@ public:
     };
 
 protected:
-    /** initialize internal pointers */
-    void init();
+    /** apply the changes that the GUI thread has made since
+        the previous buffer. audio thread only. */
+    void applyControls();
 
-    /** execute the program once */
-    void executeProgram(float inLeft, float inRight, float &outLeft, float &outRight);
+    /** crossfade 'frames' frames of outbuf, the output of
+        m_current, from 'previous', the output of m_fading,
+        and retire m_fading at the end. audio thread only. */
+    void crossfade(float *outbuf, const float *previous, uint32_t frames);
 
-    /** calculate FIR output.
-        returns the number of stack elements that are popped.
-    */
-    uint32_t execFIR(uint32_t n, float *stack);
+    /** generate 'frames' input samples from the selected source
+        into m_inLeft and m_inRight and update the VU levels */
+    void generateInput(const float *inbuf, uint32_t frames, src_t source, float freq);
+
+    /** restart the noise source from m_noiseSeed */
+    void seedNoiseGenerators();
 
-    /** calculate Biquad section.
-        returns the number of stack elements that are popped.
-    */
-    uint32_t execBiquad(uint32_t n, float *stack);
 
     QMainWindow *m_guiWindow;
     PaStream    *m_stream;
@@ -197,41 +527,55 @@ protected:
     PaDeviceIndex m_inDevice;
     PaDeviceIndex m_outDevice;
     double      m_sampleRate;   // the current sample rate in Hz
-
-    float       m_leftLevel;    // the left channel VU level
-    float       m_rightLevel;   // the right channel VU level
-    bool        m_runState;     // true if VM is running a program
-
-    QMutex      m_controlMutex; // mutex to synchronize GUI and VM threads
-
-    VM::program_t   m_program;  // VM byte code
-    VM::variables_t m_vars;     // VM program variables
-
-    src_t   m_source;           // selected input source
-
-    // the following pointers are variables in
-    // m_vars, or NULL if the variable does not exist
-    // in the current VM program
-    float   *m_lout;            // pointer to left OUT variable
-    float   *m_lin;             // pointer to left IN variable
-    float   *m_rout;            // pointer to right OUT variable
-    float   *m_rin;             // pointer to right IN variable
-    float   *m_in;              // pointer to mono IN variable
-    float   *m_out;             // pointer to mono OUT variable
-    float   *m_slider[4];       // pointers to slider variables
-
-    float   m_freq;             // sine or quadsine frequency (in Hz)
-    float   m_phaseaccu;        // phase accumulator [0..1) for frequency generator
-
-    // variables to send to spectrum & scope displays
-    // can be NULL if nothing is selected
-    float   *m_monitorVar[4];
+    uint32_t    m_virtualRate;  // rate of the program in Hz, or 0
+
+    float       m_leftLevel;    // the left channel VU level, audio thread only
+    float       m_rightLevel;   // the right channel VU level, audio thread only
+    std::atomic<uint32_t> m_vuSequence; // odd while m_vuLeft and m_vuRight are written
+    std::atomic<float> m_vuLeft;        // VU levels of the last buffer, see getVU
+    std::atomic<float> m_vuRight;
+    std::atomic<bool> m_runState;       // true if VM is running a program
+
+    // the program executed by the audio thread, and the one
+    // loaded last, which the GUI thread may inspect
+    ProgramInstance *m_current;
+    ProgramInstance *m_loaded;
+    Handoff<ProgramInstance> m_programs;
+
+    // hot reload, audio thread only, except m_crossfadeLength
+    ProgramInstance *m_fading;          // the replaced program during a crossfade, or NULL
+    uint32_t    m_fadePosition;         // frames of the crossfade done
+    uint32_t    m_fadeDelay;            // frames before the new program has output
+    uint32_t    m_fadeLength;           // frames of the crossfade
+    std::vector<float> m_fadeBuffer;    // interleaved output of m_fading
+    std::atomic<uint32_t> m_crossfadeLength; // set by setCrossfadeLength
+
+    WavStreamer *m_wavstreamer;         // streams the audio file, audio thread only
+    Handoff<WavStreamer> m_wavstreamers;
+    std::atomic<bool> m_hasAudioFile;   // true if setAudioFile succeeded
+
+    // controls set by the GUI thread
+    std::atomic<float> m_sliderValue[4];
+    std::atomic<uint32_t> m_sliderChanges; // bit n is set when slider n has changed
+    std::atomic<uint32_t> m_slidersSet;    // bit n is set once slider n has been set
+    std::atomic<int>   m_requestedEngine;  // interpreter selected by setEngine
+    std::atomic<bool>  m_blockMode;        // true if block execution is enabled
+    std::atomic<int>   m_source;           // selected input source
+    std::atomic<float> m_freq;             // sine or quadsine frequency (in Hz)
+    std::atomic<uint32_t> m_noiseSeed;     // seed set by setNoiseSeed
+    std::atomic<bool>  m_reseed;           // true if the generators must restart
+    FastMath::precision_t m_precision;     // precision selected by setPrecision
+    uint32_t           m_pipelineStages;   // stages selected by setPipelineStages
+
+    NoiseGenerator  m_sourceNoise[2];   // left and right channel of the noise source
+    float   m_phaseaccu;                // phase accumulator [0..1) for frequency generator
+
+    // planar input of one block
+    std::vector<float>  m_inLeft;
+    std::vector<float>  m_inRight;
 
     // thread-safe ring buffers for GUI I/O
     PaUtilRingBuffer m_ringbuffer[2];
-
-    // handles audio streaming from .wav files
-    WavStreamer m_wavstreamer;
 };
 
 #endif
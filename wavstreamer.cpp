@@ -37,6 +37,100 @@ WavStreamer::~WavStreamer()
 }
 
 int32_t WavStreamer::openFile(const QString &filename)
+{
+    int32_t result = openHeader(filename, false);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    // allocate the correct temporary buffer.
+    if (tempBuffer!=NULL) delete[] static_cast<char*>(tempBuffer);
+    tempBuffer = static_cast<void*>(new char[m_waveFormat.wBitsPerSample*TEMPBUFFERSIZE*2/8]);
+
+    // don't forget to actually read the data
+    readRawData(TEMPBUFFERSIZE);
+    sampleIndex = 0;
+
+    m_filename = filename;
+    m_isOK = true;
+    return 0;
+}
+
+int32_t WavStreamer::loadFile(const QString &filename, std::vector<float> &samples, uint32_t &channels,
+                              uint32_t *sampleRate)
+{
+    samples.clear();
+    channels = 0;
+
+    int32_t result = openHeader(filename, true);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    // read the whole data chunk at once
+    const uint32_t bytesPerSample = m_waveFormat.wBitsPerSample/8;
+    const uint32_t count = (m_playEnd - m_playStart) / bytesPerSample;
+    std::vector<uint8_t> data(count*bytesPerSample);
+    int32_t bytes = data.empty() ? 0 : m_waveStream->readRawData(reinterpret_cast<char*>(&data[0]), data.size());
+    delete m_waveStream;
+    m_waveStream = NULL;
+    m_file.close();
+    if ((bytes != static_cast<int32_t>(data.size())) ||
+        ((m_waveFormat.wFormatTag == 3) && (bytesPerSample != 4)))
+    {
+        return -1;
+    }
+
+    // the same conversions as fillBuffer
+    samples.resize(count);
+    for(uint32_t i=0; i<count; i++)
+    {
+        const uint8_t *ptr = &data[i*bytesPerSample];
+        if (m_waveFormat.wFormatTag == 3)
+        {
+            memcpy(&samples[i], ptr, sizeof(float));
+            continue;
+        }
+        switch(bytesPerSample)
+        {
+        case 2:
+            {
+                int16_t v;
+                memcpy(&v, ptr, sizeof(v));
+                samples[i] = static_cast<float>(v) / 32768.0f;
+            }
+            break;
+        case 3:
+            {
+                uint32_t v = (static_cast<uint32_t>(ptr[0]) << 8) |
+                             (static_cast<uint32_t>(ptr[1]) << 16) |
+                             (static_cast<uint32_t>(ptr[2]) << 24);
+                samples[i] = static_cast<float>(static_cast<int32_t>(v)) / 2147483648.0f;
+            }
+            break;
+        case 4:
+            {
+                int32_t v;
+                memcpy(&v, ptr, sizeof(v));
+                samples[i] = static_cast<float>(v) / 2147483648.0f;
+            }
+            break;
+        default:
+            samples.clear();
+            return -1;
+        }
+    }
+    channels = m_waveFormat.wChannels;
+    if (sampleRate != NULL)
+    {
+        *sampleRate = m_waveFormat.dwSamplesPerSec;
+    }
+    return 0;
+}
+
+int32_t WavStreamer::openHeader(const QString &filename, bool allowMono)
 {
     if (m_waveStream != 0)
     {
@@ -105,7 +199,8 @@ int32_t WavStreamer::openFile(const QString &filename)
         m_waveFormat.wFormatTag = 1;  // treat as PCM data, which should be the same when we have only 2 channels.
     }
 
-    if (((m_waveFormat.wFormatTag != 3) && (m_waveFormat.wFormatTag != 1)) || (m_waveFormat.wChannels != 2))
+    bool channelsOK = (m_waveFormat.wChannels == 2) || (allowMono && (m_waveFormat.wChannels == 1));
+    if (((m_waveFormat.wFormatTag != 3) && (m_waveFormat.wFormatTag != 1)) || !channelsOK)
     {
         delete m_waveStream;
         m_waveStream = NULL;
@@ -140,17 +235,6 @@ int32_t WavStreamer::openFile(const QString &filename)
     m_playStart  = m_waveStream->device()->pos();
     m_playOffset = m_playStart;
     m_playEnd    = m_playStart + m_chunkSize;
-
-    // allocate the correct temporary buffer.
-    if (tempBuffer!=NULL) delete[] static_cast<char*>(tempBuffer);
-    tempBuffer = static_cast<void*>(new char[m_waveFormat.wBitsPerSample*TEMPBUFFERSIZE*2/8]);
-
-    // don't forget to actually read the data
-    readRawData(TEMPBUFFERSIZE);
-    sampleIndex = 0;
-
-    m_filename = filename;
-    m_isOK = true;
     return 0;
 }
 
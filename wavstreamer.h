@@ -21,6 +21,7 @@
 #include <QDataStream>
 
 #include <stdint.h>
+#include <vector>
 // ----------------------------------------------------------
 
 #pragma pack(push)
@@ -60,6 +61,15 @@ public:
     */
     int32_t openFile(const QString &filename);
 
+    /** Reads a whole mono or stereo file, for example an impulse response.
+        Stereo samples are interleaved. The file is closed afterwards, and
+        a file opened by openFile is no longer streamed.
+        @param sampleRate if not NULL, receives the sample rate of the file
+        @return error code. 0 = ok, -1 = invalid format, -2 = cannot open file
+    */
+    int32_t loadFile(const QString &filename, std::vector<float> &samples, uint32_t &channels,
+                     uint32_t *sampleRate = NULL);
+
     /** returns true if there is a correct wav file to be streamed */
     bool isOK() const
     {
@@ -93,6 +103,12 @@ protected:
 
     bool findChunk(const char ID[4]);
 
+    /** Opens a file and finds its audio data, without reading it.
+        Mono files are only accepted when 'allowMono' is true.
+        @return error code, as openFile
+    */
+    int32_t openHeader(const QString &filename, bool allowMono);
+
     /** ReadSamples fills temp_buffer with data.
         Actual byte-count depends on the sample size (16 bit, 24 bit, 32 bit or float)
     */